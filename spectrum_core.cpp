@@ -14,17 +14,26 @@
 #include <sys/stat.h>
 #ifdef _WIN32
 #include <direct.h>
+#include <io.h>
 #define TAPE_GETCWD _getcwd
+#define TAPE_TRUNCATE(file, size) _chsize_s(_fileno(file), (__int64)(size))
+#define TAPE_SYNC(file) _commit(_fileno(file))
 #define STAT_STRUCT struct _stat
 #define STAT_FUNC _stat
 #define STAT_ISDIR(mode) (((mode) & _S_IFDIR) != 0)
 #else
 #include <unistd.h>
 #define TAPE_GETCWD getcwd
+#define TAPE_TRUNCATE(file, size) ftruncate(fileno(file), (off_t)(size))
+#define TAPE_SYNC(file) fsync(fileno(file))
 #define STAT_STRUCT struct stat
 #define STAT_FUNC stat
 #define STAT_ISDIR(mode) S_ISDIR(mode)
 #endif
+#if !defined(_WIN32) && !defined(ESP_PLATFORM)
+#include <sys/mman.h>
+#define SPECTRUM_HAS_MMAP 1
+#endif
 
 #if defined(ESP_PLATFORM)
 #include <Arduino.h>
@@ -33,11 +42,28 @@
 #define SPECTRUM_HAS_ARDUINO_GFX 1
 #endif
 #endif
+#if defined(__has_include)
+#if __has_include(<driver/i2s.h>)
+#define SPECTRUM_HAS_I2S 1
+#endif
+#endif
 #if defined(SPECTRUM_HAS_ARDUINO_GFX)
 #include <Arduino_GFX_Library.h>
 #endif
+#if defined(SPECTRUM_HAS_I2S)
+#include <driver/i2s.h>
+#endif
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #endif
+#include <atomic>
 
 #if defined(ESP_PLATFORM) && !defined(SPECTRUM_HAS_ARDUINO_GFX)
 typedef struct Arduino_GFX Arduino_GFX;
@@ -61,8 +87,12 @@ typedef struct SpectrumMemoryPage SpectrumMemoryPage;
 typedef struct AyState AyState;
 typedef struct TapeBlock TapeBlock;
 typedef struct TapeImage TapeImage;
-typedef struct TapePulse TapePulse;
+typedef struct TapePulseRun TapePulseRun;
 typedef struct TapeWaveform TapeWaveform;
+typedef struct TapeWaveformReader TapeWaveformReader;
+typedef struct TapeWavStream TapeWavStream;
+typedef struct TapePulseCursor TapePulseCursor;
+typedef struct TapeTimelineEntry TapeTimelineEntry;
 typedef struct TapePlaybackState TapePlaybackState;
 typedef struct TapeRecorder TapeRecorder;
 typedef struct TapeControlRect TapeControlRect;
@@ -71,6 +101,13 @@ typedef struct TapeControlIcon TapeControlIcon;
 typedef struct TapeOverlayGlyph TapeOverlayGlyph;
 typedef struct TapeBrowserEntry TapeBrowserEntry;
 typedef struct Z80 Z80;
+typedef struct AudioRateStats AudioRateStats;
+typedef struct AudioOfflineStats AudioOfflineStats;
+typedef struct AudioOfflineSession AudioOfflineSession;
+typedef struct AudioSinkFormat AudioSinkFormat;
+typedef struct AudioSink AudioSink;
+typedef struct AudioFileSink AudioFileSink;
+typedef struct AudioRingSink AudioRingSink;
 
 // --- Z80 Flag Register Bits ---
 #define FLAG_C  (1 << 0) // Carry Flag
@@ -136,6 +173,9 @@ static uint8_t gate_array_1ffd_state = 0u;
 static uint8_t ay_registers[16];
 static uint8_t ay_selected_register = 0u;
 static int ay_register_latched = 0;
+static FILE* ay_log_file = NULL; // register log capture, see ay_log_start()
+static uint64_t ay_log_last_t_state = 0;
+static uint64_t ay_log_write_count = 0;
 
 typedef enum SpectrumMemoryPageType {
     MEMORY_PAGE_NONE,
@@ -166,10 +206,50 @@ int cpu_step(Z80* cpu);
 int init_lcd_backend(void);
 void cleanup_lcd_backend(void);
 void render_screen(void);
+int video_pipeline_start(void);
+void video_pipeline_stop(void);
+uint32_t video_frame_hash(void);
+int video_write_ppm(const char* path);
+void video_set_blit_mode(int mode);
+void video_set_frameskip(int frames);
+int video_frameskip_current(void);
 int cpu_interrupt(Z80* cpu, uint8_t data_bus);
 int cpu_nmi(Z80* cpu);
 int cpu_ddfd_cb_step(Z80* cpu, uint16_t* index_reg, int is_ix);
 void audio_callback(void* userdata, uint8_t* stream, int len);
+void audio_set_output_format(int sample_rate, int channels);
+void audio_set_band_limited_beeper(int enabled);
+void audio_set_rate_control(int enabled, int target_samples);
+void audio_mark_frame_end(uint64_t frame_end_t_state);
+void audio_get_rate_stats(AudioRateStats* stats);
+int audio_render_offline(const char* media_path,
+                         uint32_t frames,
+                         const char* output_path,
+                         int sample_rate,
+                         int channels,
+                         AudioOfflineStats* stats);
+int ay_log_start(const char* path);
+void ay_log_stop(void);
+void tape_set_fast_load(int enabled);
+void tape_set_auto_warp(int enabled);
+int emulator_warp_active(void);
+void audio_file_sink_init(AudioFileSink* file_sink, FILE* file, int wav);
+AudioSink* audio_null_sink(void);
+void audio_ring_sink_init(AudioRingSink* ring, int16_t* storage, size_t storage_samples);
+size_t audio_ring_sink_read(AudioRingSink* ring, int16_t* out, size_t frames);
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_I2S)
+AudioSink* audio_i2s_sink(void);
+#endif
+int audio_sink_open(AudioSink* sink, int sample_rate, int channels, uint32_t block_frames);
+void audio_sink_frame_end(uint64_t t_state);
+int audio_sink_format(AudioSinkFormat* format);
+uint32_t audio_sink_latency_frames(void);
+int audio_sink_close(void);
+int ay_log_render(const char* log_path,
+                  const char* output_path,
+                  int sample_rate,
+                  int channels,
+                  AudioOfflineStats* stats);
 static void border_record_event(uint64_t event_t_state, uint8_t color_idx);
 static void border_draw_span(uint64_t span_start, uint64_t span_end, uint8_t color_idx);
 static void spectrum_map_page(int segment, SpectrumMemoryPageType type, uint8_t index);
@@ -177,15 +257,36 @@ static void spectrum_refresh_visible_ram(void);
 static void spectrum_apply_memory_configuration(void);
 static void spectrum_update_contention_flags(void);
 static void video_free_framebuffers(void);
+#if defined(ESP_PLATFORM)
+static uint16_t* video_alloc_framebuffer(size_t pixel_count, uint8_t* from_psram);
+Arduino_GFX* create_board_gfx(void);
+#endif
 static inline int ula_contention_penalty(uint64_t t_state);
 static void beeper_reset_audio_state(uint64_t current_t_state, int current_level);
 static void beeper_set_latency_limit(double sample_limit);
 static void beeper_push_event(uint64_t t_state, int level);
-static size_t beeper_catch_up_to(double catch_up_position, double playback_position_snapshot);
+static size_t beeper_catch_up_to(uint64_t catch_up_position);
 static double beeper_current_latency_samples(void);
 static double beeper_latency_threshold(void);
 static uint32_t beeper_recommended_throttle_delay(double latency_samples);
 static int audio_dump_start(const char* path, uint32_t sample_rate, uint16_t channels);
+static int emulator_run_frame(Z80* cpu);
+static int audio_render_offline_frames(Z80* cpu,
+                                       uint32_t frames,
+                                       AudioSink* sink,
+                                       int sample_rate,
+                                       int channels,
+                                       AudioOfflineStats* stats);
+static int audio_offline_begin(AudioOfflineSession* session,
+                               AudioSink* sink,
+                               int sample_rate,
+                               int channels,
+                               uint32_t block_frames);
+static int audio_offline_render_until(AudioOfflineSession* session, uint64_t t_state);
+static int audio_offline_end(AudioOfflineSession* session, uint64_t end_t_state, AudioOfflineStats* stats);
+static int ay_log_begin(FILE* file, uint64_t t_state);
+static int ay_log_render_stream(FILE* log, AudioSink* sink, int sample_rate, int channels, AudioOfflineStats* stats);
+static int ay_log_read_record(FILE* file, uint64_t* delta, uint8_t* reg, uint8_t* value);
 static void audio_dump_write_samples(const Sint16* samples, size_t count);
 static void audio_dump_finish(void);
 static void audio_dump_abort(void);
@@ -220,11 +321,70 @@ static size_t lcd_framebuffer_size = 0u;
 static int lcd_backbuffer_index = 0;
 static int lcd_double_buffered = 0;
 static uint8_t lcd_framebuffer_from_psram[2] = {0u, 0u};
-static uint16_t spectrum_colors_565[8];
-static uint16_t spectrum_bright_colors_565[8];
 #endif
 
-uint32_t pixels[ TOTAL_WIDTH * TOTAL_HEIGHT ];
+// --- Indexed Framebuffer ---
+// Frames are rasterised as 8-bit palette indices; RGBA/RGB565 expansion only
+// happens at the output stage (LCD flush, PPM dump).
+#define VIDEO_PALETTE_SIZE 256
+#define VIDEO_PALETTE_BRIGHT_BASE 8
+#define VIDEO_PALETTE_OVERLAY_BASE 16
+
+uint8_t pixels[ TOTAL_WIDTH * TOTAL_HEIGHT ];
+static uint32_t video_palette_rgba[VIDEO_PALETTE_SIZE];
+static uint16_t video_palette_565[VIDEO_PALETTE_SIZE];
+static size_t video_palette_count = 0u;
+
+// --- Panel Blit (scale + RGB565 conversion) ---
+#define VIDEO_PANEL_DEFAULT_WIDTH 480
+#define VIDEO_PANEL_DEFAULT_HEIGHT 320
+#define VIDEO_PANEL_MAX_WIDTH 800
+#define VIDEO_PANEL_MAX_HEIGHT 480
+
+typedef enum VideoBlitMode {
+    VIDEO_BLIT_MODE_CENTER,  // 1:1, centred (cropped if the panel is smaller)
+    VIDEO_BLIT_MODE_FIT,     // aspect-preserving scale to the largest size that fits
+    VIDEO_BLIT_MODE_FILL,    // aspect-preserving scale that covers the panel, cropping the border
+    VIDEO_BLIT_MODE_STRETCH, // independent horizontal/vertical scale to the full panel
+    VIDEO_BLIT_MODE_COUNT
+} VideoBlitMode;
+
+// Destination rectangle on the panel plus, for every destination column/row,
+// the source column/row in pixels[] it samples.
+typedef struct VideoBlitLayout {
+    VideoBlitMode mode;
+    int panel_width;
+    int panel_height;
+    int dest_x;
+    int dest_y;
+    int dest_width;
+    int dest_height;
+    uint16_t src_x[VIDEO_PANEL_MAX_WIDTH];
+    uint16_t src_y[VIDEO_PANEL_MAX_HEIGHT];
+} VideoBlitLayout;
+
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_ARDUINO_GFX)
+static VideoBlitLayout video_blit_layout;
+static int video_blit_layout_valid = 0;
+#endif
+static std::atomic<int> video_blit_requested_mode(VIDEO_BLIT_MODE_FIT);
+
+// --- Row Diffing ---
+// One hash per source row of pixels[] (overlay included). The panel and each
+// LCD backbuffer remember the hashes of what they currently show/contain so
+// unchanged rows are neither converted nor flushed again.
+typedef struct VideoRowCache {
+    uint32_t hashes[TOTAL_HEIGHT];
+    int valid;
+} VideoRowCache;
+
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_ARDUINO_GFX)
+static uint32_t video_frame_row_hashes[TOTAL_HEIGHT];
+static VideoRowCache video_panel_rows;
+static VideoRowCache video_backbuffer_rows[2];
+static uint64_t video_frames_unchanged = 0;
+static uint64_t video_rows_flushed = 0;
+#endif
 
 typedef struct BorderColorEvent {
     uint64_t t_state;
@@ -237,6 +397,99 @@ static uint64_t border_frame_start_tstate = 0;
 static uint8_t border_frame_color = 0;
 uint8_t border_color_idx = 0;
 
+// --- Frame Snapshots (emulation -> render thread) ---
+#define VIDEO_FRAME_SLOT_COUNT 3
+#define VIDEO_FRAME_BORDER_EVENT_CAPACITY 2048
+#define VIDEO_FRAME_SCREEN_BYTES 6912
+#define VIDEO_OVERLAY_COMMAND_CAPACITY 256
+#define VIDEO_OVERLAY_TEXT_CAPACITY 4096
+#define VIDEO_SLOT_INDEX_MASK 0x03u
+#define VIDEO_SLOT_FRESH 0x04u
+
+typedef enum VideoOverlayCommandType {
+    VIDEO_OVERLAY_COMMAND_RECT,
+    VIDEO_OVERLAY_COMMAND_TEXT,
+    VIDEO_OVERLAY_COMMAND_ICON
+} VideoOverlayCommandType;
+
+typedef struct VideoOverlayCommand {
+    VideoOverlayCommandType type;
+    int16_t x;
+    int16_t y;
+    int16_t width;
+    int16_t height;
+    uint8_t scale;
+    uint8_t spacing;
+    uint16_t text_offset;
+    const TapeControlIcon* icon;
+    uint32_t color;
+    uint32_t border_color;
+} VideoOverlayCommand;
+
+typedef struct VideoOverlayList {
+    VideoOverlayCommand commands[VIDEO_OVERLAY_COMMAND_CAPACITY];
+    size_t count;
+    char text[VIDEO_OVERLAY_TEXT_CAPACITY];
+    size_t text_used;
+} VideoOverlayList;
+
+typedef struct VideoFrameBorderEvent {
+    uint32_t offset;
+    uint8_t color_idx;
+} VideoFrameBorderEvent;
+
+typedef struct VideoFrameSnapshot {
+    uint64_t frame_start_tstate;
+    int flash_phase;
+    uint8_t border_start_color;
+    size_t border_event_count;
+    VideoFrameBorderEvent border_events[VIDEO_FRAME_BORDER_EVENT_CAPACITY];
+    uint8_t screen[VIDEO_FRAME_SCREEN_BYTES];
+    VideoOverlayList overlay;
+} VideoFrameSnapshot;
+
+// Lock-free triple buffer: the emulation thread owns video_producer_slot,
+// the render thread owns video_consumer_slot and the third index lives in
+// video_ready_slot (tagged with VIDEO_SLOT_FRESH once a frame is published).
+static VideoFrameSnapshot video_frame_slots[VIDEO_FRAME_SLOT_COUNT];
+static std::atomic<uint8_t> video_ready_slot(1u);
+static int video_producer_slot = 0;
+static int video_consumer_slot = 2;
+static VideoOverlayList* video_overlay_recording = NULL;
+static std::atomic<int> video_render_running(0);
+static std::atomic<uint64_t> video_frames_published(0);
+static std::atomic<uint64_t> video_frames_dropped(0);
+static std::atomic<uint64_t> video_frames_presented(0);
+static int video_pipeline_active = 0;
+
+// --- Frame Skipping ---
+// Emulation always advances whole frames; the controller only decides which
+// of them are rasterised and flushed.
+#define VIDEO_FRAMESKIP_MAX 8
+#define VIDEO_FRAMESKIP_RELEASE_FRAMES 50
+#define VIDEO_FRAMESKIP_SETTLE_FRAMES 16 // lets the period average follow a step up
+static const uint32_t VIDEO_FRAME_PERIOD_US = 20000u;
+static int video_frameskip_setting = 0; // 0 = auto, otherwise present every Nth frame
+static int video_frameskip_interval = 1;
+static int video_frameskip_countdown = 0;
+static int video_frameskip_release_count = 0;
+static int video_frameskip_settle_count = 0;
+static uint64_t video_frameskip_last_frame_us = 0;
+static uint32_t video_frame_period_us = 0;
+static std::atomic<uint32_t> video_present_cost_us(0);
+static uint64_t video_frames_skipped = 0;
+#if defined(ESP_PLATFORM)
+static const BaseType_t VIDEO_RENDER_TASK_CORE = 0;
+static const uint32_t VIDEO_RENDER_TASK_STACK = 4096u;
+static TaskHandle_t video_render_task_handle = NULL;
+static std::atomic<int> video_render_task_exited(1);
+#else
+static std::thread video_render_thread;
+static std::mutex video_render_wake_mutex;
+static std::condition_variable video_render_wake_cv;
+static int video_render_wake_pending = 0;
+#endif
+
 // --- Timing Globals ---
 uint64_t total_t_states = 0; // A global clock for the entire CPU
 
@@ -244,6 +497,71 @@ uint64_t total_t_states = 0; // A global clock for the entire CPU
 const uint32_t spectrum_colors[8] = {0x000000FF,0x0000CDFF,0xCD0000FF,0xCD00CDFF,0x00CD00FF,0x00CDCDFF,0xCDCD00FF,0xCFCFCFFF};
 const uint32_t spectrum_bright_colors[8] = {0x000000FF,0x0000FFFF,0xFF0000FF,0xFF00FFFF,0x00FF00FF,0x00FFFFFF,0xFFFF00FF,0xFFFFFFF};
 
+// Colours used by the tape overlay and manager, appended after the 16 Spectrum entries.
+static const uint32_t video_overlay_colors[] = {
+    0xFFFFFFFFu, 0x383838FFu, 0x2A2A2AFFu, 0x7F7F7FFFu, 0xFF4444FFu, 0x803030FFu,
+    0x7F1E1EFFu, 0x2E6F3FFFu, 0x1C1C1CF0u, 0xDDDDDDFFu, 0xB0B0B0FFu, 0x9FD36CFFu,
+    0x101820FFu, 0x4F81EFFFu, 0xE0F2FFFFu, 0x2C2C2CFFu, 0x242424FFu, 0x6FA7FFFFu
+};
+
+static uint16_t video_rgba_to_rgb565(uint32_t rgba)
+{
+    uint8_t r = (uint8_t)((rgba >> 24) & 0xFFu);
+    uint8_t g = (uint8_t)((rgba >> 16) & 0xFFu);
+    uint8_t b = (uint8_t)((rgba >> 8) & 0xFFu);
+
+    uint16_t rr = (uint16_t)(r >> 3);
+    uint16_t gg = (uint16_t)(g >> 2);
+    uint16_t bb = (uint16_t)(b >> 3);
+
+    return (uint16_t)((rr << 11) | (gg << 5) | bb);
+}
+
+static void video_palette_init(void) {
+    if (video_palette_count > 0u) {
+        return;
+    }
+    for (int i = 0; i < 8; ++i) {
+        video_palette_rgba[i] = spectrum_colors[i];
+        video_palette_rgba[VIDEO_PALETTE_BRIGHT_BASE + i] = spectrum_bright_colors[i];
+    }
+    size_t count = VIDEO_PALETTE_OVERLAY_BASE;
+    size_t overlay_count = sizeof(video_overlay_colors) / sizeof(video_overlay_colors[0]);
+    for (size_t i = 0; i < overlay_count && count < VIDEO_PALETTE_SIZE; ++i) {
+        video_palette_rgba[count++] = video_overlay_colors[i];
+    }
+    for (size_t i = 0; i < VIDEO_PALETTE_SIZE; ++i) {
+        video_palette_565[i] = video_rgba_to_rgb565(video_palette_rgba[i]);
+    }
+    video_palette_count = count;
+}
+
+// Maps an overlay RGBA colour onto the palette; colours outside the table fall
+// back to the closest entry so the overlay never needs a true-colour surface.
+static uint8_t video_palette_index(uint32_t rgba) {
+    video_palette_init();
+    for (size_t i = VIDEO_PALETTE_OVERLAY_BASE; i < video_palette_count; ++i) {
+        if (video_palette_rgba[i] == rgba) {
+            return (uint8_t)i;
+        }
+    }
+
+    size_t best_index = 0u;
+    uint32_t best_distance = UINT32_MAX;
+    for (size_t i = 0; i < video_palette_count; ++i) {
+        uint32_t candidate = video_palette_rgba[i];
+        int dr = (int)((rgba >> 24) & 0xFFu) - (int)((candidate >> 24) & 0xFFu);
+        int dg = (int)((rgba >> 16) & 0xFFu) - (int)((candidate >> 16) & 0xFFu);
+        int db = (int)((rgba >> 8) & 0xFFu) - (int)((candidate >> 8) & 0xFFu);
+        uint32_t distance = (uint32_t)(dr * dr + dg * dg + db * db);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_index = i;
+        }
+    }
+    return (uint8_t)best_index;
+}
+
 // --- Audio Globals ---
 volatile int beeper_state = 0; // 0 = low, 1 = high
 const int AUDIO_AMPLITUDE = 2000;
@@ -270,13 +588,18 @@ static int beeper_logging_enabled = 0;
 static const char* audio_dump_path = NULL;
 
 static const int16_t TAPE_WAV_AMPLITUDE = 20000;
+#define TAPE_RECORDER_WAV_BUFFER_SAMPLES 8192u
 
 static int speaker_tape_playback_level = 1;
 static int speaker_tape_record_level = 1;
 static int speaker_output_level = 1;
 
 static const double AY_CLOCK_HZ = 1750000.0;
-static double ay_cycles_per_sample = 0.0;
+// The generators advance at the chip's internal AY_CLOCK_HZ / 8 rate; the
+// per-sample step count is a Q16 increment so no sample rate needs doubles.
+static const double AY_STEP_HZ = 1750000.0 / 8.0;
+static uint32_t ay_step_increment = 0u;
+static uint32_t ay_step_phase = 0u;
 static double ay_global_gain = 6000.0;
 static double ay_channel_pan[3] = {-0.75, 0.0, 0.75};
 static const double ay_volume_table[16] = {
@@ -289,16 +612,43 @@ static const double ay_volume_table[16] = {
 static void audio_backend_lock(void) {}
 static void audio_backend_unlock(void) {}
 
+// Integer form of the BEEPER_HP_ALPHA DC blocker:
+// y[n] = x[n] - x[n-1] + y[n-1] - (1 - alpha) * y[n-1], with y held in
+// AUDIO_HP_FRACTION_BITS fixed point and (1 - alpha) in Q32.
+#define AUDIO_HP_FRACTION_BITS 12
+static const int64_t AUDIO_HP_DECAY_Q32 = 21474836; // (1 - 0.995) * 2^32
+
+typedef struct AudioHighpass {
+    int32_t last_input;
+    int32_t last_output;
+} AudioHighpass;
+
+static inline int32_t audio_highpass_run(AudioHighpass* filter, int32_t input) {
+    int32_t output = filter->last_output;
+    output -= (int32_t)(((int64_t)output * AUDIO_HP_DECAY_Q32) >> 32);
+    output += (input - filter->last_input) * (1 << AUDIO_HP_FRACTION_BITS);
+    filter->last_input = input;
+    filter->last_output = output;
+    // Truncate toward zero like the (int16_t) cast of the double filter; the
+    // bias only applies to negative values and keeps the shift branch-free.
+    int32_t bias = (output >> 31) & ((1 << AUDIO_HP_FRACTION_BITS) - 1);
+    return (output + bias) >> AUDIO_HP_FRACTION_BITS;
+}
+
+// Counters are in AY_STEP_HZ ticks: tones toggle every `period` ticks, the
+// noise LFSR shifts every 2 * R6 ticks and the envelope steps every 2 * EP
+// ticks (fE = clock / (256 * EP) over 16 steps).
 struct AyState {
-    double tone_period[3];
-    double tone_counter[3];
+    uint8_t registers[16];
+    uint32_t tone_period[3];
+    uint32_t tone_counter[3];
     int tone_output[3];
-    double noise_period;
-    double noise_counter;
+    uint32_t noise_period;
+    uint32_t noise_counter;
     uint32_t noise_lfsr;
     int noise_output;
-    double envelope_period;
-    double envelope_counter;
+    uint32_t envelope_period;
+    uint32_t envelope_counter;
     uint8_t envelope_volume;
     int envelope_direction;
     int envelope_hold;
@@ -308,10 +658,35 @@ struct AyState {
 };
 
 static AyState ay_state;
-static double ay_hp_last_input_left = 0.0;
-static double ay_hp_last_output_left = 0.0;
-static double ay_hp_last_input_right = 0.0;
-static double ay_hp_last_output_right = 0.0;
+
+// Register writes reach the generator through this queue so the audio side
+// applies them at the tstate they were issued, not when the callback runs.
+// ay_registers[] stays the CPU-visible copy read back through 0xFFFD.
+#define AY_EVENT_CAPACITY 4096
+
+typedef struct AyRegisterEvent {
+    uint64_t t_state;
+    uint8_t reg;
+    uint8_t value;
+} AyRegisterEvent;
+
+// Same SPSC discipline as the beeper ring. Writes that find it full are
+// dropped and their registers marked in ay_dirty_registers; the next write
+// that fits re-sends their current values first, so a drop delays a register
+// change instead of losing it.
+static AyRegisterEvent ay_events[AY_EVENT_CAPACITY];
+static std::atomic<size_t> ay_event_head(0);
+static std::atomic<size_t> ay_event_tail(0);
+static std::atomic<uint32_t> ay_events_dropped(0);
+static std::atomic<size_t> ay_resync_index(0);
+static uint16_t ay_dirty_registers = 0u;
+static uint64_t ay_last_event_t_state = 0;
+// Output-scale amplitude of each channel at each volume level, already
+// multiplied by its pan gain and ay_global_gain (i.e. Q15 of full scale).
+static int32_t ay_mix_table_left[3][16];
+static int32_t ay_mix_table_right[3][16];
+static AudioHighpass ay_highpass_left = {0, 0};
+static AudioHighpass ay_highpass_right = {0, 0};
 
 // --- Tape Constants ---
 static const int TAPE_PILOT_PULSE_TSTATES = 2168;
@@ -330,7 +705,10 @@ typedef enum TapeBlockType {
     TAPE_BLOCK_TYPE_PURE_DATA,
     TAPE_BLOCK_TYPE_PURE_TONE,
     TAPE_BLOCK_TYPE_PULSE_SEQUENCE,
-    TAPE_BLOCK_TYPE_DIRECT_RECORDING
+    TAPE_BLOCK_TYPE_DIRECT_RECORDING,
+    TAPE_BLOCK_TYPE_CSW,        // data holds the RLE pulse stream
+    TAPE_BLOCK_TYPE_PZX_PULSES, // data holds a PZX PULS payload
+    TAPE_BLOCK_TYPE_PZX_DATA    // data holds a PZX DATA payload
 } TapeBlockType;
 
 struct TapeBlock {
@@ -354,32 +732,136 @@ struct TapeBlock {
     uint32_t direct_tstates_per_sample;
     uint8_t* direct_samples;
     uint32_t direct_sample_count;
-    int direct_initial_level;
+    int direct_initial_level; // also the CSW starting polarity
+    uint32_t csw_sample_rate;
+    int in_arena; // data and direct_samples point into TapeImage.arena
 };
 
 struct TapeImage {
     TapeBlock* blocks;
     size_t count;
     size_t capacity;
+    TapeTimelineEntry* timeline; // built on the first seek, dropped when blocks change
+    uint64_t length_tstates;
+    uint8_t* arena; // the loaded file, when blocks play from it in place
 };
 
-struct TapePulse {
-    uint32_t duration;
+// Pulse trains are stored as runs. A plain run repeats durations[0] `count`
+// times (pilot tones, sync, long silences); a packed run picks each pulse from
+// its four durations with a 2-bit code in the waveform's symbol store, so
+// data bits cost two bits a pulse even with the one-sample jitter of WAV
+// edges. Identical pulses at the end of a packed run are split off into a
+// plain run once there are TAPE_PULSE_RUN_MIN_REPEAT of them.
+#define TAPE_PULSE_RUN_SYMBOLS 4u
+#define TAPE_PULSE_RUN_MIN_REPEAT 16u
+#define TAPE_PULSE_RUN_PLAIN UINT32_MAX
+
+struct TapePulseRun {
+    uint32_t durations[TAPE_PULSE_RUN_SYMBOLS]; // unused slots are 0
+    uint32_t count;
+    uint32_t symbol_offset; // first code in `symbols`, or TAPE_PULSE_RUN_PLAIN
 };
 
 struct TapeWaveform {
-    TapePulse* pulses;
-    size_t count;
-    size_t capacity;
+    TapePulseRun* runs;
+    size_t run_count;
+    size_t run_capacity;
+    uint8_t* symbols;       // four 2-bit codes per byte
+    size_t symbol_count;
+    size_t symbol_capacity; // in codes
+    uint32_t tail_repeat;   // identical pulses closing the last packed run
+    size_t count;           // pulses
     int initial_level;
     uint32_t sample_rate;
 };
 
+struct TapeWaveformReader {
+    size_t run;
+    uint32_t offset;
+};
+
+// A WAV tape is decoded TAPE_WAV_CHUNK_FRAMES frames at a time into a batch
+// of pulses just ahead of the playback reader, so memory stays bounded
+// however long the recording is. Only the first channel is used.
+struct TapeWavStream {
+    FILE* file;
+    const uint8_t* mapped; // whole file, when mmap is available
+    size_t mapped_size;
+    uint64_t data_offset;
+    uint64_t data_bytes;
+    uint64_t consumed;
+    uint32_t frame_bytes;
+    uint16_t bytes_per_sample;
+    uint8_t* raw;      // chunk read buffer (unused when mapped)
+    int16_t* samples;  // first channel, scaled to 16 bits
+    uint8_t* classes;  // per-sample threshold flags
+    double tstates_per_sample;
+    int started;
+    int level;
+    int initial_level;
+    uint64_t run_length;
+    uint64_t pulses;   // produced since the start of the tape
+};
+
+typedef enum TapePulseStage {
+    TAPE_PULSE_STAGE_BLOCK_START,
+    TAPE_PULSE_STAGE_PILOT,
+    TAPE_PULSE_STAGE_SYNC1,
+    TAPE_PULSE_STAGE_SYNC2,
+    TAPE_PULSE_STAGE_DATA,
+    TAPE_PULSE_STAGE_TONE,
+    TAPE_PULSE_STAGE_SEQUENCE,
+    TAPE_PULSE_STAGE_DIRECT,
+    TAPE_PULSE_STAGE_CSW,
+    TAPE_PULSE_STAGE_PZX_PULSES,
+    TAPE_PULSE_STAGE_PZX_DATA,
+    TAPE_PULSE_STAGE_BLOCK_END,
+    TAPE_PULSE_STAGE_END
+} TapePulseStage;
+
+// Generates a TapeImage's edges one at a time from the block being played,
+// so playback needs a few dozen bytes however long the tape is. The cursor
+// always sits on a pulse (`current`) until the tape runs out; pauses and
+// the tail of direct recordings are folded into the next pulse.
+struct TapePulseCursor {
+    size_t block_index;
+    TapePulseStage stage;
+    uint32_t index;          // pilot/tone pulses left, sequence entry or direct sample
+    uint32_t byte_index;
+    uint8_t bit_mask;
+    uint8_t bits_left;
+    uint8_t second_half;
+    int direct_level;
+    uint64_t direct_run;
+    uint64_t pending_silence;
+    uint16_t pilot_pulse;
+    uint16_t sync1;
+    uint16_t sync2;
+    uint16_t bit0[2];
+    uint16_t bit1[2];
+    uint64_t sample_position; // CSW samples into the block
+    uint32_t run_left;        // pulses left in a PZX run, or into a PZX bit
+    uint32_t run_tstates;
+    uint64_t emitted;
+    int initial_level;
+    uint64_t current;
+    int has_current;
+};
+
+// The cursor as it stands on a block's first pulse, which includes the
+// pause before it. Entry `count` marks the end of the tape.
+struct TapeTimelineEntry {
+    uint64_t start_tstates;
+    TapePulseCursor cursor;
+};
+
 typedef enum TapeFormat {
     TAPE_FORMAT_NONE,
     TAPE_FORMAT_TAP,
     TAPE_FORMAT_TZX,
-    TAPE_FORMAT_WAV
+    TAPE_FORMAT_WAV,
+    TAPE_FORMAT_CSW,
+    TAPE_FORMAT_PZX
 } TapeFormat;
 
 typedef enum SnapshotFormat {
@@ -403,6 +885,9 @@ typedef enum TapePhase {
 struct TapePlaybackState {
     TapeImage image;
     TapeWaveform waveform;
+    TapeWaveformReader waveform_reader;
+    TapeWavStream wav_stream;
+    TapePulseCursor pulse_cursor;
     TapeFormat format;
     int use_waveform_playback;
     size_t current_block;
@@ -426,14 +911,13 @@ struct TapePlaybackState {
 typedef enum TapeOutputFormat {
     TAPE_OUTPUT_NONE,
     TAPE_OUTPUT_TAP,
+    TAPE_OUTPUT_TZX,
     TAPE_OUTPUT_WAV
 } TapeOutputFormat;
 
 struct TapeRecorder {
     TapeImage recorded;
-    TapePulse* pulses;
-    size_t pulse_count;
-    size_t pulse_capacity;
+    TapeWaveform pulses;
     uint64_t last_transition_tstate;
     int last_level;
     int block_active;
@@ -441,21 +925,18 @@ struct TapeRecorder {
     const char* output_path;
     int block_start_level;
     uint32_t sample_rate;
-    int16_t* audio_samples;
-    size_t audio_sample_count;
-    size_t audio_sample_capacity;
-    int16_t* wav_prefix_samples;
-    size_t wav_prefix_sample_count;
+    FILE* wav_file;
+    int16_t* wav_buffer;
+    size_t wav_buffered;
+    uint16_t wav_bytes_per_sample;
     TapeOutputFormat output_format;
     int recording;
     int session_dirty;
     uint64_t position_tstates;
     uint64_t position_start_tstate;
     int append_mode;
-    uint32_t append_data_chunk_offset;
-    uint32_t append_existing_data_bytes;
-    uint64_t wav_existing_samples;
-    uint64_t wav_head_samples;
+    uint32_t wav_data_chunk_offset;
+    uint64_t wav_data_bytes;
     int wav_requires_truncate;
     uint64_t idle_start_tstate;
 };
@@ -464,6 +945,19 @@ static TapePlaybackState tape_playback = {0};
 static TapeRecorder tape_recorder = {0};
 static int tape_ear_state = 1;
 static int tape_input_enabled = 0;
+static int tape_fast_load_enabled = 1;
+
+// Auto warp: while a loader is polling EAR against a playing tape the frame
+// loop runs unpaced, audio is held back and only every
+// TAPE_WARP_VIDEO_INTERVAL-th frame is presented.
+#define TAPE_WARP_VIDEO_INTERVAL 25
+static int tape_warp_enabled = 1;
+static int tape_warp_active = 0;
+static int tape_warp_streak = 0;
+static uint32_t tape_warp_ear_reads = 0;
+static uint16_t tape_warp_pc_min = 0;
+static uint16_t tape_warp_pc_max = 0;
+static const Z80* tape_warp_cpu = NULL;
 
 static FILE* spectrum_log_file = NULL;
 
@@ -754,13 +1248,14 @@ static void tape_start_playback(TapePlaybackState* state, uint64_t start_time);
 static void tape_pause_playback(TapePlaybackState* state, uint64_t current_t_state);
 static int tape_resume_playback(TapePlaybackState* state, uint64_t current_t_state);
 static void tape_rewind_playback(TapePlaybackState* state);
+static int tape_seek_playback(TapePlaybackState* state, uint64_t position);
 static int tape_begin_block(TapePlaybackState* state, size_t block_index, uint64_t start_time);
 static void tape_update(uint64_t current_t_state);
 static int tape_current_block_pilot_count(const TapePlaybackState* state);
 static void tape_waveform_reset(TapeWaveform* waveform);
 static int tape_waveform_add_pulse(TapeWaveform* waveform, uint64_t duration);
-static int tape_waveform_add_with_pending(TapeWaveform* waveform, uint64_t duration, uint64_t* pending_silence);
-static int tape_generate_waveform_from_image(const TapeImage* image, TapeWaveform* waveform);
+static void tape_pulse_cursor_reset(TapePulseCursor* cursor, const TapeImage* image);
+static int tape_pulse_cursor_advance(TapePulseCursor* cursor, const TapeImage* image);
 static int tape_load_wav(const char* path, TapePlaybackState* state);
 static int tape_create_blank_wav(const char* path, uint32_t sample_rate);
 static void tape_manager_browser_normalize_separators(char* path);
@@ -786,11 +1281,12 @@ static void tape_recorder_handle_mic(uint64_t t_state, int level);
 static void tape_recorder_update(uint64_t current_t_state, int force_flush);
 static int tape_recorder_write_output(void);
 static void tape_recorder_reset_audio(void);
-static void tape_recorder_reset_wav_prefix(void);
 static size_t tape_recorder_samples_from_tstates(uint64_t duration);
 static uint64_t tape_recorder_tstates_from_samples(uint64_t sample_count);
 static int tape_recorder_append_audio_samples(int level, size_t sample_count);
 static void tape_recorder_append_block_audio(uint64_t idle_cycles);
+static int tape_recorder_open_wav(uint32_t data_chunk_offset, uint16_t bytes_per_sample, uint64_t start_bytes);
+static int tape_recorder_flush_wav(void);
 static int tape_recorder_write_wav(void);
 static int tape_recorder_prepare_append_wav(uint32_t* data_chunk_offset,
                                             uint32_t* existing_bytes,
@@ -800,6 +1296,7 @@ static void tape_shutdown(void);
 static void tape_deck_play(uint64_t current_t_state);
 static void tape_deck_stop(uint64_t current_t_state);
 static void tape_deck_rewind(uint64_t current_t_state);
+static void tape_deck_skip_block(uint64_t current_t_state, int direction);
 static void tape_deck_record(uint64_t current_t_state, int append_mode);
 static void tape_manager_toggle(void);
 static void tape_manager_hide(void);
@@ -815,13 +1312,23 @@ static void tape_playback_accumulate_elapsed(TapePlaybackState* state, uint64_t
 static uint64_t tape_playback_elapsed_tstates(const TapePlaybackState* state, uint64_t current_t_state);
 static uint64_t tape_recorder_elapsed_tstates(uint64_t current_t_state);
 static void tape_render_overlay(void);
+static void tape_overlay_draw_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color);
+static void tape_overlay_draw_rect(int x, int y, int width, int height, uint32_t fill_color, uint32_t border_color);
+static void tape_overlay_draw_icon(int origin_x, int origin_y, const TapeControlIcon* icon, int scale, uint32_t color);
+static void tape_overlay_paint_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color);
+static void tape_overlay_paint_rect(int x, int y, int width, int height, uint32_t fill_color, uint32_t border_color);
+static void tape_overlay_paint_icon(int origin_x, int origin_y, const TapeControlIcon* icon, int scale, uint32_t color);
 static int speaker_calculate_output_level(void);
 static void speaker_update_output(uint64_t t_state, int emit_event);
 static void ay_reset_state(void);
 static void ay_set_sample_rate(int sample_rate);
-static void ay_mix_sample(double elapsed_cycles, double* left_out, double* right_out);
-static void ay_write_register(uint8_t reg, uint8_t value);
+static void ay_render_block(int32_t* left, int32_t* right, int frames, uint32_t increment);
+static size_t ay_apply_events_until(uint64_t t_state);
+static void ay_apply_events_before(size_t end);
+static int ay_output_silent(void);
+static void ay_write_register(uint8_t reg, uint8_t value, uint64_t t_state);
 static int ay_parse_pan_spec(const char* spec);
+static void ay_log_record(uint8_t reg, uint8_t value, uint64_t t_state);
 
 
 // --- LCD Initialization ---
@@ -833,45 +1340,45 @@ int init_lcd_backend(void) {
     fprintf(stderr, "LCD backend unavailable: install the Arduino_GFX library for ESP32 builds.");
     return 0;
 #else
+    video_pipeline_stop();
     video_free_framebuffers();
-    lcd_framebuffer_size = (size_t)TOTAL_WIDTH * (size_t)TOTAL_HEIGHT * sizeof(uint16_t);
-
-    lcd_framebuffers[0] = video_alloc_framebuffer((size_t)TOTAL_WIDTH * (size_t)TOTAL_HEIGHT,
-                                                  &lcd_framebuffer_from_psram[0]);
-    lcd_framebuffers[1] = video_alloc_framebuffer((size_t)TOTAL_WIDTH * (size_t)TOTAL_HEIGHT,
-                                                  &lcd_framebuffer_from_psram[1]);
-    lcd_double_buffered = lcd_framebuffers[0] && lcd_framebuffers[1];
-    if (!lcd_framebuffers[0]) {
-        fprintf(stderr, "LCD framebuffer allocation failed (wanted %zu bytes)
-", lcd_framebuffer_size);
-        video_free_framebuffers();
-        return 0;
-    }
 
-    lcd_backbuffer_index = 0;
     lcd = create_board_gfx();
     if (!lcd) {
-        fprintf(stderr, "LCD driver unavailable: implement create_board_gfx() for your panel.
-");
-        video_free_framebuffers();
+        fprintf(stderr, "LCD driver unavailable: implement create_board_gfx() for your panel.\n");
         return 0;
     }
 
     if (!lcd->begin()) {
-        fprintf(stderr, "LCD init failed
-");
+        fprintf(stderr, "LCD init failed\n");
+        lcd = NULL;
+        return 0;
+    }
+
+    // Framebuffers hold the scaled destination rectangle, which never exceeds the panel.
+    size_t panel_pixels = (size_t)lcd->width() * (size_t)lcd->height();
+    lcd_framebuffer_size = panel_pixels * sizeof(uint16_t);
+    lcd_framebuffers[0] = video_alloc_framebuffer(panel_pixels, &lcd_framebuffer_from_psram[0]);
+    lcd_framebuffers[1] = video_alloc_framebuffer(panel_pixels, &lcd_framebuffer_from_psram[1]);
+    lcd_double_buffered = lcd_framebuffers[0] && lcd_framebuffers[1];
+    if (!lcd_framebuffers[0]) {
+        fprintf(stderr, "LCD framebuffer allocation failed (wanted %zu bytes)\n", lcd_framebuffer_size);
         video_free_framebuffers();
+        lcd = NULL;
         return 0;
     }
 
-    video_refresh_color_tables();
+    lcd_backbuffer_index = 0;
+    video_blit_layout_valid = 0;
+    video_palette_init();
     lcd->fillScreen(0x0000);
-    audio_available = 0;
+    if (!video_pipeline_start()) {
+        fprintf(stderr, "LCD render task unavailable; presenting frames on the emulation core\n");
+    }
     return 1;
 #endif
 #else
-    fprintf(stderr, "LCD backend requested but ESP_PLATFORM is not defined.
-");
+    fprintf(stderr, "LCD backend requested but ESP_PLATFORM is not defined.\n");
     return 0;
 #endif
 }
@@ -879,16 +1386,34 @@ int init_lcd_backend(void) {
 // --- LCD Cleanup ---
 void cleanup_lcd_backend(void) {
 #if defined(ESP_PLATFORM)
+    video_pipeline_stop();
     lcd = NULL;
     video_free_framebuffers();
+    audio_sink_close();
     audio_available = 0;
-    ay_set_sample_rate(0);
+    audio_set_output_format(0, audio_channel_count);
     audio_dump_finish();
 #endif
 }
 
-// --- Render ZX Spectrum Screen ---
-void render_screen(void) {
+// --- Frame Capture (emulation thread) ---
+// Queues a border colour change for the frame being built. When the queue
+// is full the last change is replaced, so the border still ends up right.
+static void border_record_event(uint64_t event_t_state, uint8_t color_idx) {
+    size_t index = border_color_event_count;
+    if (index == BORDER_EVENT_CAPACITY) {
+        --index;
+    } else {
+        ++border_color_event_count;
+    }
+    border_color_events[index].t_state = event_t_state;
+    border_color_events[index].color_idx = color_idx & 0x07u;
+}
+
+// Retires the border events of the frame that just ended. With a snapshot
+// they are copied into it; skipped frames (frame == NULL) only advance the
+// border timeline.
+static void video_capture_border(VideoFrameSnapshot* frame) {
     uint64_t frame_start = border_frame_start_tstate;
     uint64_t frame_end = frame_start + T_STATES_PER_FRAME;
 
@@ -905,29 +1430,33 @@ void render_screen(void) {
         }
         border_color_event_count -= drop_count;
     }
-    border_frame_color = start_color;
 
-    uint32_t base_rgba = spectrum_colors[start_color];
-    size_t total_pixels = (size_t)TOTAL_WIDTH * (size_t)TOTAL_HEIGHT;
-    for (size_t i = 0; i < total_pixels; ++i) {
-        pixels[i] = base_rgba;
+    if (frame) {
+        frame->frame_start_tstate = frame_start;
+        frame->border_start_color = start_color;
+        frame->border_event_count = 0;
     }
 
-    uint64_t segment_start = frame_start;
     uint8_t current_color = start_color;
     size_t event_index = 0;
     while (event_index < border_color_event_count && border_color_events[event_index].t_state < frame_end) {
-        uint64_t event_time = border_color_events[event_index].t_state;
-        if (event_time > segment_start) {
-            border_draw_span(segment_start, event_time, current_color);
-        }
         current_color = border_color_events[event_index].color_idx & 0x07u;
-        segment_start = event_time;
+        if (!frame) {
+            ++event_index;
+            continue;
+        }
+        uint32_t offset = (uint32_t)(border_color_events[event_index].t_state - frame_start);
+        if (frame->border_event_count < VIDEO_FRAME_BORDER_EVENT_CAPACITY) {
+            VideoFrameBorderEvent* event = &frame->border_events[frame->border_event_count++];
+            event->offset = offset;
+            event->color_idx = current_color;
+        } else {
+            // Out of room: fold the remaining changes into the last span so the
+            // frame still ends on the correct colour.
+            frame->border_events[VIDEO_FRAME_BORDER_EVENT_CAPACITY - 1].color_idx = current_color;
+        }
         ++event_index;
     }
-    if (frame_end > segment_start) {
-        border_draw_span(segment_start, frame_end, current_color);
-    }
 
     if (event_index > 0) {
         size_t remaining = border_color_event_count - event_index;
@@ -939,21 +1468,164 @@ void render_screen(void) {
 
     border_frame_start_tstate = frame_end;
     border_frame_color = current_color & 0x07u;
+}
+
+static void video_capture_frame(VideoFrameSnapshot* frame) {
+    video_capture_border(frame);
 
     uint64_t frame_count = total_t_states / T_STATES_PER_FRAME;
-    int flash_phase = (int)((frame_count >> 5) & 1ULL);
+    frame->flash_phase = (int)((frame_count >> 5) & 1ULL);
     const uint8_t* vram_bank = memory + VRAM_START;
-    const uint8_t* attr_bank = memory + ATTR_START;
     if (current_screen_bank < 8u) {
-        if (spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == current_screen_bank) {
-            vram_bank = memory + VRAM_START;
-            attr_bank = memory + ATTR_START;
-        } else {
-            const uint8_t* bank = ram_pages[current_screen_bank];
-            vram_bank = bank;
-            attr_bank = bank + (ATTR_START - VRAM_START);
+        if (!(spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == current_screen_bank)) {
+            vram_bank = ram_pages[current_screen_bank];
+        }
+    }
+    memcpy(frame->screen, vram_bank, VIDEO_FRAME_SCREEN_BYTES);
+
+    frame->overlay.count = 0;
+    frame->overlay.text_used = 0;
+    video_overlay_recording = &frame->overlay;
+    tape_render_overlay();
+    tape_render_manager();
+    video_overlay_recording = NULL;
+}
+
+// --- Overlay Display List ---
+static VideoOverlayCommand* video_overlay_append(VideoOverlayCommandType type) {
+    VideoOverlayList* list = video_overlay_recording;
+    if (!list || list->count >= VIDEO_OVERLAY_COMMAND_CAPACITY) {
+        return NULL;
+    }
+    VideoOverlayCommand* command = &list->commands[list->count++];
+    memset(command, 0, sizeof(*command));
+    command->type = type;
+    return command;
+}
+
+static void video_overlay_record_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color) {
+    VideoOverlayList* list = video_overlay_recording;
+    if (!list || !text) {
+        return;
+    }
+
+    // Only keep the glyphs that can land on screen; long paths would otherwise
+    // exhaust the text arena.
+    int advance = TAPE_OVERLAY_FONT_WIDTH * scale + spacing;
+    size_t length = strlen(text);
+    if (advance > 0) {
+        int visible_width = TOTAL_WIDTH - origin_x;
+        size_t visible = visible_width > 0 ? (size_t)(visible_width / advance + 1) : 0u;
+        if (length > visible) {
+            length = visible;
+        }
+    }
+    if (list->text_used + length + 1u > VIDEO_OVERLAY_TEXT_CAPACITY) {
+        return;
+    }
+
+    VideoOverlayCommand* command = video_overlay_append(VIDEO_OVERLAY_COMMAND_TEXT);
+    if (!command) {
+        return;
+    }
+    command->x = (int16_t)origin_x;
+    command->y = (int16_t)origin_y;
+    command->scale = (uint8_t)scale;
+    command->spacing = (uint8_t)spacing;
+    command->color = color;
+    command->text_offset = (uint16_t)list->text_used;
+    memcpy(&list->text[list->text_used], text, length);
+    list->text[list->text_used + length] = '\0';
+    list->text_used += length + 1u;
+}
+
+static void video_overlay_replay(const VideoOverlayList* list) {
+    for (size_t i = 0; i < list->count; ++i) {
+        const VideoOverlayCommand* command = &list->commands[i];
+        switch (command->type) {
+            case VIDEO_OVERLAY_COMMAND_RECT:
+                tape_overlay_paint_rect(command->x,
+                                        command->y,
+                                        command->width,
+                                        command->height,
+                                        command->color,
+                                        command->border_color);
+                break;
+            case VIDEO_OVERLAY_COMMAND_TEXT:
+                tape_overlay_paint_text(command->x,
+                                        command->y,
+                                        &list->text[command->text_offset],
+                                        command->scale,
+                                        command->spacing,
+                                        command->color);
+                break;
+            case VIDEO_OVERLAY_COMMAND_ICON:
+                tape_overlay_paint_icon(command->x, command->y, command->icon, command->scale, command->color);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// --- Frame Rasterisation (render thread) ---
+// Paints the border as the beam draws it between two tstates of a frame.
+// Each line's visible part starts ULA_LEFT_BORDER_TSTATES before the first
+// pixel fetch (14336 on line 64) and lasts ULA_LINE_VISIBLE_TSTATES at two
+// pixels a tstate; the display area is drawn over afterwards.
+static void border_draw_span(uint64_t span_start, uint64_t span_end, uint8_t color_idx) {
+    const uint64_t first_line = 14336u / ULA_T_STATES_PER_LINE - BORDER_SIZE;
+    const uint64_t visible_start = first_line * ULA_T_STATES_PER_LINE;
+    const uint64_t visible_end = visible_start + (uint64_t)TOTAL_HEIGHT * ULA_T_STATES_PER_LINE;
+    uint64_t frame_base = span_start - span_start % T_STATES_PER_FRAME;
+    uint64_t start = span_start - frame_base + ULA_LEFT_BORDER_TSTATES;
+    uint64_t end = span_end - frame_base + ULA_LEFT_BORDER_TSTATES;
+    if (start < visible_start) {
+        start = visible_start;
+    }
+    if (end > visible_end) {
+        end = visible_end;
+    }
+
+    while (start < end) {
+        uint64_t line = start / ULA_T_STATES_PER_LINE;
+        uint64_t line_start = line * ULA_T_STATES_PER_LINE;
+        uint64_t stop = end < line_start + ULA_T_STATES_PER_LINE ? end : line_start + ULA_T_STATES_PER_LINE;
+        uint64_t column = start - line_start;
+        uint64_t last = stop - line_start;
+        if (last > ULA_LINE_VISIBLE_TSTATES) {
+            last = ULA_LINE_VISIBLE_TSTATES;
+        }
+        if (column < last) {
+            size_t row = (size_t)(line - first_line);
+            memset(&pixels[row * TOTAL_WIDTH + column * 2u], color_idx & 0x07u, (size_t)(last - column) * 2u);
+        }
+        start = stop;
+    }
+}
+
+static void video_rasterize_frame(const VideoFrameSnapshot* frame) {
+    uint64_t frame_start = frame->frame_start_tstate;
+    uint64_t frame_end = frame_start + T_STATES_PER_FRAME;
+
+    memset(pixels, frame->border_start_color & 0x07u, sizeof(pixels));
+
+    uint64_t segment_start = frame_start;
+    uint8_t current_color = frame->border_start_color & 0x07u;
+    for (size_t i = 0; i < frame->border_event_count; ++i) {
+        uint64_t event_time = frame_start + frame->border_events[i].offset;
+        if (event_time > segment_start) {
+            border_draw_span(segment_start, event_time, current_color);
         }
+        current_color = frame->border_events[i].color_idx & 0x07u;
+        segment_start = event_time;
+    }
+    if (frame_end > segment_start) {
+        border_draw_span(segment_start, frame_end, current_color);
     }
+
+    const uint8_t* vram_bank = frame->screen;
+    const uint8_t* attr_bank = frame->screen + (ATTR_START - VRAM_START);
     for (int y = 0; y < SCREEN_HEIGHT; ++y) {
         for (int x_char = 0; x_char < SCREEN_WIDTH / 8; ++x_char) {
             uint16_t pix_addr = VRAM_START + ((y & 0xC0) << 5) + ((y & 7) << 8) + ((y & 0x38) << 2) + x_char;
@@ -966,11 +1638,11 @@ void render_screen(void) {
             int pap_idx = (attr_byte >> 3) & 7;
             int bright = (attr_byte >> 6) & 1;
             int flash = (attr_byte >> 7) & 1;
-            const uint32_t* cmap = bright ? spectrum_bright_colors : spectrum_colors;
-            uint32_t ink = cmap[ink_idx];
-            uint32_t pap = cmap[pap_idx];
-            if (flash && flash_phase) {
-                uint32_t tmp = ink;
+            uint8_t palette_base = bright ? VIDEO_PALETTE_BRIGHT_BASE : 0u;
+            uint8_t ink = (uint8_t)(palette_base + ink_idx);
+            uint8_t pap = (uint8_t)(palette_base + pap_idx);
+            if (flash && frame->flash_phase) {
+                uint8_t tmp = ink;
                 ink = pap;
                 pap = tmp;
             }
@@ -981,4385 +1653,6877 @@ void render_screen(void) {
             }
         }
     }
-    tape_render_overlay();
-    tape_render_manager();
-#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_ARDUINO_GFX)
-    if (lcd_framebuffers[lcd_backbuffer_index]) {
-        video_convert_framebuffer(lcd_framebuffers[lcd_backbuffer_index]);
-        if (lcd) {
-            lcd->draw16bitRGBBitmap(0, 0, lcd_framebuffers[lcd_backbuffer_index], TOTAL_WIDTH, TOTAL_HEIGHT);
-        }
-        if (lcd_double_buffered) {
-            lcd_backbuffer_index ^= 1;
-        }
-    }
-#endif
-}
-
-static void ula_queue_port_value(uint8_t value);
-static void ula_process_port_events(uint64_t current_t_state);
 
-static FILE* audio_dump_file = NULL;
-static uint32_t audio_dump_data_bytes = 0;
-static uint16_t audio_dump_channels = 1;
-
-#define BEEPER_EVENT_CAPACITY 8192
-
-typedef struct BeeperEvent {
-    uint64_t t_state;
-    int8_t level;
-} BeeperEvent;
+    video_overlay_replay(&frame->overlay);
+}
 
-static BeeperEvent beeper_events[BEEPER_EVENT_CAPACITY];
-static size_t beeper_event_head = 0;
-static size_t beeper_event_tail = 0;
-static uint64_t beeper_last_event_t_state = 0;
-static double beeper_cycles_per_sample = 0.0;
-static double beeper_playback_position = 0.0;
-static double beeper_writer_cursor = 0.0;
-static double beeper_hp_last_input = 0.0;
-static double beeper_hp_last_output = 0.0;
-static int beeper_playback_level = 0;
-static int beeper_latency_warning_active = 0;
-static int beeper_idle_log_active = 0;
-static uint64_t beeper_idle_reset_count = 0;
-// --- Audio Callback ---
-void audio_callback(void* userdata, uint8_t* stream, int len) {
-    (void)userdata;
-    int16_t* buffer = (int16_t*)stream;
-    int num_samples = len / (int)sizeof(int16_t);
-    int channels = audio_channel_count > 0 ? audio_channel_count : 1;
-    if (channels <= 0) {
-        channels = 1;
+// --- Panel Blit ---
+// Fills table[0..dest_extent) with source indices spread evenly over
+// [src_origin, src_origin + src_extent), sampling at destination pixel centres.
+static void video_blit_build_axis(uint16_t* table, int dest_extent, int src_origin, int src_extent) {
+    for (int d = 0; d < dest_extent; ++d) {
+        int offset = (int)(((int64_t)(2 * d + 1) * src_extent) / (2 * (int64_t)dest_extent));
+        table[d] = (uint16_t)(src_origin + offset);
     }
-    int num_frames = (channels > 0) ? (num_samples / channels) : 0;
-    double cycles_per_sample = beeper_cycles_per_sample;
-    double playback_position = beeper_playback_position;
-    double last_input = beeper_hp_last_input;
-    double last_output = beeper_hp_last_output;
-    int level = beeper_playback_level;
+}
 
-    if (cycles_per_sample <= 0.0 || num_frames <= 0) {
-        memset(buffer, 0, (size_t)len);
-        return;
+static void video_blit_compute_layout(VideoBlitLayout* layout, VideoBlitMode mode, int panel_width, int panel_height) {
+    if (panel_width > VIDEO_PANEL_MAX_WIDTH) {
+        panel_width = VIDEO_PANEL_MAX_WIDTH;
+    }
+    if (panel_height > VIDEO_PANEL_MAX_HEIGHT) {
+        panel_height = VIDEO_PANEL_MAX_HEIGHT;
+    }
+    if (panel_width <= 0 || panel_height <= 0) {
+        panel_width = VIDEO_PANEL_DEFAULT_WIDTH;
+        panel_height = VIDEO_PANEL_DEFAULT_HEIGHT;
     }
 
-    if (beeper_event_head == beeper_event_tail && cycles_per_sample > 0.0) {
-        double idle_cycles = playback_position - (double)beeper_last_event_t_state;
-        if (idle_cycles > 0.0) {
-            double idle_samples = idle_cycles / cycles_per_sample;
-            if (idle_samples >= BEEPER_IDLE_RESET_SAMPLES) {
-                memset(buffer, 0, (size_t)len);
-
-                double new_position = playback_position + cycles_per_sample * (double)num_frames;
-                double writer_cursor = beeper_writer_cursor;
-                double writer_lag_samples = 0.0;
-                if (cycles_per_sample > 0.0) {
-                    writer_lag_samples = (new_position - writer_cursor) / cycles_per_sample;
-                }
-
-                if (!beeper_idle_log_active) {
-                    double idle_ms = (idle_cycles / CPU_CLOCK_HZ) * 1000.0;
-                    BEEPER_LOG(
-                        "[BEEPER] idle reset #%llu after %.0f samples (idle %.2f ms, playback %.0f -> %.0f cycles, writer %llu, cursor %.0f, lag %.2f samples)\n",
-                        (unsigned long long)(beeper_idle_reset_count + 1u),
-                        idle_samples,
-                        idle_ms,
-                        playback_position,
-                        new_position,
-                        (unsigned long long)beeper_last_event_t_state,
-                        writer_cursor,
-                        writer_lag_samples);
-                    if (beeper_logging_enabled) {
-                        beeper_idle_log_active = 1;
-                        ++beeper_idle_reset_count;
-                    }
-                }
-
-                double baseline = (double)level * (double)AUDIO_AMPLITUDE;
-                last_input = baseline;
-                last_output = 0.0;
+    int dest_width = panel_width;
+    int dest_height = panel_height;
+    int src_x = 0;
+    int src_y = 0;
+    int src_width = TOTAL_WIDTH;
+    int src_height = TOTAL_HEIGHT;
+    int64_t panel_ratio = (int64_t)panel_width * TOTAL_HEIGHT;
+    int64_t frame_ratio = (int64_t)panel_height * TOTAL_WIDTH;
 
-                audio_dump_write_samples(buffer, (size_t)(num_frames * channels));
-                beeper_hp_last_input = last_input;
-                beeper_hp_last_output = last_output;
-                beeper_playback_position = new_position;
-                beeper_writer_cursor = writer_cursor;
-                return;
+    switch (mode) {
+        case VIDEO_BLIT_MODE_CENTER:
+            dest_width = panel_width < TOTAL_WIDTH ? panel_width : TOTAL_WIDTH;
+            dest_height = panel_height < TOTAL_HEIGHT ? panel_height : TOTAL_HEIGHT;
+            src_width = dest_width;
+            src_height = dest_height;
+            break;
+        case VIDEO_BLIT_MODE_FIT:
+            if (panel_ratio <= frame_ratio) {
+                dest_height = (int)(((int64_t)TOTAL_HEIGHT * panel_width) / TOTAL_WIDTH);
+            } else {
+                dest_width = (int)(((int64_t)TOTAL_WIDTH * panel_height) / TOTAL_HEIGHT);
             }
-        }
+            break;
+        case VIDEO_BLIT_MODE_FILL:
+            if (panel_ratio >= frame_ratio) {
+                src_height = (int)(((int64_t)panel_height * TOTAL_WIDTH) / panel_width);
+            } else {
+                src_width = (int)(((int64_t)panel_width * TOTAL_HEIGHT) / panel_height);
+            }
+            break;
+        case VIDEO_BLIT_MODE_STRETCH:
+        default:
+            mode = VIDEO_BLIT_MODE_STRETCH;
+            break;
     }
 
-    for (int i = 0; i < num_frames; ++i) {
-        double target_position = playback_position + cycles_per_sample;
-
-        while (beeper_event_head != beeper_event_tail &&
-               (double)beeper_events[beeper_event_head].t_state <= target_position) {
-            level = beeper_events[beeper_event_head].level;
-            beeper_event_head = (beeper_event_head + 1) % BEEPER_EVENT_CAPACITY;
+    if (dest_width < 1) {
+        dest_width = 1;
+    }
+    if (dest_height < 1) {
+        dest_height = 1;
+    }
+    src_x = (TOTAL_WIDTH - src_width) / 2;
+    src_y = (TOTAL_HEIGHT - src_height) / 2;
+
+    layout->mode = mode;
+    layout->panel_width = panel_width;
+    layout->panel_height = panel_height;
+    layout->dest_width = dest_width;
+    layout->dest_height = dest_height;
+    layout->dest_x = (panel_width - dest_width) / 2;
+    layout->dest_y = (panel_height - dest_height) / 2;
+    video_blit_build_axis(layout->src_x, dest_width, src_x, src_width);
+    video_blit_build_axis(layout->src_y, dest_height, src_y, src_height);
+}
+
+// Scales pixels[] into dest (dest_width x dest_height, tightly packed) and
+// expands palette indices to RGB565 in the same pass. Destination rows that
+// sample the same source row as the previous one are copied instead of
+// converted again. When dirty_rows is given, only destination rows whose
+// source row is flagged are written.
+static void video_blit_frame(const VideoBlitLayout* layout, uint16_t* dest, const uint8_t* dirty_rows) {
+    const uint16_t* src_x = layout->src_x;
+    int width = layout->dest_width;
+    const uint16_t* previous_row = NULL;
+    int previous_src_y = -1;
+
+    for (int dy = 0; dy < layout->dest_height; ++dy) {
+        uint16_t* dst_row = &dest[(size_t)dy * (size_t)width];
+        int sy = layout->src_y[dy];
+        if (dirty_rows && !dirty_rows[sy]) {
+            continue;
         }
-
-        double raw_sample = (double)level * (double)AUDIO_AMPLITUDE;
-        double filtered_sample = raw_sample - last_input + BEEPER_HP_ALPHA * last_output;
-        last_input = raw_sample;
-        last_output = filtered_sample;
-
-        int16_t sample_value = (int16_t)filtered_sample;
-        for (int ch = 0; ch < channels; ++ch) {
-            buffer[i * channels + ch] = sample_value;
+        if (sy == previous_src_y && previous_row) {
+            memcpy(dst_row, previous_row, (size_t)width * sizeof(uint16_t));
+            continue;
+        }
+        const uint8_t* src_row = &pixels[sy * TOTAL_WIDTH];
+        for (int dx = 0; dx < width; ++dx) {
+            dst_row[dx] = video_palette_565[src_row[src_x[dx]]];
         }
+        previous_row = dst_row;
+        previous_src_y = sy;
+    }
+}
 
-        playback_position = target_position;
+static uint32_t video_hash_row(const uint8_t* row) {
+    uint32_t hash = 2166136261u;
+    for (int x = 0; x < TOTAL_WIDTH; x += 4) {
+        uint32_t word;
+        memcpy(&word, &row[x], sizeof(word));
+        hash = (hash ^ word) * 16777619u;
     }
+    return hash;
+}
 
-    beeper_playback_position = playback_position;
-    beeper_hp_last_input = last_input;
-    beeper_hp_last_output = last_output;
-    beeper_playback_level = level;
+static void video_hash_frame_rows(uint32_t* hashes) {
+    for (int y = 0; y < TOTAL_HEIGHT; ++y) {
+        hashes[y] = video_hash_row(&pixels[y * TOTAL_WIDTH]);
+    }
+}
 
-    if (audio_dump_file && audio_dump_channels == (uint16_t)channels) {
-        audio_dump_write_samples(buffer, (size_t)(num_frames * channels));
+// Flags the source rows whose hash differs from the cache and returns how many did.
+static int video_row_cache_diff(const VideoRowCache* cache, const uint32_t* hashes, uint8_t* dirty_rows) {
+    int dirty_count = 0;
+    for (int y = 0; y < TOTAL_HEIGHT; ++y) {
+        dirty_rows[y] = (uint8_t)(!cache->valid || cache->hashes[y] != hashes[y]);
+        dirty_count += dirty_rows[y];
     }
+    return dirty_count;
 }
 
+static void video_row_cache_store(VideoRowCache* cache, const uint32_t* hashes) {
+    memcpy(cache->hashes, hashes, sizeof(cache->hashes));
+    cache->valid = 1;
+}
 
-static size_t beeper_pending_event_count(void);
-static void beeper_force_resync(uint64_t sync_t_state);
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_ARDUINO_GFX)
+static void video_row_caches_invalidate(void) {
+    video_panel_rows.valid = 0;
+    video_backbuffer_rows[0].valid = 0;
+    video_backbuffer_rows[1].valid = 0;
+}
+#endif
 
-#if defined(ESP_PLATFORM)
-static uint16_t video_rgba_to_rgb565(uint32_t rgba)
-{
-    uint8_t r = (uint8_t)((rgba >> 24) & 0xFFu);
-    uint8_t g = (uint8_t)((rgba >> 16) & 0xFFu);
-    uint8_t b = (uint8_t)((rgba >> 8) & 0xFFu);
+void video_set_blit_mode(int mode) {
+    if (mode < 0 || mode >= VIDEO_BLIT_MODE_COUNT) {
+        return;
+    }
+    video_blit_requested_mode.store(mode, std::memory_order_release);
+}
 
-    uint16_t rr = (uint16_t)(r >> 3);
-    uint16_t gg = (uint16_t)(g >> 2);
-    uint16_t bb = (uint16_t)(b >> 3);
+static void video_present_frame(void) {
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_ARDUINO_GFX)
+    if (!lcd || !lcd_framebuffers[lcd_backbuffer_index]) {
+        return;
+    }
 
-    return (uint16_t)((rr << 11) | (gg << 5) | bb);
-}
+    VideoBlitMode requested = (VideoBlitMode)video_blit_requested_mode.load(std::memory_order_acquire);
+    if (!video_blit_layout_valid || video_blit_layout.mode != requested) {
+        video_blit_compute_layout(&video_blit_layout, requested, lcd->width(), lcd->height());
+        video_blit_layout_valid = 1;
+        video_row_caches_invalidate();
+        lcd->fillScreen(0x0000);
+    }
 
-static void video_refresh_color_tables(void)
-{
-    for (int i = 0; i < 8; ++i) {
-        spectrum_colors_565[i] = video_rgba_to_rgb565(spectrum_colors[i]);
-        spectrum_bright_colors_565[i] = video_rgba_to_rgb565(spectrum_bright_colors[i]);
+    static uint8_t panel_dirty[TOTAL_HEIGHT];
+    static uint8_t buffer_dirty[TOTAL_HEIGHT];
+    video_hash_frame_rows(video_frame_row_hashes);
+    if (video_row_cache_diff(&video_panel_rows, video_frame_row_hashes, panel_dirty) == 0) {
+        ++video_frames_unchanged;
+        return;
     }
-}
 
-static uint16_t* video_alloc_framebuffer(size_t pixel_count, uint8_t* from_psram)
-{
-    size_t bytes = pixel_count * sizeof(uint16_t);
-    uint16_t* buffer = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (buffer) {
-        if (from_psram) {
-            *from_psram = 1u;
+    // The backbuffer may be a frame or more behind the panel, so bring it up
+    // to date against its own hashes before flushing what the panel lacks.
+    VideoRowCache* buffer_rows = &video_backbuffer_rows[lcd_backbuffer_index];
+    uint16_t* target = lcd_framebuffers[lcd_backbuffer_index];
+    if (video_row_cache_diff(buffer_rows, video_frame_row_hashes, buffer_dirty) > 0) {
+        video_blit_frame(&video_blit_layout, target, buffer_dirty);
+        video_row_cache_store(buffer_rows, video_frame_row_hashes);
+    }
+
+    int width = video_blit_layout.dest_width;
+    int dy = 0;
+    while (dy < video_blit_layout.dest_height) {
+        if (!panel_dirty[video_blit_layout.src_y[dy]]) {
+            ++dy;
+            continue;
         }
-        return buffer;
+        int run_start = dy;
+        while (dy < video_blit_layout.dest_height && panel_dirty[video_blit_layout.src_y[dy]]) {
+            ++dy;
+        }
+        lcd->draw16bitRGBBitmap((int16_t)video_blit_layout.dest_x,
+                                (int16_t)(video_blit_layout.dest_y + run_start),
+                                &target[(size_t)run_start * (size_t)width],
+                                (int16_t)width,
+                                (int16_t)(dy - run_start));
+        video_rows_flushed += (uint64_t)(dy - run_start);
     }
-    buffer = (uint16_t*)malloc(bytes);
-    if (from_psram) {
-        *from_psram = 0u;
+    video_row_cache_store(&video_panel_rows, video_frame_row_hashes);
+
+    if (lcd_double_buffered) {
+        lcd_backbuffer_index ^= 1;
     }
-    return buffer;
+#endif
 }
 
-static void video_free_framebuffers(void)
-{
-    for (int i = 0; i < 2; ++i) {
-        if (lcd_framebuffers[i]) {
-            if (lcd_framebuffer_from_psram[i]) {
-                heap_caps_free(lcd_framebuffers[i]);
-            } else {
-                free(lcd_framebuffers[i]);
-            }
-            lcd_framebuffers[i] = NULL;
-            lcd_framebuffer_from_psram[i] = 0u;
+// --- Frame Skip Controller ---
+static uint64_t video_monotonic_us(void) {
+#if defined(ESP_PLATFORM)
+    return (uint64_t)esp_timer_get_time();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+static void video_frameskip_record_cost(uint64_t elapsed_us) {
+    uint32_t sample = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+    uint32_t average = video_present_cost_us.load(std::memory_order_relaxed);
+    if (average == 0u) {
+        average = sample;
+    } else {
+        average = (uint32_t)(((uint64_t)average * 7u + sample) / 8u);
+    }
+    video_present_cost_us.store(average, std::memory_order_relaxed);
+}
+
+// Picks the presentation interval. With the render task the flush runs in
+// parallel, so the interval only has to cover its cost; inline rendering
+// steps up when frames arrive late and the present cost is what overruns
+// the time emulation leaves, and only probes one step down when the cost,
+// plus a quarter, fits the shorter interval. Increases then wait
+// VIDEO_FRAMESKIP_SETTLE_FRAMES for the period average to catch up;
+// decreases always wait VIDEO_FRAMESKIP_RELEASE_FRAMES frames.
+static void video_frameskip_update(uint64_t now_us) {
+    if (video_frameskip_last_frame_us != 0u && now_us > video_frameskip_last_frame_us) {
+        uint64_t elapsed = now_us - video_frameskip_last_frame_us;
+        uint32_t sample = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+        if (video_frame_period_us == 0u) {
+            video_frame_period_us = sample;
+        } else {
+            video_frame_period_us = (uint32_t)(((uint64_t)video_frame_period_us * 7u + sample) / 8u);
         }
     }
-    lcd_framebuffer_size = 0u;
-    lcd_double_buffered = 0;
-    lcd_backbuffer_index = 0;
-}
+    video_frameskip_last_frame_us = now_us;
 
-static void video_convert_framebuffer(uint16_t* dest)
-{
-    if (!dest) {
+    if (video_frameskip_setting > 0) {
+        video_frameskip_interval = video_frameskip_setting;
+        video_frameskip_release_count = 0;
         return;
     }
 
-    for (int y = 0; y < TOTAL_HEIGHT; ++y) {
-        const uint32_t* src_row = &pixels[y * TOTAL_WIDTH];
-        uint16_t* dst_row = &dest[y * TOTAL_WIDTH];
-        for (int x = 0; x < TOTAL_WIDTH; ++x) {
-            dst_row[x] = video_rgba_to_rgb565(src_row[x]);
+    if (video_frameskip_settle_count > 0) {
+        --video_frameskip_settle_count;
+    }
+    int target = video_frameskip_interval;
+    uint32_t cost = video_present_cost_us.load(std::memory_order_relaxed);
+    if (video_pipeline_active) {
+        target = (int)((cost + VIDEO_FRAME_PERIOD_US - 1u) / VIDEO_FRAME_PERIOD_US);
+    } else if (video_frame_period_us > VIDEO_FRAME_PERIOD_US + VIDEO_FRAME_PERIOD_US / 10u) {
+        // Late frames: the period less the present cost each one carries is
+        // emulation time. Only skip when presenting is what doesn't fit.
+        uint32_t amortised = cost / (uint32_t)video_frameskip_interval;
+        uint32_t emulation = video_frame_period_us > amortised ? video_frame_period_us - amortised : 0u;
+        if (video_frameskip_settle_count == 0 && emulation < VIDEO_FRAME_PERIOD_US &&
+            cost > (uint64_t)(VIDEO_FRAME_PERIOD_US - emulation) * (uint32_t)video_frameskip_interval) {
+            target = video_frameskip_interval + 1;
+        }
+    } else if ((uint64_t)cost + cost / 4u <= (uint64_t)(video_frameskip_interval - 1) * VIDEO_FRAME_PERIOD_US) {
+        target = video_frameskip_interval - 1;
+    }
+    if (target < 1) {
+        target = 1;
+    } else if (target > VIDEO_FRAMESKIP_MAX) {
+        target = VIDEO_FRAMESKIP_MAX;
+    }
+
+    if (target > video_frameskip_interval) {
+        video_frameskip_interval = target;
+        video_frameskip_release_count = 0;
+        video_frameskip_settle_count = VIDEO_FRAMESKIP_SETTLE_FRAMES;
+    } else if (target < video_frameskip_interval) {
+        if (++video_frameskip_release_count >= VIDEO_FRAMESKIP_RELEASE_FRAMES) {
+            --video_frameskip_interval;
+            video_frameskip_release_count = 0;
         }
+    } else {
+        video_frameskip_release_count = 0;
     }
 }
 
-__attribute__((weak)) Arduino_GFX* create_board_gfx(void)
-{
-    return NULL;
+// 0 selects automatic skipping; N > 0 presents every Nth frame.
+void video_set_frameskip(int frames) {
+    if (frames < 0) {
+        frames = 0;
+    } else if (frames > VIDEO_FRAMESKIP_MAX) {
+        frames = VIDEO_FRAMESKIP_MAX;
+    }
+    video_frameskip_setting = frames;
+    video_frameskip_interval = frames > 0 ? frames : 1;
+    video_frameskip_countdown = 0;
+    video_frameskip_release_count = 0;
+    video_frameskip_settle_count = 0;
 }
-#endif
-
-// --- Keyboard State ---
-uint8_t keyboard_matrix[8] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 
-// --- ROM Handling ---
-static const char *default_rom_filename = "48.rom";
+int video_frameskip_current(void) {
+    return video_frameskip_interval;
+}
 
-static int spectrum_rom_contains_ascii(const uint8_t *rom, size_t size, const char *needle) {
-    if (!rom || !needle) {
-        return 0;
+// --- Render Pipeline ---
+static void video_pipeline_publish(void) {
+    uint8_t previous = video_ready_slot.exchange((uint8_t)(video_producer_slot | VIDEO_SLOT_FRESH),
+                                                 std::memory_order_acq_rel);
+    video_producer_slot = (int)(previous & VIDEO_SLOT_INDEX_MASK);
+    if (previous & VIDEO_SLOT_FRESH) {
+        video_frames_dropped.fetch_add(1u, std::memory_order_relaxed);
     }
+    video_frames_published.fetch_add(1u, std::memory_order_relaxed);
 
-    size_t needle_len = strlen(needle);
-    if (needle_len == 0u || needle_len > size) {
-        return 0;
+#if defined(ESP_PLATFORM)
+    if (video_render_task_handle) {
+        xTaskNotifyGive(video_render_task_handle);
     }
-
-    for (size_t i = 0; i + needle_len <= size; ++i) {
-        size_t j = 0u;
-        while (j < needle_len && rom[i + j] == (uint8_t)needle[j]) {
-            ++j;
-        }
-        if (j == needle_len) {
-            return 1;
-        }
+#else
+    {
+        std::lock_guard<std::mutex> guard(video_render_wake_mutex);
+        video_render_wake_pending = 1;
     }
-
-    return 0;
+    video_render_wake_cv.notify_one();
+#endif
 }
 
-static int spectrum_rom_contains_ascii_case_insensitive(const uint8_t *rom,
-                                                        size_t size,
-                                                        const char *needle) {
-    if (!rom || !needle) {
-        return 0;
-    }
-
-    size_t needle_len = strlen(needle);
-    if (needle_len == 0u || needle_len > size) {
+static int video_pipeline_acquire(void) {
+    if (!(video_ready_slot.load(std::memory_order_acquire) & VIDEO_SLOT_FRESH)) {
         return 0;
     }
+    uint8_t previous = video_ready_slot.exchange((uint8_t)video_consumer_slot, std::memory_order_acq_rel);
+    video_consumer_slot = (int)(previous & VIDEO_SLOT_INDEX_MASK);
+    return 1;
+}
 
-    for (size_t i = 0; i + needle_len <= size; ++i) {
-        size_t j = 0u;
-        while (j < needle_len) {
-            unsigned char rom_byte = rom[i + j];
-            unsigned char needle_byte = (unsigned char)needle[j];
-            if (tolower(rom_byte) != tolower(needle_byte)) {
-                break;
-            }
-            ++j;
+static void video_render_worker(void) {
+    while (video_render_running.load(std::memory_order_acquire)) {
+#if defined(ESP_PLATFORM)
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+        {
+            std::unique_lock<std::mutex> lock(video_render_wake_mutex);
+            video_render_wake_cv.wait(lock, [] {
+                return video_render_wake_pending || !video_render_running.load(std::memory_order_acquire);
+            });
+            video_render_wake_pending = 0;
         }
-        if (j == needle_len) {
-            return 1;
+#endif
+        if (!video_render_running.load(std::memory_order_acquire)) {
+            break;
+        }
+        if (!video_pipeline_acquire()) {
+            continue;
         }
+        uint64_t present_start = video_monotonic_us();
+        video_rasterize_frame(&video_frame_slots[video_consumer_slot]);
+        video_present_frame();
+        video_frameskip_record_cost(video_monotonic_us() - present_start);
+        video_frames_presented.fetch_add(1u, std::memory_order_release);
     }
+}
 
-    return 0;
+#if defined(ESP_PLATFORM)
+static void video_render_task(void* param) {
+    (void)param;
+    video_render_worker();
+    video_render_task_exited.store(1, std::memory_order_release);
+    vTaskDelete(NULL);
 }
+#endif
 
-static int spectrum_rom_bank_seems_48k_basic(const uint8_t *rom) {
-    if (!rom) {
-        return 0;
+int video_pipeline_start(void) {
+    if (video_pipeline_active) {
+        return 1;
     }
 
-    int has_1982 = spectrum_rom_contains_ascii(rom, 0x4000u, "1982");
-    int has_sinclair_research = spectrum_rom_contains_ascii_case_insensitive(rom, 0x4000u, "Sinclair Research");
-    return has_1982 && has_sinclair_research;
-}
+    video_palette_init();
+    video_ready_slot.store(1u, std::memory_order_relaxed);
+    video_producer_slot = 0;
+    video_consumer_slot = 2;
+    video_frames_published.store(0u, std::memory_order_relaxed);
+    video_frames_dropped.store(0u, std::memory_order_relaxed);
+    video_frames_presented.store(0u, std::memory_order_relaxed);
+    video_render_running.store(1, std::memory_order_release);
 
-static int spectrum_rom_bank_seems_128k_menu(const uint8_t *rom) {
-    if (!rom) {
+#if defined(ESP_PLATFORM)
+    video_render_task_exited.store(0, std::memory_order_release);
+    if (xTaskCreatePinnedToCore(video_render_task,
+                                "spectrum_video",
+                                VIDEO_RENDER_TASK_STACK,
+                                NULL,
+                                tskIDLE_PRIORITY + 1,
+                                &video_render_task_handle,
+                                VIDEO_RENDER_TASK_CORE) != pdPASS) {
+        video_render_task_handle = NULL;
+        video_render_task_exited.store(1, std::memory_order_release);
+        video_render_running.store(0, std::memory_order_release);
         return 0;
     }
-
-    static const char *menu_markers[] = {"128K", "1986", "1985", "AMSTRAD", "MENU"};
-    size_t marker_count = sizeof(menu_markers) / sizeof(menu_markers[0]);
-    int marker_hit = 0;
-    for (size_t i = 0; i < marker_count; ++i) {
-        if (spectrum_rom_contains_ascii_case_insensitive(rom, 0x4000u, menu_markers[i])) {
-            marker_hit = 1;
-            break;
-        }
-    }
-
-    if (!marker_hit) {
+#else
+    video_render_wake_pending = 0;
+    try {
+        video_render_thread = std::thread(video_render_worker);
+    } catch (...) {
+        video_render_running.store(0, std::memory_order_release);
         return 0;
     }
+#endif
 
-    int has_128_text = spectrum_rom_contains_ascii(rom, 0x4000u, "128");
-    return has_128_text;
+    video_pipeline_active = 1;
+    return 1;
 }
 
-static void spectrum_swap_rom_banks(size_t a,
-                                    size_t b,
-                                    uint8_t bank_loaded[4],
-                                    uint8_t bank_loaded_from_primary[4],
-                                    uint8_t bank_loaded_from_companion[4],
-                                    uint8_t bank_loaded_from_hint[4],
-                                    uint8_t bank_mirrored_from[4],
-                                    uint8_t bank_matches_basic[4],
-                                    uint8_t bank_matches_menu[4]) {
-    if (a >= 4u || b >= 4u || a == b) {
+void video_pipeline_stop(void) {
+    if (!video_pipeline_active) {
         return;
     }
 
-    uint8_t temp_bank[0x4000u];
-    memcpy(temp_bank, rom_pages[a], sizeof(temp_bank));
-    memcpy(rom_pages[a], rom_pages[b], sizeof(temp_bank));
-    memcpy(rom_pages[b], temp_bank, sizeof(temp_bank));
-
-    if (bank_loaded) {
-        uint8_t tmp_flag = bank_loaded[a];
-        bank_loaded[a] = bank_loaded[b];
-        bank_loaded[b] = tmp_flag;
-    }
-    if (bank_loaded_from_primary) {
-        uint8_t tmp_flag = bank_loaded_from_primary[a];
-        bank_loaded_from_primary[a] = bank_loaded_from_primary[b];
-        bank_loaded_from_primary[b] = tmp_flag;
+    video_render_running.store(0, std::memory_order_release);
+#if defined(ESP_PLATFORM)
+    if (video_render_task_handle) {
+        xTaskNotifyGive(video_render_task_handle);
     }
-    if (bank_loaded_from_companion) {
-        uint8_t tmp_flag = bank_loaded_from_companion[a];
-        bank_loaded_from_companion[a] = bank_loaded_from_companion[b];
-        bank_loaded_from_companion[b] = tmp_flag;
+    while (!video_render_task_exited.load(std::memory_order_acquire)) {
+        vTaskDelay(1);
     }
-    if (bank_loaded_from_hint) {
-        uint8_t tmp_flag = bank_loaded_from_hint[a];
-        bank_loaded_from_hint[a] = bank_loaded_from_hint[b];
-        bank_loaded_from_hint[b] = tmp_flag;
+    video_render_task_handle = NULL;
+#else
+    {
+        std::lock_guard<std::mutex> guard(video_render_wake_mutex);
+        video_render_wake_pending = 1;
     }
-    if (bank_mirrored_from) {
-        uint8_t tmp_origin = bank_mirrored_from[a];
-        bank_mirrored_from[a] = bank_mirrored_from[b];
-        bank_mirrored_from[b] = tmp_origin;
-        for (size_t i = 0; i < 4u; ++i) {
-            if (i == a || i == b) {
-                continue;
-            }
-            if (bank_mirrored_from[i] == (uint8_t)a) {
-                bank_mirrored_from[i] = (uint8_t)b;
-            } else if (bank_mirrored_from[i] == (uint8_t)b) {
-                bank_mirrored_from[i] = (uint8_t)a;
-            }
-        }
+    video_render_wake_cv.notify_one();
+    if (video_render_thread.joinable()) {
+        video_render_thread.join();
     }
-    if (bank_matches_basic) {
-        uint8_t tmp_flag = bank_matches_basic[a];
-        bank_matches_basic[a] = bank_matches_basic[b];
-        bank_matches_basic[b] = tmp_flag;
+#endif
+    video_pipeline_active = 0;
+}
+
+// --- Render ZX Spectrum Screen ---
+void render_screen(void) {
+    video_palette_init();
+    video_frameskip_update(video_monotonic_us());
+    if (video_frameskip_countdown > 0) {
+        --video_frameskip_countdown;
+        ++video_frames_skipped;
+        video_capture_border(NULL);
+        return;
     }
-    if (bank_matches_menu) {
-        uint8_t tmp_flag = bank_matches_menu[a];
-        bank_matches_menu[a] = bank_matches_menu[b];
-        bank_matches_menu[b] = tmp_flag;
+    video_frameskip_countdown = (tape_warp_active ? TAPE_WARP_VIDEO_INTERVAL : video_frameskip_interval) - 1;
+
+    VideoFrameSnapshot* frame = &video_frame_slots[video_producer_slot];
+    video_capture_frame(frame);
+    if (video_pipeline_active) {
+        video_pipeline_publish();
+        return;
     }
+    uint64_t present_start = video_monotonic_us();
+    video_rasterize_frame(frame);
+    video_present_frame();
+    video_frameskip_record_cost(video_monotonic_us() - present_start);
 }
 
-static size_t spectrum_expected_rom_banks(SpectrumModel model) {
-    switch (model) {
-        case SPECTRUM_MODEL_128K:
-            return 2u;
-        case SPECTRUM_MODEL_PLUS2A:
-        case SPECTRUM_MODEL_PLUS3:
-            return 4u;
-        case SPECTRUM_MODEL_48K:
-        default:
-            return 1u;
-    }
+// --- Frame Output Helpers ---
+uint32_t video_frame_hash(void) {
+    return spectrum_hash_buffer(pixels, sizeof(pixels));
 }
 
-static int spectrum_load_rom_bank_file(const char *path, uint8_t *dest) {
-    if (!path || !dest) {
+int video_write_ppm(const char* path) {
+    if (!path) {
         return 0;
     }
 
-    FILE *bank_file = fopen(path, "rb");
-    if (!bank_file) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to open frame dump '%s': %s\n", path, strerror(errno));
         return 0;
     }
 
-    memset(dest, 0, 0x4000);
-    size_t read = fread(dest, 1, 0x4000, bank_file);
-    fclose(bank_file);
-
-    if (read < 0x4000) {
-        fprintf(stderr,
-                "ROM bank '%s' is %zu bytes; expected at least 16384 bytes\n",
-                path,
-                read);
-        if (read == 0) {
-            return 0;
+    video_palette_init();
+    fprintf(out, "P6\n%d %d\n255\n", TOTAL_WIDTH, TOTAL_HEIGHT);
+    uint8_t row[TOTAL_WIDTH * 3];
+    int ok = 1;
+    for (int y = 0; y < TOTAL_HEIGHT && ok; ++y) {
+        const uint8_t* src_row = &pixels[y * TOTAL_WIDTH];
+        for (int x = 0; x < TOTAL_WIDTH; ++x) {
+            uint32_t rgba = video_palette_rgba[src_row[x]];
+            row[x * 3 + 0] = (uint8_t)((rgba >> 24) & 0xFFu);
+            row[x * 3 + 1] = (uint8_t)((rgba >> 16) & 0xFFu);
+            row[x * 3 + 2] = (uint8_t)((rgba >> 8) & 0xFFu);
         }
+        ok = fwrite(row, sizeof(row), 1, out) == 1;
     }
 
-    if (read > 0x4000) {
-        fprintf(stderr,
-                "ROM bank '%s' is larger than 16384 bytes; extra data will be ignored\n",
-                path);
-    }
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write frame dump '%s'\n", path);
+    }
+    return ok;
+}
 
-    return 1;
+static void ula_queue_port_value(uint8_t value);
+static void ula_process_port_events(uint64_t current_t_state);
+
+// --- Audio Dump Writer ---
+// audio_callback() only copies its output into a preallocated ring; a worker
+// thread (an SD-writer task on ESP32) drains it in batches and owns the file.
+// When storage falls behind, whole callback blocks are dropped and counted
+// rather than stalling the audio path.
+#define AUDIO_DUMP_RING_SAMPLES 65536u
+#define AUDIO_DUMP_RING_MASK (AUDIO_DUMP_RING_SAMPLES - 1u)
+#define AUDIO_DUMP_BATCH_SAMPLES 8192u
+#define AUDIO_DUMP_POLL_MS 20
+
+static FILE* audio_dump_file = NULL;
+static uint32_t audio_dump_data_bytes = 0;
+static uint16_t audio_dump_channels = 1;
+static Sint16* audio_dump_ring = NULL;
+static std::atomic<size_t> audio_dump_head(0); // samples written out (worker)
+static std::atomic<size_t> audio_dump_tail(0); // samples queued (audio callback)
+static std::atomic<int> audio_dump_active(0);
+static std::atomic<int> audio_dump_running(0);
+static std::atomic<uint64_t> audio_dump_dropped_samples(0);
+static int audio_dump_failed = 0;
+#if defined(ESP_PLATFORM)
+static const BaseType_t AUDIO_DUMP_TASK_CORE = 0;
+static const uint32_t AUDIO_DUMP_TASK_STACK = 4096u;
+static TaskHandle_t audio_dump_task_handle = NULL;
+static std::atomic<int> audio_dump_task_exited(1);
+#else
+static std::thread audio_dump_thread;
+static std::mutex audio_dump_wake_mutex;
+static std::condition_variable audio_dump_wake_cv;
+#endif
+
+#define BEEPER_EVENT_CAPACITY 8192
+
+typedef struct BeeperEvent {
+    uint64_t t_state;
+    int8_t level;
+} BeeperEvent;
+
+// Single-producer/single-consumer ring: the emulation thread only advances
+// beeper_event_tail and the audio consumer only advances beeper_event_head.
+// A full ring drops the new event and counts it; the next event carries the
+// absolute level again, so a drop costs at most one edge.
+static BeeperEvent beeper_events[BEEPER_EVENT_CAPACITY];
+static std::atomic<size_t> beeper_event_head(0);
+static std::atomic<size_t> beeper_event_tail(0);
+static std::atomic<uint32_t> beeper_events_dropped(0);
+static uint64_t beeper_last_event_t_state = 0;
+static double beeper_cycles_per_sample = 0.0;
+
+// Audio positions are tstates << BEEPER_POSITION_FRACTION_BITS. The
+// per-sample step carries another 16 bits below that in `remainder`, so the
+// cursor follows CPU_CLOCK_HZ / sample_rate without drifting over a session.
+#define BEEPER_POSITION_FRACTION_BITS 16
+
+typedef struct BeeperCursor {
+    uint64_t position;
+    uint32_t remainder;
+} BeeperCursor;
+
+static uint64_t beeper_step_position = 0;
+static uint32_t beeper_step_remainder = 0;
+static BeeperCursor beeper_playback = {0, 0};
+// Consumer-owned state the emulation thread needs to see: the playback
+// position (republished after every callback) and requests it cannot carry
+// out itself because they move beeper_event_head. A resync request holds
+// the target tstate + 1 and drops everything queued before
+// beeper_resync_index; a catch-up request holds a position to skip to.
+static std::atomic<uint64_t> beeper_playback_published(0);
+static std::atomic<uint64_t> beeper_resync_request(0);
+static std::atomic<size_t> beeper_resync_index(0);
+static std::atomic<uint64_t> beeper_catch_up_request(0);
+static std::atomic<uint64_t> beeper_writer_cursor(0);
+static AudioHighpass beeper_highpass = {0, 0};
+static int beeper_playback_level = 0;
+static int beeper_latency_warning_active = 0;
+static std::atomic<int> beeper_idle_log_active(0);
+static uint64_t beeper_idle_reset_count = 0;
+
+#define AUDIO_MIX_BLOCK_FRAMES 256
+
+// --- Dynamic rate control ---
+// The host or I2S clock never runs at exactly CPU_CLOCK_HZ / sample_rate
+// relative to the emulation, so audio_callback() scales its per-sample step
+// by a small ratio steered from the buffer fill (writer cursor minus playback
+// position, smoothed over a few callbacks). A proportional term reacts to the
+// fill error and an integral term settles on the clock offset. The ratio is
+// clamped to +-0.5% (under 9 cents), which is inaudible, and the trimming in
+// beeper_push_event() is kept only as a safety net far above the target.
+#define AUDIO_RATE_MAX_ADJUST 0.005
+#define AUDIO_RATE_SMOOTHING 0.125
+#define AUDIO_RATE_INTEGRAL_GAIN 0.00002
+#define AUDIO_RATE_TRIM_FACTOR 4
+#define AUDIO_RATE_ADJUST_BITS 24
+
+struct AudioRateStats {
+    double fill_samples;   // smoothed writer - playback distance
+    double target_samples;
+    double ratio;          // emulated time consumed per sample vs nominal
+    uint32_t underruns;    // times playback overtook the writer
+    uint32_t overruns;     // backlog trims the controller could not absorb
+    uint32_t dropped_events;
+};
+
+// Filled in by audio_render_offline() and ay_log_render().
+struct AudioOfflineStats {
+    uint64_t frames;
+    uint64_t samples;        // per channel
+    double emulated_seconds;
+    double wall_seconds;
+    double audio_seconds;    // time spent inside audio_callback()
+};
+
+// Where audio_callback() output goes. Pull sinks own the clock (a device
+// such as I2S) and call audio_callback() from their own task; push sinks are
+// fed by the emulation thread, which renders in lockstep with emulated time
+// at each frame end and hands the samples to write().
+typedef enum AudioSinkMode {
+    AUDIO_SINK_PUSH,
+    AUDIO_SINK_PULL
+} AudioSinkMode;
+
+// Requested by audio_sink_open(); open() may adjust any field it cannot
+// honour and reports the frames it buffers itself in buffer_frames.
+struct AudioSinkFormat {
+    int sample_rate;
+    int channels;
+    uint32_t block_frames;  // frames per write() or per pull
+    uint32_t buffer_frames;
+};
+
+struct AudioSink {
+    const char* name;
+    AudioSinkMode mode;
+    void* context;
+    int (*open)(AudioSink* sink, AudioSinkFormat* format);   // optional; 0 refuses
+    int (*start)(AudioSink* sink);                           // pull sinks: begin pulling
+    int (*write)(AudioSink* sink, const int16_t* samples, uint32_t frames); // push sinks; 0 on failure
+    uint32_t (*latency_frames)(AudioSink* sink);             // optional; rendered but not yet heard
+    void (*close)(AudioSink* sink);                          // optional
+};
+
+// Writes 16-bit PCM to a caller-owned FILE, with a RIFF header when `wav`.
+struct AudioFileSink {
+    AudioSink sink;
+    FILE* file;
+    int wav;
+    int channels;
+    uint64_t frames;
+};
+
+// Keeps output in a caller-supplied ring for audio_ring_sink_read(), e.g.
+// from a test or a benchmark thread. Frames that do not fit are dropped and
+// counted rather than blocking the emulation thread.
+struct AudioRingSink {
+    AudioSink sink;
+    int16_t* storage;
+    size_t storage_samples;
+    size_t capacity_frames;
+    int channels;
+    std::atomic<size_t> head; // frames read (reader)
+    std::atomic<size_t> tail; // frames written (emulation thread)
+    std::atomic<uint64_t> dropped_frames;
+};
+
+// Lockstep rendering shared by push sinks, the offline renderer and AY log
+// playback: audio_callback() is driven by whoever advances emulated time,
+// and each call renders exactly the samples that end at or before that time.
+struct AudioOfflineSession {
+    AudioSink* sink;
+    int sample_rate;
+    int channels;
+    uint32_t block_frames;
+    int saved_rate;
+    int saved_channels;
+    int saved_available;
+    int ok;
+    uint64_t start_t_state;
+    uint64_t rendered;
+    uint64_t audio_us;
+    uint64_t wall_start_us;
+};
+
+static uint64_t beeper_step_q32 = 0;
+// Set while audio_render_offline() drives audio_callback() in lockstep with
+// the CPU, so beeper_push_event() leaves the backlog alone.
+static int audio_lockstep = 0;
+static int audio_rate_control_enabled = 1;
+static int audio_rate_target_request = 0;
+static int audio_rate_primed = 0;
+static int audio_rate_underrun_active = 0;
+static double audio_rate_fill_average = 0.0;
+static double audio_rate_integral = 0.0;
+static std::atomic<int32_t> audio_rate_fill_published(0);   // samples << 8
+static std::atomic<int32_t> audio_rate_target_published(0); // samples
+static std::atomic<int32_t> audio_rate_adjust_published(0); // Q24
+static std::atomic<uint32_t> audio_underrun_count(0);
+static std::atomic<uint32_t> audio_overrun_count(0);
+
+// Settings changed from other threads. The setters publish the new values
+// and raise a flag; audio_callback() applies them before its next buffer,
+// so the state it owns is never touched mid-render.
+#define AUDIO_PENDING_BAND_LIMIT 0x01u
+#define AUDIO_PENDING_RATE_CONTROL 0x02u
+static std::atomic<uint32_t> audio_pending_settings(0);
+static std::atomic<int> audio_band_limit_setting(1);
+static std::atomic<int> audio_rate_control_setting(1);
+static std::atomic<int> audio_rate_target_setting(0);
+
+static void beeper_service_requests(void);
+
+// --- Band-limited beeper steps ---
+// Speaker edges (beeper, tape playback and MIC) are rendered as band-limited
+// steps: each edge adds a windowed-sinc impulse, picked from one of
+// BLEP_PHASES sub-sample offsets, into a delta ring whose running sum is the
+// output level. The kernel cuts off at 0.9 x Nyquist with a Blackman window
+// and delays the beeper by BLEP_HALF_TAPS samples. The table is computed by
+// the compiler (C++11 constexpr) so nothing runs at startup.
+#define BLEP_PHASES 32
+#define BLEP_TAPS 16
+#define BLEP_HALF_TAPS (BLEP_TAPS / 2)
+#define BLEP_SCALE_BITS 15
+#define BLEP_RING_SIZE 32
+#define BLEP_RING_MASK (BLEP_RING_SIZE - 1)
+
+static constexpr double BLEP_PI = 3.14159265358979323846;
+static constexpr double BLEP_CUTOFF = 0.9;
+
+static constexpr double blep_floor(double x) {
+    return (double)(long long)x > x ? (double)(long long)x - 1.0 : (double)(long long)x;
 }
 
-static int spectrum_populate_rom_pages(const char *rom_primary_path,
-                                       const uint8_t *rom_buffer,
-                                       size_t rom_size) {
-    if (!rom_buffer || rom_size < 0x4000) {
-        return 0;
-    }
+static constexpr double blep_wrap(double x) {
+    return x - 2.0 * BLEP_PI * blep_floor((x + BLEP_PI) / (2.0 * BLEP_PI));
+}
 
-    size_t expected_banks = spectrum_expected_rom_banks(spectrum_model);
-    if (expected_banks == 0u) {
-        expected_banks = 1u;
-    }
-    if (expected_banks > 4u) {
-        expected_banks = 4u;
-    }
+static constexpr double blep_sin_series(double x2, double term, int n, double sum) {
+    return n > 12 ? sum + term
+                  : blep_sin_series(x2, -term * x2 / (double)((2 * n) * (2 * n + 1)), n + 1, sum + term);
+}
 
-    const char *rom_label = rom_primary_path ? rom_primary_path : "<buffer>";
-    printf("Preparing ROM layout for model %d using '%s' (%zu expected bank%s)\n",
-           (int)spectrum_model,
-           rom_label,
-           expected_banks,
-           expected_banks == 1u ? "" : "s");
+static constexpr double blep_sin(double x) {
+    return blep_sin_series(blep_wrap(x) * blep_wrap(x), blep_wrap(x), 1, 0.0);
+}
 
-    char rom_stem[PATH_MAX];
-    char rom_extension[PATH_MAX];
-    rom_stem[0] = '\0';
-    rom_extension[0] = '\0';
+static constexpr double blep_cos(double x) {
+    return blep_sin(x + BLEP_PI * 0.5);
+}
 
-    if (rom_primary_path) {
-        size_t path_len = strlen(rom_primary_path);
-        if (path_len >= PATH_MAX) {
-            path_len = PATH_MAX - 1u;
-        }
+static constexpr double blep_abs(double x) {
+    return x < 0.0 ? -x : x;
+}
 
-        const char *last_slash = strrchr(rom_primary_path, '/');
-        const char *last_backslash = strrchr(rom_primary_path, '\\');
-        if (!last_slash || (last_backslash && last_backslash > last_slash)) {
-            last_slash = last_backslash;
-        }
+static constexpr double blep_impulse(double x) {
+    return blep_abs(x) >= (double)BLEP_HALF_TAPS ? 0.0
+           : (blep_abs(x) < 1e-9 ? BLEP_CUTOFF : blep_sin(BLEP_PI * BLEP_CUTOFF * x) / (BLEP_PI * x)) *
+                 (0.42 + 0.5 * blep_cos(BLEP_PI * x / (double)BLEP_HALF_TAPS) +
+                  0.08 * blep_cos(2.0 * BLEP_PI * x / (double)BLEP_HALF_TAPS));
+}
 
-        const char *extension = strrchr(rom_primary_path, '.');
-        if (extension && last_slash && extension < last_slash) {
-            extension = NULL;
-        }
+// Tap k of phase p covers the output sample k - (BLEP_HALF_TAPS - 1) samples
+// after the one the edge falls in, the edge sitting p / BLEP_PHASES into it.
+static constexpr double blep_raw_tap(int phase, int tap) {
+    return blep_impulse((double)(tap - (BLEP_HALF_TAPS - 1)) - (double)phase / (double)BLEP_PHASES);
+}
 
-        size_t stem_len = extension ? (size_t)(extension - rom_primary_path) : path_len;
-        if (stem_len >= PATH_MAX) {
-            stem_len = PATH_MAX - 1u;
-        }
-        memcpy(rom_stem, rom_primary_path, stem_len);
-        rom_stem[stem_len] = '\0';
+static constexpr double blep_raw_sum(int phase, int tap) {
+    return tap >= BLEP_TAPS ? 0.0 : blep_raw_tap(phase, tap) + blep_raw_sum(phase, tap + 1);
+}
 
-        if (extension) {
-            size_t ext_len = strlen(extension);
-            if (ext_len >= PATH_MAX) {
-                ext_len = PATH_MAX - 1u;
-            }
-            memcpy(rom_extension, extension, ext_len);
-            rom_extension[ext_len] = '\0';
-        }
-    }
+static constexpr int blep_round(double x) {
+    return (int)(x >= 0.0 ? x + 0.5 : x - 0.5);
+}
 
-    size_t stem_length = strlen(rom_stem);
-    int bank_hint = -1;
-    char separator_hint = '-';
-    if (stem_length >= 2u) {
-        char sep_candidate = rom_stem[stem_length - 2u];
-        char digit_candidate = rom_stem[stem_length - 1u];
-        if ((sep_candidate == '-' || sep_candidate == '_') && isdigit((unsigned char)digit_candidate)) {
-            int digit_value = digit_candidate - '0';
-            if (digit_value >= 0 && digit_value <= 9) {
-                bank_hint = digit_value;
-                separator_hint = sep_candidate;
-                stem_length -= 2u;
-                rom_stem[stem_length] = '\0';
-            }
-        }
-    }
+static constexpr int blep_scaled_tap(int phase, int tap) {
+    return blep_round(blep_raw_tap(phase, tap) * (double)(1 << BLEP_SCALE_BITS) / blep_raw_sum(phase, 0));
+}
 
-    if (bank_hint < 0 || bank_hint > 3) {
-        bank_hint = -1;
+static constexpr int blep_scaled_sum(int phase, int tap) {
+    return tap >= BLEP_TAPS ? 0 : blep_scaled_tap(phase, tap) + blep_scaled_sum(phase, tap + 1);
+}
+
+// Rounding leftovers go to the tap nearest the edge so every phase sums to
+// exactly 1 << BLEP_SCALE_BITS and the integrated level never drifts.
+static constexpr int16_t blep_tap(int phase, int tap) {
+    return (int16_t)(blep_scaled_tap(phase, tap) +
+                     (tap == (phase < BLEP_PHASES / 2 ? BLEP_HALF_TAPS - 1 : BLEP_HALF_TAPS)
+                          ? (1 << BLEP_SCALE_BITS) - blep_scaled_sum(phase, 0)
+                          : 0));
+}
+
+template <int... I> struct BlepIndices {};
+template <int N, int... I> struct BlepMakeIndices : BlepMakeIndices<N - 1, N - 1, I...> {};
+template <int... I> struct BlepMakeIndices<0, I...> {
+    typedef BlepIndices<I...> type;
+};
+
+typedef struct BlepRow {
+    int16_t taps[BLEP_TAPS];
+} BlepRow;
+
+typedef struct BlepTable {
+    BlepRow phases[BLEP_PHASES];
+} BlepTable;
+
+template <int... T> static constexpr BlepRow blep_make_row(int phase, BlepIndices<T...>) {
+    return BlepRow{{blep_tap(phase, T)...}};
+}
+
+template <int... P> static constexpr BlepTable blep_make_table(BlepIndices<P...>) {
+    return BlepTable{{blep_make_row(P, BlepMakeIndices<BLEP_TAPS>::type())...}};
+}
+
+static constexpr BlepTable beeper_blep_table = blep_make_table(BlepMakeIndices<BLEP_PHASES>::type());
+
+static int beeper_blep_enabled = 1;
+static int32_t beeper_blep_ring[BLEP_RING_SIZE];
+static uint32_t beeper_blep_index = 0;
+static int32_t beeper_blep_level = 0; // AUDIO_AMPLITUDE units << BLEP_SCALE_BITS
+
+static void beeper_blep_reset(int level) {
+    memset(beeper_blep_ring, 0, sizeof(beeper_blep_ring));
+    beeper_blep_index = 0;
+    beeper_blep_level = (level * AUDIO_AMPLITUDE) * (1 << BLEP_SCALE_BITS);
+}
+
+// Adds an edge of `delta` (AUDIO_AMPLITUDE units) at `event_position` to the
+// sample that starts at `sample_start` and is `step` long (all tstates << 16).
+static inline void beeper_blep_add_edge(uint64_t sample_start, uint64_t step, uint64_t event_position, int32_t delta) {
+    uint64_t offset = event_position > sample_start ? event_position - sample_start : 0;
+    uint32_t phase = (uint32_t)((offset * BLEP_PHASES) / step);
+    if (phase >= BLEP_PHASES) {
+        phase = BLEP_PHASES - 1;
+    }
+    const int16_t* taps = beeper_blep_table.phases[phase].taps;
+    uint32_t index = beeper_blep_index;
+    for (int k = 0; k < BLEP_TAPS; ++k) {
+        beeper_blep_ring[(index + (uint32_t)k) & BLEP_RING_MASK] += delta * taps[k];
     }
+}
 
-    if (bank_hint >= 0) {
-        printf("Primary ROM filename supplies numeric bank hint %d (separator '%c')\n",
-               bank_hint,
-               separator_hint);
-    } else {
-        printf("Primary ROM filename did not contain a numeric bank hint\n");
+static inline int32_t beeper_blep_next_sample(void) {
+    uint32_t index = beeper_blep_index;
+    beeper_blep_level += beeper_blep_ring[index];
+    beeper_blep_ring[index] = 0;
+    beeper_blep_index = (index + 1u) & BLEP_RING_MASK;
+    return (beeper_blep_level + (1 << (BLEP_SCALE_BITS - 1))) >> BLEP_SCALE_BITS;
+}
+
+static inline uint64_t beeper_position_from_tstates(double t_state) {
+    if (t_state <= 0.0) {
+        return 0;
     }
+    return (uint64_t)(t_state * (double)(1u << BEEPER_POSITION_FRACTION_BITS));
+}
 
-    memset(rom_pages, 0, sizeof(rom_pages));
-    uint8_t bank_loaded[4] = {0, 0, 0, 0};
-    uint8_t bank_loaded_from_hint[4] = {0, 0, 0, 0};
-    uint8_t bank_loaded_from_primary[4] = {0, 0, 0, 0};
-    uint8_t bank_loaded_from_companion[4] = {0, 0, 0, 0};
-    uint8_t bank_mirrored_from[4];
-    uint8_t bank_matches_basic[4] = {0, 0, 0, 0};
-    uint8_t bank_matches_menu[4] = {0, 0, 0, 0};
-    for (size_t i = 0; i < 4u; ++i) {
-        bank_mirrored_from[i] = 0xFFu;
+static inline double beeper_position_to_tstates(uint64_t position) {
+    return (double)position / (double)(1u << BEEPER_POSITION_FRACTION_BITS);
+}
+
+static inline void beeper_cursor_advance(BeeperCursor* cursor, uint32_t frames) {
+    uint64_t remainder = (uint64_t)cursor->remainder + (uint64_t)beeper_step_remainder * frames;
+    cursor->position += beeper_step_position * frames + (remainder >> 16);
+    cursor->remainder = (uint32_t)(remainder & 0xFFFFu);
+}
+
+// Producer side of the beeper ring. Returns 0 when the ring was full.
+static inline int beeper_queue_push(uint64_t t_state, int level) {
+    size_t tail = beeper_event_tail.load(std::memory_order_relaxed);
+    size_t next_tail = (tail + 1) % BEEPER_EVENT_CAPACITY;
+    if (next_tail == beeper_event_head.load(std::memory_order_acquire)) {
+        beeper_events_dropped.fetch_add(1u, std::memory_order_relaxed);
+        return 0;
     }
+    beeper_events[tail].t_state = t_state;
+    beeper_events[tail].level = (int8_t)level;
+    beeper_event_tail.store(next_tail, std::memory_order_release);
+    return 1;
+}
 
-    size_t dest_order[4];
-    size_t dest_count = 0u;
-    if (bank_hint >= 0) {
-        dest_order[dest_count++] = (size_t)bank_hint;
-        for (size_t bank = 0; bank < 4u; ++bank) {
-            if ((int)bank == bank_hint) {
-                continue;
+static inline int16_t audio_clamp_sample(int32_t value) {
+    if (value > 32767) {
+        return 32767;
+    }
+    if (value < -32768) {
+        return -32768;
+    }
+    return (int16_t)value;
+}
+
+// Renders the AY for `frames` output samples starting at `start_position`,
+// split into runs at each queued register write. A write becomes audible on
+// the first sample whose end position reaches its tstate, matching how the
+// beeper loop consumes beeper_events.
+static void audio_render_ay_span(uint64_t start_position,
+                                 uint64_t step,
+                                 uint32_t ay_increment,
+                                 int32_t* left,
+                                 int32_t* right,
+                                 int frames) {
+    int rendered = 0;
+    while (rendered < frames) {
+        ay_apply_events_until((start_position + step * (uint64_t)(rendered + 1)) >> BEEPER_POSITION_FRACTION_BITS);
+        int run = frames - rendered;
+        size_t ay_head = ay_event_head.load(std::memory_order_relaxed);
+        if (ay_head != ay_event_tail.load(std::memory_order_acquire)) {
+            uint64_t event_position = ay_events[ay_head].t_state << BEEPER_POSITION_FRACTION_BITS;
+            uint64_t distance = event_position > start_position ? event_position - start_position : 0;
+            int next_change = (int)((distance + step - 1u) / step) - 1;
+            if (next_change - rendered < run) {
+                run = next_change - rendered;
+                if (run < 1) {
+                    run = 1;
+                }
             }
-            dest_order[dest_count++] = bank;
-        }
-    } else {
-        for (size_t bank = 0; bank < 4u; ++bank) {
-            dest_order[dest_count++] = bank;
         }
+        ay_render_block(left + rendered, right + rendered, run, ay_increment);
+        rendered += run;
     }
+}
 
-    size_t buffer_offset = 0u;
-    size_t chunk_index = 0u;
-    while (buffer_offset + 0x4000u <= rom_size && chunk_index < dest_count) {
-        size_t dest_index = dest_order[chunk_index];
-        memcpy(rom_pages[dest_index], rom_buffer + buffer_offset, 0x4000u);
-        bank_loaded[dest_index] = 1u;
-        bank_loaded_from_primary[dest_index] = 1u;
-        bank_mirrored_from[dest_index] = (uint8_t)dest_index;
-        if (chunk_index == 0u && bank_hint >= 0 && dest_index == (size_t)bank_hint) {
-            bank_loaded_from_hint[dest_index] = 1u;
-        }
-        printf("Primary ROM chunk %zu copied into bank %zu (0x%04zX bytes)%s\n",
-               chunk_index,
-               dest_index,
-               (size_t)0x4000u,
-               (bank_hint >= 0 && dest_index == (size_t)bank_hint) ? " [hinted]" : "");
-        buffer_offset += 0x4000u;
-        ++chunk_index;
+// Runs once per callback on the consumer side and returns the step
+// adjustment (Q24 fraction of the nominal step) for the next `frames`.
+static int32_t audio_rate_control_update(uint64_t playback_position, int frames) {
+    int target = audio_rate_target_request;
+    if (target <= 0) {
+        // Two callbacks of headroom plus half a video frame, since the
+        // emulation delivers its audio a frame at a time.
+        target = 2 * frames + audio_sample_rate / 100;
     }
+    uint64_t writer = beeper_writer_cursor.load(std::memory_order_relaxed);
+    double fill = (double)(int64_t)(writer - playback_position) / (double)beeper_step_position;
 
-    if (buffer_offset < rom_size && chunk_index < dest_count) {
-        size_t remaining = rom_size - buffer_offset;
-        if (remaining > 0x4000u) {
-            remaining = 0x4000u;
-        }
-        size_t dest_index = dest_order[chunk_index];
-        memcpy(rom_pages[dest_index], rom_buffer + buffer_offset, remaining);
-        if (remaining < 0x4000u) {
-            memset(rom_pages[dest_index] + remaining, 0, 0x4000u - remaining);
-        }
-        bank_loaded[dest_index] = 1u;
-        bank_loaded_from_primary[dest_index] = 1u;
-        bank_mirrored_from[dest_index] = (uint8_t)dest_index;
-        if (chunk_index == 0u && bank_hint >= 0 && dest_index == (size_t)bank_hint) {
-            bank_loaded_from_hint[dest_index] = 1u;
-        }
-        printf("Primary ROM tail chunk copied into bank %zu (%zu bytes)%s\n",
-               dest_index,
-               remaining,
-               (bank_hint >= 0 && dest_index == (size_t)bank_hint) ? " [hinted]" : "");
+    if (!audio_rate_primed) {
+        audio_rate_fill_average = fill;
+        audio_rate_primed = 1;
+    } else {
+        audio_rate_fill_average += (fill - audio_rate_fill_average) * AUDIO_RATE_SMOOTHING;
     }
 
-    size_t current_loaded = 0u;
-    for (size_t i = 0; i < 4u; ++i) {
-        if (bank_loaded[i]) {
-            ++current_loaded;
-        }
+    double error = (audio_rate_fill_average - (double)target) / (double)target;
+    if (error > 1.0) {
+        error = 1.0;
+    } else if (error < -1.0) {
+        error = -1.0;
     }
-
-    char separator_candidates[3];
-    size_t separator_count = 0u;
-    separator_candidates[separator_count++] = separator_hint;
-    if (separator_hint != '-') {
-        separator_candidates[separator_count++] = '-';
+    audio_rate_integral += error * AUDIO_RATE_INTEGRAL_GAIN;
+    if (audio_rate_integral > AUDIO_RATE_MAX_ADJUST) {
+        audio_rate_integral = AUDIO_RATE_MAX_ADJUST;
+    } else if (audio_rate_integral < -AUDIO_RATE_MAX_ADJUST) {
+        audio_rate_integral = -AUDIO_RATE_MAX_ADJUST;
     }
-    if (separator_hint != '_' && separator_count < 3u) {
-        separator_candidates[separator_count++] = '_';
+    double adjust = error * AUDIO_RATE_MAX_ADJUST + audio_rate_integral;
+    if (adjust > AUDIO_RATE_MAX_ADJUST) {
+        adjust = AUDIO_RATE_MAX_ADJUST;
+    } else if (adjust < -AUDIO_RATE_MAX_ADJUST) {
+        adjust = -AUDIO_RATE_MAX_ADJUST;
     }
 
-    if (rom_stem[0] == '\0' && rom_primary_path) {
-        size_t path_len = strlen(rom_primary_path);
-        if (path_len >= PATH_MAX) {
-            path_len = PATH_MAX - 1u;
-        }
-        memcpy(rom_stem, rom_primary_path, path_len);
-        rom_stem[path_len] = '\0';
-        stem_length = strlen(rom_stem);
-    } else {
-        stem_length = strlen(rom_stem);
-    }
+    int32_t adjust_q24 = (int32_t)lround(adjust * (double)(1 << AUDIO_RATE_ADJUST_BITS));
+    audio_rate_fill_published.store((int32_t)lround(audio_rate_fill_average * 256.0), std::memory_order_relaxed);
+    audio_rate_target_published.store(target, std::memory_order_relaxed);
+    audio_rate_adjust_published.store(adjust_q24, std::memory_order_relaxed);
+    return adjust_q24;
+}
 
-    size_t banks_needed = expected_banks;
-    if (banks_needed == 0u) {
-        banks_needed = 1u;
+// --- Audio Callback ---
+// Consumer side of audio_set_band_limited_beeper() and audio_set_rate_control().
+static void audio_apply_pending_settings(void) {
+    uint32_t pending = audio_pending_settings.exchange(0u, std::memory_order_acquire);
+    if (pending & AUDIO_PENDING_BAND_LIMIT) {
+        beeper_blep_enabled = audio_band_limit_setting.load(std::memory_order_relaxed);
+        beeper_blep_reset(beeper_playback_level);
     }
-    if (banks_needed > 4u) {
-        banks_needed = 4u;
+    if (pending & AUDIO_PENDING_RATE_CONTROL) {
+        audio_rate_control_enabled = audio_rate_control_setting.load(std::memory_order_relaxed);
+        audio_rate_target_request = audio_rate_target_setting.load(std::memory_order_relaxed);
+        audio_rate_primed = 0;
+        audio_rate_integral = 0.0;
+        audio_rate_adjust_published.store(0, std::memory_order_relaxed);
     }
+}
 
-    char companion_path[PATH_MAX];
-    if (current_loaded < banks_needed && rom_stem[0] != '\0') {
-        for (size_t sep_index = 0; sep_index < separator_count && current_loaded < banks_needed; ++sep_index) {
-            char separator = separator_candidates[sep_index];
-            if (separator == '\0') {
-                continue;
-            }
-            for (size_t bank = 0; bank < banks_needed && current_loaded < banks_needed; ++bank) {
-                if (bank_loaded[bank]) {
-                    continue;
-                }
-                int written = snprintf(companion_path,
-                                       sizeof(companion_path),
-                                       "%s%c%zu%s",
-                                       rom_stem,
-                                       separator,
-                                       bank,
-                                       rom_extension);
-                if (written <= 0 || (size_t)written >= sizeof(companion_path)) {
-                    continue;
-                }
-                if (spectrum_load_rom_bank_file(companion_path, rom_pages[bank])) {
-                    bank_loaded[bank] = 1u;
-                    bank_loaded_from_hint[bank] = 1u;
-                    bank_loaded_from_companion[bank] = 1u;
-                    bank_mirrored_from[bank] = (uint8_t)bank;
-                    ++current_loaded;
-                    printf("Loaded ROM bank %zu from %s\n", bank, companion_path);
-                }
-            }
-        }
+void audio_callback(void* userdata, uint8_t* stream, int len) {
+    (void)userdata;
+    audio_apply_pending_settings();
+    int16_t* buffer = (int16_t*)stream;
+    int num_samples = len / (int)sizeof(int16_t);
+    int channels = audio_channel_count > 0 ? audio_channel_count : 1;
+    if (channels <= 0) {
+        channels = 1;
     }
+    int num_frames = (channels > 0) ? (num_samples / channels) : 0;
+    double cycles_per_sample = beeper_cycles_per_sample;
+    BeeperCursor playback = beeper_playback;
+    AudioHighpass highpass = beeper_highpass;
+    int level = beeper_playback_level;
 
-    size_t inspect_limit = banks_needed;
-    if (inspect_limit > 4u) {
-        inspect_limit = 4u;
+    if (cycles_per_sample <= 0.0 || beeper_step_position == 0u || num_frames <= 0) {
+        memset(buffer, 0, (size_t)len);
+        return;
     }
 
-    int hints_cover_all = 1;
-    for (size_t bank = 0; bank < inspect_limit; ++bank) {
-        if (!bank_loaded[bank] || !bank_loaded_from_hint[bank]) {
-            hints_cover_all = 0;
-            break;
-        }
-    }
+    beeper_service_requests();
 
-    int enforce_pair_order = (expected_banks <= 2u);
-    if (hints_cover_all) {
-        if (enforce_pair_order && inspect_limit >= 2u) {
-            printf("All required ROM banks arrived with numeric hints; verifying canonical order\n");
-        } else {
-            printf("All required ROM banks arrived with numeric hints; skipping heuristic reordering\n");
-        }
-    }
+    size_t event_head = beeper_event_head.load(std::memory_order_relaxed);
+    size_t event_tail = beeper_event_tail.load(std::memory_order_acquire);
+    int ay_pending = ay_event_head.load(std::memory_order_relaxed) != ay_event_tail.load(std::memory_order_acquire);
+    if (event_head == event_tail && !ay_pending && ay_output_silent()) {
+        double playback_t_states = beeper_position_to_tstates(playback.position);
+        double writer_cursor = beeper_position_to_tstates(beeper_writer_cursor.load(std::memory_order_relaxed));
+        double idle_cycles = playback_t_states - writer_cursor;
+        if (idle_cycles > 0.0) {
+            double idle_samples = idle_cycles / cycles_per_sample;
+            if (idle_samples >= BEEPER_IDLE_RESET_SAMPLES) {
+                memset(buffer, 0, (size_t)len);
 
-    if (inspect_limit >= 2u && enforce_pair_order) {
-        if (!hints_cover_all) {
-            printf("ROM bank hints incomplete; analysing signatures to find menu and BASIC banks\n");
-        }
-        int menu_candidate = -1;
-        int basic_candidate = -1;
-        size_t non_basic_candidates[4];
-        size_t non_basic_count = 0u;
-        for (size_t bank = 0; bank < inspect_limit; ++bank) {
-            if (!bank_loaded[bank]) {
-                continue;
-            }
+                BeeperCursor new_playback = playback;
+                beeper_cursor_advance(&new_playback, (uint32_t)num_frames);
+                double new_position = beeper_position_to_tstates(new_playback.position);
+                double writer_lag_samples = (new_position - writer_cursor) / cycles_per_sample;
 
-            if (spectrum_rom_bank_seems_48k_basic(rom_pages[bank])) {
-                if (!bank_matches_basic[bank]) {
-                    printf("ROM bank %zu matches 48K BASIC signature\n", bank);
-                    bank_matches_basic[bank] = 1u;
-                }
-                if (basic_candidate < 0) {
-                    basic_candidate = (int)bank;
+                if (!beeper_idle_log_active) {
+                    double idle_ms = (idle_cycles / CPU_CLOCK_HZ) * 1000.0;
+                    BEEPER_LOG(
+                        "[BEEPER] idle reset #%llu after %.0f samples (idle %.2f ms, playback %.0f -> %.0f cycles, writer %.0f, lag %.2f samples)\n",
+                        (unsigned long long)(beeper_idle_reset_count + 1u),
+                        idle_samples,
+                        idle_ms,
+                        playback_t_states,
+                        new_position,
+                        writer_cursor,
+                        writer_lag_samples);
+                    if (beeper_logging_enabled) {
+                        beeper_idle_log_active = 1;
+                        ++beeper_idle_reset_count;
+                    }
                 }
-                continue;
-            }
 
-            if (menu_candidate < 0 && spectrum_rom_bank_seems_128k_menu(rom_pages[bank])) {
-                if (!bank_matches_menu[bank]) {
-                    printf("ROM bank %zu matches 128K menu signature\n", bank);
-                    bank_matches_menu[bank] = 1u;
-                }
-                menu_candidate = (int)bank;
-            }
+                highpass.last_input = level * AUDIO_AMPLITUDE;
+                highpass.last_output = 0;
+                beeper_blep_reset(level);
 
-            if (non_basic_count < sizeof(non_basic_candidates) / sizeof(non_basic_candidates[0])) {
-                non_basic_candidates[non_basic_count++] = bank;
+                audio_dump_write_samples(buffer, (size_t)(num_frames * channels));
+                beeper_highpass = highpass;
+                beeper_playback = new_playback;
+                beeper_playback_published.store(new_playback.position, std::memory_order_release);
+                return;
             }
         }
+    }
 
-        if (!hints_cover_all && menu_candidate < 0 && basic_candidate >= 0 && non_basic_count > 0u) {
-            menu_candidate = (int)non_basic_candidates[0];
-            printf("Assuming ROM bank %d is the 128K menu (non-48K companion)\n", menu_candidate);
+    uint64_t step_q32 = beeper_step_q32;
+    uint32_t ay_increment = ay_step_increment;
+    if (audio_rate_control_enabled && audio_available) {
+        int64_t adjust_q24 = audio_rate_control_update(playback.position, num_frames);
+        step_q32 = (uint64_t)((int64_t)step_q32 + (((int64_t)step_q32 * adjust_q24) >> AUDIO_RATE_ADJUST_BITS));
+        ay_increment = (uint32_t)((int64_t)ay_increment + (((int64_t)ay_increment * adjust_q24) >> AUDIO_RATE_ADJUST_BITS));
+    }
+    uint64_t step_position = step_q32 >> 16;
+    uint32_t step_remainder = (uint32_t)(step_q32 & 0xFFFFu);
+    int blep_enabled = beeper_blep_enabled;
+    int32_t ay_left[AUDIO_MIX_BLOCK_FRAMES];
+    int32_t ay_right[AUDIO_MIX_BLOCK_FRAMES];
+    int frame = 0;
+    while (frame < num_frames) {
+        int block_frames = num_frames - frame;
+        if (block_frames > AUDIO_MIX_BLOCK_FRAMES) {
+            block_frames = AUDIO_MIX_BLOCK_FRAMES;
         }
 
-        if (menu_candidate >= 0 && menu_candidate != 0) {
-            int original_menu = menu_candidate;
-            spectrum_swap_rom_banks(0u,
-                                     (size_t)menu_candidate,
-                                     bank_loaded,
-                                     bank_loaded_from_primary,
-                                     bank_loaded_from_companion,
-                                     bank_loaded_from_hint,
-                                     bank_mirrored_from,
-                                     bank_matches_basic,
-                                     bank_matches_menu);
-            const char *note = hints_cover_all ? " (overrode numeric hints)" : "";
-            printf("Reordered ROM bank %d into slot 0 for 128K menu%s\n", original_menu, note);
-            if (basic_candidate == 0) {
-                basic_candidate = original_menu;
-            } else if (basic_candidate == original_menu) {
-                basic_candidate = 0;
+        // A silent AY with nothing queued (every 48K title) costs nothing.
+        int ay_active = ay_event_head.load(std::memory_order_relaxed) != ay_event_tail.load(std::memory_order_acquire) ||
+                        !ay_output_silent();
+        if (ay_active) {
+            audio_render_ay_span(playback.position, step_position, ay_increment, ay_left, ay_right, block_frames);
+        } else {
+            memset(&ay_highpass_left, 0, sizeof(ay_highpass_left));
+            memset(&ay_highpass_right, 0, sizeof(ay_highpass_right));
+        }
+
+        for (int i = 0; i < block_frames; ++i) {
+            uint64_t sample_start = playback.position;
+            playback.remainder += step_remainder;
+            playback.position += step_position + (playback.remainder >> 16);
+            playback.remainder &= 0xFFFFu;
+            uint64_t target_t_state = playback.position >> BEEPER_POSITION_FRACTION_BITS;
+
+            while (event_head != event_tail && beeper_events[event_head].t_state <= target_t_state) {
+                int next_level = beeper_events[event_head].level;
+                if (blep_enabled && next_level != level) {
+                    beeper_blep_add_edge(sample_start,
+                                         step_position,
+                                         beeper_events[event_head].t_state << BEEPER_POSITION_FRACTION_BITS,
+                                         (next_level - level) * AUDIO_AMPLITUDE);
+                }
+                level = next_level;
+                event_head = (event_head + 1) % BEEPER_EVENT_CAPACITY;
             }
-            menu_candidate = 0;
-        }
 
-        size_t desired_basic_slot = 1u;
-        if (basic_candidate >= 0 && inspect_limit > desired_basic_slot && (size_t)basic_candidate != desired_basic_slot) {
-            int original_basic = basic_candidate;
-            spectrum_swap_rom_banks(desired_basic_slot,
-                                     (size_t)basic_candidate,
-                                     bank_loaded,
-                                     bank_loaded_from_primary,
-                                     bank_loaded_from_companion,
-                                     bank_loaded_from_hint,
-                                     bank_mirrored_from,
-                                     bank_matches_basic,
-                                     bank_matches_menu);
-            const char *note = hints_cover_all ? " (overrode numeric hints)" : "";
-            printf("Reordered ROM bank %d into slot %zu for 48K BASIC%s\n",
-                   original_basic,
-                   desired_basic_slot,
-                   note);
-            if (menu_candidate == (int)desired_basic_slot) {
-                menu_candidate = original_basic;
-            } else if (menu_candidate == original_basic) {
-                menu_candidate = (int)desired_basic_slot;
+            int32_t raw_sample = blep_enabled ? beeper_blep_next_sample() : level * AUDIO_AMPLITUDE;
+            int32_t filtered_sample = audio_highpass_run(&highpass, raw_sample);
+
+            int16_t* out = buffer + (size_t)(frame + i) * (size_t)channels;
+            if (!ay_active) {
+                out[0] = (int16_t)filtered_sample;
+                for (int ch = 1; ch < channels; ++ch) {
+                    out[ch] = out[0];
+                }
+            } else if (channels == 1) {
+                out[0] = audio_clamp_sample(filtered_sample + ((ay_left[i] + ay_right[i]) >> 1));
+            } else {
+                int16_t mono = audio_clamp_sample(filtered_sample + ((ay_left[i] + ay_right[i]) >> 1));
+                out[0] = audio_clamp_sample(filtered_sample + ay_left[i]);
+                out[1] = audio_clamp_sample(filtered_sample + ay_right[i]);
+                for (int ch = 2; ch < channels; ++ch) {
+                    out[ch] = mono;
+                }
             }
-            basic_candidate = (int)desired_basic_slot;
         }
+        frame += block_frames;
     }
 
-    int fallback_bank = -1;
-    for (size_t i = 0; i < 4u; ++i) {
-        if (bank_loaded[i]) {
-            fallback_bank = (int)i;
-            break;
+    beeper_event_head.store(event_head, std::memory_order_release);
+    beeper_playback = playback;
+    beeper_highpass = highpass;
+    beeper_playback_level = level;
+    beeper_playback_published.store(playback.position, std::memory_order_release);
+
+    if (playback.position > beeper_writer_cursor.load(std::memory_order_relaxed)) {
+        if (audio_available && !audio_rate_underrun_active) {
+            audio_underrun_count.fetch_add(1u, std::memory_order_relaxed);
         }
+        audio_rate_underrun_active = 1;
+    } else {
+        audio_rate_underrun_active = 0;
     }
 
-    if (fallback_bank < 0) {
-        fprintf(stderr, "Failed to populate any ROM bank from '%s'\n", rom_primary_path ? rom_primary_path : "<buffer>");
-        return 0;
+    if (audio_dump_active.load(std::memory_order_relaxed) && audio_dump_channels == (uint16_t)channels) {
+        audio_dump_write_samples(buffer, (size_t)(num_frames * channels));
     }
+}
 
-    if (current_loaded < banks_needed) {
-        fprintf(stderr,
-                "Warning: only %zu of %zu ROM banks were found for '%s'; mirroring bank %d\n",
-                current_loaded,
-                banks_needed,
-                rom_label,
-                fallback_bank);
-        for (size_t bank = 0; bank < banks_needed; ++bank) {
-            if (!bank_loaded[bank]) {
-                memcpy(rom_pages[bank], rom_pages[fallback_bank], 0x4000);
-                bank_loaded[bank] = 1u;
-                bank_mirrored_from[bank] = (uint8_t)fallback_bank;
-            }
+
+static size_t beeper_pending_event_count(void);
+static void beeper_force_resync(uint64_t sync_t_state, size_t resume_index);
+
+#if defined(ESP_PLATFORM)
+static uint16_t* video_alloc_framebuffer(size_t pixel_count, uint8_t* from_psram)
+{
+    size_t bytes = pixel_count * sizeof(uint16_t);
+    uint16_t* buffer = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer) {
+        if (from_psram) {
+            *from_psram = 1u;
         }
-        current_loaded = banks_needed;
+        return buffer;
     }
+    buffer = (uint16_t*)malloc(bytes);
+    if (from_psram) {
+        *from_psram = 0u;
+    }
+    return buffer;
+}
 
-    size_t final_bank_count = banks_needed;
-    if (current_loaded > final_bank_count) {
-        final_bank_count = current_loaded;
-        if (final_bank_count > 4u) {
-            final_bank_count = 4u;
+static void video_free_framebuffers(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        if (lcd_framebuffers[i]) {
+            if (lcd_framebuffer_from_psram[i]) {
+                heap_caps_free(lcd_framebuffers[i]);
+            } else {
+                free(lcd_framebuffers[i]);
+            }
+            lcd_framebuffers[i] = NULL;
+            lcd_framebuffer_from_psram[i] = 0u;
         }
     }
+    lcd_framebuffer_size = 0u;
+    lcd_double_buffered = 0;
+    lcd_backbuffer_index = 0;
+}
 
-    if (final_bank_count == 0u) {
-        final_bank_count = 1u;
-    }
+__attribute__((weak)) Arduino_GFX* create_board_gfx(void)
+{
+    return NULL;
+}
+#endif
 
-    for (size_t bank = final_bank_count; bank < 4u; ++bank) {
-        size_t mirror = bank % final_bank_count;
-        memcpy(rom_pages[bank], rom_pages[mirror], 0x4000);
-        bank_mirrored_from[bank] = (uint8_t)mirror;
-    }
+// --- Keyboard State ---
+uint8_t keyboard_matrix[8] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 
-    rom_page_count = (uint8_t)final_bank_count;
+// --- ROM Handling ---
+static const char *default_rom_filename = "48.rom";
 
-    for (size_t bank = 0; bank < final_bank_count; ++bank) {
-        if (!bank_loaded[bank]) {
-            bank_matches_basic[bank] = 0u;
-            bank_matches_menu[bank] = 0u;
-            continue;
-        }
-        bank_matches_basic[bank] = spectrum_rom_bank_seems_48k_basic(rom_pages[bank]) ? 1u : 0u;
-        bank_matches_menu[bank] = spectrum_rom_bank_seems_128k_menu(rom_pages[bank]) ? 1u : 0u;
+static int spectrum_rom_contains_ascii(const uint8_t *rom, size_t size, const char *needle) {
+    if (!rom || !needle) {
+        return 0;
     }
 
-    printf("Final ROM bank layout (%zu active bank%s, ROM page count %u):\n",
-           final_bank_count,
-           final_bank_count == 1u ? "" : "s",
-           (unsigned int)rom_page_count);
-    for (size_t bank = 0; bank < final_bank_count; ++bank) {
-        const char *source;
-        char source_detail[64];
-        if (bank_loaded_from_primary[bank]) {
-            source = "primary image";
-            source_detail[0] = '\0';
-        } else if (bank_loaded_from_companion[bank]) {
-            source = "companion image";
-            source_detail[0] = '\0';
-        } else if (bank_mirrored_from[bank] != 0xFFu && bank_mirrored_from[bank] != bank) {
-            source = "mirrored";
-            snprintf(source_detail,
-                     sizeof(source_detail),
-                     " (from bank %u)",
-                     (unsigned int)bank_mirrored_from[bank]);
-        } else if (bank_mirrored_from[bank] == bank) {
-            source = "initialised";
-            source_detail[0] = '\0';
-        } else {
-            source = "uninitialised";
-            source_detail[0] = '\0';
-        }
+    size_t needle_len = strlen(needle);
+    if (needle_len == 0u || needle_len > size) {
+        return 0;
+    }
 
-        const char *classification = "no signature";
-        if (bank_matches_menu[bank] || spectrum_rom_bank_seems_128k_menu(rom_pages[bank])) {
-            classification = "128K menu signature";
-        } else if (bank_matches_basic[bank] || spectrum_rom_bank_seems_48k_basic(rom_pages[bank])) {
-            classification = "48K BASIC signature";
+    for (size_t i = 0; i + needle_len <= size; ++i) {
+        size_t j = 0u;
+        while (j < needle_len && rom[i + j] == (uint8_t)needle[j]) {
+            ++j;
+        }
+        if (j == needle_len) {
+            return 1;
         }
-
-        printf("  bank %zu: %s%s%s\n",
-               bank,
-               source,
-               source_detail,
-               bank_loaded_from_hint[bank] ? " [hinted]" : "");
-        printf("    signature: %s\n", classification);
     }
 
-    return 1;
+    return 0;
 }
 
-static char *build_executable_relative_path(const char *executable_path, const char *filename);
-// --- Z80 CPU State ---
-typedef struct Z80 {
-    // 8-bit Main Registers
-    uint8_t reg_A; uint8_t reg_F;
-    uint8_t reg_B; uint8_t reg_C;
-    uint8_t reg_D; uint8_t reg_E;
-    uint8_t reg_H; uint8_t reg_L;
-
-    // 8-bit Alternate Registers
-    uint8_t alt_reg_A; uint8_t alt_reg_F;
-    uint8_t alt_reg_B; uint8_t alt_reg_C;
-    uint8_t alt_reg_D; uint8_t alt_reg_E;
-    uint8_t alt_reg_H; uint8_t alt_reg_L;
-
-    // 8-bit Special Registers
-    uint8_t reg_I; // Interrupt Vector
-    uint8_t reg_R; // Memory Refresh
-
-    // 16-bit Index Registers
-    uint16_t reg_IX;
-    uint16_t reg_IY;
-
-    // 16-bit Special Registers
-    uint16_t reg_SP; // Stack Pointer
-    uint16_t reg_PC; // Program Counter
-
-    // Interrupt Flip-Flops
-    int iff1; // Main interrupt enable flag
-    int iff2; // Temp storage for iff1 (used by NMI)
-    int interruptMode; // IM 0, 1, or 2
-    int ei_delay; // Flag to handle EI's delayed effect
-    int halted; // Flag for HALT instruction
-
-} Z80;
-
-
-// --- ROM Utilities ---
-static char *build_executable_relative_path(const char *executable_path, const char *filename) {
-    if (!executable_path || !filename) {
-        return NULL;
+static int spectrum_rom_contains_ascii_case_insensitive(const uint8_t *rom,
+                                                        size_t size,
+                                                        const char *needle) {
+    if (!rom || !needle) {
+        return 0;
     }
 
-    const char *last_sep = strrchr(executable_path, '/');
-#ifdef _WIN32
-    const char *last_backslash = strrchr(executable_path, '\\');
-    if (!last_sep || (last_backslash && last_backslash > last_sep)) {
-        last_sep = last_backslash;
-    }
-#endif
-    if (!last_sep) {
-        return NULL;
+    size_t needle_len = strlen(needle);
+    if (needle_len == 0u || needle_len > size) {
+        return 0;
     }
 
-    size_t dir_len = (size_t)(last_sep - executable_path + 1);
-    size_t name_len = strlen(filename);
-    char *joined = (char *)malloc(dir_len + name_len + 1);
-    if (!joined) {
-        return NULL;
+    for (size_t i = 0; i + needle_len <= size; ++i) {
+        size_t j = 0u;
+        while (j < needle_len) {
+            unsigned char rom_byte = rom[i + j];
+            unsigned char needle_byte = (unsigned char)needle[j];
+            if (tolower(rom_byte) != tolower(needle_byte)) {
+                break;
+            }
+            ++j;
+        }
+        if (j == needle_len) {
+            return 1;
+        }
     }
-    memcpy(joined, executable_path, dir_len);
-    memcpy(joined + dir_len, filename, name_len + 1);
-    return joined;
-}
-
-
-// --- Memory Access Helpers ---
-static const uint8_t spectrum_contended_bank_masks[] = {
-    [CONTENTION_PROFILE_48K] = (uint8_t)(1u << 5),
-    [CONTENTION_PROFILE_128K] = (uint8_t)((1u << 1) | (1u << 3) | (1u << 5) | (1u << 7)),
-    [CONTENTION_PROFILE_128K_PLUS2A] = (uint8_t)((1u << 4) | (1u << 5) | (1u << 6) | (1u << 7)),
-    [CONTENTION_PROFILE_128K_PLUS3] = (uint8_t)((1u << 4) | (1u << 5) | (1u << 6) | (1u << 7))
-};
-
-static const int spectrum_contention_penalties[][8] = {
-    [CONTENTION_PROFILE_48K]         = {6, 5, 4, 3, 2, 1, 0, 0},
-    [CONTENTION_PROFILE_128K]        = {6, 5, 4, 3, 2, 1, 0, 0},
-    [CONTENTION_PROFILE_128K_PLUS2A] = {0, 6, 5, 4, 3, 2, 1, 0},
-    [CONTENTION_PROFILE_128K_PLUS3]  = {0, 6, 5, 4, 3, 2, 1, 0}
-};
-
-static inline void spectrum_reset_floating_bus(void) {
-    floating_bus_last_value = 0xFFu;
-}
 
-static inline uint64_t spectrum_current_access_tstate(void) {
-    if (ula_instruction_progress_ptr) {
-        return ula_instruction_base_tstate + (uint64_t)(*ula_instruction_progress_ptr);
-    }
-    return total_t_states;
+    return 0;
 }
 
-static inline int spectrum_is_ram_bank_contended(uint8_t bank) {
-    if (bank >= 8u) {
+static int spectrum_rom_bank_seems_48k_basic(const uint8_t *rom) {
+    if (!rom) {
         return 0;
     }
-    uint8_t mask = spectrum_contended_bank_masks[spectrum_contention_profile];
-    return (mask & (uint8_t)(1u << bank)) != 0u;
-}
-
-static void spectrum_map_page(int segment, SpectrumMemoryPageType type, uint8_t index) {
-    if (segment < 0 || segment >= 4) {
-        return;
-    }
 
-    SpectrumMemoryPage *slot = &spectrum_pages[segment];
-    uint16_t base = (uint16_t)(segment * 0x4000u);
-    if (slot->type == type && slot->index == index && slot->type != MEMORY_PAGE_NONE) {
-        return;
-    }
-
-    if (slot->type == MEMORY_PAGE_RAM && slot->index < 8u) {
-        memcpy(ram_pages[slot->index], memory + base, 0x4000);
-    }
-
-    if (type == MEMORY_PAGE_ROM) {
-        uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
-        uint8_t rom_index = (uint8_t)(index % rom_limit);
-        memcpy(memory + base, rom_pages[rom_index], 0x4000);
-        slot->type = MEMORY_PAGE_ROM;
-        slot->index = rom_index;
-    } else if (type == MEMORY_PAGE_RAM) {
-        uint8_t ram_index = (uint8_t)(index % 8u);
-        memcpy(memory + base, ram_pages[ram_index], 0x4000);
-        slot->type = MEMORY_PAGE_RAM;
-        slot->index = ram_index;
-    } else {
-        memset(memory + base, 0, 0x4000);
-        slot->type = MEMORY_PAGE_NONE;
-        slot->index = 0u;
-    }
+    int has_1982 = spectrum_rom_contains_ascii(rom, 0x4000u, "1982");
+    int has_sinclair_research = spectrum_rom_contains_ascii_case_insensitive(rom, 0x4000u, "Sinclair Research");
+    return has_1982 && has_sinclair_research;
 }
 
-static void spectrum_refresh_visible_ram(void) {
-    for (int segment = 0; segment < 4; ++segment) {
-        SpectrumMemoryPage* slot = &spectrum_pages[segment];
-        if (slot->type == MEMORY_PAGE_RAM && slot->index < 8u) {
-            uint16_t base = (uint16_t)(segment * 0x4000u);
-            memcpy(memory + base, ram_pages[slot->index], 0x4000u);
-        }
+static int spectrum_rom_bank_seems_128k_menu(const uint8_t *rom) {
+    if (!rom) {
+        return 0;
     }
-}
 
-static void spectrum_update_contention_flags(void) {
-    for (int segment = 0; segment < 4; ++segment) {
-        uint8_t contended = 0u;
-        if (spectrum_pages[segment].type == MEMORY_PAGE_RAM) {
-            contended = (uint8_t)spectrum_is_ram_bank_contended(spectrum_pages[segment].index);
+    static const char *menu_markers[] = {"128K", "1986", "1985", "AMSTRAD", "MENU"};
+    size_t marker_count = sizeof(menu_markers) / sizeof(menu_markers[0]);
+    int marker_hit = 0;
+    for (size_t i = 0; i < marker_count; ++i) {
+        if (spectrum_rom_contains_ascii_case_insensitive(rom, 0x4000u, menu_markers[i])) {
+            marker_hit = 1;
+            break;
         }
-        page_contended[segment] = contended;
     }
-}
 
-static void spectrum_set_contention_profile(SpectrumContentionProfile profile) {
-    spectrum_contention_profile = profile;
-    spectrum_update_contention_flags();
-}
+    if (!marker_hit) {
+        return 0;
+    }
 
-static void spectrum_set_peripheral_contention_profile(PeripheralContentionProfile profile) {
-    peripheral_contention_profile = profile;
+    int has_128_text = spectrum_rom_contains_ascii(rom, 0x4000u, "128");
+    return has_128_text;
 }
 
-static inline void apply_port_contention(uint64_t access_t_state) {
-    if (!ula_instruction_progress_ptr) {
+static void spectrum_swap_rom_banks(size_t a,
+                                    size_t b,
+                                    uint8_t bank_loaded[4],
+                                    uint8_t bank_loaded_from_primary[4],
+                                    uint8_t bank_loaded_from_companion[4],
+                                    uint8_t bank_loaded_from_hint[4],
+                                    uint8_t bank_mirrored_from[4],
+                                    uint8_t bank_matches_basic[4],
+                                    uint8_t bank_matches_menu[4]) {
+    if (a >= 4u || b >= 4u || a == b) {
         return;
     }
 
-    int penalty = 0;
-    switch (peripheral_contention_profile) {
-        case PERIPHERAL_CONTENTION_NONE:
-            return;
-        case PERIPHERAL_CONTENTION_IF1:
-            penalty = ula_contention_penalty(access_t_state);
-            break;
-        case PERIPHERAL_CONTENTION_PLUS3:
-            penalty = ula_contention_penalty(access_t_state) + 3;
-            break;
-    }
+    uint8_t temp_bank[0x4000u];
+    memcpy(temp_bank, rom_pages[a], sizeof(temp_bank));
+    memcpy(rom_pages[a], rom_pages[b], sizeof(temp_bank));
+    memcpy(rom_pages[b], temp_bank, sizeof(temp_bank));
 
-    if (penalty > 0) {
-        *ula_instruction_progress_ptr += penalty;
+    if (bank_loaded) {
+        uint8_t tmp_flag = bank_loaded[a];
+        bank_loaded[a] = bank_loaded[b];
+        bank_loaded[b] = tmp_flag;
+    }
+    if (bank_loaded_from_primary) {
+        uint8_t tmp_flag = bank_loaded_from_primary[a];
+        bank_loaded_from_primary[a] = bank_loaded_from_primary[b];
+        bank_loaded_from_primary[b] = tmp_flag;
+    }
+    if (bank_loaded_from_companion) {
+        uint8_t tmp_flag = bank_loaded_from_companion[a];
+        bank_loaded_from_companion[a] = bank_loaded_from_companion[b];
+        bank_loaded_from_companion[b] = tmp_flag;
+    }
+    if (bank_loaded_from_hint) {
+        uint8_t tmp_flag = bank_loaded_from_hint[a];
+        bank_loaded_from_hint[a] = bank_loaded_from_hint[b];
+        bank_loaded_from_hint[b] = tmp_flag;
+    }
+    if (bank_mirrored_from) {
+        uint8_t tmp_origin = bank_mirrored_from[a];
+        bank_mirrored_from[a] = bank_mirrored_from[b];
+        bank_mirrored_from[b] = tmp_origin;
+        for (size_t i = 0; i < 4u; ++i) {
+            if (i == a || i == b) {
+                continue;
+            }
+            if (bank_mirrored_from[i] == (uint8_t)a) {
+                bank_mirrored_from[i] = (uint8_t)b;
+            } else if (bank_mirrored_from[i] == (uint8_t)b) {
+                bank_mirrored_from[i] = (uint8_t)a;
+            }
+        }
+    }
+    if (bank_matches_basic) {
+        uint8_t tmp_flag = bank_matches_basic[a];
+        bank_matches_basic[a] = bank_matches_basic[b];
+        bank_matches_basic[b] = tmp_flag;
+    }
+    if (bank_matches_menu) {
+        uint8_t tmp_flag = bank_matches_menu[a];
+        bank_matches_menu[a] = bank_matches_menu[b];
+        bank_matches_menu[b] = tmp_flag;
     }
 }
 
-static inline uint16_t spectrum_screen_pixel_offset(uint32_t y, uint32_t x_char) {
-    return (uint16_t)(((y & 0xC0u) << 5) | ((y & 0x07u) << 8) | ((y & 0x38u) << 2) | x_char);
-}
-
-static inline uint16_t spectrum_screen_attr_offset(uint32_t y, uint32_t x_char) {
-    return (uint16_t)(((y >> 3) * 32u) + x_char);
-}
-
-static uint8_t spectrum_sample_floating_bus(uint64_t access_t_state) {
-    uint32_t phase = (uint32_t)(access_t_state % T_STATES_PER_FRAME);
-    if (phase < 14336u || phase >= 57344u) {
-        return floating_bus_last_value;
+static size_t spectrum_expected_rom_banks(SpectrumModel model) {
+    switch (model) {
+        case SPECTRUM_MODEL_128K:
+            return 2u;
+        case SPECTRUM_MODEL_PLUS2A:
+        case SPECTRUM_MODEL_PLUS3:
+            return 4u;
+        case SPECTRUM_MODEL_48K:
+        default:
+            return 1u;
     }
+}
 
-    uint32_t display_phase = phase - 14336u;
-    uint32_t line = display_phase / 224u;
-    uint32_t line_phase = display_phase % 224u;
-
-    if (line_phase < 48u || line_phase >= 176u) {
-        return floating_bus_last_value;
+static int spectrum_load_rom_bank_file(const char *path, uint8_t *dest) {
+    if (!path || !dest) {
+        return 0;
     }
 
-    uint32_t column_phase = line_phase - 48u;
-    uint32_t sub_phase = column_phase & 3u;
-    uint32_t x_char = column_phase >> 2;
-    if (x_char >= 32u) {
-        return floating_bus_last_value;
+    FILE *bank_file = fopen(path, "rb");
+    if (!bank_file) {
+        return 0;
     }
 
-    if (current_screen_bank >= 8u) {
-        return floating_bus_last_value;
-    }
+    memset(dest, 0, 0x4000);
+    size_t read = fread(dest, 1, 0x4000, bank_file);
+    fclose(bank_file);
 
-    const uint8_t* vram_bank;
-    const uint8_t* attr_bank;
-    if (spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == current_screen_bank) {
-        vram_bank = memory + VRAM_START;
-        attr_bank = memory + ATTR_START;
-    } else {
-        const uint8_t* bank = ram_pages[current_screen_bank];
-        vram_bank = bank;
-        attr_bank = bank + (ATTR_START - VRAM_START);
+    if (read < 0x4000) {
+        fprintf(stderr,
+                "ROM bank '%s' is %zu bytes; expected at least 16384 bytes\n",
+                path,
+                read);
+        if (read == 0) {
+            return 0;
+        }
     }
 
-    uint8_t value;
-    if ((sub_phase & 2u) == 0u) {
-        uint16_t offset = spectrum_screen_pixel_offset(line, x_char);
-        value = vram_bank[offset];
-    } else {
-        uint16_t offset = spectrum_screen_attr_offset(line, x_char);
-        value = attr_bank[offset];
+    if (read > 0x4000) {
+        fprintf(stderr,
+                "ROM bank '%s' is larger than 16384 bytes; extra data will be ignored\n",
+                path);
     }
 
-    floating_bus_last_value = value;
-    return value;
+    return 1;
 }
 
-static inline int ula_contention_penalty(uint64_t t_state) {
-    uint32_t phase = (uint32_t)(t_state % T_STATES_PER_FRAME);
-    if (phase < 14336u || phase >= 57344u) {
+static int spectrum_populate_rom_pages(const char *rom_primary_path,
+                                       const uint8_t *rom_buffer,
+                                       size_t rom_size) {
+    if (!rom_buffer || rom_size < 0x4000) {
         return 0;
     }
-    const int* penalties = spectrum_contention_penalties[spectrum_contention_profile];
-    return penalties[phase & 7u];
-}
 
-static void spectrum_apply_memory_configuration(void) {
-    if (spectrum_model == SPECTRUM_MODEL_48K) {
-        current_rom_page = 0u;
-        current_screen_bank = 5u;
-        current_paged_bank = 7u;
-        spectrum_map_page(0, MEMORY_PAGE_ROM, 0u);
-        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
-        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
-        spectrum_map_page(3, MEMORY_PAGE_RAM, 7u);
-        spectrum_update_contention_flags();
-        return;
+    size_t expected_banks = spectrum_expected_rom_banks(spectrum_model);
+    if (expected_banks == 0u) {
+        expected_banks = 1u;
     }
-
-    int plus_model = (spectrum_model == SPECTRUM_MODEL_PLUS2A) || (spectrum_model == SPECTRUM_MODEL_PLUS3);
-    if (!plus_model) {
-        uint8_t desired_rom = (uint8_t)((gate_array_7ffd_state >> 4) & 0x01u);
-        uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
-        current_rom_page = (uint8_t)(desired_rom % rom_limit);
-        current_screen_bank = (gate_array_7ffd_state & 0x08u) ? 7u : 5u;
-        spectrum_map_page(0, MEMORY_PAGE_ROM, current_rom_page);
-        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
-        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
-        spectrum_map_page(3, MEMORY_PAGE_RAM, current_paged_bank);
-        spectrum_update_contention_flags();
-        return;
+    if (expected_banks > 4u) {
+        expected_banks = 4u;
     }
 
-    uint8_t rom_low = (uint8_t)((gate_array_7ffd_state >> 4) & 0x01u);
-    uint8_t rom_high = (uint8_t)(gate_array_1ffd_state & 0x01u);
-    uint8_t desired_rom = (uint8_t)(((rom_high & 0x01u) << 1) | rom_low);
-    uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
-    current_rom_page = (uint8_t)(desired_rom % rom_limit);
+    const char *rom_label = rom_primary_path ? rom_primary_path : "<buffer>";
+    printf("Preparing ROM layout for model %d using '%s' (%zu expected bank%s)\n",
+           (int)spectrum_model,
+           rom_label,
+           expected_banks,
+           expected_banks == 1u ? "" : "s");
 
-    int special_paging = (gate_array_1ffd_state & 0x04u) != 0;
-    int all_ram = !special_paging && ((gate_array_1ffd_state & 0x02u) != 0);
+    char rom_stem[PATH_MAX];
+    char rom_extension[PATH_MAX];
+    rom_stem[0] = '\0';
+    rom_extension[0] = '\0';
 
-    if (special_paging) {
-        static const uint8_t special_maps[4][4] = {
-            {0u, 1u, 2u, 3u},
-            {4u, 5u, 6u, 7u},
-            {4u, 5u, 6u, 3u},
-            {4u, 7u, 6u, 3u}
-        };
-        uint8_t config = (uint8_t)(gate_array_1ffd_state & 0x03u);
-        const uint8_t* map = special_maps[config];
-        spectrum_map_page(0, MEMORY_PAGE_RAM, map[0]);
-        spectrum_map_page(1, MEMORY_PAGE_RAM, map[1]);
-        spectrum_map_page(2, MEMORY_PAGE_RAM, map[2]);
-        spectrum_map_page(3, MEMORY_PAGE_RAM, map[3]);
-        if (spectrum_pages[1].type == MEMORY_PAGE_RAM) {
-            current_screen_bank = spectrum_pages[1].index;
-        } else {
-            current_screen_bank = 5u;
+    if (rom_primary_path) {
+        size_t path_len = strlen(rom_primary_path);
+        if (path_len >= PATH_MAX) {
+            path_len = PATH_MAX - 1u;
         }
-    } else {
-        if (all_ram) {
-            spectrum_map_page(0, MEMORY_PAGE_RAM, 0u);
-        } else {
-            spectrum_map_page(0, MEMORY_PAGE_ROM, current_rom_page);
+
+        const char *last_slash = strrchr(rom_primary_path, '/');
+        const char *last_backslash = strrchr(rom_primary_path, '\\');
+        if (!last_slash || (last_backslash && last_backslash > last_slash)) {
+            last_slash = last_backslash;
         }
-        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
-        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
-        spectrum_map_page(3, MEMORY_PAGE_RAM, current_paged_bank);
-        current_screen_bank = (gate_array_7ffd_state & 0x08u) ? 7u : 5u;
-    }
 
-    spectrum_update_contention_flags();
-}
+        const char *extension = strrchr(rom_primary_path, '.');
+        if (extension && last_slash && extension < last_slash) {
+            extension = NULL;
+        }
 
-static uint32_t spectrum_hash_buffer(const uint8_t* data, size_t length) {
-    const uint32_t fnv_offset = 2166136261u;
-    const uint32_t fnv_prime = 16777619u;
-    uint32_t hash = fnv_offset;
+        size_t stem_len = extension ? (size_t)(extension - rom_primary_path) : path_len;
+        if (stem_len >= PATH_MAX) {
+            stem_len = PATH_MAX - 1u;
+        }
+        memcpy(rom_stem, rom_primary_path, stem_len);
+        rom_stem[stem_len] = '\0';
 
-    if (!data) {
-        return hash;
+        if (extension) {
+            size_t ext_len = strlen(extension);
+            if (ext_len >= PATH_MAX) {
+                ext_len = PATH_MAX - 1u;
+            }
+            memcpy(rom_extension, extension, ext_len);
+            rom_extension[ext_len] = '\0';
+        }
     }
 
-    for (size_t i = 0; i < length; ++i) {
-        hash ^= data[i];
-        hash *= fnv_prime;
+    size_t stem_length = strlen(rom_stem);
+    int bank_hint = -1;
+    char separator_hint = '-';
+    if (stem_length >= 2u) {
+        char sep_candidate = rom_stem[stem_length - 2u];
+        char digit_candidate = rom_stem[stem_length - 1u];
+        if ((sep_candidate == '-' || sep_candidate == '_') && isdigit((unsigned char)digit_candidate)) {
+            int digit_value = digit_candidate - '0';
+            if (digit_value >= 0 && digit_value <= 9) {
+                bank_hint = digit_value;
+                separator_hint = sep_candidate;
+                stem_length -= 2u;
+                rom_stem[stem_length] = '\0';
+            }
+        }
     }
 
-    return hash;
-}
-
-static void spectrum_log_ram_hashes(const char* reason) {
-    if (!ram_hash_logging) {
-        return;
+    if (bank_hint < 0 || bank_hint > 3) {
+        bank_hint = -1;
     }
 
-    const char* tag = reason ? reason : "ram";
-    fprintf(stderr,
-            "[RAM ] %s hashes 7FFD=%02X 1FFD=%02X disabled=%d screen=%u",
-            tag,
-            (unsigned)gate_array_7ffd_state,
-            (unsigned)gate_array_1ffd_state,
-            paging_disabled,
-            (unsigned)current_screen_bank);
-
-    for (int bank = 0; bank < 8; ++bank) {
-        uint32_t hash = spectrum_hash_buffer(ram_pages[bank], 0x4000u);
-        fprintf(stderr, " bank%u=%08X", bank, hash);
+    if (bank_hint >= 0) {
+        printf("Primary ROM filename supplies numeric bank hint %d (separator '%c')\n",
+               bank_hint,
+               separator_hint);
+    } else {
+        printf("Primary ROM filename did not contain a numeric bank hint\n");
     }
 
-    fputc('\n', stderr);
-}
-
-static void spectrum_configure_model(SpectrumModel model) {
-    spectrum_model = model;
-    paging_disabled = 0;
-    gate_array_7ffd_state = 0u;
-    gate_array_1ffd_state = 0u;
-    ay_selected_register = 0u;
-    ay_register_latched = 0;
-    memset(ay_registers, 0, sizeof(ay_registers));
-    ay_reset_state();
-    current_screen_bank = 5u;
-    current_rom_page = 0u;
-    current_paged_bank = (model == SPECTRUM_MODEL_48K) ? 7u : 0u;
-    for (int i = 0; i < 4; ++i) {
-        spectrum_pages[i].type = MEMORY_PAGE_NONE;
-        spectrum_pages[i].index = 0u;
-    }
-    if (model == SPECTRUM_MODEL_48K) {
-        spectrum_contention_profile = CONTENTION_PROFILE_48K;
-    } else if (model == SPECTRUM_MODEL_128K) {
-        spectrum_contention_profile = CONTENTION_PROFILE_128K;
-    } else if (model == SPECTRUM_MODEL_PLUS2A) {
-        spectrum_contention_profile = CONTENTION_PROFILE_128K_PLUS2A;
-    } else {
-        spectrum_contention_profile = CONTENTION_PROFILE_128K_PLUS3;
+    memset(rom_pages, 0, sizeof(rom_pages));
+    uint8_t bank_loaded[4] = {0, 0, 0, 0};
+    uint8_t bank_loaded_from_hint[4] = {0, 0, 0, 0};
+    uint8_t bank_loaded_from_primary[4] = {0, 0, 0, 0};
+    uint8_t bank_loaded_from_companion[4] = {0, 0, 0, 0};
+    uint8_t bank_mirrored_from[4];
+    uint8_t bank_matches_basic[4] = {0, 0, 0, 0};
+    uint8_t bank_matches_menu[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < 4u; ++i) {
+        bank_mirrored_from[i] = 0xFFu;
     }
 
-    if (model == SPECTRUM_MODEL_PLUS3) {
-        peripheral_contention_profile = PERIPHERAL_CONTENTION_PLUS3;
+    size_t dest_order[4];
+    size_t dest_count = 0u;
+    if (bank_hint >= 0) {
+        dest_order[dest_count++] = (size_t)bank_hint;
+        for (size_t bank = 0; bank < 4u; ++bank) {
+            if ((int)bank == bank_hint) {
+                continue;
+            }
+            dest_order[dest_count++] = bank;
+        }
     } else {
-        peripheral_contention_profile = PERIPHERAL_CONTENTION_NONE;
+        for (size_t bank = 0; bank < 4u; ++bank) {
+            dest_order[dest_count++] = bank;
+        }
     }
-    spectrum_reset_floating_bus();
-    spectrum_apply_memory_configuration();
-    spectrum_log_paging_state("model configure", 0u, 0u, total_t_states);
-}
 
-static inline void apply_memory_contention(uint16_t addr) {
-    if (!ula_instruction_progress_ptr) {
-        return;
-    }
-    uint16_t page = (uint16_t)(addr >> 14);
-    if (page > 3u) {
-        return;
+    size_t buffer_offset = 0u;
+    size_t chunk_index = 0u;
+    while (buffer_offset + 0x4000u <= rom_size && chunk_index < dest_count) {
+        size_t dest_index = dest_order[chunk_index];
+        memcpy(rom_pages[dest_index], rom_buffer + buffer_offset, 0x4000u);
+        bank_loaded[dest_index] = 1u;
+        bank_loaded_from_primary[dest_index] = 1u;
+        bank_mirrored_from[dest_index] = (uint8_t)dest_index;
+        if (chunk_index == 0u && bank_hint >= 0 && dest_index == (size_t)bank_hint) {
+            bank_loaded_from_hint[dest_index] = 1u;
+        }
+        printf("Primary ROM chunk %zu copied into bank %zu (0x%04zX bytes)%s\n",
+               chunk_index,
+               dest_index,
+               (size_t)0x4000u,
+               (bank_hint >= 0 && dest_index == (size_t)bank_hint) ? " [hinted]" : "");
+        buffer_offset += 0x4000u;
+        ++chunk_index;
     }
-    if (!page_contended[page]) {
-        return;
+
+    if (buffer_offset < rom_size && chunk_index < dest_count) {
+        size_t remaining = rom_size - buffer_offset;
+        if (remaining > 0x4000u) {
+            remaining = 0x4000u;
+        }
+        size_t dest_index = dest_order[chunk_index];
+        memcpy(rom_pages[dest_index], rom_buffer + buffer_offset, remaining);
+        if (remaining < 0x4000u) {
+            memset(rom_pages[dest_index] + remaining, 0, 0x4000u - remaining);
+        }
+        bank_loaded[dest_index] = 1u;
+        bank_loaded_from_primary[dest_index] = 1u;
+        bank_mirrored_from[dest_index] = (uint8_t)dest_index;
+        if (chunk_index == 0u && bank_hint >= 0 && dest_index == (size_t)bank_hint) {
+            bank_loaded_from_hint[dest_index] = 1u;
+        }
+        printf("Primary ROM tail chunk copied into bank %zu (%zu bytes)%s\n",
+               dest_index,
+               remaining,
+               (bank_hint >= 0 && dest_index == (size_t)bank_hint) ? " [hinted]" : "");
     }
-    uint64_t access_t_state = spectrum_current_access_tstate();
-    int penalty = ula_contention_penalty(access_t_state);
-    if (penalty > 0) {
-        *ula_instruction_progress_ptr += penalty;
+
+    size_t current_loaded = 0u;
+    for (size_t i = 0; i < 4u; ++i) {
+        if (bank_loaded[i]) {
+            ++current_loaded;
+        }
     }
-}
 
-static inline void spectrum_write_ram_shadow(uint16_t addr, uint8_t val) {
-    uint16_t page = (uint16_t)(addr >> 14);
-    if (page >= 4u) {
-        return;
+    char separator_candidates[3];
+    size_t separator_count = 0u;
+    separator_candidates[separator_count++] = separator_hint;
+    if (separator_hint != '-') {
+        separator_candidates[separator_count++] = '-';
     }
-    SpectrumMemoryPage *slot = &spectrum_pages[page];
-    if (slot->type != MEMORY_PAGE_RAM || slot->index >= 8u) {
-        return;
+    if (separator_hint != '_' && separator_count < 3u) {
+        separator_candidates[separator_count++] = '_';
     }
-    uint16_t base = (uint16_t)(page * 0x4000u);
-    ram_pages[slot->index][addr - base] = val;
-}
 
-static void spectrum_map_rom_page(uint8_t page) {
-    uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
-    uint8_t desired = (uint8_t)(page % rom_limit);
-    if (spectrum_model == SPECTRUM_MODEL_PLUS2A || spectrum_model == SPECTRUM_MODEL_PLUS3) {
-        gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x10u) | ((desired & 0x01u) << 4));
-        gate_array_1ffd_state = (uint8_t)((gate_array_1ffd_state & (uint8_t)~0x01u) | ((desired >> 1) & 0x01u));
+    if (rom_stem[0] == '\0' && rom_primary_path) {
+        size_t path_len = strlen(rom_primary_path);
+        if (path_len >= PATH_MAX) {
+            path_len = PATH_MAX - 1u;
+        }
+        memcpy(rom_stem, rom_primary_path, path_len);
+        rom_stem[path_len] = '\0';
+        stem_length = strlen(rom_stem);
     } else {
-        gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x10u) | ((desired & 0x01u) << 4));
+        stem_length = strlen(rom_stem);
     }
-    current_rom_page = desired;
-    spectrum_pages[0].type = MEMORY_PAGE_NONE;
-    spectrum_pages[0].index = 0u;
-    spectrum_apply_memory_configuration();
-}
 
-static void spectrum_map_upper_bank(uint8_t new_bank) {
-    if (spectrum_model == SPECTRUM_MODEL_48K) {
-        return;
+    size_t banks_needed = expected_banks;
+    if (banks_needed == 0u) {
+        banks_needed = 1u;
     }
-    new_bank &= 0x07u;
-    if (new_bank == current_paged_bank) {
-        return;
+    if (banks_needed > 4u) {
+        banks_needed = 4u;
     }
-    current_paged_bank = new_bank;
-    gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x07u) | current_paged_bank);
-    spectrum_apply_memory_configuration();
-}
 
-uint8_t readByte(uint16_t addr) {
-    apply_memory_contention(addr);
-    return memory[addr];
-}
+    char companion_path[PATH_MAX];
+    if (current_loaded < banks_needed && rom_stem[0] != '\0') {
+        for (size_t sep_index = 0; sep_index < separator_count && current_loaded < banks_needed; ++sep_index) {
+            char separator = separator_candidates[sep_index];
+            if (separator == '\0') {
+                continue;
+            }
+            for (size_t bank = 0; bank < banks_needed && current_loaded < banks_needed; ++bank) {
+                if (bank_loaded[bank]) {
+                    continue;
+                }
+                int written = snprintf(companion_path,
+                                       sizeof(companion_path),
+                                       "%s%c%zu%s",
+                                       rom_stem,
+                                       separator,
+                                       bank,
+                                       rom_extension);
+                if (written <= 0 || (size_t)written >= sizeof(companion_path)) {
+                    continue;
+                }
+                if (spectrum_load_rom_bank_file(companion_path, rom_pages[bank])) {
+                    bank_loaded[bank] = 1u;
+                    bank_loaded_from_hint[bank] = 1u;
+                    bank_loaded_from_companion[bank] = 1u;
+                    bank_mirrored_from[bank] = (uint8_t)bank;
+                    ++current_loaded;
+                    printf("Loaded ROM bank %zu from %s\n", bank, companion_path);
+                }
+            }
+        }
+    }
 
-void writeByte(uint16_t addr, uint8_t val) {
-    apply_memory_contention(addr);
-    if (addr < 0x4000u) {
-        return;
+    size_t inspect_limit = banks_needed;
+    if (inspect_limit > 4u) {
+        inspect_limit = 4u;
     }
-    memory[addr] = val;
-    spectrum_write_ram_shadow(addr, val);
-}
 
-uint16_t readWord(uint16_t addr) {
-    uint8_t lo = readByte(addr);
-    uint8_t hi = readByte((uint16_t)(addr + 1u));
-    return (uint16_t)((hi << 8) | lo);
-}
+    int hints_cover_all = 1;
+    for (size_t bank = 0; bank < inspect_limit; ++bank) {
+        if (!bank_loaded[bank] || !bank_loaded_from_hint[bank]) {
+            hints_cover_all = 0;
+            break;
+        }
+    }
 
-void writeWord(uint16_t addr, uint16_t val) {
-    uint8_t lo = (uint8_t)(val & 0xFFu);
-    uint8_t hi = (uint8_t)((val >> 8) & 0xFFu);
-    writeByte(addr, lo);
-    writeByte((uint16_t)(addr + 1u), hi);
-}
+    int enforce_pair_order = (expected_banks <= 2u);
+    if (hints_cover_all) {
+        if (enforce_pair_order && inspect_limit >= 2u) {
+            printf("All required ROM banks arrived with numeric hints; verifying canonical order\n");
+        } else {
+            printf("All required ROM banks arrived with numeric hints; skipping heuristic reordering\n");
+        }
+    }
 
-static void beeper_reset_audio_state(uint64_t current_t_state, int current_level) {
-    beeper_event_head = 0;
-    beeper_event_tail = 0;
-    beeper_last_event_t_state = current_t_state;
-    beeper_playback_position = (double)current_t_state;
-    beeper_writer_cursor = (double)current_t_state;
-    beeper_playback_level = current_level;
-    double baseline = (double)current_level * (double)AUDIO_AMPLITUDE;
-    beeper_hp_last_input = baseline;
-    beeper_hp_last_output = 0.0;
-    beeper_idle_log_active = 0;
-}
+    if (inspect_limit >= 2u && enforce_pair_order) {
+        if (!hints_cover_all) {
+            printf("ROM bank hints incomplete; analysing signatures to find menu and BASIC banks\n");
+        }
+        int menu_candidate = -1;
+        int basic_candidate = -1;
+        size_t non_basic_candidates[4];
+        size_t non_basic_count = 0u;
+        for (size_t bank = 0; bank < inspect_limit; ++bank) {
+            if (!bank_loaded[bank]) {
+                continue;
+            }
 
-static void beeper_force_resync(uint64_t sync_t_state) {
-    double baseline = (double)beeper_playback_level * (double)AUDIO_AMPLITUDE;
-    beeper_event_head = 0;
-    beeper_event_tail = 0;
-    beeper_playback_position = (double)sync_t_state;
-    beeper_writer_cursor = (double)sync_t_state;
-    beeper_last_event_t_state = sync_t_state;
-    beeper_hp_last_input = baseline;
-    beeper_hp_last_output = 0.0;
-    beeper_idle_log_active = 0;
-}
+            if (spectrum_rom_bank_seems_48k_basic(rom_pages[bank])) {
+                if (!bank_matches_basic[bank]) {
+                    printf("ROM bank %zu matches 48K BASIC signature\n", bank);
+                    bank_matches_basic[bank] = 1u;
+                }
+                if (basic_candidate < 0) {
+                    basic_candidate = (int)bank;
+                }
+                continue;
+            }
 
-static size_t beeper_pending_event_count(void) {
-    size_t head = beeper_event_head;
-    size_t tail = beeper_event_tail;
+            if (menu_candidate < 0 && spectrum_rom_bank_seems_128k_menu(rom_pages[bank])) {
+                if (!bank_matches_menu[bank]) {
+                    printf("ROM bank %zu matches 128K menu signature\n", bank);
+                    bank_matches_menu[bank] = 1u;
+                }
+                menu_candidate = (int)bank;
+            }
 
-    if (tail >= head) {
-        return tail - head;
-    }
+            if (non_basic_count < sizeof(non_basic_candidates) / sizeof(non_basic_candidates[0])) {
+                non_basic_candidates[non_basic_count++] = bank;
+            }
+        }
 
-    return (size_t)BEEPER_EVENT_CAPACITY - head + tail;
-}
+        if (!hints_cover_all && menu_candidate < 0 && basic_candidate >= 0 && non_basic_count > 0u) {
+            menu_candidate = (int)non_basic_candidates[0];
+            printf("Assuming ROM bank %d is the 128K menu (non-48K companion)\n", menu_candidate);
+        }
 
-static double beeper_latency_threshold(void) {
-    double threshold = beeper_latency_throttle_samples;
-    if (threshold < beeper_max_latency_samples) {
-        threshold = beeper_max_latency_samples;
-    }
-    return threshold;
-}
+        if (menu_candidate >= 0 && menu_candidate != 0) {
+            int original_menu = menu_candidate;
+            spectrum_swap_rom_banks(0u,
+                                     (size_t)menu_candidate,
+                                     bank_loaded,
+                                     bank_loaded_from_primary,
+                                     bank_loaded_from_companion,
+                                     bank_loaded_from_hint,
+                                     bank_mirrored_from,
+                                     bank_matches_basic,
+                                     bank_matches_menu);
+            const char *note = hints_cover_all ? " (overrode numeric hints)" : "";
+            printf("Reordered ROM bank %d into slot 0 for 128K menu%s\n", original_menu, note);
+            if (basic_candidate == 0) {
+                basic_candidate = original_menu;
+            } else if (basic_candidate == original_menu) {
+                basic_candidate = 0;
+            }
+            menu_candidate = 0;
+        }
 
-static uint32_t beeper_recommended_throttle_delay(double latency_samples) {
-    double threshold = beeper_latency_threshold();
-    if (latency_samples <= threshold || audio_sample_rate <= 0) {
-        return 0;
+        size_t desired_basic_slot = 1u;
+        if (basic_candidate >= 0 && inspect_limit > desired_basic_slot && (size_t)basic_candidate != desired_basic_slot) {
+            int original_basic = basic_candidate;
+            spectrum_swap_rom_banks(desired_basic_slot,
+                                     (size_t)basic_candidate,
+                                     bank_loaded,
+                                     bank_loaded_from_primary,
+                                     bank_loaded_from_companion,
+                                     bank_loaded_from_hint,
+                                     bank_mirrored_from,
+                                     bank_matches_basic,
+                                     bank_matches_menu);
+            const char *note = hints_cover_all ? " (overrode numeric hints)" : "";
+            printf("Reordered ROM bank %d into slot %zu for 48K BASIC%s\n",
+                   original_basic,
+                   desired_basic_slot,
+                   note);
+            if (menu_candidate == (int)desired_basic_slot) {
+                menu_candidate = original_basic;
+            } else if (menu_candidate == original_basic) {
+                menu_candidate = (int)desired_basic_slot;
+            }
+            basic_candidate = (int)desired_basic_slot;
+        }
     }
 
-    double over = latency_samples - threshold;
-    double limit = beeper_max_latency_samples;
-    if (limit <= 0.0) {
-        limit = 256.0;
+    int fallback_bank = -1;
+    for (size_t i = 0; i < 4u; ++i) {
+        if (bank_loaded[i]) {
+            fallback_bank = (int)i;
+            break;
+        }
     }
 
-    if (over <= limit * 0.1) {
+    if (fallback_bank < 0) {
+        fprintf(stderr, "Failed to populate any ROM bank from '%s'\n", rom_primary_path ? rom_primary_path : "<buffer>");
         return 0;
     }
 
-    if (over <= limit * 0.5) {
-        return 1;
+    if (current_loaded < banks_needed) {
+        fprintf(stderr,
+                "Warning: only %zu of %zu ROM banks were found for '%s'; mirroring bank %d\n",
+                current_loaded,
+                banks_needed,
+                rom_label,
+                fallback_bank);
+        for (size_t bank = 0; bank < banks_needed; ++bank) {
+            if (!bank_loaded[bank]) {
+                memcpy(rom_pages[bank], rom_pages[fallback_bank], 0x4000);
+                bank_loaded[bank] = 1u;
+                bank_mirrored_from[bank] = (uint8_t)fallback_bank;
+            }
+        }
+        current_loaded = banks_needed;
     }
 
-    double estimated_ms = ceil((over * 1000.0) / (double)audio_sample_rate);
-    if (estimated_ms < 2.0) {
-        estimated_ms = 2.0;
-    } else if (estimated_ms > 8.0) {
-        estimated_ms = 8.0;
+    size_t final_bank_count = banks_needed;
+    if (current_loaded > final_bank_count) {
+        final_bank_count = current_loaded;
+        if (final_bank_count > 4u) {
+            final_bank_count = 4u;
+        }
     }
 
-    return (uint32_t)estimated_ms;
-}
-
-static double beeper_current_latency_samples(void) {
-    if (!audio_available || beeper_cycles_per_sample <= 0.0) {
-        beeper_latency_warning_active = 0;
-        return 0.0;
+    if (final_bank_count == 0u) {
+        final_bank_count = 1u;
     }
 
-    double writer_cursor;
-    double playback_position;
+    for (size_t bank = final_bank_count; bank < 4u; ++bank) {
+        size_t mirror = bank % final_bank_count;
+        memcpy(rom_pages[bank], rom_pages[mirror], 0x4000);
+        bank_mirrored_from[bank] = (uint8_t)mirror;
+    }
 
-    audio_backend_lock();
-    writer_cursor = beeper_writer_cursor;
-    playback_position = beeper_playback_position;
-    audio_backend_unlock();
+    rom_page_count = (uint8_t)final_bank_count;
 
-    double latency_cycles = writer_cursor - playback_position;
-    if (latency_cycles <= 0.0) {
-        if (beeper_latency_warning_active) {
-            beeper_latency_warning_active = 0;
+    for (size_t bank = 0; bank < final_bank_count; ++bank) {
+        if (!bank_loaded[bank]) {
+            bank_matches_basic[bank] = 0u;
+            bank_matches_menu[bank] = 0u;
+            continue;
         }
-        return 0.0;
-    }
-
-    double latency_samples = latency_cycles / beeper_cycles_per_sample;
-    if (latency_samples < 0.0) {
-        latency_samples = 0.0;
+        bank_matches_basic[bank] = spectrum_rom_bank_seems_48k_basic(rom_pages[bank]) ? 1u : 0u;
+        bank_matches_menu[bank] = spectrum_rom_bank_seems_128k_menu(rom_pages[bank]) ? 1u : 0u;
     }
 
-    double throttle_threshold = beeper_latency_threshold();
-    if (latency_samples >= throttle_threshold) {
-        if (!beeper_latency_warning_active) {
-            BEEPER_LOG(
-                "[BEEPER] latency %.2f samples exceeds throttle %.2f (clamp %.2f); throttling CPU until audio catches up\n",
-                latency_samples,
-                throttle_threshold,
-                beeper_max_latency_samples);
-            beeper_latency_warning_active = 1;
-        }
-    } else {
-        double release_threshold = beeper_latency_release_samples;
-        if (release_threshold < beeper_max_latency_samples) {
-            release_threshold = beeper_max_latency_samples;
-        }
-        if (latency_samples < release_threshold && beeper_latency_warning_active) {
-            beeper_latency_warning_active = 0;
+    printf("Final ROM bank layout (%zu active bank%s, ROM page count %u):\n",
+           final_bank_count,
+           final_bank_count == 1u ? "" : "s",
+           (unsigned int)rom_page_count);
+    for (size_t bank = 0; bank < final_bank_count; ++bank) {
+        const char *source;
+        char source_detail[64];
+        if (bank_loaded_from_primary[bank]) {
+            source = "primary image";
+            source_detail[0] = '\0';
+        } else if (bank_loaded_from_companion[bank]) {
+            source = "companion image";
+            source_detail[0] = '\0';
+        } else if (bank_mirrored_from[bank] != 0xFFu && bank_mirrored_from[bank] != bank) {
+            source = "mirrored";
+            snprintf(source_detail,
+                     sizeof(source_detail),
+                     " (from bank %u)",
+                     (unsigned int)bank_mirrored_from[bank]);
+        } else if (bank_mirrored_from[bank] == bank) {
+            source = "initialised";
+            source_detail[0] = '\0';
+        } else {
+            source = "uninitialised";
+            source_detail[0] = '\0';
         }
-    }
 
-    return latency_samples;
-}
+        const char *classification = "no signature";
+        if (bank_matches_menu[bank] || spectrum_rom_bank_seems_128k_menu(rom_pages[bank])) {
+            classification = "128K menu signature";
+        } else if (bank_matches_basic[bank] || spectrum_rom_bank_seems_48k_basic(rom_pages[bank])) {
+            classification = "48K BASIC signature";
+        }
 
-static void beeper_set_latency_limit(double sample_limit) {
-    if (sample_limit < 64.0) {
-        sample_limit = 64.0;
+        printf("  bank %zu: %s%s%s\n",
+               bank,
+               source,
+               source_detail,
+               bank_loaded_from_hint[bank] ? " [hinted]" : "");
+        printf("    signature: %s\n", classification);
     }
-    beeper_max_latency_samples = sample_limit;
 
-    double headroom = sample_limit * 0.5;
-    if (headroom < 128.0) {
-        headroom = 128.0;
-    } else if (headroom > 2048.0) {
-        headroom = 2048.0;
-    }
+    return 1;
+}
 
-    beeper_latency_throttle_samples = beeper_max_latency_samples + headroom;
+static char *build_executable_relative_path(const char *executable_path, const char *filename);
+// --- Z80 CPU State ---
+typedef struct Z80 {
+    // 8-bit Main Registers
+    uint8_t reg_A; uint8_t reg_F;
+    uint8_t reg_B; uint8_t reg_C;
+    uint8_t reg_D; uint8_t reg_E;
+    uint8_t reg_H; uint8_t reg_L;
 
-    double release = beeper_latency_throttle_samples - headroom * 0.5;
-    if (release < beeper_max_latency_samples) {
-        release = beeper_max_latency_samples;
-    }
-    beeper_latency_release_samples = release;
+    // 8-bit Alternate Registers
+    uint8_t alt_reg_A; uint8_t alt_reg_F;
+    uint8_t alt_reg_B; uint8_t alt_reg_C;
+    uint8_t alt_reg_D; uint8_t alt_reg_E;
+    uint8_t alt_reg_H; uint8_t alt_reg_L;
 
-    double trim_margin = headroom;
-    if (trim_margin < beeper_max_latency_samples) {
-        trim_margin = beeper_max_latency_samples;
-    }
-    beeper_latency_trim_samples = beeper_latency_throttle_samples + trim_margin;
-}
+    // 8-bit Special Registers
+    uint8_t reg_I; // Interrupt Vector
+    uint8_t reg_R; // Memory Refresh
 
-static void audio_dump_write_uint16(uint8_t* dst, uint16_t value) {
-    dst[0] = (uint8_t)(value & 0xFFu);
-    dst[1] = (uint8_t)((value >> 8) & 0xFFu);
-}
+    // 16-bit Index Registers
+    uint16_t reg_IX;
+    uint16_t reg_IY;
 
-static void audio_dump_write_uint32(uint8_t* dst, uint32_t value) {
-    dst[0] = (uint8_t)(value & 0xFFu);
-    dst[1] = (uint8_t)((value >> 8) & 0xFFu);
-    dst[2] = (uint8_t)((value >> 16) & 0xFFu);
-    dst[3] = (uint8_t)((value >> 24) & 0xFFu);
-}
+    // 16-bit Special Registers
+    uint16_t reg_SP; // Stack Pointer
+    uint16_t reg_PC; // Program Counter
 
-static int audio_dump_start(const char* path, uint32_t sample_rate, uint16_t channels) {
-    if (!path || channels == 0u) {
-        return 0;
+    // Interrupt Flip-Flops
+    int iff1; // Main interrupt enable flag
+    int iff2; // Temp storage for iff1 (used by NMI)
+    int interruptMode; // IM 0, 1, or 2
+    int ei_delay; // Flag to handle EI's delayed effect
+    int halted; // Flag for HALT instruction
+
+} Z80;
+
+
+// --- ROM Utilities ---
+static char *build_executable_relative_path(const char *executable_path, const char *filename) {
+    if (!executable_path || !filename) {
+        return NULL;
     }
 
-    audio_dump_file = fopen(path, "wb");
-    if (!audio_dump_file) {
-        fprintf(stderr, "[BEEPER] failed to open audio dump '%s': %s\n", path, strerror(errno));
-        return 0;
+    const char *last_sep = strrchr(executable_path, '/');
+#ifdef _WIN32
+    const char *last_backslash = strrchr(executable_path, '\\');
+    if (!last_sep || (last_backslash && last_backslash > last_sep)) {
+        last_sep = last_backslash;
+    }
+#endif
+    if (!last_sep) {
+        return NULL;
     }
 
-    audio_dump_data_bytes = 0;
-    audio_dump_channels = channels;
+    size_t dir_len = (size_t)(last_sep - executable_path + 1);
+    size_t name_len = strlen(filename);
+    char *joined = (char *)malloc(dir_len + name_len + 1);
+    if (!joined) {
+        return NULL;
+    }
+    memcpy(joined, executable_path, dir_len);
+    memcpy(joined + dir_len, filename, name_len + 1);
+    return joined;
+}
 
-    uint8_t header[44];
-    memset(header, 0, sizeof(header));
 
-    memcpy(header, "RIFF", 4);
-    audio_dump_write_uint32(header + 4, 36u);
-    memcpy(header + 8, "WAVE", 4);
-    memcpy(header + 12, "fmt ", 4);
-    audio_dump_write_uint32(header + 16, 16u); // PCM chunk size
-    audio_dump_write_uint16(header + 20, 1u);  // PCM format
-    audio_dump_write_uint16(header + 22, channels);
-    audio_dump_write_uint32(header + 24, sample_rate);
-    uint32_t byte_rate = sample_rate * channels * (uint32_t)sizeof(Sint16);
-    audio_dump_write_uint32(header + 28, byte_rate);
-    uint16_t block_align = (uint16_t)(channels * (uint16_t)sizeof(Sint16));
-    audio_dump_write_uint16(header + 32, block_align);
-    audio_dump_write_uint16(header + 34, 16u); // bits per sample
-    memcpy(header + 36, "data", 4);
-    audio_dump_write_uint32(header + 40, 0u);
+// --- Memory Access Helpers ---
+static const uint8_t spectrum_contended_bank_masks[] = {
+    [CONTENTION_PROFILE_48K] = (uint8_t)(1u << 5),
+    [CONTENTION_PROFILE_128K] = (uint8_t)((1u << 1) | (1u << 3) | (1u << 5) | (1u << 7)),
+    [CONTENTION_PROFILE_128K_PLUS2A] = (uint8_t)((1u << 4) | (1u << 5) | (1u << 6) | (1u << 7)),
+    [CONTENTION_PROFILE_128K_PLUS3] = (uint8_t)((1u << 4) | (1u << 5) | (1u << 6) | (1u << 7))
+};
 
-    if (fwrite(header, sizeof(header), 1, audio_dump_file) != 1) {
-        fprintf(stderr, "[BEEPER] failed to write WAV header to '%s'\n", path);
-        audio_dump_abort();
-        return 0;
-    }
+static const int spectrum_contention_penalties[][8] = {
+    [CONTENTION_PROFILE_48K]         = {6, 5, 4, 3, 2, 1, 0, 0},
+    [CONTENTION_PROFILE_128K]        = {6, 5, 4, 3, 2, 1, 0, 0},
+    [CONTENTION_PROFILE_128K_PLUS2A] = {0, 6, 5, 4, 3, 2, 1, 0},
+    [CONTENTION_PROFILE_128K_PLUS3]  = {0, 6, 5, 4, 3, 2, 1, 0}
+};
 
-    BEEPER_LOG("[BEEPER] dumping audio to %s\n", path);
-    return 1;
+static inline void spectrum_reset_floating_bus(void) {
+    floating_bus_last_value = 0xFFu;
 }
 
-static void audio_dump_abort(void) {
-    if (audio_dump_file) {
-        fclose(audio_dump_file);
-        audio_dump_file = NULL;
+static inline uint64_t spectrum_current_access_tstate(void) {
+    if (ula_instruction_progress_ptr) {
+        return ula_instruction_base_tstate + (uint64_t)(*ula_instruction_progress_ptr);
     }
-    audio_dump_data_bytes = 0;
+    return total_t_states;
 }
 
-static void audio_dump_write_samples(const Sint16* samples, size_t count) {
-    if (!audio_dump_file || !samples || count == 0) {
-        return;
+static inline int spectrum_is_ram_bank_contended(uint8_t bank) {
+    if (bank >= 8u) {
+        return 0;
     }
+    uint8_t mask = spectrum_contended_bank_masks[spectrum_contention_profile];
+    return (mask & (uint8_t)(1u << bank)) != 0u;
+}
 
-    size_t written = fwrite(samples, sizeof(Sint16), count, audio_dump_file);
-    if (written != count) {
-        fprintf(stderr,
-                "[BEEPER] audio dump write failed after %zu samples\n",
-                (size_t)(audio_dump_data_bytes / 2u));
-        audio_dump_abort();
+static void spectrum_map_page(int segment, SpectrumMemoryPageType type, uint8_t index) {
+    if (segment < 0 || segment >= 4) {
         return;
     }
 
-    audio_dump_data_bytes += (uint32_t)(written * sizeof(Sint16));
-}
-
-static void audio_dump_finish(void) {
-    if (!audio_dump_file) {
+    SpectrumMemoryPage *slot = &spectrum_pages[segment];
+    uint16_t base = (uint16_t)(segment * 0x4000u);
+    if (slot->type == type && slot->index == index && slot->type != MEMORY_PAGE_NONE) {
         return;
     }
 
-    uint32_t riff_size = 36u + audio_dump_data_bytes;
-    uint32_t data_size = audio_dump_data_bytes;
-
-    if (fseek(audio_dump_file, 4L, SEEK_SET) == 0) {
-        uint8_t size_bytes[4];
-        audio_dump_write_uint32(size_bytes, riff_size);
-        fwrite(size_bytes, sizeof(size_bytes), 1, audio_dump_file);
+    if (slot->type == MEMORY_PAGE_RAM && slot->index < 8u) {
+        memcpy(ram_pages[slot->index], memory + base, 0x4000);
     }
 
-    if (fseek(audio_dump_file, 40L, SEEK_SET) == 0) {
-        uint8_t data_bytes_buf[4];
-        audio_dump_write_uint32(data_bytes_buf, data_size);
-        fwrite(data_bytes_buf, sizeof(data_bytes_buf), 1, audio_dump_file);
+    if (type == MEMORY_PAGE_ROM) {
+        uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
+        uint8_t rom_index = (uint8_t)(index % rom_limit);
+        memcpy(memory + base, rom_pages[rom_index], 0x4000);
+        slot->type = MEMORY_PAGE_ROM;
+        slot->index = rom_index;
+    } else if (type == MEMORY_PAGE_RAM) {
+        uint8_t ram_index = (uint8_t)(index % 8u);
+        memcpy(memory + base, ram_pages[ram_index], 0x4000);
+        slot->type = MEMORY_PAGE_RAM;
+        slot->index = ram_index;
+    } else {
+        memset(memory + base, 0, 0x4000);
+        slot->type = MEMORY_PAGE_NONE;
+        slot->index = 0u;
     }
-
-    fclose(audio_dump_file);
-    audio_dump_file = NULL;
-    audio_dump_data_bytes = 0;
 }
 
-static uint64_t tape_pause_to_tstates(uint32_t pause_ms) {
-    if (pause_ms == 0) {
-        return 0;
-    }
-    double tstates = ((double)pause_ms / 1000.0) * CPU_CLOCK_HZ;
-    if (tstates <= 0.0) {
-        return 0;
+static void spectrum_refresh_visible_ram(void) {
+    for (int segment = 0; segment < 4; ++segment) {
+        SpectrumMemoryPage* slot = &spectrum_pages[segment];
+        if (slot->type == MEMORY_PAGE_RAM && slot->index < 8u) {
+            uint16_t base = (uint16_t)(segment * 0x4000u);
+            memcpy(memory + base, ram_pages[slot->index], 0x4000u);
+        }
     }
-    return (uint64_t)(tstates + 0.5);
 }
 
-static const char* tape_header_type_name(uint8_t header_type) {
-    switch (header_type) {
-        case 0x00:
-            return "Program";
-        case 0x01:
-            return "Number array";
-        case 0x02:
-            return "Character array";
-        case 0x03:
-            return "Bytes";
-        default:
-            return "Unknown";
+static void spectrum_update_contention_flags(void) {
+    for (int segment = 0; segment < 4; ++segment) {
+        uint8_t contended = 0u;
+        if (spectrum_pages[segment].type == MEMORY_PAGE_RAM) {
+            contended = (uint8_t)spectrum_is_ram_bank_contended(spectrum_pages[segment].index);
+        }
+        page_contended[segment] = contended;
     }
 }
 
-static void tape_log_block_summary(const TapeBlock* block, size_t index) {
-    if (!tape_debug_logging) {
-        return;
-    }
+static void spectrum_set_contention_profile(SpectrumContentionProfile profile) {
+    spectrum_contention_profile = profile;
+    spectrum_update_contention_flags();
+}
 
-    if (!block) {
-        tape_log("Block %zu: <null>\n", index);
+static void spectrum_set_peripheral_contention_profile(PeripheralContentionProfile profile) {
+    peripheral_contention_profile = profile;
+}
+
+static inline void apply_port_contention(uint64_t access_t_state) {
+    if (!ula_instruction_progress_ptr) {
         return;
     }
 
-    tape_log("Block %zu: type=%d length=%u pause=%u", index, (int)block->type, block->length, block->pause_ms);
+    int penalty = 0;
+    switch (peripheral_contention_profile) {
+        case PERIPHERAL_CONTENTION_NONE:
+            return;
+        case PERIPHERAL_CONTENTION_IF1:
+            penalty = ula_contention_penalty(access_t_state);
+            break;
+        case PERIPHERAL_CONTENTION_PLUS3:
+            penalty = ula_contention_penalty(access_t_state) + 3;
+            break;
+    }
 
-    switch (block->type) {
-        case TAPE_BLOCK_TYPE_STANDARD:
-        case TAPE_BLOCK_TYPE_TURBO:
-        case TAPE_BLOCK_TYPE_PURE_DATA: {
-            if (!block->data || block->length == 0) {
-                tape_log(" (empty)\n");
-                return;
-            }
-
-            uint8_t flag = block->data[0];
-            tape_log(" flag=0x%02X", flag);
-
-            if (flag == 0x00 && block->length >= 19) {
-                uint8_t header_type = block->data[1];
-                char name[11];
-                size_t copy_len = 10u;
-                size_t available = 0u;
-                if (block->length > 2u) {
-                    available = block->length - 2u;
-                }
-                if (available < copy_len) {
-                    copy_len = available;
-                }
-                memset(name, '\0', sizeof(name));
-                if (copy_len > 0u) {
-                    memcpy(name, &block->data[2], copy_len);
-                    for (size_t i = 0; i < copy_len; ++i) {
-                        if ((unsigned char)name[i] < 32u || (unsigned char)name[i] > 126u) {
-                            name[i] = '?';
-                        }
-                    }
-                    for (int i = (int)copy_len - 1; i >= 0; --i) {
-                        if (name[i] == ' ') {
-                            name[i] = '\0';
-                        } else {
-                            break;
-                        }
-                    }
-                }
-                uint16_t data_length = (uint16_t)block->data[12] | ((uint16_t)block->data[13] << 8);
-                uint16_t param1 = (uint16_t)block->data[14] | ((uint16_t)block->data[15] << 8);
-                uint16_t param2 = (uint16_t)block->data[16] | ((uint16_t)block->data[17] << 8);
-                tape_log(" header=%s name='%s' data_len=%u param1=%u param2=%u\n",
-                         tape_header_type_name(header_type),
-                         name,
-                         data_length,
-                         param1,
-                         param2);
-                return;
-            }
-
-            if (flag == 0xFF && block->length >= 2) {
-                uint32_t payload_length = block->length - 2u;
-                uint8_t checksum = block->data[block->length - 1];
-                tape_log(" data payload_len=%u checksum=0x%02X\n", payload_length, checksum);
-                return;
-            }
-
-            tape_log("\n");
-            return;
-        }
-        case TAPE_BLOCK_TYPE_PURE_TONE:
-            tape_log(" tone pulses=%u length=%u\n",
-                     (unsigned)block->tone_pulse_count,
-                     (unsigned)block->tone_pulse_tstates);
-            return;
-        case TAPE_BLOCK_TYPE_PULSE_SEQUENCE:
-            tape_log(" pulse-seq count=%zu\n", block->pulse_sequence_count);
-            return;
-        case TAPE_BLOCK_TYPE_DIRECT_RECORDING:
-            tape_log(" direct samples=%u tstates/sample=%u\n",
-                     (unsigned)block->direct_sample_count,
-                     (unsigned)block->direct_tstates_per_sample);
-            return;
+    if (penalty > 0) {
+        *ula_instruction_progress_ptr += penalty;
     }
 }
 
-static void tape_free_image(TapeImage* image) {
-    if (!image) {
-        return;
-    }
-    if (image->blocks) {
-        for (size_t i = 0; i < image->count; ++i) {
-            free(image->blocks[i].data);
-            image->blocks[i].data = NULL;
-            free(image->blocks[i].pulse_sequence_durations);
-            image->blocks[i].pulse_sequence_durations = NULL;
-            free(image->blocks[i].direct_samples);
-            image->blocks[i].direct_samples = NULL;
-        }
-        free(image->blocks);
-    }
-    image->blocks = NULL;
-    image->count = 0;
-    image->capacity = 0;
+static inline uint16_t spectrum_screen_pixel_offset(uint32_t y, uint32_t x_char) {
+    return (uint16_t)(((y & 0xC0u) << 5) | ((y & 0x07u) << 8) | ((y & 0x38u) << 2) | x_char);
 }
 
-static TapeBlock* tape_image_new_block(TapeImage* image) {
-    if (!image) {
-        return NULL;
-    }
-
-    if (image->count == image->capacity) {
-        size_t new_capacity = image->capacity ? image->capacity * 2 : 8;
-        TapeBlock* new_blocks = (TapeBlock*)realloc(image->blocks, new_capacity * sizeof(TapeBlock));
-        if (!new_blocks) {
-            return NULL;
-        }
-        image->blocks = new_blocks;
-        image->capacity = new_capacity;
-    }
-
-    TapeBlock* block = &image->blocks[image->count];
-    block->type = TAPE_BLOCK_TYPE_STANDARD;
-    block->length = 0u;
-    block->pause_ms = 0u;
-    block->data = NULL;
-    block->used_bits_in_last_byte = 8u;
-    block->pilot_pulse_tstates = (uint16_t)TAPE_PILOT_PULSE_TSTATES;
-    block->pilot_pulse_count = 0u;
-    block->sync_first_pulse_tstates = (uint16_t)TAPE_SYNC_FIRST_PULSE_TSTATES;
-    block->sync_second_pulse_tstates = (uint16_t)TAPE_SYNC_SECOND_PULSE_TSTATES;
-    block->bit0_first_pulse_tstates = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
-    block->bit0_second_pulse_tstates = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
-    block->bit1_first_pulse_tstates = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
-    block->bit1_second_pulse_tstates = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
-    block->tone_pulse_tstates = 0u;
-    block->tone_pulse_count = 0u;
-    block->pulse_sequence_durations = NULL;
-    block->pulse_sequence_count = 0u;
-    block->direct_tstates_per_sample = 0u;
-    block->direct_samples = NULL;
-    block->direct_sample_count = 0u;
-    block->direct_initial_level = 1;
-    return block;
+static inline uint16_t spectrum_screen_attr_offset(uint32_t y, uint32_t x_char) {
+    return (uint16_t)(((y >> 3) * 32u) + x_char);
 }
 
-static int tape_image_add_block(TapeImage* image, const uint8_t* data, uint32_t length, uint32_t pause_ms) {
-    TapeBlock* block = tape_image_new_block(image);
-    if (!block) {
-        return 0;
+static uint8_t spectrum_sample_floating_bus(uint64_t access_t_state) {
+    uint32_t phase = (uint32_t)(access_t_state % T_STATES_PER_FRAME);
+    if (phase < 14336u || phase >= 57344u) {
+        return floating_bus_last_value;
     }
 
-    block->type = TAPE_BLOCK_TYPE_STANDARD;
-    block->length = length;
-    block->pause_ms = pause_ms;
+    uint32_t display_phase = phase - 14336u;
+    uint32_t line = display_phase / 224u;
+    uint32_t line_phase = display_phase % 224u;
 
-    if (length > 0) {
-        block->data = (uint8_t*)malloc(length);
-        if (!block->data) {
-            return 0;
-        }
-        memcpy(block->data, data, length);
+    if (line_phase < 48u || line_phase >= 176u) {
+        return floating_bus_last_value;
     }
 
-    tape_log_block_summary(block, image->count);
-    image->count++;
-    return 1;
-}
-
-static int tape_image_add_turbo_block(TapeImage* image,
-                                      const uint8_t* data,
-                                      uint32_t length,
-                                      uint32_t pause_ms,
-                                      uint16_t pilot_pulse_tstates,
-                                      uint32_t pilot_pulses,
-                                      uint16_t sync1_tstates,
-                                      uint16_t sync2_tstates,
-                                      uint16_t bit0_first,
-                                      uint16_t bit0_second,
-                                      uint16_t bit1_first,
-                                      uint16_t bit1_second,
-                                      uint8_t used_bits) {
-    TapeBlock* block = tape_image_new_block(image);
-    if (!block) {
-        return 0;
+    uint32_t column_phase = line_phase - 48u;
+    uint32_t sub_phase = column_phase & 3u;
+    uint32_t x_char = column_phase >> 2;
+    if (x_char >= 32u) {
+        return floating_bus_last_value;
     }
 
-    block->type = TAPE_BLOCK_TYPE_TURBO;
-    block->length = length;
-    block->pause_ms = pause_ms;
-    block->pilot_pulse_tstates = pilot_pulse_tstates;
-    block->pilot_pulse_count = pilot_pulses;
-    block->sync_first_pulse_tstates = sync1_tstates;
-    block->sync_second_pulse_tstates = sync2_tstates;
-    block->bit0_first_pulse_tstates = bit0_first;
-    block->bit0_second_pulse_tstates = bit0_second;
-    block->bit1_first_pulse_tstates = bit1_first;
-    block->bit1_second_pulse_tstates = bit1_second;
-    block->used_bits_in_last_byte = (used_bits == 0u) ? 8u : used_bits;
+    if (current_screen_bank >= 8u) {
+        return floating_bus_last_value;
+    }
 
-    if (length > 0u) {
-        block->data = (uint8_t*)malloc(length);
-        if (!block->data) {
-            return 0;
-        }
-        memcpy(block->data, data, length);
+    const uint8_t* vram_bank;
+    const uint8_t* attr_bank;
+    if (spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == current_screen_bank) {
+        vram_bank = memory + VRAM_START;
+        attr_bank = memory + ATTR_START;
+    } else {
+        const uint8_t* bank = ram_pages[current_screen_bank];
+        vram_bank = bank;
+        attr_bank = bank + (ATTR_START - VRAM_START);
     }
 
-    tape_log_block_summary(block, image->count);
-    image->count++;
-    return 1;
-}
+    uint8_t value;
+    if ((sub_phase & 2u) == 0u) {
+        uint16_t offset = spectrum_screen_pixel_offset(line, x_char);
+        value = vram_bank[offset];
+    } else {
+        uint16_t offset = spectrum_screen_attr_offset(line, x_char);
+        value = attr_bank[offset];
+    }
 
-static int tape_image_add_pure_data_block(TapeImage* image,
-                                          const uint8_t* data,
-                                          uint32_t length,
-                                          uint32_t pause_ms,
-                                          uint16_t bit0_first,
-                                          uint16_t bit0_second,
-                                          uint16_t bit1_first,
-                                          uint16_t bit1_second,
-                                          uint8_t used_bits) {
-    return tape_image_add_turbo_block(image,
-                                      data,
-                                      length,
-                                      pause_ms,
-                                      0u,
-                                      0u,
-                                      0u,
-                                      0u,
-                                      bit0_first,
-                                      bit0_second,
-                                      bit1_first,
-                                      bit1_second,
-                                      used_bits);
+    floating_bus_last_value = value;
+    return value;
 }
 
-static int tape_image_add_pure_tone_block(TapeImage* image,
-                                          uint16_t pulse_tstates,
-                                          uint32_t pulse_count,
-                                          uint32_t pause_ms) {
-    TapeBlock* block = tape_image_new_block(image);
-    if (!block) {
+static inline int ula_contention_penalty(uint64_t t_state) {
+    uint32_t phase = (uint32_t)(t_state % T_STATES_PER_FRAME);
+    if (phase < 14336u || phase >= 57344u) {
         return 0;
     }
-
-    block->type = TAPE_BLOCK_TYPE_PURE_TONE;
-    block->tone_pulse_tstates = pulse_tstates;
-    block->tone_pulse_count = pulse_count;
-    block->pause_ms = pause_ms;
-
-    tape_log_block_summary(block, image->count);
-    image->count++;
-    return 1;
+    const int* penalties = spectrum_contention_penalties[spectrum_contention_profile];
+    return penalties[phase & 7u];
 }
 
-static int tape_image_add_pulse_sequence_block(TapeImage* image,
-                                               const uint16_t* durations,
-                                               size_t count,
-                                               uint32_t pause_ms) {
-    TapeBlock* block = tape_image_new_block(image);
-    if (!block) {
-        return 0;
+static void spectrum_apply_memory_configuration(void) {
+    if (spectrum_model == SPECTRUM_MODEL_48K) {
+        current_rom_page = 0u;
+        current_screen_bank = 5u;
+        current_paged_bank = 7u;
+        spectrum_map_page(0, MEMORY_PAGE_ROM, 0u);
+        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
+        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
+        spectrum_map_page(3, MEMORY_PAGE_RAM, 7u);
+        spectrum_update_contention_flags();
+        return;
     }
 
-    block->type = TAPE_BLOCK_TYPE_PULSE_SEQUENCE;
-    block->pause_ms = pause_ms;
+    int plus_model = (spectrum_model == SPECTRUM_MODEL_PLUS2A) || (spectrum_model == SPECTRUM_MODEL_PLUS3);
+    if (!plus_model) {
+        uint8_t desired_rom = (uint8_t)((gate_array_7ffd_state >> 4) & 0x01u);
+        uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
+        current_rom_page = (uint8_t)(desired_rom % rom_limit);
+        current_screen_bank = (gate_array_7ffd_state & 0x08u) ? 7u : 5u;
+        spectrum_map_page(0, MEMORY_PAGE_ROM, current_rom_page);
+        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
+        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
+        spectrum_map_page(3, MEMORY_PAGE_RAM, current_paged_bank);
+        spectrum_update_contention_flags();
+        return;
+    }
 
-    if (count > 0u) {
-        size_t bytes = count * sizeof(uint16_t);
-        block->pulse_sequence_durations = (uint16_t*)malloc(bytes);
-        if (!block->pulse_sequence_durations) {
-            return 0;
+    uint8_t rom_low = (uint8_t)((gate_array_7ffd_state >> 4) & 0x01u);
+    uint8_t rom_high = (uint8_t)(gate_array_1ffd_state & 0x01u);
+    uint8_t desired_rom = (uint8_t)(((rom_high & 0x01u) << 1) | rom_low);
+    uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
+    current_rom_page = (uint8_t)(desired_rom % rom_limit);
+
+    int special_paging = (gate_array_1ffd_state & 0x04u) != 0;
+    int all_ram = !special_paging && ((gate_array_1ffd_state & 0x02u) != 0);
+
+    if (special_paging) {
+        static const uint8_t special_maps[4][4] = {
+            {0u, 1u, 2u, 3u},
+            {4u, 5u, 6u, 7u},
+            {4u, 5u, 6u, 3u},
+            {4u, 7u, 6u, 3u}
+        };
+        uint8_t config = (uint8_t)(gate_array_1ffd_state & 0x03u);
+        const uint8_t* map = special_maps[config];
+        spectrum_map_page(0, MEMORY_PAGE_RAM, map[0]);
+        spectrum_map_page(1, MEMORY_PAGE_RAM, map[1]);
+        spectrum_map_page(2, MEMORY_PAGE_RAM, map[2]);
+        spectrum_map_page(3, MEMORY_PAGE_RAM, map[3]);
+        if (spectrum_pages[1].type == MEMORY_PAGE_RAM) {
+            current_screen_bank = spectrum_pages[1].index;
+        } else {
+            current_screen_bank = 5u;
         }
-        memcpy(block->pulse_sequence_durations, durations, bytes);
-        block->pulse_sequence_count = count;
+    } else {
+        if (all_ram) {
+            spectrum_map_page(0, MEMORY_PAGE_RAM, 0u);
+        } else {
+            spectrum_map_page(0, MEMORY_PAGE_ROM, current_rom_page);
+        }
+        spectrum_map_page(1, MEMORY_PAGE_RAM, 5u);
+        spectrum_map_page(2, MEMORY_PAGE_RAM, 2u);
+        spectrum_map_page(3, MEMORY_PAGE_RAM, current_paged_bank);
+        current_screen_bank = (gate_array_7ffd_state & 0x08u) ? 7u : 5u;
     }
 
-    tape_log_block_summary(block, image->count);
-    image->count++;
-    return 1;
+    spectrum_update_contention_flags();
 }
 
-static int tape_image_add_direct_recording_block(TapeImage* image,
-                                                 uint32_t tstates_per_sample,
-                                                 const uint8_t* samples,
-                                                 uint32_t sample_bytes,
-                                                 uint8_t used_bits,
-                                                 uint32_t pause_ms) {
-    TapeBlock* block = tape_image_new_block(image);
-    if (!block) {
-        return 0;
+static uint32_t spectrum_hash_buffer(const uint8_t* data, size_t length) {
+    const uint32_t fnv_offset = 2166136261u;
+    const uint32_t fnv_prime = 16777619u;
+    uint32_t hash = fnv_offset;
+
+    if (!data) {
+        return hash;
     }
 
-    block->type = TAPE_BLOCK_TYPE_DIRECT_RECORDING;
-    block->pause_ms = pause_ms;
-    block->direct_tstates_per_sample = tstates_per_sample;
-    block->used_bits_in_last_byte = (used_bits == 0u) ? 8u : used_bits;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= data[i];
+        hash *= fnv_prime;
+    }
 
-    if (sample_bytes > 0u) {
-        block->direct_samples = (uint8_t*)malloc(sample_bytes);
-        if (!block->direct_samples) {
-            return 0;
-        }
-        memcpy(block->direct_samples, samples, sample_bytes);
+    return hash;
+}
+
+static void spectrum_log_ram_hashes(const char* reason) {
+    if (!ram_hash_logging) {
+        return;
     }
 
-    uint32_t total_bits = sample_bytes * 8u;
-    if (sample_bytes > 0u && block->used_bits_in_last_byte < 8u) {
-        total_bits -= (uint32_t)(8u - block->used_bits_in_last_byte);
+    const char* tag = reason ? reason : "ram";
+    fprintf(stderr,
+            "[RAM ] %s hashes 7FFD=%02X 1FFD=%02X disabled=%d screen=%u",
+            tag,
+            (unsigned)gate_array_7ffd_state,
+            (unsigned)gate_array_1ffd_state,
+            paging_disabled,
+            (unsigned)current_screen_bank);
+
+    for (int bank = 0; bank < 8; ++bank) {
+        uint32_t hash = spectrum_hash_buffer(ram_pages[bank], 0x4000u);
+        fprintf(stderr, " bank%u=%08X", bank, hash);
     }
-    block->direct_sample_count = total_bits;
-    if (block->direct_sample_count > 0u && block->direct_samples) {
-        block->direct_initial_level = (block->direct_samples[0] & 0x80u) ? 1 : 0;
+
+    fputc('\n', stderr);
+}
+
+static void spectrum_configure_model(SpectrumModel model) {
+    spectrum_model = model;
+    paging_disabled = 0;
+    gate_array_7ffd_state = 0u;
+    gate_array_1ffd_state = 0u;
+    ay_selected_register = 0u;
+    ay_register_latched = 0;
+    memset(ay_registers, 0, sizeof(ay_registers));
+    ay_reset_state();
+    current_screen_bank = 5u;
+    current_rom_page = 0u;
+    current_paged_bank = (model == SPECTRUM_MODEL_48K) ? 7u : 0u;
+    for (int i = 0; i < 4; ++i) {
+        spectrum_pages[i].type = MEMORY_PAGE_NONE;
+        spectrum_pages[i].index = 0u;
+    }
+    if (model == SPECTRUM_MODEL_48K) {
+        spectrum_contention_profile = CONTENTION_PROFILE_48K;
+    } else if (model == SPECTRUM_MODEL_128K) {
+        spectrum_contention_profile = CONTENTION_PROFILE_128K;
+    } else if (model == SPECTRUM_MODEL_PLUS2A) {
+        spectrum_contention_profile = CONTENTION_PROFILE_128K_PLUS2A;
     } else {
-        block->direct_initial_level = 0;
+        spectrum_contention_profile = CONTENTION_PROFILE_128K_PLUS3;
     }
 
-    tape_log_block_summary(block, image->count);
-    image->count++;
-    return 1;
+    if (model == SPECTRUM_MODEL_PLUS3) {
+        peripheral_contention_profile = PERIPHERAL_CONTENTION_PLUS3;
+    } else {
+        peripheral_contention_profile = PERIPHERAL_CONTENTION_NONE;
+    }
+    spectrum_reset_floating_bus();
+    spectrum_apply_memory_configuration();
+    spectrum_log_paging_state("model configure", 0u, 0u, total_t_states);
 }
 
-static void tape_waveform_reset(TapeWaveform* waveform) {
-    if (!waveform) {
+static inline void apply_memory_contention(uint16_t addr) {
+    if (!ula_instruction_progress_ptr) {
         return;
     }
-    if (waveform->pulses) {
-        free(waveform->pulses);
-        waveform->pulses = NULL;
+    uint16_t page = (uint16_t)(addr >> 14);
+    if (page > 3u) {
+        return;
+    }
+    if (!page_contended[page]) {
+        return;
+    }
+    uint64_t access_t_state = spectrum_current_access_tstate();
+    int penalty = ula_contention_penalty(access_t_state);
+    if (penalty > 0) {
+        *ula_instruction_progress_ptr += penalty;
     }
-    waveform->count = 0;
-    waveform->capacity = 0;
-    waveform->initial_level = 1;
-    waveform->sample_rate = 0u;
 }
 
-static int tape_waveform_add_pulse(TapeWaveform* waveform, uint64_t duration) {
-    if (!waveform || duration == 0) {
-        return 1;
-    }
-    if (duration > UINT32_MAX) {
-        duration = UINT32_MAX;
+static inline void spectrum_write_ram_shadow(uint16_t addr, uint8_t val) {
+    uint16_t page = (uint16_t)(addr >> 14);
+    if (page >= 4u) {
+        return;
     }
-    if (waveform->count == waveform->capacity) {
-        size_t new_capacity = waveform->capacity ? waveform->capacity * 2 : 512;
-        TapePulse* new_pulses = (TapePulse*)realloc(waveform->pulses, new_capacity * sizeof(TapePulse));
-        if (!new_pulses) {
-            return 0;
-        }
-        waveform->pulses = new_pulses;
-        waveform->capacity = new_capacity;
+    SpectrumMemoryPage *slot = &spectrum_pages[page];
+    if (slot->type != MEMORY_PAGE_RAM || slot->index >= 8u) {
+        return;
     }
-    waveform->pulses[waveform->count].duration = (uint32_t)duration;
-    waveform->count++;
-    return 1;
+    uint16_t base = (uint16_t)(page * 0x4000u);
+    ram_pages[slot->index][addr - base] = val;
 }
 
-static int tape_waveform_add_with_pending(TapeWaveform* waveform,
-                                          uint64_t duration,
-                                          uint64_t* pending_silence) {
-    if (pending_silence && *pending_silence) {
-        duration += *pending_silence;
-        *pending_silence = 0;
+static void spectrum_map_rom_page(uint8_t page) {
+    uint8_t rom_limit = rom_page_count > 0u ? rom_page_count : 1u;
+    uint8_t desired = (uint8_t)(page % rom_limit);
+    if (spectrum_model == SPECTRUM_MODEL_PLUS2A || spectrum_model == SPECTRUM_MODEL_PLUS3) {
+        gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x10u) | ((desired & 0x01u) << 4));
+        gate_array_1ffd_state = (uint8_t)((gate_array_1ffd_state & (uint8_t)~0x01u) | ((desired >> 1) & 0x01u));
+    } else {
+        gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x10u) | ((desired & 0x01u) << 4));
     }
-    return tape_waveform_add_pulse(waveform, duration);
+    current_rom_page = desired;
+    spectrum_pages[0].type = MEMORY_PAGE_NONE;
+    spectrum_pages[0].index = 0u;
+    spectrum_apply_memory_configuration();
 }
 
-static int tape_generate_waveform_from_image(const TapeImage* image, TapeWaveform* waveform) {
-    if (!image || !waveform) {
-        return 0;
+static void spectrum_map_upper_bank(uint8_t new_bank) {
+    if (spectrum_model == SPECTRUM_MODEL_48K) {
+        return;
+    }
+    new_bank &= 0x07u;
+    if (new_bank == current_paged_bank) {
+        return;
     }
+    current_paged_bank = new_bank;
+    gate_array_7ffd_state = (uint8_t)((gate_array_7ffd_state & (uint8_t)~0x07u) | current_paged_bank);
+    spectrum_apply_memory_configuration();
+}
 
-    tape_waveform_reset(waveform);
-    waveform->initial_level = 1;
-    waveform->sample_rate = 0u;
+uint8_t readByte(uint16_t addr) {
+    apply_memory_contention(addr);
+    return memory[addr];
+}
 
-    if (image->count == 0) {
-        return 1;
+void writeByte(uint16_t addr, uint8_t val) {
+    apply_memory_contention(addr);
+    if (addr < 0x4000u) {
+        return;
     }
+    memory[addr] = val;
+    spectrum_write_ram_shadow(addr, val);
+}
 
-    uint64_t pending_silence = 0;
-    if (waveform->count == 0) {
-        waveform->initial_level = 1;
-    }
-    for (size_t block_index = 0; block_index < image->count; ++block_index) {
-        const TapeBlock* block = &image->blocks[block_index];
-        switch (block->type) {
-            case TAPE_BLOCK_TYPE_STANDARD:
-            case TAPE_BLOCK_TYPE_TURBO:
-            case TAPE_BLOCK_TYPE_PURE_DATA: {
-                uint32_t pilot_count = 0u;
-                uint16_t pilot_pulse = block->pilot_pulse_tstates;
-                uint16_t sync1 = block->sync_first_pulse_tstates;
-                uint16_t sync2 = block->sync_second_pulse_tstates;
-                uint16_t bit0_first = block->bit0_first_pulse_tstates;
-                uint16_t bit0_second = block->bit0_second_pulse_tstates;
-                uint16_t bit1_first = block->bit1_first_pulse_tstates;
-                uint16_t bit1_second = block->bit1_second_pulse_tstates;
-
-                if (block->type == TAPE_BLOCK_TYPE_STANDARD) {
-                    if (block->length > 0 && block->data && block->data[0] == 0x00) {
-                        pilot_count = (uint32_t)TAPE_HEADER_PILOT_COUNT;
-                    } else {
-                        pilot_count = (uint32_t)TAPE_DATA_PILOT_COUNT;
-                    }
-                    pilot_pulse = (uint16_t)TAPE_PILOT_PULSE_TSTATES;
-                    sync1 = (uint16_t)TAPE_SYNC_FIRST_PULSE_TSTATES;
-                    sync2 = (uint16_t)TAPE_SYNC_SECOND_PULSE_TSTATES;
-                    bit0_first = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
-                    bit0_second = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
-                    bit1_first = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
-                    bit1_second = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
-                } else {
-                    pilot_count = block->pilot_pulse_count;
-                }
+uint16_t readWord(uint16_t addr) {
+    uint8_t lo = readByte(addr);
+    uint8_t hi = readByte((uint16_t)(addr + 1u));
+    return (uint16_t)((hi << 8) | lo);
+}
 
-                for (uint32_t pulse = 0; pulse < pilot_count; ++pulse) {
-                    uint64_t duration = (uint64_t)pilot_pulse;
-                    if (!tape_waveform_add_with_pending(waveform, duration, &pending_silence)) {
-                        return 0;
-                    }
-                }
+void writeWord(uint16_t addr, uint16_t val) {
+    uint8_t lo = (uint8_t)(val & 0xFFu);
+    uint8_t hi = (uint8_t)((val >> 8) & 0xFFu);
+    writeByte(addr, lo);
+    writeByte((uint16_t)(addr + 1u), hi);
+}
 
-                if (sync1 > 0u) {
-                    if (!tape_waveform_add_with_pending(waveform, (uint64_t)sync1, &pending_silence)) {
-                        return 0;
-                    }
-                }
+// Only called while no audio consumer is running (output format changes).
+static void beeper_reset_audio_state(uint64_t current_t_state, int current_level) {
+    beeper_event_head.store(0, std::memory_order_relaxed);
+    beeper_event_tail.store(0, std::memory_order_relaxed);
+    beeper_resync_request.store(0, std::memory_order_relaxed);
+    beeper_catch_up_request.store(0, std::memory_order_relaxed);
+    beeper_last_event_t_state = current_t_state;
+    beeper_playback.position = current_t_state << BEEPER_POSITION_FRACTION_BITS;
+    beeper_playback.remainder = 0;
+    beeper_playback_published.store(beeper_playback.position, std::memory_order_relaxed);
+    beeper_writer_cursor.store(beeper_playback.position, std::memory_order_relaxed);
+    beeper_playback_level = current_level;
+    beeper_highpass.last_input = current_level * AUDIO_AMPLITUDE;
+    beeper_highpass.last_output = 0;
+    beeper_blep_reset(current_level);
+    beeper_idle_log_active = 0;
+    ay_apply_events_until(UINT64_MAX);
+    ay_last_event_t_state = current_t_state;
+    ay_dirty_registers = 0u;
+    audio_rate_primed = 0;
+    audio_rate_integral = 0.0;
+    audio_rate_underrun_active = 0;
+}
+
+// Consumer side: drops the beeper events queued before `resume_index`, lands
+// the AY writes queued before ay_resync_index and restarts playback at
+// `sync_t_state`.
+static void beeper_force_resync(uint64_t sync_t_state, size_t resume_index) {
+    beeper_event_head.store(resume_index, std::memory_order_release);
+    beeper_playback.position = sync_t_state << BEEPER_POSITION_FRACTION_BITS;
+    beeper_playback.remainder = 0;
+    beeper_playback_published.store(beeper_playback.position, std::memory_order_release);
+    beeper_highpass.last_input = beeper_playback_level * AUDIO_AMPLITUDE;
+    beeper_highpass.last_output = 0;
+    beeper_blep_reset(beeper_playback_level);
+    ay_apply_events_before(ay_resync_index.load(std::memory_order_relaxed));
+    audio_rate_primed = 0;
+}
+
+// Producer side of a timeline rewind. With an audio consumer running the
+// resync is only requested; it lands at the start of the next callback.
+static void beeper_request_resync(uint64_t sync_t_state) {
+    size_t resume_index = beeper_event_tail.load(std::memory_order_relaxed);
+    beeper_last_event_t_state = sync_t_state;
+    ay_last_event_t_state = sync_t_state;
+    beeper_writer_cursor.store(sync_t_state << BEEPER_POSITION_FRACTION_BITS, std::memory_order_relaxed);
+    beeper_idle_log_active = 0;
+    beeper_resync_index.store(resume_index, std::memory_order_relaxed);
+    ay_resync_index.store(ay_event_tail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    beeper_catch_up_request.store(0, std::memory_order_relaxed);
+    if (audio_available) {
+        beeper_resync_request.store(sync_t_state + 1u, std::memory_order_release);
+    } else {
+        beeper_force_resync(sync_t_state, resume_index);
+    }
+}
 
-                if (sync2 > 0u) {
-                    if (!tape_waveform_add_pulse(waveform, (uint64_t)sync2)) {
-                        return 0;
-                    }
-                }
+// Carries out what the producer asked for since the last callback.
+static void beeper_service_requests(void) {
+    uint64_t resync = beeper_resync_request.exchange(0, std::memory_order_acq_rel);
+    if (resync != 0u) {
+        beeper_force_resync(resync - 1u, beeper_resync_index.load(std::memory_order_relaxed));
+    }
+    uint64_t catch_up = beeper_catch_up_request.exchange(0, std::memory_order_acq_rel);
+    if (catch_up != 0u) {
+        beeper_catch_up_to(catch_up);
+    }
+}
 
-                if (block->length > 0 && block->data) {
-                    for (uint32_t byte_index = 0; byte_index < block->length; ++byte_index) {
-                        uint8_t value = block->data[byte_index];
-                        uint8_t mask = 0x80u;
-                        uint8_t bits_to_emit = 8u;
-                        if (byte_index == block->length - 1u) {
-                            uint8_t used_bits = block->used_bits_in_last_byte;
-                            if (used_bits > 0u && used_bits < 8u) {
-                                bits_to_emit = used_bits;
-                            }
-                        }
-                        for (uint8_t bit = 0u; bit < bits_to_emit; ++bit) {
-                            int is_one = (value & mask) ? 1 : 0;
-                            uint16_t first = is_one ? bit1_first : bit0_first;
-                            uint16_t second = is_one ? bit1_second : bit0_second;
-                            if (!tape_waveform_add_with_pending(waveform, (uint64_t)first, &pending_silence)) {
-                                return 0;
-                            }
-                            if (!tape_waveform_add_pulse(waveform, (uint64_t)second)) {
-                                return 0;
-                            }
-                            mask >>= 1;
-                        }
-                    }
-                }
-                break;
-            }
-            case TAPE_BLOCK_TYPE_PURE_TONE: {
-                uint32_t pulse_count = block->tone_pulse_count;
-                for (uint32_t i = 0; i < pulse_count; ++i) {
-                    if (!tape_waveform_add_with_pending(waveform, (uint64_t)block->tone_pulse_tstates, &pending_silence)) {
-                        return 0;
-                    }
-                }
-                break;
-            }
-            case TAPE_BLOCK_TYPE_PULSE_SEQUENCE: {
-                for (size_t i = 0; i < block->pulse_sequence_count; ++i) {
-                    uint64_t duration = (uint64_t)block->pulse_sequence_durations[i];
-                    if (!tape_waveform_add_with_pending(waveform, duration, &pending_silence)) {
-                        return 0;
-                    }
-                }
-                break;
-            }
-            case TAPE_BLOCK_TYPE_DIRECT_RECORDING: {
-                if (block->direct_sample_count > 0u && block->direct_samples) {
-                    uint32_t samples = block->direct_sample_count;
-                    uint32_t tstates_per_sample = block->direct_tstates_per_sample ? block->direct_tstates_per_sample : 1u;
-                    int current_level = block->direct_initial_level ? 1 : 0;
-                    if (waveform->count == 0) {
-                        waveform->initial_level = current_level;
-                    }
-                    uint64_t run_length = 0;
-                    for (uint32_t sample_index = 0; sample_index < samples; ++sample_index) {
-                        uint32_t byte_index = sample_index / 8u;
-                        uint32_t bit_index = 7u - (sample_index % 8u);
-                        int level = (block->direct_samples[byte_index] >> bit_index) & 0x01;
-                        if (sample_index == 0) {
-                            current_level = level;
-                            run_length = (uint64_t)tstates_per_sample;
-                            continue;
-                        }
-                        if (level == current_level) {
-                            run_length += (uint64_t)tstates_per_sample;
-                        } else {
-                            if (!tape_waveform_add_with_pending(waveform, run_length, &pending_silence)) {
-                                return 0;
-                            }
-                            current_level = level;
-                            run_length = (uint64_t)tstates_per_sample;
-                        }
-                    }
-                    pending_silence += run_length;
-                }
-                break;
-            }
-        }
+static double beeper_playback_tstates(void) {
+    return beeper_position_to_tstates(beeper_playback_published.load(std::memory_order_acquire));
+}
 
-        pending_silence += tape_pause_to_tstates(block->pause_ms);
+static size_t beeper_pending_event_count(void) {
+    size_t head = beeper_event_head.load(std::memory_order_acquire);
+    size_t tail = beeper_event_tail.load(std::memory_order_acquire);
+
+    if (tail >= head) {
+        return tail - head;
     }
 
-    return 1;
+    return (size_t)BEEPER_EVENT_CAPACITY - head + tail;
 }
 
-static int tape_load_tap(const char* path, TapeImage* image) {
-    FILE* tf = fopen(path, "rb");
-    if (!tf) {
-        fprintf(stderr, "Failed to open TAP file '%s': %s\n", path, strerror(errno));
+static double beeper_latency_threshold(void) {
+    double threshold = beeper_latency_throttle_samples;
+    if (threshold < beeper_max_latency_samples) {
+        threshold = beeper_max_latency_samples;
+    }
+    return threshold;
+}
+
+static uint32_t beeper_recommended_throttle_delay(double latency_samples) {
+    double threshold = beeper_latency_threshold();
+    if (latency_samples <= threshold || audio_sample_rate <= 0) {
         return 0;
     }
 
-    uint8_t length_bytes[2];
-    while (fread(length_bytes, sizeof(length_bytes), 1, tf) == 1) {
-        uint32_t block_length = (uint32_t)length_bytes[0] | ((uint32_t)length_bytes[1] << 8);
-        uint8_t* buffer = NULL;
-        if (block_length > 0) {
-            buffer = (uint8_t*)malloc(block_length);
-            if (!buffer) {
-                fprintf(stderr, "Out of memory while reading TAP block\n");
-                fclose(tf);
-                return 0;
-            }
-            if (fread(buffer, block_length, 1, tf) != 1) {
-                fprintf(stderr, "Failed to read TAP block payload\n");
-                free(buffer);
-                fclose(tf);
-                return 0;
-            }
-        }
+    double over = latency_samples - threshold;
+    double limit = beeper_max_latency_samples;
+    if (limit <= 0.0) {
+        limit = 256.0;
+    }
 
-        uint32_t pause_ms = 1000u;
-        if (buffer) {
-            if (!tape_image_add_block(image, buffer, block_length, pause_ms)) {
-                fprintf(stderr, "Failed to store TAP block\n");
-                free(buffer);
-                fclose(tf);
-                return 0;
-            }
-            free(buffer);
-        } else {
-            uint8_t empty = 0;
-            if (!tape_image_add_block(image, &empty, 0u, pause_ms)) {
-                fprintf(stderr, "Failed to store empty TAP block\n");
-                fclose(tf);
-                return 0;
-            }
+    if (over <= limit * 0.1) {
+        return 0;
+    }
+
+    if (over <= limit * 0.5) {
+        return 1;
+    }
+
+    double estimated_ms = ceil((over * 1000.0) / (double)audio_sample_rate);
+    if (estimated_ms < 2.0) {
+        estimated_ms = 2.0;
+    } else if (estimated_ms > 8.0) {
+        estimated_ms = 8.0;
+    }
+
+    return (uint32_t)estimated_ms;
+}
+
+static double beeper_current_latency_samples(void) {
+    if (!audio_available || beeper_cycles_per_sample <= 0.0) {
+        beeper_latency_warning_active = 0;
+        return 0.0;
+    }
+
+    uint64_t writer_cursor;
+    uint64_t playback_position;
+
+    writer_cursor = beeper_writer_cursor.load(std::memory_order_relaxed);
+    playback_position = beeper_playback_published.load(std::memory_order_acquire);
+
+    double latency_cycles = beeper_position_to_tstates(writer_cursor) - beeper_position_to_tstates(playback_position);
+    if (latency_cycles <= 0.0) {
+        if (beeper_latency_warning_active) {
+            beeper_latency_warning_active = 0;
         }
+        return 0.0;
     }
 
-    if (!feof(tf)) {
-        fprintf(stderr, "Failed to read TAP file '%s' completely\n", path);
-        fclose(tf);
-        return 0;
+    double latency_samples = latency_cycles / beeper_cycles_per_sample;
+    if (latency_samples < 0.0) {
+        latency_samples = 0.0;
     }
 
-    fclose(tf);
-    if (tape_debug_logging) {
-        tape_log("Loaded TAP '%s' with %zu blocks\n", path, image->count);
+    double throttle_threshold = beeper_latency_threshold();
+    if (latency_samples >= throttle_threshold) {
+        if (!beeper_latency_warning_active) {
+            BEEPER_LOG(
+                "[BEEPER] latency %.2f samples exceeds throttle %.2f (clamp %.2f); throttling CPU until audio catches up\n",
+                latency_samples,
+                throttle_threshold,
+                beeper_max_latency_samples);
+            beeper_latency_warning_active = 1;
+        }
+    } else {
+        double release_threshold = beeper_latency_release_samples;
+        if (release_threshold < beeper_max_latency_samples) {
+            release_threshold = beeper_max_latency_samples;
+        }
+        if (latency_samples < release_threshold && beeper_latency_warning_active) {
+            beeper_latency_warning_active = 0;
+        }
     }
-    return 1;
+
+    return latency_samples;
 }
 
-static int tape_load_tzx(const char* path, TapeImage* image) {
-    FILE* tf = fopen(path, "rb");
-    if (!tf) {
-        fprintf(stderr, "Failed to open TZX file '%s': %s\n", path, strerror(errno));
-        return 0;
+static void beeper_set_latency_limit(double sample_limit) {
+    if (sample_limit < 64.0) {
+        sample_limit = 64.0;
     }
+    beeper_max_latency_samples = sample_limit;
 
-    uint8_t header[10];
-    if (fread(header, sizeof(header), 1, tf) != 1) {
-        fprintf(stderr, "Failed to read TZX header from '%s'\n", path);
-        fclose(tf);
-        return 0;
+    double headroom = sample_limit * 0.5;
+    if (headroom < 128.0) {
+        headroom = 128.0;
+    } else if (headroom > 2048.0) {
+        headroom = 2048.0;
     }
 
-    if (memcmp(header, "ZXTape!\x1A", 8) != 0) {
-        fprintf(stderr, "File '%s' is not a valid TZX image\n", path);
-        fclose(tf);
-        return 0;
+    beeper_latency_throttle_samples = beeper_max_latency_samples + headroom;
+
+    double release = beeper_latency_throttle_samples - headroom * 0.5;
+    if (release < beeper_max_latency_samples) {
+        release = beeper_max_latency_samples;
     }
+    beeper_latency_release_samples = release;
 
-    int block_id = 0;
-    while ((block_id = fgetc(tf)) != EOF) {
-        if (block_id == 0x10) {
-            uint8_t pause_bytes[2];
-            uint8_t length_bytes[2];
-            if (fread(pause_bytes, sizeof(pause_bytes), 1, tf) != 1 ||
-                fread(length_bytes, sizeof(length_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX block\n");
-                fclose(tf);
-                return 0;
-            }
+    double trim_margin = headroom;
+    if (trim_margin < beeper_max_latency_samples) {
+        trim_margin = beeper_max_latency_samples;
+    }
+    beeper_latency_trim_samples = beeper_latency_throttle_samples + trim_margin;
+}
 
-            uint32_t pause_ms = (uint32_t)pause_bytes[0] | ((uint32_t)pause_bytes[1] << 8);
-            uint32_t block_length = (uint32_t)length_bytes[0] | ((uint32_t)length_bytes[1] << 8);
+// Sets the rate and channel layout audio_callback() renders at and restarts
+// the playback timeline at the current tstate. A rate of zero stops the audio
+// side consuming events; AY writes then apply immediately.
+void audio_set_output_format(int sample_rate, int channels) {
+    audio_channel_count = channels > 0 ? channels : 1;
+    if (sample_rate <= 0) {
+        ay_apply_events_until(UINT64_MAX);
+        beeper_cycles_per_sample = 0.0;
+        beeper_step_q32 = 0;
+        beeper_step_position = 0;
+        beeper_step_remainder = 0;
+        ay_set_sample_rate(0);
+        return;
+    }
+    audio_sample_rate = sample_rate;
+    beeper_cycles_per_sample = CPU_CLOCK_HZ / (double)sample_rate;
+    // Until the first callback reports its size, assume AUDIO_MIX_BLOCK_FRAMES.
+    int target_request = audio_rate_target_setting.load(std::memory_order_relaxed);
+    audio_rate_target_published.store(target_request > 0
+                                          ? target_request
+                                          : 2 * AUDIO_MIX_BLOCK_FRAMES + sample_rate / 100,
+                                      std::memory_order_relaxed);
+    beeper_step_q32 = ((uint64_t)CPU_CLOCK_HZ << 32) / (uint64_t)sample_rate;
+    beeper_step_position = beeper_step_q32 >> 16;
+    beeper_step_remainder = (uint32_t)(beeper_step_q32 & 0xFFFFu);
+    ay_set_sample_rate(sample_rate);
+    beeper_reset_audio_state(total_t_states, speaker_output_level);
+}
+
+// Selects band-limited (default) or point-sampled rendering of speaker edges.
+// Takes effect at the start of the next audio buffer.
+void audio_set_band_limited_beeper(int enabled) {
+    audio_band_limit_setting.store(enabled ? 1 : 0, std::memory_order_relaxed);
+    audio_pending_settings.fetch_or(AUDIO_PENDING_BAND_LIMIT, std::memory_order_release);
+}
+
+// Enables or disables the resampling-ratio control loop. `target_samples` is
+// the buffer fill to hold; zero picks two callbacks plus half a video frame.
+// Like the beeper mode, the change is applied by the next audio buffer.
+void audio_set_rate_control(int enabled, int target_samples) {
+    audio_rate_control_setting.store(enabled ? 1 : 0, std::memory_order_relaxed);
+    audio_rate_target_setting.store(target_samples > 0 ? target_samples : 0, std::memory_order_relaxed);
+    audio_pending_settings.fetch_or(AUDIO_PENDING_RATE_CONTROL, std::memory_order_release);
+}
+
+// Called by the frame loop once the CPU has run up to `frame_end_t_state`.
+// Moves the writer cursor through stretches with no speaker edges, so the
+// rate control sees emulated time rather than the last beeper event.
+void audio_mark_frame_end(uint64_t frame_end_t_state) {
+    uint64_t position = frame_end_t_state << BEEPER_POSITION_FRACTION_BITS;
+    if (position > beeper_writer_cursor.load(std::memory_order_relaxed)) {
+        beeper_writer_cursor.store(position, std::memory_order_relaxed);
+    }
+}
+
+void audio_get_rate_stats(AudioRateStats* stats) {
+    if (!stats) {
+        return;
+    }
+    stats->fill_samples = audio_rate_fill_published.load(std::memory_order_relaxed) / 256.0;
+    stats->target_samples = (double)audio_rate_target_published.load(std::memory_order_relaxed);
+    stats->ratio = 1.0 + audio_rate_adjust_published.load(std::memory_order_relaxed) /
+                             (double)(1 << AUDIO_RATE_ADJUST_BITS);
+    stats->underruns = audio_underrun_count.load(std::memory_order_relaxed);
+    stats->overruns = audio_overrun_count.load(std::memory_order_relaxed);
+    stats->dropped_events = beeper_events_dropped.load(std::memory_order_relaxed) +
+                            ay_events_dropped.load(std::memory_order_relaxed);
+}
 
-            uint8_t* buffer = NULL;
-            if (block_length > 0u) {
-                buffer = (uint8_t*)malloc(block_length);
-                if (!buffer) {
-                    fprintf(stderr, "Out of memory while reading TZX block\n");
-                    fclose(tf);
-                    return 0;
-                }
-                if (fread(buffer, block_length, 1, tf) != 1) {
-                    fprintf(stderr, "Failed to read TZX block payload\n");
-                    free(buffer);
-                    fclose(tf);
-                    return 0;
-                }
-            }
+static void audio_dump_write_uint16(uint8_t* dst, uint16_t value) {
+    dst[0] = (uint8_t)(value & 0xFFu);
+    dst[1] = (uint8_t)((value >> 8) & 0xFFu);
+}
 
-            if (buffer) {
-                if (!tape_image_add_block(image, buffer, block_length, pause_ms == 0xFFFFu ? 0u : pause_ms)) {
-                    fprintf(stderr, "Failed to store TZX block\n");
-                    free(buffer);
-                    fclose(tf);
-                    return 0;
-                }
-                free(buffer);
+static void audio_dump_write_uint32(uint8_t* dst, uint32_t value) {
+    dst[0] = (uint8_t)(value & 0xFFu);
+    dst[1] = (uint8_t)((value >> 8) & 0xFFu);
+    dst[2] = (uint8_t)((value >> 16) & 0xFFu);
+    dst[3] = (uint8_t)((value >> 24) & 0xFFu);
+}
+
+static void audio_dump_wake(void) {
+#if defined(ESP_PLATFORM)
+    if (audio_dump_task_handle) {
+        xTaskNotifyGive(audio_dump_task_handle);
+    }
+#else
+    // Deliberately without the mutex: the worker also wakes on a timeout, so
+    // a missed notification only delays a batch.
+    audio_dump_wake_cv.notify_one();
+#endif
+}
+
+// Writes out whatever the ring holds, in at most two contiguous runs.
+static void audio_dump_drain(void) {
+    size_t head = audio_dump_head.load(std::memory_order_relaxed);
+    size_t tail = audio_dump_tail.load(std::memory_order_acquire);
+    while (head != tail) {
+        size_t offset = head & AUDIO_DUMP_RING_MASK;
+        size_t run = tail - head;
+        if (run > AUDIO_DUMP_RING_SAMPLES - offset) {
+            run = AUDIO_DUMP_RING_SAMPLES - offset;
+        }
+        if (!audio_dump_failed) {
+            size_t written = fwrite(audio_dump_ring + offset, sizeof(Sint16), run, audio_dump_file);
+            if (written != run) {
+                fprintf(stderr,
+                        "[BEEPER] audio dump write failed after %zu samples\n",
+                        (size_t)(audio_dump_data_bytes / 2u));
+                audio_dump_failed = 1;
             } else {
-                uint8_t empty = 0;
-                if (!tape_image_add_block(image, &empty, 0u, pause_ms == 0xFFFFu ? 0u : pause_ms)) {
-                    fprintf(stderr, "Failed to store empty TZX block\n");
-                    fclose(tf);
-                    return 0;
-                }
+                audio_dump_data_bytes += (uint32_t)(written * sizeof(Sint16));
             }
-        } else if (block_id == 0x11) {
-            uint8_t header_bytes[16];
-            if (fread(header_bytes, sizeof(header_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX turbo data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint16_t pilot_pulse = (uint16_t)header_bytes[0] | ((uint16_t)header_bytes[1] << 8);
-            uint16_t sync1 = (uint16_t)header_bytes[2] | ((uint16_t)header_bytes[3] << 8);
-            uint16_t sync2 = (uint16_t)header_bytes[4] | ((uint16_t)header_bytes[5] << 8);
-            uint16_t bit0_first = (uint16_t)header_bytes[6] | ((uint16_t)header_bytes[7] << 8);
-            uint16_t bit0_second = (uint16_t)header_bytes[8] | ((uint16_t)header_bytes[9] << 8);
-            uint16_t bit1_first = (uint16_t)header_bytes[10] | ((uint16_t)header_bytes[11] << 8);
-            uint16_t bit1_second = (uint16_t)header_bytes[12] | ((uint16_t)header_bytes[13] << 8);
-            uint16_t pilot_count = (uint16_t)header_bytes[14] | ((uint16_t)header_bytes[15] << 8);
-            int used_bits = fgetc(tf);
-            if (used_bits == EOF) {
-                fprintf(stderr, "Truncated TZX turbo data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint8_t pause_bytes[2];
-            if (fread(pause_bytes, sizeof(pause_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX turbo data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint8_t length_bytes[3];
-            if (fread(length_bytes, sizeof(length_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX turbo data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint32_t pause_ms = (uint32_t)pause_bytes[0] | ((uint32_t)pause_bytes[1] << 8);
-            uint32_t block_length = (uint32_t)length_bytes[0] |
-                                    ((uint32_t)length_bytes[1] << 8) |
-                                    ((uint32_t)length_bytes[2] << 16);
-            uint8_t* buffer = NULL;
-            if (block_length > 0u) {
-                buffer = (uint8_t*)malloc(block_length);
-                if (!buffer) {
-                    fprintf(stderr, "Out of memory while reading TZX turbo block\n");
-                    fclose(tf);
-                    return 0;
-                }
-                if (fread(buffer, block_length, 1, tf) != 1) {
-                    fprintf(stderr, "Failed to read TZX turbo block payload\n");
-                    free(buffer);
-                    fclose(tf);
-                    return 0;
-                }
-            }
-            if (!tape_image_add_turbo_block(image,
-                                            buffer,
-                                            block_length,
-                                            pause_ms == 0xFFFFu ? 0u : pause_ms,
-                                            pilot_pulse,
-                                            pilot_count,
-                                            sync1,
-                                            sync2,
-                                            bit0_first,
-                                            bit0_second,
-                                            bit1_first,
-                                            bit1_second,
-                                            (uint8_t)(used_bits & 0xFF))) {
-                fprintf(stderr, "Failed to store TZX turbo block\n");
-                free(buffer);
-                fclose(tf);
-                return 0;
-            }
-            free(buffer);
-        } else if (block_id == 0x12) {
-            uint8_t tone_bytes[4];
-            if (fread(tone_bytes, sizeof(tone_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX pure tone block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint16_t pulse_length = (uint16_t)tone_bytes[0] | ((uint16_t)tone_bytes[1] << 8);
-            uint16_t pulse_count = (uint16_t)tone_bytes[2] | ((uint16_t)tone_bytes[3] << 8);
-            if (!tape_image_add_pure_tone_block(image, pulse_length, pulse_count, 0u)) {
-                fprintf(stderr, "Failed to store TZX pure tone block\n");
-                fclose(tf);
-                return 0;
-            }
-        } else if (block_id == 0x13) {
-            int pulse_count = fgetc(tf);
-            if (pulse_count == EOF) {
-                fprintf(stderr, "Truncated TZX pulse sequence block\n");
-                fclose(tf);
-                return 0;
-            }
-            if (pulse_count == 0) {
-                continue;
-            }
-            size_t count = (size_t)(pulse_count & 0xFF);
-            uint16_t* durations = (uint16_t*)malloc(count * sizeof(uint16_t));
-            if (!durations) {
-                fprintf(stderr, "Out of memory while reading pulse sequence\n");
-                fclose(tf);
-                return 0;
-            }
-            for (size_t i = 0; i < count; ++i) {
-                uint8_t duration_bytes[2];
-                if (fread(duration_bytes, sizeof(duration_bytes), 1, tf) != 1) {
-                    fprintf(stderr, "Truncated TZX pulse sequence block\n");
-                    free(durations);
-                    fclose(tf);
-                    return 0;
-                }
-                durations[i] = (uint16_t)duration_bytes[0] | ((uint16_t)duration_bytes[1] << 8);
-            }
-            if (!tape_image_add_pulse_sequence_block(image, durations, count, 0u)) {
-                fprintf(stderr, "Failed to store TZX pulse sequence block\n");
-                free(durations);
-                fclose(tf);
-                return 0;
-            }
-            free(durations);
-        } else if (block_id == 0x14) {
-            uint8_t header_bytes[8];
-            if (fread(header_bytes, sizeof(header_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX pure data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint16_t bit0_first = (uint16_t)header_bytes[0] | ((uint16_t)header_bytes[1] << 8);
-            uint16_t bit0_second = (uint16_t)header_bytes[2] | ((uint16_t)header_bytes[3] << 8);
-            uint16_t bit1_first = (uint16_t)header_bytes[4] | ((uint16_t)header_bytes[5] << 8);
-            uint16_t bit1_second = (uint16_t)header_bytes[6] | ((uint16_t)header_bytes[7] << 8);
-            int used_bits = fgetc(tf);
-            if (used_bits == EOF) {
-                fprintf(stderr, "Truncated TZX pure data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint8_t pause_bytes[2];
-            if (fread(pause_bytes, sizeof(pause_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX pure data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint8_t length_bytes[3];
-            if (fread(length_bytes, sizeof(length_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX pure data block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint32_t pause_ms = (uint32_t)pause_bytes[0] | ((uint32_t)pause_bytes[1] << 8);
-            uint32_t block_length = (uint32_t)length_bytes[0] |
-                                    ((uint32_t)length_bytes[1] << 8) |
-                                    ((uint32_t)length_bytes[2] << 16);
-            uint8_t* buffer = NULL;
-            if (block_length > 0u) {
-                buffer = (uint8_t*)malloc(block_length);
-                if (!buffer) {
-                    fprintf(stderr, "Out of memory while reading TZX pure data block\n");
-                    fclose(tf);
-                    return 0;
-                }
-                if (fread(buffer, block_length, 1, tf) != 1) {
-                    fprintf(stderr, "Failed to read TZX pure data block payload\n");
-                    free(buffer);
-                    fclose(tf);
-                    return 0;
-                }
-            }
-            if (!tape_image_add_pure_data_block(image,
-                                                buffer,
-                                                block_length,
-                                                pause_ms == 0xFFFFu ? 0u : pause_ms,
-                                                bit0_first,
-                                                bit0_second,
-                                                bit1_first,
-                                                bit1_second,
-                                                (uint8_t)(used_bits & 0xFF))) {
-                fprintf(stderr, "Failed to store TZX pure data block\n");
-                free(buffer);
-                fclose(tf);
-                return 0;
-            }
-            free(buffer);
-        } else if (block_id == 0x15) {
-            uint8_t header_bytes[5];
-            if (fread(header_bytes, sizeof(header_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX direct recording block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint16_t sample_tstates = (uint16_t)header_bytes[0] | ((uint16_t)header_bytes[1] << 8);
-            uint16_t pause_ms = (uint16_t)header_bytes[2] | ((uint16_t)header_bytes[3] << 8);
-            uint8_t used_bits = header_bytes[4];
-            uint8_t length_bytes[3];
-            if (fread(length_bytes, sizeof(length_bytes), 1, tf) != 1) {
-                fprintf(stderr, "Truncated TZX direct recording block\n");
-                fclose(tf);
-                return 0;
-            }
-            uint32_t sample_bytes = (uint32_t)length_bytes[0] |
-                                     ((uint32_t)length_bytes[1] << 8) |
-                                     ((uint32_t)length_bytes[2] << 16);
-            uint8_t* buffer = NULL;
-            if (sample_bytes > 0u) {
-                buffer = (uint8_t*)malloc(sample_bytes);
-                if (!buffer) {
-                    fprintf(stderr, "Out of memory while reading TZX direct recording block\n");
-                    fclose(tf);
-                    return 0;
-                }
-                if (fread(buffer, sample_bytes, 1, tf) != 1) {
-                    fprintf(stderr, "Failed to read TZX direct recording block payload\n");
-                    free(buffer);
-                    fclose(tf);
-                    return 0;
-                }
-            }
-            if (!tape_image_add_direct_recording_block(image,
-                                                       sample_tstates,
-                                                       buffer,
-                                                       sample_bytes,
-                                                       used_bits,
-                                                       pause_ms == 0xFFFFu ? 0u : (uint32_t)pause_ms)) {
-                fprintf(stderr, "Failed to store TZX direct recording block\n");
-                free(buffer);
-                fclose(tf);
-                return 0;
-            }
-            free(buffer);
-        } else {
-            fprintf(stderr, "Unsupported TZX block type 0x%02X in '%s'\n", block_id, path);
-            fclose(tf);
-            return 0;
         }
+        head += run;
+        audio_dump_head.store(head, std::memory_order_release);
     }
-
-    fclose(tf);
-    return 1;
 }
 
-static int z80_decompress_stream(FILE* sf, uint8_t* dest, size_t dest_size) {
-    if (!sf || !dest) {
-        return 0;
-    }
-
-    size_t dest_index = 0;
-    while (dest_index < dest_size) {
-        int byte_value = fgetc(sf);
-        if (byte_value == EOF) {
-            return 0;
+static void audio_dump_worker(void) {
+    uint64_t reported_dropped = 0;
+    while (audio_dump_running.load(std::memory_order_acquire)) {
+#if defined(ESP_PLATFORM)
+        (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUDIO_DUMP_POLL_MS));
+#else
+        {
+            std::unique_lock<std::mutex> lock(audio_dump_wake_mutex);
+            audio_dump_wake_cv.wait_for(lock, std::chrono::milliseconds(AUDIO_DUMP_POLL_MS));
         }
-        if (byte_value != 0xED) {
-            dest[dest_index++] = (uint8_t)byte_value;
-            continue;
+#endif
+        audio_dump_drain();
+        uint64_t dropped = audio_dump_dropped_samples.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            BEEPER_LOG("[BEEPER] audio dump storage falling behind: %llu samples dropped\n",
+                       (unsigned long long)dropped);
+            reported_dropped = dropped;
         }
+    }
+    audio_dump_drain();
+}
 
-        int next_value = fgetc(sf);
-        if (next_value == EOF) {
-            return 0;
-        }
-        if (next_value != 0xED) {
-            dest[dest_index++] = 0xED;
-            if (ungetc(next_value, sf) == EOF) {
-                return 0;
-            }
-            continue;
-        }
+#if defined(ESP_PLATFORM)
+static void audio_dump_task(void* param) {
+    (void)param;
+    audio_dump_worker();
+    audio_dump_task_exited.store(1, std::memory_order_release);
+    vTaskDelete(NULL);
+}
+#endif
 
-        int count_value = fgetc(sf);
-        int data_value = fgetc(sf);
-        if (count_value == EOF || data_value == EOF) {
-            return 0;
-        }
-        size_t repeat = (count_value == 0) ? 256u : (size_t)count_value;
-        for (size_t i = 0; i < repeat; ++i) {
-            if (dest_index >= dest_size) {
-                return 0;
-            }
-            dest[dest_index++] = (uint8_t)data_value;
-        }
+// Writes a 16-bit PCM WAV header with zero sizes; audio_dump_patch_sizes()
+// fills them in once the length is known.
+static int audio_dump_write_header(FILE* file, uint32_t sample_rate, uint16_t channels) {
+    uint8_t header[44];
+    memset(header, 0, sizeof(header));
+
+    memcpy(header, "RIFF", 4);
+    audio_dump_write_uint32(header + 4, 36u);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    audio_dump_write_uint32(header + 16, 16u); // PCM chunk size
+    audio_dump_write_uint16(header + 20, 1u);  // PCM format
+    audio_dump_write_uint16(header + 22, channels);
+    audio_dump_write_uint32(header + 24, sample_rate);
+    uint32_t byte_rate = sample_rate * channels * (uint32_t)sizeof(Sint16);
+    audio_dump_write_uint32(header + 28, byte_rate);
+    uint16_t block_align = (uint16_t)(channels * (uint16_t)sizeof(Sint16));
+    audio_dump_write_uint16(header + 32, block_align);
+    audio_dump_write_uint16(header + 34, 16u); // bits per sample
+    memcpy(header + 36, "data", 4);
+    audio_dump_write_uint32(header + 40, 0u);
+
+    return fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+static void audio_dump_patch_sizes(FILE* file, uint32_t data_bytes) {
+    if (fseek(file, 4L, SEEK_SET) == 0) {
+        uint8_t size_bytes[4];
+        audio_dump_write_uint32(size_bytes, 36u + data_bytes);
+        fwrite(size_bytes, sizeof(size_bytes), 1, file);
     }
 
-    return 1;
+    if (fseek(file, 40L, SEEK_SET) == 0) {
+        uint8_t data_bytes_buf[4];
+        audio_dump_write_uint32(data_bytes_buf, data_bytes);
+        fwrite(data_bytes_buf, sizeof(data_bytes_buf), 1, file);
+    }
 }
 
-static int z80_decompress_block_buffer(const uint8_t* src,
-                                       size_t src_len,
-                                       uint8_t* dest,
-                                       size_t dest_len) {
-    if (!src || !dest) {
+static int audio_dump_start(const char* path, uint32_t sample_rate, uint16_t channels) {
+    if (!path || channels == 0u) {
         return 0;
     }
+    if (audio_dump_file) {
+        audio_dump_finish();
+    }
 
-    size_t src_index = 0;
-    size_t dest_index = 0;
-    while (dest_index < dest_len && src_index < src_len) {
-        uint8_t value = src[src_index++];
-        if (value != 0xED || src_index >= src_len) {
-            dest[dest_index++] = value;
-            continue;
-        }
+    audio_dump_file = fopen(path, "wb");
+    if (!audio_dump_file) {
+        fprintf(stderr, "[BEEPER] failed to open audio dump '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
 
-        uint8_t next = src[src_index];
-        if (next != 0xED) {
-            dest[dest_index++] = value;
-            continue;
-        }
+    audio_dump_data_bytes = 0;
+    audio_dump_channels = channels;
+    audio_dump_failed = 0;
 
-        src_index++;
-        if (src_index + 2 > src_len) {
-            return 0;
+    if (!audio_dump_write_header(audio_dump_file, sample_rate, channels)) {
+        fprintf(stderr, "[BEEPER] failed to write WAV header to '%s'\n", path);
+        audio_dump_abort();
+        return 0;
+    }
+
+    if (!audio_dump_ring) {
+#if defined(ESP_PLATFORM)
+        audio_dump_ring = (Sint16*)heap_caps_malloc(AUDIO_DUMP_RING_SAMPLES * sizeof(Sint16),
+                                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+        if (!audio_dump_ring) {
+            audio_dump_ring = (Sint16*)malloc(AUDIO_DUMP_RING_SAMPLES * sizeof(Sint16));
         }
-        uint8_t count_byte = src[src_index++];
-        uint8_t data_byte = src[src_index++];
-        size_t repeat = (count_byte == 0) ? 256u : (size_t)count_byte;
-        for (size_t i = 0; i < repeat; ++i) {
-            if (dest_index >= dest_len) {
-                return 0;
-            }
-            dest[dest_index++] = data_byte;
+        if (!audio_dump_ring) {
+            fprintf(stderr, "[BEEPER] failed to allocate audio dump buffer\n");
+            audio_dump_abort();
+            return 0;
         }
     }
+    audio_dump_head.store(0, std::memory_order_relaxed);
+    audio_dump_tail.store(0, std::memory_order_relaxed);
+    audio_dump_dropped_samples.store(0, std::memory_order_relaxed);
+    audio_dump_running.store(1, std::memory_order_release);
 
-    return dest_index == dest_len;
+#if defined(ESP_PLATFORM)
+    audio_dump_task_exited.store(0, std::memory_order_release);
+    if (xTaskCreatePinnedToCore(audio_dump_task,
+                                "spectrum_wav",
+                                AUDIO_DUMP_TASK_STACK,
+                                NULL,
+                                tskIDLE_PRIORITY + 1,
+                                &audio_dump_task_handle,
+                                AUDIO_DUMP_TASK_CORE) != pdPASS) {
+        audio_dump_task_handle = NULL;
+        audio_dump_task_exited.store(1, std::memory_order_release);
+        audio_dump_running.store(0, std::memory_order_release);
+        fprintf(stderr, "[BEEPER] failed to start audio dump task\n");
+        audio_dump_abort();
+        return 0;
+    }
+#else
+    try {
+        audio_dump_thread = std::thread(audio_dump_worker);
+    } catch (...) {
+        audio_dump_running.store(0, std::memory_order_release);
+        fprintf(stderr, "[BEEPER] failed to start audio dump thread\n");
+        audio_dump_abort();
+        return 0;
+    }
+#endif
+
+    audio_dump_active.store(1, std::memory_order_release);
+    BEEPER_LOG("[BEEPER] dumping audio to %s\n", path);
+    return 1;
 }
 
-static SnapshotFormat snapshot_format_from_extension(const char* path) {
-    if (!path) {
-        return SNAPSHOT_FORMAT_NONE;
+// Stops the worker (after it has drained the ring) so the file is no longer
+// shared with another thread.
+static void audio_dump_stop_worker(void) {
+    audio_dump_active.store(0, std::memory_order_release);
+    if (!audio_dump_running.load(std::memory_order_acquire)) {
+        return;
     }
-
-    if (string_ends_with_case_insensitive(path, ".sna")) {
-        return SNAPSHOT_FORMAT_SNA;
+    audio_dump_running.store(0, std::memory_order_release);
+#if defined(ESP_PLATFORM)
+    if (audio_dump_task_handle) {
+        xTaskNotifyGive(audio_dump_task_handle);
     }
-    if (string_ends_with_case_insensitive(path, ".z80")) {
-        return SNAPSHOT_FORMAT_Z80;
+    while (!audio_dump_task_exited.load(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+    audio_dump_task_handle = NULL;
+#else
+    audio_dump_wake();
+    if (audio_dump_thread.joinable()) {
+        audio_dump_thread.join();
     }
+#endif
+}
 
-    return SNAPSHOT_FORMAT_NONE;
+static void audio_dump_abort(void) {
+    audio_dump_stop_worker();
+    if (audio_dump_file) {
+        fclose(audio_dump_file);
+        audio_dump_file = NULL;
+    }
+    audio_dump_data_bytes = 0;
 }
 
-static int snapshot_load_sna(const char* path, Z80* cpu) {
-    if (!path || !cpu) {
-        return 0;
+// Called from audio_callback(): never blocks and never touches the file.
+static void audio_dump_write_samples(const Sint16* samples, size_t count) {
+    if (!audio_dump_active.load(std::memory_order_acquire) || !audio_dump_ring || !samples || count == 0) {
+        return;
     }
 
-    FILE* sf = fopen(path, "rb");
-    if (!sf) {
-        fprintf(stderr, "Failed to open SNA snapshot '%s': %s\n", path, strerror(errno));
-        return 0;
+    size_t tail = audio_dump_tail.load(std::memory_order_relaxed);
+    size_t head = audio_dump_head.load(std::memory_order_acquire);
+    if (count > AUDIO_DUMP_RING_SAMPLES - (tail - head)) {
+        audio_dump_dropped_samples.fetch_add(count, std::memory_order_relaxed);
+        return;
     }
 
-    uint8_t header[27];
-    if (fread(header, sizeof(header), 1, sf) != 1) {
-        fprintf(stderr, "Failed to read SNA header from '%s'\n", path);
-        fclose(sf);
-        return 0;
+    size_t offset = tail & AUDIO_DUMP_RING_MASK;
+    size_t first = AUDIO_DUMP_RING_SAMPLES - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(audio_dump_ring + offset, samples, first * sizeof(Sint16));
+    if (count > first) {
+        memcpy(audio_dump_ring, samples + first, (count - first) * sizeof(Sint16));
     }
+    audio_dump_tail.store(tail + count, std::memory_order_release);
 
-    cpu->reg_I = header[0];
-    uint16_t hl_alt = (uint16_t)header[1] | ((uint16_t)header[2] << 8);
-    uint16_t de_alt = (uint16_t)header[3] | ((uint16_t)header[4] << 8);
-    uint16_t bc_alt = (uint16_t)header[5] | ((uint16_t)header[6] << 8);
-    uint16_t af_alt = (uint16_t)header[7] | ((uint16_t)header[8] << 8);
-    uint16_t hl = (uint16_t)header[9] | ((uint16_t)header[10] << 8);
-    uint16_t de = (uint16_t)header[11] | ((uint16_t)header[12] << 8);
-    uint16_t bc = (uint16_t)header[13] | ((uint16_t)header[14] << 8);
-    uint16_t iy = (uint16_t)header[15] | ((uint16_t)header[16] << 8);
-    uint16_t ix = (uint16_t)header[17] | ((uint16_t)header[18] << 8);
-    uint8_t iff2 = header[19];
-    uint8_t r = header[20];
-    uint16_t af = (uint16_t)header[21] | ((uint16_t)header[22] << 8);
-    uint16_t sp = (uint16_t)header[23] | ((uint16_t)header[24] << 8);
-    uint8_t interrupt_mode = header[25];
-    uint8_t border = header[26] & 0x07u;
+    if (((tail + count) - head) >= AUDIO_DUMP_BATCH_SAMPLES) {
+        audio_dump_wake();
+    }
+}
 
-    cpu->alt_reg_L = (uint8_t)(hl_alt & 0xFFu);
-    cpu->alt_reg_H = (uint8_t)(hl_alt >> 8);
-    cpu->alt_reg_E = (uint8_t)(de_alt & 0xFFu);
-    cpu->alt_reg_D = (uint8_t)(de_alt >> 8);
-    cpu->alt_reg_C = (uint8_t)(bc_alt & 0xFFu);
-    cpu->alt_reg_B = (uint8_t)(bc_alt >> 8);
-    cpu->alt_reg_F = (uint8_t)(af_alt & 0xFFu);
-    cpu->alt_reg_A = (uint8_t)(af_alt >> 8);
+static void audio_dump_finish(void) {
+    if (!audio_dump_file) {
+        return;
+    }
 
-    cpu->reg_L = (uint8_t)(hl & 0xFFu);
-    cpu->reg_H = (uint8_t)(hl >> 8);
-    cpu->reg_E = (uint8_t)(de & 0xFFu);
-    cpu->reg_D = (uint8_t)(de >> 8);
-    cpu->reg_C = (uint8_t)(bc & 0xFFu);
-    cpu->reg_B = (uint8_t)(bc >> 8);
-    cpu->reg_IY = iy;
-    cpu->reg_IX = ix;
-    cpu->iff2 = (iff2 & 0x01u) ? 1 : 0;
-    cpu->iff1 = cpu->iff2;
-    cpu->reg_R = r;
-    cpu->reg_F = (uint8_t)(af & 0xFFu);
-    cpu->reg_A = (uint8_t)(af >> 8);
-    cpu->reg_SP = sp;
-    cpu->interruptMode = (int)(interrupt_mode & 0x03u);
-    cpu->ei_delay = 0;
-    cpu->halted = 0;
+    audio_dump_stop_worker();
+    audio_dump_patch_sizes(audio_dump_file, audio_dump_data_bytes);
 
-    border_color_idx = border;
+    uint64_t dropped = audio_dump_dropped_samples.load(std::memory_order_relaxed);
+    if (dropped > 0u) {
+        fprintf(stderr, "[BEEPER] audio dump dropped %llu samples (storage too slow)\n", (unsigned long long)dropped);
+    }
 
-    uint8_t* ram_buffer = (uint8_t*)malloc(0xC000u);
-    if (!ram_buffer) {
-        fprintf(stderr, "Out of memory loading SNA snapshot\n");
-        fclose(sf);
+    fclose(audio_dump_file);
+    audio_dump_file = NULL;
+    audio_dump_data_bytes = 0;
+}
+
+static uint64_t tape_pause_to_tstates(uint32_t pause_ms) {
+    if (pause_ms == 0) {
         return 0;
     }
-
-    if (fread(ram_buffer, 0xC000u, 1, sf) != 1) {
-        fprintf(stderr, "Failed to read SNA RAM image from '%s'\n", path);
-        free(ram_buffer);
-        fclose(sf);
+    double tstates = ((double)pause_ms / 1000.0) * CPU_CLOCK_HZ;
+    if (tstates <= 0.0) {
         return 0;
     }
+    return (uint64_t)(tstates + 0.5);
+}
 
-    uint8_t pc_bytes[2];
-    if (fread(pc_bytes, sizeof(pc_bytes), 1, sf) != 1) {
-        fprintf(stderr, "Failed to read SNA program counter from '%s'\n", path);
-        free(ram_buffer);
-        fclose(sf);
-        return 0;
+static const char* tape_header_type_name(uint8_t header_type) {
+    switch (header_type) {
+        case 0x00:
+            return "Program";
+        case 0x01:
+            return "Number array";
+        case 0x02:
+            return "Character array";
+        case 0x03:
+            return "Bytes";
+        default:
+            return "Unknown";
     }
-    uint16_t pc = (uint16_t)pc_bytes[0] | ((uint16_t)pc_bytes[1] << 8);
-    cpu->reg_PC = pc;
+}
 
-    long extension_pos = ftell(sf);
-    size_t extension_bytes = 0u;
-    if (extension_pos >= 0 && fseek(sf, 0, SEEK_END) == 0) {
-        long end_pos = ftell(sf);
-        if (end_pos >= extension_pos) {
-            extension_bytes = (size_t)(end_pos - extension_pos);
-        }
-        if (fseek(sf, extension_pos, SEEK_SET) != 0) {
-            fprintf(stderr, "Failed to seek within SNA snapshot '%s'\n", path);
-            free(ram_buffer);
-            fclose(sf);
-            return 0;
-        }
+static void tape_log_block_summary(const TapeBlock* block, size_t index) {
+    if (!tape_debug_logging) {
+        return;
     }
 
-    int loaded_ok = 0;
-    if (extension_bytes == 0u) {
-        spectrum_configure_model(SPECTRUM_MODEL_48K);
-        memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
-        memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
-        memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
-        spectrum_apply_memory_configuration();
-        spectrum_refresh_visible_ram();
-        loaded_ok = 1;
-    } else {
-        size_t required_bytes = 2u + (size_t)8u * 0x4000u;
-        if (extension_bytes < required_bytes) {
-            fprintf(stderr, "SNA snapshot '%s' truncated 128K payload (%zu bytes)\n",
-                    path,
-                    extension_bytes);
-        } else {
-            uint8_t port_7ffd = 0u;
-            uint8_t trdos_flag = 0u;
-            if (fread(&port_7ffd, 1, 1, sf) != 1 || fread(&trdos_flag, 1, 1, sf) != 1) {
-                fprintf(stderr, "Failed to read SNA 128K gate-array state from '%s'\n", path);
-            } else {
-                (void)trdos_flag;
-                loaded_ok = 1;
-                for (int bank = 0; bank < 8; ++bank) {
-                    if (fread(ram_pages[bank], 0x4000u, 1, sf) != 1) {
-                        fprintf(stderr, "Failed to read SNA 128K RAM bank %d from '%s'\n",
-                                bank,
-                                path);
-                        loaded_ok = 0;
-                        break;
-                    }
-                }
+    if (!block) {
+        tape_log("Block %zu: <null>\n", index);
+        return;
+    }
+
+    tape_log("Block %zu: type=%d length=%u pause=%u", index, (int)block->type, block->length, block->pause_ms);
+
+    switch (block->type) {
+        case TAPE_BLOCK_TYPE_STANDARD:
+        case TAPE_BLOCK_TYPE_TURBO:
+        case TAPE_BLOCK_TYPE_PURE_DATA: {
+            if (!block->data || block->length == 0) {
+                tape_log(" (empty)\n");
+                return;
             }
 
-            if (loaded_ok) {
-                size_t consumed = required_bytes;
-                uint8_t port_1ffd = 0u;
-                int have_1ffd = 0;
-                if (extension_bytes > consumed) {
-                    size_t remaining = extension_bytes - consumed;
-                    if (remaining >= 1u) {
-                        if (fread(&port_1ffd, 1, 1, sf) != 1) {
-                            fprintf(stderr, "Failed to read SNA 128K 1FFD state from '%s'\n", path);
-                            loaded_ok = 0;
-                        } else {
-                            have_1ffd = 1;
-                            consumed += 1u;
-                        }
-                    }
-                    if (loaded_ok && extension_bytes > consumed) {
-                        fprintf(stderr,
-                                "SNA snapshot '%s' has %zu unexpected padding bytes\n",
-                                path,
-                                extension_bytes - consumed);
-                        loaded_ok = 0;
-                    }
-                }
+            uint8_t flag = block->data[0];
+            tape_log(" flag=0x%02X", flag);
 
-                if (loaded_ok) {
-                    SpectrumModel preferred = spectrum_model;
-                    SpectrumModel target_model;
-                    if (have_1ffd) {
-                        if (preferred == SPECTRUM_MODEL_PLUS2A || preferred == SPECTRUM_MODEL_PLUS3) {
-                            target_model = preferred;
-                        } else {
-                            target_model = SPECTRUM_MODEL_PLUS2A;
+            if (flag == 0x00 && block->length >= 19) {
+                uint8_t header_type = block->data[1];
+                char name[11];
+                size_t copy_len = 10u;
+                size_t available = 0u;
+                if (block->length > 2u) {
+                    available = block->length - 2u;
+                }
+                if (available < copy_len) {
+                    copy_len = available;
+                }
+                memset(name, '\0', sizeof(name));
+                if (copy_len > 0u) {
+                    memcpy(name, &block->data[2], copy_len);
+                    for (size_t i = 0; i < copy_len; ++i) {
+                        if ((unsigned char)name[i] < 32u || (unsigned char)name[i] > 126u) {
+                            name[i] = '?';
                         }
-                    } else {
-                        if (preferred == SPECTRUM_MODEL_128K ||
-                            preferred == SPECTRUM_MODEL_PLUS2A ||
-                            preferred == SPECTRUM_MODEL_PLUS3) {
-                            target_model = preferred;
+                    }
+                    for (int i = (int)copy_len - 1; i >= 0; --i) {
+                        if (name[i] == ' ') {
+                            name[i] = '\0';
                         } else {
-                            target_model = SPECTRUM_MODEL_128K;
+                            break;
                         }
                     }
-
-                    spectrum_configure_model(target_model);
-
-                    gate_array_7ffd_state = (uint8_t)(port_7ffd & 0x3Fu);
-                    paging_disabled = (gate_array_7ffd_state & 0x20u) ? 1 : 0;
-                    current_paged_bank = (uint8_t)(gate_array_7ffd_state & 0x07u);
-                    if (target_model == SPECTRUM_MODEL_PLUS2A || target_model == SPECTRUM_MODEL_PLUS3) {
-                        gate_array_1ffd_state = have_1ffd ? (uint8_t)(port_1ffd & 0x07u) : 0u;
-                    } else {
-                        gate_array_1ffd_state = 0u;
-                    }
-
-                    spectrum_apply_memory_configuration();
-                    spectrum_refresh_visible_ram();
                 }
+                uint16_t data_length = (uint16_t)block->data[12] | ((uint16_t)block->data[13] << 8);
+                uint16_t param1 = (uint16_t)block->data[14] | ((uint16_t)block->data[15] << 8);
+                uint16_t param2 = (uint16_t)block->data[16] | ((uint16_t)block->data[17] << 8);
+                tape_log(" header=%s name='%s' data_len=%u param1=%u param2=%u\n",
+                         tape_header_type_name(header_type),
+                         name,
+                         data_length,
+                         param1,
+                         param2);
+                return;
             }
-        }
-    }
-
-    free(ram_buffer);
 
-    if (!loaded_ok) {
-        fclose(sf);
-        return 0;
-    }
+            if (flag == 0xFF && block->length >= 2) {
+                uint32_t payload_length = block->length - 2u;
+                uint8_t checksum = block->data[block->length - 1];
+                tape_log(" data payload_len=%u checksum=0x%02X\n", payload_length, checksum);
+                return;
+            }
 
-    fclose(sf);
-
-    fprintf(stderr,
-            "SNA snapshot '%s': model=%s PC=%04X SP=%04X IM=%d border=%u bank=%u rom=%u %s\n",
-            path,
-            spectrum_model_to_string(spectrum_model),
-            (unsigned)cpu->reg_PC,
-            (unsigned)cpu->reg_SP,
-            cpu->interruptMode,
-            (unsigned)border,
-            (unsigned)current_paged_bank,
-            (unsigned)current_rom_page,
-            paging_disabled ? "paging=locked" : "paging=unlocked");
-    return 1;
+            tape_log("\n");
+            return;
+        }
+        case TAPE_BLOCK_TYPE_PURE_TONE:
+            tape_log(" tone pulses=%u length=%u\n",
+                     (unsigned)block->tone_pulse_count,
+                     (unsigned)block->tone_pulse_tstates);
+            return;
+        case TAPE_BLOCK_TYPE_PULSE_SEQUENCE:
+            tape_log(" pulse-seq count=%zu\n", block->pulse_sequence_count);
+            return;
+        case TAPE_BLOCK_TYPE_DIRECT_RECORDING:
+            tape_log(" direct samples=%u tstates/sample=%u\n",
+                     (unsigned)block->direct_sample_count,
+                     (unsigned)block->direct_tstates_per_sample);
+            return;
+        case TAPE_BLOCK_TYPE_CSW:
+            tape_log(" csw rate=%u\n", (unsigned)block->csw_sample_rate);
+            return;
+        case TAPE_BLOCK_TYPE_PZX_PULSES:
+        case TAPE_BLOCK_TYPE_PZX_DATA:
+            tape_log(" pzx %s\n", block->type == TAPE_BLOCK_TYPE_PZX_DATA ? "data" : "pulses");
+            return;
+    }
 }
 
-static SpectrumModel z80_hardware_mode_to_model(uint8_t hardware_mode) {
-    switch (hardware_mode) {
-        case 3:
-        case 4:
-        case 5:
-            return SPECTRUM_MODEL_128K;
-        case 6:
-            return SPECTRUM_MODEL_PLUS2A;
-        case 7:
-            return SPECTRUM_MODEL_PLUS3;
-        case 0:
-        case 1:
-        case 2:
-        default:
-            return SPECTRUM_MODEL_48K;
+static void tape_free_image(TapeImage* image) {
+    if (!image) {
+        return;
+    }
+    if (image->blocks) {
+        for (size_t i = 0; i < image->count; ++i) {
+            if (!image->blocks[i].in_arena) {
+                free(image->blocks[i].data);
+                free(image->blocks[i].direct_samples);
+            }
+            image->blocks[i].data = NULL;
+            image->blocks[i].direct_samples = NULL;
+            free(image->blocks[i].pulse_sequence_durations);
+            image->blocks[i].pulse_sequence_durations = NULL;
+        }
+        free(image->blocks);
     }
+    image->blocks = NULL;
+    image->count = 0;
+    image->capacity = 0;
+    free(image->timeline);
+    image->timeline = NULL;
+    image->length_tstates = 0;
+    free(image->arena);
+    image->arena = NULL;
 }
 
-static int z80_map_page_id_to_offset(int page_id, size_t* offset, uint8_t* mask_bit) {
-    if (!offset || !mask_bit) {
-        return 0;
+static TapeBlock* tape_image_new_block(TapeImage* image) {
+    if (!image) {
+        return NULL;
     }
 
-    switch (page_id) {
-        case 8:
-            *offset = 0x0000u;
-            *mask_bit = 0x01u;
-            return 1;
-        case 4:
-            *offset = 0x4000u;
-            *mask_bit = 0x02u;
-            return 1;
-        case 5:
-            *offset = 0x8000u;
-            *mask_bit = 0x04u;
-            return 1;
-        default:
-            break;
+    free(image->timeline);
+    image->timeline = NULL;
+
+    if (image->count == image->capacity) {
+        size_t new_capacity = image->capacity ? image->capacity * 2 : 8;
+        TapeBlock* new_blocks = (TapeBlock*)realloc(image->blocks, new_capacity * sizeof(TapeBlock));
+        if (!new_blocks) {
+            return NULL;
+        }
+        image->blocks = new_blocks;
+        image->capacity = new_capacity;
     }
 
-    return 0;
+    TapeBlock* block = &image->blocks[image->count];
+    block->type = TAPE_BLOCK_TYPE_STANDARD;
+    block->length = 0u;
+    block->pause_ms = 0u;
+    block->data = NULL;
+    block->used_bits_in_last_byte = 8u;
+    block->pilot_pulse_tstates = (uint16_t)TAPE_PILOT_PULSE_TSTATES;
+    block->pilot_pulse_count = 0u;
+    block->sync_first_pulse_tstates = (uint16_t)TAPE_SYNC_FIRST_PULSE_TSTATES;
+    block->sync_second_pulse_tstates = (uint16_t)TAPE_SYNC_SECOND_PULSE_TSTATES;
+    block->bit0_first_pulse_tstates = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
+    block->bit0_second_pulse_tstates = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
+    block->bit1_first_pulse_tstates = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
+    block->bit1_second_pulse_tstates = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
+    block->tone_pulse_tstates = 0u;
+    block->tone_pulse_count = 0u;
+    block->pulse_sequence_durations = NULL;
+    block->pulse_sequence_count = 0u;
+    block->direct_tstates_per_sample = 0u;
+    block->direct_samples = NULL;
+    block->direct_sample_count = 0u;
+    block->direct_initial_level = 1;
+    block->csw_sample_rate = 0u;
+    block->in_arena = 0;
+    return block;
 }
 
-static int z80_map_page_id_to_bank(int page_id, uint8_t* bank, uint16_t* mask_bit) {
-    if (!bank || !mask_bit) {
+// Makes room for `count` more blocks in one allocation.
+static int tape_image_reserve(TapeImage* image, size_t count) {
+    if (image->capacity - image->count >= count) {
+        return 1;
+    }
+    TapeBlock* blocks = (TapeBlock*)realloc(image->blocks, (image->count + count) * sizeof(TapeBlock));
+    if (!blocks) {
         return 0;
     }
+    image->blocks = blocks;
+    image->capacity = image->count + count;
+    return 1;
+}
 
-    if (page_id >= 0 && page_id <= 7) {
-        *bank = (uint8_t)page_id;
-        *mask_bit = (uint16_t)(1u << page_id);
-        return 1;
+static int tape_image_add_block(TapeImage* image, const uint8_t* data, uint32_t length, uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
+        return 0;
     }
 
-    switch (page_id) {
-        case 8:
-            *bank = 0u;
-            *mask_bit = 1u;
-            return 1;
-        case 9:
-            *bank = 1u;
-            *mask_bit = 2u;
-            return 1;
-        case 10:
-            *bank = 2u;
-            *mask_bit = 4u;
-            return 1;
-        default:
-            break;
+    block->type = TAPE_BLOCK_TYPE_STANDARD;
+    block->length = length;
+    block->pause_ms = pause_ms;
+
+    if (length > 0) {
+        block->data = (uint8_t*)malloc(length);
+        if (!block->data) {
+            return 0;
+        }
+        memcpy(block->data, data, length);
     }
 
-    return 0;
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
 }
 
-static int snapshot_load_z80(const char* path, Z80* cpu) {
-    if (!path || !cpu) {
+static int tape_image_add_turbo_block(TapeImage* image,
+                                      const uint8_t* data,
+                                      uint32_t length,
+                                      uint32_t pause_ms,
+                                      uint16_t pilot_pulse_tstates,
+                                      uint32_t pilot_pulses,
+                                      uint16_t sync1_tstates,
+                                      uint16_t sync2_tstates,
+                                      uint16_t bit0_first,
+                                      uint16_t bit0_second,
+                                      uint16_t bit1_first,
+                                      uint16_t bit1_second,
+                                      uint8_t used_bits) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
         return 0;
     }
 
-    FILE* sf = fopen(path, "rb");
-    if (!sf) {
-        fprintf(stderr, "Failed to open Z80 snapshot '%s': %s\n", path, strerror(errno));
+    block->type = TAPE_BLOCK_TYPE_TURBO;
+    block->length = length;
+    block->pause_ms = pause_ms;
+    block->pilot_pulse_tstates = pilot_pulse_tstates;
+    block->pilot_pulse_count = pilot_pulses;
+    block->sync_first_pulse_tstates = sync1_tstates;
+    block->sync_second_pulse_tstates = sync2_tstates;
+    block->bit0_first_pulse_tstates = bit0_first;
+    block->bit0_second_pulse_tstates = bit0_second;
+    block->bit1_first_pulse_tstates = bit1_first;
+    block->bit1_second_pulse_tstates = bit1_second;
+    block->used_bits_in_last_byte = (used_bits == 0u) ? 8u : used_bits;
+
+    if (length > 0u) {
+        block->data = (uint8_t*)malloc(length);
+        if (!block->data) {
+            return 0;
+        }
+        memcpy(block->data, data, length);
+    }
+
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
+}
+
+static int tape_image_add_pure_data_block(TapeImage* image,
+                                          const uint8_t* data,
+                                          uint32_t length,
+                                          uint32_t pause_ms,
+                                          uint16_t bit0_first,
+                                          uint16_t bit0_second,
+                                          uint16_t bit1_first,
+                                          uint16_t bit1_second,
+                                          uint8_t used_bits) {
+    if (!tape_image_add_turbo_block(image,
+                                    data,
+                                    length,
+                                    pause_ms,
+                                    0u,
+                                    0u,
+                                    0u,
+                                    0u,
+                                    bit0_first,
+                                    bit0_second,
+                                    bit1_first,
+                                    bit1_second,
+                                    used_bits)) {
         return 0;
     }
+    image->blocks[image->count - 1u].type = TAPE_BLOCK_TYPE_PURE_DATA;
+    return 1;
+}
 
-    uint8_t header[30];
-    if (fread(header, sizeof(header), 1, sf) != 1) {
-        fprintf(stderr, "Failed to read Z80 header from '%s'\n", path);
-        fclose(sf);
+static int tape_image_add_pure_tone_block(TapeImage* image,
+                                          uint16_t pulse_tstates,
+                                          uint32_t pulse_count,
+                                          uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
         return 0;
     }
 
-    uint16_t pc = (uint16_t)header[6] | ((uint16_t)header[7] << 8);
-    int header_pc_zero = (pc == 0u);
-    uint16_t sp = (uint16_t)header[8] | ((uint16_t)header[9] << 8);
-    uint8_t flags = header[12];
-    uint8_t compressed_flag = (flags & 0x20u) ? 1u : 0u;
-    uint8_t r_bit_7 = (flags & 0x01u) ? 0x80u : 0u;
-    border_color_idx = (flags >> 1) & 0x07u;
+    block->type = TAPE_BLOCK_TYPE_PURE_TONE;
+    block->tone_pulse_tstates = pulse_tstates;
+    block->tone_pulse_count = pulse_count;
+    block->pause_ms = pause_ms;
 
-    uint8_t hardware_mode = 0u;
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
+}
 
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
+static int tape_image_add_pulse_sequence_block(TapeImage* image,
+                                               const uint16_t* durations,
+                                               size_t count,
+                                               uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
+        return 0;
+    }
 
-    cpu->reg_A = header[0];
-    cpu->reg_F = header[1];
-    cpu->reg_C = header[2];
-    cpu->reg_B = header[3];
-    cpu->reg_L = header[4];
-    cpu->reg_H = header[5];
-    cpu->reg_SP = sp;
-    cpu->reg_I = header[10];
-    cpu->reg_R = (uint8_t)((header[11] & 0x7Fu) | r_bit_7);
+    block->type = TAPE_BLOCK_TYPE_PULSE_SEQUENCE;
+    block->pause_ms = pause_ms;
 
-    cpu->reg_E = header[13];
-    cpu->reg_D = header[14];
-    cpu->alt_reg_C = header[15];
-    cpu->alt_reg_B = header[16];
-    cpu->alt_reg_E = header[17];
-    cpu->alt_reg_D = header[18];
-    cpu->alt_reg_L = header[19];
-    cpu->alt_reg_H = header[20];
-    cpu->alt_reg_A = header[21];
-    cpu->alt_reg_F = header[22];
-    cpu->reg_IY = (uint16_t)header[23] | ((uint16_t)header[24] << 8);
-    cpu->reg_IX = (uint16_t)header[25] | ((uint16_t)header[26] << 8);
-    cpu->iff1 = (header[27] & 0x01u) ? 1 : 0;
-    cpu->iff2 = (header[28] & 0x01u) ? 1 : 0;
+    if (count > 0u) {
+        size_t bytes = count * sizeof(uint16_t);
+        block->pulse_sequence_durations = (uint16_t*)malloc(bytes);
+        if (!block->pulse_sequence_durations) {
+            return 0;
+        }
+        memcpy(block->pulse_sequence_durations, durations, bytes);
+        block->pulse_sequence_count = count;
+    }
 
-    uint8_t interrupt_mode = header[29];
-    cpu->interruptMode = (int)(interrupt_mode & 0x03u);
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
+}
 
-    cpu->ei_delay = 0;
-    cpu->halted = 0;
+static int tape_image_add_direct_recording_block(TapeImage* image,
+                                                 uint32_t tstates_per_sample,
+                                                 const uint8_t* samples,
+                                                 uint32_t sample_bytes,
+                                                 uint8_t used_bits,
+                                                 uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
+        return 0;
+    }
 
-    uint8_t port_7ffd = 0u;
-    uint8_t port_1ffd = 0u;
-    uint8_t* ram_buffer = NULL;
+    block->type = TAPE_BLOCK_TYPE_DIRECT_RECORDING;
+    block->pause_ms = pause_ms;
+    block->direct_tstates_per_sample = tstates_per_sample;
+    block->used_bits_in_last_byte = (used_bits == 0u) ? 8u : used_bits;
 
-    if (pc != 0) {
-        ram_buffer = (uint8_t*)malloc(0xC000u);
-        if (!ram_buffer) {
-            fprintf(stderr, "Out of memory loading Z80 snapshot\n");
-            fclose(sf);
+    if (sample_bytes > 0u) {
+        block->direct_samples = (uint8_t*)malloc(sample_bytes);
+        if (!block->direct_samples) {
             return 0;
         }
+        memcpy(block->direct_samples, samples, sample_bytes);
+    }
 
-        if (compressed_flag) {
-            if (!z80_decompress_stream(sf, ram_buffer, 0xC000u)) {
-                fprintf(stderr, "Failed to decompress V1 Z80 snapshot '%s'\n", path);
-                free(ram_buffer);
-                fclose(sf);
-                return 0;
-            }
-        } else {
-            if (fread(ram_buffer, 0xC000u, 1, sf) != 1) {
-                fprintf(stderr, "Failed to read V1 Z80 RAM image from '%s'\n", path);
-                free(ram_buffer);
-                fclose(sf);
-                return 0;
-            }
+    uint32_t total_bits = sample_bytes * 8u;
+    if (sample_bytes > 0u && block->used_bits_in_last_byte < 8u) {
+        total_bits -= (uint32_t)(8u - block->used_bits_in_last_byte);
+    }
+    block->direct_sample_count = total_bits;
+    if (block->direct_sample_count > 0u && block->direct_samples) {
+        block->direct_initial_level = (block->direct_samples[0] & 0x80u) ? 1 : 0;
+    } else {
+        block->direct_initial_level = 0;
+    }
+
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
+}
+
+// Adds a block that plays `payload` as it stands (CSW RLE bytes or a PZX
+// PULS/DATA body). The block takes over `payload`, even on failure.
+static int tape_image_add_stream_block(TapeImage* image,
+                                       TapeBlockType type,
+                                       uint8_t* payload,
+                                       uint32_t length,
+                                       uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
+        free(payload);
+        return 0;
+    }
+
+    block->type = type;
+    block->data = payload;
+    block->length = length;
+    block->pause_ms = pause_ms;
+
+    tape_log_block_summary(block, image->count);
+    image->count++;
+    return 1;
+}
+
+// Drops the pulses but keeps the buffers for the next block.
+static void tape_waveform_clear(TapeWaveform* waveform) {
+    waveform->run_count = 0;
+    waveform->symbol_count = 0;
+    waveform->tail_repeat = 0;
+    waveform->count = 0;
+}
+
+static void tape_waveform_reset(TapeWaveform* waveform) {
+    if (!waveform) {
+        return;
+    }
+    if (waveform->runs) {
+        free(waveform->runs);
+        waveform->runs = NULL;
+    }
+    if (waveform->symbols) {
+        free(waveform->symbols);
+        waveform->symbols = NULL;
+    }
+    tape_waveform_clear(waveform);
+    waveform->run_capacity = 0;
+    waveform->symbol_capacity = 0;
+    waveform->initial_level = 1;
+    waveform->sample_rate = 0u;
+}
+
+static size_t tape_waveform_memory_bytes(const TapeWaveform* waveform) {
+    return waveform->run_count * sizeof(TapePulseRun) + (waveform->symbol_count + 3u) / 4u;
+}
+
+static TapePulseRun* tape_waveform_push_run(TapeWaveform* waveform, uint32_t duration, uint32_t count) {
+    if (waveform->run_count == waveform->run_capacity) {
+        size_t new_capacity = waveform->run_capacity ? waveform->run_capacity * 2 : 64;
+        TapePulseRun* new_runs = (TapePulseRun*)realloc(waveform->runs, new_capacity * sizeof(TapePulseRun));
+        if (!new_runs) {
+            return NULL;
         }
+        waveform->runs = new_runs;
+        waveform->run_capacity = new_capacity;
+    }
+    TapePulseRun* run = &waveform->runs[waveform->run_count++];
+    memset(run, 0, sizeof(*run));
+    run->durations[0] = duration;
+    run->count = count;
+    run->symbol_offset = TAPE_PULSE_RUN_PLAIN;
+    return run;
+}
 
-        memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
-        memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
-        memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
-        spectrum_refresh_visible_ram();
-        free(ram_buffer);
-        spectrum_apply_memory_configuration();
-    } else {
-        uint8_t ext_len_bytes[2];
-        if (fread(ext_len_bytes, sizeof(ext_len_bytes), 1, sf) != 1) {
-            fprintf(stderr, "Failed to read Z80 extended header length from '%s'\n", path);
-            fclose(sf);
+static int tape_waveform_push_symbol(TapeWaveform* waveform, uint8_t code) {
+    if (waveform->symbol_count == waveform->symbol_capacity) {
+        size_t new_capacity = waveform->symbol_capacity ? waveform->symbol_capacity * 2 : 4096;
+        uint8_t* new_symbols = (uint8_t*)realloc(waveform->symbols, new_capacity / 4u);
+        if (!new_symbols) {
             return 0;
         }
-        uint16_t ext_len = (uint16_t)ext_len_bytes[0] | ((uint16_t)ext_len_bytes[1] << 8);
-        uint8_t* ext_header = NULL;
-        if (ext_len > 0u) {
-            ext_header = (uint8_t*)malloc(ext_len);
-            if (!ext_header) {
-                fprintf(stderr, "Out of memory reading Z80 extended header\n");
-                fclose(sf);
-                return 0;
+        waveform->symbols = new_symbols;
+        waveform->symbol_capacity = new_capacity;
+    }
+    size_t index = waveform->symbol_count++;
+    uint8_t shift = (uint8_t)((index & 3u) * 2u);
+    uint8_t* slot = &waveform->symbols[index / 4u];
+    *slot = (uint8_t)((*slot & ~(3u << shift)) | ((uint32_t)code << shift));
+    return 1;
+}
+
+static uint32_t tape_waveform_run_duration(const TapeWaveform* waveform, const TapePulseRun* run, uint32_t offset) {
+    if (run->symbol_offset == TAPE_PULSE_RUN_PLAIN) {
+        return run->durations[0];
+    }
+    size_t index = (size_t)run->symbol_offset + offset;
+    return run->durations[(waveform->symbols[index / 4u] >> ((index & 3u) * 2u)) & 3u];
+}
+
+static int tape_waveform_add_pulse(TapeWaveform* waveform, uint64_t duration) {
+    if (!waveform || duration == 0) {
+        return 1;
+    }
+    if (duration > UINT32_MAX) {
+        duration = UINT32_MAX;
+    }
+    uint32_t value = (uint32_t)duration;
+    TapePulseRun* run = waveform->run_count ? &waveform->runs[waveform->run_count - 1u] : NULL;
+    if (run && run->symbol_offset == TAPE_PULSE_RUN_PLAIN) {
+        if (run->durations[0] == value && run->count < UINT32_MAX) {
+            run->count++;
+            waveform->count++;
+            return 1;
+        }
+        if (run->count >= TAPE_PULSE_RUN_MIN_REPEAT || waveform->symbol_count >= UINT32_MAX) {
+            run = NULL;
+        } else {
+            // Too short to stand alone: restate it as codes of a packed run.
+            run->symbol_offset = (uint32_t)waveform->symbol_count;
+            for (uint32_t i = 0; i < run->count; ++i) {
+                if (!tape_waveform_push_symbol(waveform, 0u)) {
+                    return 0;
+                }
             }
-            if (fread(ext_header, ext_len, 1, sf) != 1) {
-                fprintf(stderr, "Failed to read Z80 extended header from '%s'\n", path);
-                free(ext_header);
-                fclose(sf);
-                return 0;
+            waveform->tail_repeat = run->count;
+        }
+    }
+
+    uint32_t code = TAPE_PULSE_RUN_SYMBOLS;
+    if (run && run->count < UINT32_MAX) {
+        for (uint32_t i = 0; i < TAPE_PULSE_RUN_SYMBOLS; ++i) {
+            if (run->durations[i] == value || run->durations[i] == 0u) {
+                run->durations[i] = value;
+                code = i;
+                break;
             }
         }
+    }
+    if (code == TAPE_PULSE_RUN_SYMBOLS) {
+        if (!tape_waveform_push_run(waveform, value, 1u)) {
+            return 0;
+        }
+        waveform->count++;
+        return 1;
+    }
 
-        if (ext_header && ext_len >= 2u) {
-            pc = (uint16_t)ext_header[0] | ((uint16_t)ext_header[1] << 8);
+    uint32_t previous = tape_waveform_run_duration(waveform, run, run->count - 1u);
+    if (!tape_waveform_push_symbol(waveform, (uint8_t)code)) {
+        return 0;
+    }
+    run->count++;
+    waveform->count++;
+    waveform->tail_repeat = previous == value ? waveform->tail_repeat + 1u : 1u;
+    if (waveform->tail_repeat >= TAPE_PULSE_RUN_MIN_REPEAT && run->count > waveform->tail_repeat) {
+        uint32_t repeat = waveform->tail_repeat;
+        run->count -= repeat;
+        waveform->symbol_count -= repeat;
+        waveform->tail_repeat = 0;
+        if (!tape_waveform_push_run(waveform, value, repeat)) {
+            return 0;
         }
-        hardware_mode = (ext_header && ext_len >= 3u) ? ext_header[2] : 0u;
-        port_7ffd = (ext_header && ext_len >= 4u) ? ext_header[3] : 0u;
-        port_1ffd = (ext_header && ext_len >= 5u) ? ext_header[4] : 0u;
+    }
+    return 1;
+}
 
-        SpectrumModel target_model = z80_hardware_mode_to_model(hardware_mode);
-        spectrum_configure_model(target_model);
+static int tape_waveform_reader_has_pulse(const TapeWaveform* waveform, const TapeWaveformReader* reader) {
+    return reader->run < waveform->run_count;
+}
 
-        int is_128k_family = (target_model != SPECTRUM_MODEL_48K);
-        uint16_t loaded_mask = 0u;
-        uint16_t expected_mask = is_128k_family ? 0xFFu : 0x07u;
+static uint32_t tape_waveform_reader_duration(const TapeWaveform* waveform, const TapeWaveformReader* reader) {
+    return tape_waveform_run_duration(waveform, &waveform->runs[reader->run], reader->offset);
+}
 
-        if (!is_128k_family) {
-            ram_buffer = (uint8_t*)malloc(0xC000u);
-            if (!ram_buffer) {
-                fprintf(stderr, "Out of memory loading Z80 snapshot\n");
-                free(ext_header);
-                fclose(sf);
-                return 0;
-            }
-        }
+// Steps to the following pulse; returns 0 past the last one.
+static int tape_waveform_reader_next(const TapeWaveform* waveform, TapeWaveformReader* reader) {
+    if (reader->run >= waveform->run_count) {
+        return 0;
+    }
+    if (++reader->offset >= waveform->runs[reader->run].count) {
+        reader->run++;
+        reader->offset = 0;
+    }
+    return reader->run < waveform->run_count;
+}
 
-        while (loaded_mask != expected_mask) {
-            uint8_t len_bytes[2];
-            if (fread(len_bytes, sizeof(len_bytes), 1, sf) != 1) {
-                if (feof(sf) && loaded_mask != 0u) {
-                    break;
-                }
-                fprintf(stderr, "Truncated Z80 memory block in '%s'\n", path);
-                free(ram_buffer);
-                free(ext_header);
-                fclose(sf);
+static uint16_t tape_read_le16(const uint8_t* bytes) {
+    return (uint16_t)((uint16_t)bytes[0] | ((uint16_t)bytes[1] << 8));
+}
+
+static uint32_t tape_read_le24(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16);
+}
+
+static uint32_t tape_read_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Reads the PULS word at `*offset`; returns 0 at the end of the block.
+static int tape_pzx_next_word(const TapeBlock* block, uint32_t* offset, uint32_t* value) {
+    if (block->length - *offset < 2u) {
+        return 0;
+    }
+    *value = tape_read_le16(block->data + *offset);
+    *offset += 2u;
+    return 1;
+}
+
+// Steps through a PULS block one pulse at a time, zero-length ones included.
+// A word above 0x8000 is a repeat count for the duration after it; a
+// duration with bit 15 set has 31 bits.
+static int tape_pzx_next_pulse(TapePulseCursor* cursor, const TapeBlock* block, uint32_t* duration) {
+    if (cursor->run_left == 0u) {
+        uint32_t count = 1u;
+        uint32_t value = 0;
+        if (!tape_pzx_next_word(block, &cursor->index, &value)) {
+            return 0;
+        }
+        if (value > 0x8000u) {
+            count = value & 0x7FFFu;
+            if (!tape_pzx_next_word(block, &cursor->index, &value)) {
                 return 0;
             }
-            uint16_t block_len = (uint16_t)len_bytes[0] | ((uint16_t)len_bytes[1] << 8);
-            int page_id = fgetc(sf);
-            if (page_id == EOF) {
-                fprintf(stderr, "Truncated Z80 memory block header in '%s'\n", path);
-                free(ram_buffer);
-                free(ext_header);
-                fclose(sf);
+        }
+        if (value >= 0x8000u) {
+            uint32_t low = 0;
+            if (!tape_pzx_next_word(block, &cursor->index, &low)) {
                 return 0;
             }
+            value = ((value & 0x7FFFu) << 16) | low;
+        }
+        cursor->run_left = count;
+        cursor->run_tstates = value;
+    }
+    --cursor->run_left;
+    *duration = cursor->run_tstates;
+    return 1;
+}
 
-            uint8_t* segment = NULL;
-            uint16_t mask_bit = 0u;
-            if (is_128k_family) {
-                uint8_t bank = 0u;
-                if (!z80_map_page_id_to_bank(page_id, &bank, &mask_bit)) {
-                    fprintf(stderr, "Z80 snapshot '%s' contains unsupported memory page id %d\n", path, page_id);
-                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
-                        fprintf(stderr, "Failed to seek past unsupported block in '%s'\n", path);
-                        free(ram_buffer);
-                        free(ext_header);
-                        fclose(sf);
-                        return 0;
-                    }
+static uint8_t tape_pulse_cursor_bits_in_byte(const TapeBlock* block, uint32_t byte_index) {
+    if (byte_index == block->length - 1u) {
+        uint8_t used_bits = block->used_bits_in_last_byte;
+        if (used_bits > 0u && used_bits < 8u) {
+            return used_bits;
+        }
+    }
+    return 8u;
+}
+
+// Produces the next raw pulse of the tape. `merge` is set for pulses that
+// absorb pending silence (the first pulse of a bit, tone or sequence entry).
+static int tape_pulse_cursor_produce(TapePulseCursor* cursor,
+                                     const TapeImage* image,
+                                     uint64_t* duration,
+                                     int* merge) {
+    for (;;) {
+        const TapeBlock* block =
+            cursor->block_index < image->count ? &image->blocks[cursor->block_index] : NULL;
+        switch (cursor->stage) {
+            case TAPE_PULSE_STAGE_BLOCK_START:
+                if (!block) {
+                    cursor->stage = TAPE_PULSE_STAGE_END;
+                    return 0;
+                }
+                switch (block->type) {
+                    case TAPE_BLOCK_TYPE_STANDARD:
+                        cursor->index = (block->length > 0 && block->data && block->data[0] == 0x00)
+                                            ? (uint32_t)TAPE_HEADER_PILOT_COUNT
+                                            : (uint32_t)TAPE_DATA_PILOT_COUNT;
+                        cursor->pilot_pulse = (uint16_t)TAPE_PILOT_PULSE_TSTATES;
+                        cursor->sync1 = (uint16_t)TAPE_SYNC_FIRST_PULSE_TSTATES;
+                        cursor->sync2 = (uint16_t)TAPE_SYNC_SECOND_PULSE_TSTATES;
+                        cursor->bit0[0] = cursor->bit0[1] = (uint16_t)TAPE_BIT0_PULSE_TSTATES;
+                        cursor->bit1[0] = cursor->bit1[1] = (uint16_t)TAPE_BIT1_PULSE_TSTATES;
+                        cursor->stage = TAPE_PULSE_STAGE_PILOT;
+                        break;
+                    case TAPE_BLOCK_TYPE_TURBO:
+                    case TAPE_BLOCK_TYPE_PURE_DATA:
+                        cursor->index = block->pilot_pulse_count;
+                        cursor->pilot_pulse = block->pilot_pulse_tstates;
+                        cursor->sync1 = block->sync_first_pulse_tstates;
+                        cursor->sync2 = block->sync_second_pulse_tstates;
+                        cursor->bit0[0] = block->bit0_first_pulse_tstates;
+                        cursor->bit0[1] = block->bit0_second_pulse_tstates;
+                        cursor->bit1[0] = block->bit1_first_pulse_tstates;
+                        cursor->bit1[1] = block->bit1_second_pulse_tstates;
+                        cursor->stage = TAPE_PULSE_STAGE_PILOT;
+                        break;
+                    case TAPE_BLOCK_TYPE_PURE_TONE:
+                        cursor->index = block->tone_pulse_count;
+                        cursor->stage = TAPE_PULSE_STAGE_TONE;
+                        break;
+                    case TAPE_BLOCK_TYPE_PULSE_SEQUENCE:
+                        cursor->index = 0;
+                        cursor->stage = TAPE_PULSE_STAGE_SEQUENCE;
+                        break;
+                    case TAPE_BLOCK_TYPE_CSW:
+                        cursor->index = 0;
+                        cursor->sample_position = 0;
+                        if (cursor->emitted == 0) {
+                            cursor->initial_level = block->direct_initial_level ? 1 : 0;
+                        }
+                        cursor->stage = block->csw_sample_rate ? TAPE_PULSE_STAGE_CSW : TAPE_PULSE_STAGE_BLOCK_END;
+                        break;
+                    case TAPE_BLOCK_TYPE_PZX_PULSES:
+                        // PULS starts low; a leading zero-length pulse makes it high.
+                        cursor->index = 0;
+                        cursor->run_left = 0;
+                        if (cursor->emitted == 0) {
+                            cursor->initial_level = (block->length >= 2u && block->data[0] == 0 && block->data[1] == 0) ? 1 : 0;
+                        }
+                        cursor->stage = TAPE_PULSE_STAGE_PZX_PULSES;
+                        break;
+                    case TAPE_BLOCK_TYPE_PZX_DATA:
+                        cursor->index = 0;
+                        cursor->run_left = 0;
+                        if (cursor->emitted == 0) {
+                            cursor->initial_level = (block->data[3] & 0x80u) ? 1 : 0;
+                        }
+                        cursor->stage = TAPE_PULSE_STAGE_PZX_DATA;
+                        break;
+                    case TAPE_BLOCK_TYPE_DIRECT_RECORDING:
+                        cursor->index = 0;
+                        cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                        if (block->direct_sample_count > 0u && block->direct_samples) {
+                            if (cursor->emitted == 0) {
+                                cursor->initial_level = block->direct_initial_level ? 1 : 0;
+                            }
+                            cursor->stage = TAPE_PULSE_STAGE_DIRECT;
+                        }
+                        break;
+                    default:
+                        cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                        break;
+                }
+                continue;
+            case TAPE_PULSE_STAGE_PILOT:
+                if (cursor->index > 0u) {
+                    --cursor->index;
+                    *duration = cursor->pilot_pulse;
+                    *merge = 1;
+                    return 1;
+                }
+                cursor->stage = TAPE_PULSE_STAGE_SYNC1;
+                continue;
+            case TAPE_PULSE_STAGE_SYNC1:
+                cursor->stage = TAPE_PULSE_STAGE_SYNC2;
+                if (cursor->sync1 > 0u) {
+                    *duration = cursor->sync1;
+                    *merge = 1;
+                    return 1;
+                }
+                continue;
+            case TAPE_PULSE_STAGE_SYNC2:
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                if (block->length > 0 && block->data) {
+                    cursor->stage = TAPE_PULSE_STAGE_DATA;
+                    cursor->byte_index = 0;
+                    cursor->bit_mask = 0x80u;
+                    cursor->bits_left = tape_pulse_cursor_bits_in_byte(block, 0u);
+                    cursor->second_half = 0;
+                }
+                if (cursor->sync2 > 0u) {
+                    *duration = cursor->sync2;
+                    *merge = 0;
+                    return 1;
+                }
+                continue;
+            case TAPE_PULSE_STAGE_DATA: {
+                if (cursor->byte_index >= block->length) {
+                    cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
                     continue;
                 }
-                if ((loaded_mask & mask_bit) != 0u) {
-                    fprintf(stderr, "Z80 snapshot '%s' repeats memory page id %d\n", path, page_id);
-                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
-                        fprintf(stderr, "Failed to seek past repeated block in '%s'\n", path);
-                        free(ram_buffer);
-                        free(ext_header);
-                        fclose(sf);
-                        return 0;
+                int is_one = (block->data[cursor->byte_index] & cursor->bit_mask) ? 1 : 0;
+                const uint16_t* halves = is_one ? cursor->bit1 : cursor->bit0;
+                if (!cursor->second_half) {
+                    cursor->second_half = 1;
+                    *duration = halves[0];
+                    *merge = 1;
+                    return 1;
+                }
+                cursor->second_half = 0;
+                *duration = halves[1];
+                *merge = 0;
+                cursor->bit_mask >>= 1;
+                if (--cursor->bits_left == 0u) {
+                    ++cursor->byte_index;
+                    cursor->bit_mask = 0x80u;
+                    if (cursor->byte_index < block->length) {
+                        cursor->bits_left = tape_pulse_cursor_bits_in_byte(block, cursor->byte_index);
                     }
-                    continue;
                 }
-                segment = ram_pages[bank];
-            } else {
-                size_t segment_offset = 0u;
-                uint8_t offset_mask = 0u;
-                if (!z80_map_page_id_to_offset(page_id, &segment_offset, &offset_mask)) {
-                    fprintf(stderr, "Z80 snapshot '%s' contains unsupported memory page id %d\n", path, page_id);
-                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
-                        fprintf(stderr, "Failed to seek past unsupported block in '%s'\n", path);
-                        free(ram_buffer);
-                        free(ext_header);
-                        fclose(sf);
-                        return 0;
+                return 1;
+            }
+            case TAPE_PULSE_STAGE_TONE:
+                if (cursor->index > 0u) {
+                    --cursor->index;
+                    *duration = block->tone_pulse_tstates;
+                    *merge = 1;
+                    return 1;
+                }
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                continue;
+            case TAPE_PULSE_STAGE_SEQUENCE:
+                if (cursor->index < block->pulse_sequence_count) {
+                    *duration = block->pulse_sequence_durations[cursor->index++];
+                    *merge = 1;
+                    return 1;
+                }
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                continue;
+            case TAPE_PULSE_STAGE_DIRECT: {
+                // Runs of equal samples become one pulse; the run still open
+                // at the end of the block joins the pause.
+                uint64_t tstates_per_sample = block->direct_tstates_per_sample ? block->direct_tstates_per_sample : 1u;
+                while (cursor->index < block->direct_sample_count) {
+                    uint32_t sample_index = cursor->index++;
+                    int level = (block->direct_samples[sample_index / 8u] >> (7u - (sample_index % 8u))) & 0x01;
+                    if (sample_index == 0u) {
+                        cursor->direct_level = level;
+                        cursor->direct_run = tstates_per_sample;
+                    } else if (level == cursor->direct_level) {
+                        cursor->direct_run += tstates_per_sample;
+                    } else {
+                        *duration = cursor->direct_run;
+                        *merge = 1;
+                        cursor->direct_level = level;
+                        cursor->direct_run = tstates_per_sample;
+                        return 1;
                     }
-                    continue;
                 }
-                mask_bit = offset_mask;
-                if ((loaded_mask & mask_bit) != 0u) {
-                    fprintf(stderr, "Z80 snapshot '%s' repeats memory page id %d\n", path, page_id);
-                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
-                        fprintf(stderr, "Failed to seek past repeated block in '%s'\n", path);
-                        free(ram_buffer);
-                        free(ext_header);
-                        fclose(sf);
-                        return 0;
+                cursor->pending_silence += cursor->direct_run;
+                cursor->direct_run = 0;
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                continue;
+            }
+            case TAPE_PULSE_STAGE_CSW:
+                // Each byte is a pulse length in samples; 0 escapes a 32-bit
+                // length. Times come from the running sample count, so
+                // rounding never accumulates.
+                while (cursor->index < block->length) {
+                    uint32_t samples = block->data[cursor->index++];
+                    if (samples == 0u) {
+                        if (block->length - cursor->index < 4u) {
+                            break;
+                        }
+                        samples = tape_read_le32(block->data + cursor->index);
+                        cursor->index += 4u;
                     }
+                    uint64_t clock = (uint64_t)CPU_CLOCK_HZ;
+                    uint64_t start = cursor->sample_position * clock / block->csw_sample_rate;
+                    cursor->sample_position += samples;
+                    *duration = cursor->sample_position * clock / block->csw_sample_rate - start;
+                    *merge = 1;
+                    return 1;
+                }
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                continue;
+            case TAPE_PULSE_STAGE_PZX_PULSES: {
+                // A zero-length pulse flips the level without taking time,
+                // so the pulses either side of it are one longer pulse.
+                uint32_t pulse = 0;
+                if (!tape_pzx_next_pulse(cursor, block, &pulse)) {
+                    cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
                     continue;
                 }
-                segment = ram_buffer + segment_offset;
-            }
-
-            if (block_len == 0xFFFFu) {
-                if (fread(segment, 0x4000u, 1, sf) != 1) {
-                    fprintf(stderr, "Failed to read uncompressed block from '%s'\n", path);
-                    free(ram_buffer);
-                    free(ext_header);
-                    fclose(sf);
-                    return 0;
+                if (pulse == 0u) {
+                    continue;
                 }
-            } else {
-                uint8_t* block_data = (uint8_t*)malloc(block_len);
-                if (!block_data) {
-                    fprintf(stderr, "Out of memory reading Z80 block\n");
-                    free(ram_buffer);
-                    free(ext_header);
-                    fclose(sf);
-                    return 0;
+                uint64_t total = pulse;
+                int flipped = 0;
+                for (;;) {
+                    uint32_t saved_index = cursor->index;
+                    uint32_t saved_run_left = cursor->run_left;
+                    uint32_t saved_run_tstates = cursor->run_tstates;
+                    if (!tape_pzx_next_pulse(cursor, block, &pulse)) {
+                        break;
+                    }
+                    if (pulse != 0u && !flipped) {
+                        cursor->index = saved_index;
+                        cursor->run_left = saved_run_left;
+                        cursor->run_tstates = saved_run_tstates;
+                        break;
+                    }
+                    flipped = pulse == 0u ? !flipped : 0;
+                    total += pulse;
                 }
-                if (fread(block_data, block_len, 1, sf) != 1) {
-                    fprintf(stderr, "Failed to read Z80 block payload from '%s'\n", path);
-                    free(block_data);
-                    free(ram_buffer);
-                    free(ext_header);
-                    fclose(sf);
-                    return 0;
+                if (flipped) {
+                    // The block ends mid-flip: carry the pulse into the next one.
+                    cursor->pending_silence += total;
+                    cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                    continue;
                 }
-                if (!z80_decompress_block_buffer(block_data, block_len, segment, 0x4000u)) {
-                    fprintf(stderr, "Failed to decompress Z80 block from '%s'\n", path);
-                    free(block_data);
-                    free(ram_buffer);
-                    free(ext_header);
-                    fclose(sf);
-                    return 0;
+                *duration = total;
+                *merge = 1;
+                return 1;
+            }
+            case TAPE_PULSE_STAGE_PZX_DATA: {
+                // Layout checked on load: bit count, tail, sequence lengths,
+                // the two sequences, then the bits.
+                const uint8_t* body = block->data;
+                uint32_t bits = tape_read_le32(body) & 0x7FFFFFFFu;
+                uint32_t pulses0 = body[6];
+                uint32_t pulses1 = body[7];
+                const uint8_t* sequence0 = body + 8;
+                const uint8_t* sequence1 = sequence0 + pulses0 * 2u;
+                const uint8_t* data = sequence1 + pulses1 * 2u;
+                while (cursor->index < bits) {
+                    int is_one = (data[cursor->index / 8u] >> (7u - (cursor->index % 8u))) & 0x01;
+                    uint32_t pulses = is_one ? pulses1 : pulses0;
+                    if (cursor->run_left < pulses) {
+                        const uint8_t* sequence = is_one ? sequence1 : sequence0;
+                        *duration = tape_read_le16(sequence + cursor->run_left * 2u);
+                        *merge = 1;
+                        if (++cursor->run_left == pulses) {
+                            cursor->run_left = 0;
+                            ++cursor->index;
+                        }
+                        return 1;
+                    }
+                    cursor->run_left = 0;
+                    ++cursor->index;
                 }
-                free(block_data);
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_END;
+                uint16_t tail = tape_read_le16(body + 4);
+                if (tail > 0u) {
+                    *duration = tail;
+                    *merge = 1;
+                    return 1;
+                }
+                continue;
             }
-
-            loaded_mask |= mask_bit;
+            case TAPE_PULSE_STAGE_BLOCK_END:
+                cursor->pending_silence += tape_pause_to_tstates(block->pause_ms);
+                ++cursor->block_index;
+                cursor->stage = TAPE_PULSE_STAGE_BLOCK_START;
+                continue;
+            case TAPE_PULSE_STAGE_END:
+            default:
+                return 0;
         }
+    }
+}
 
-        if (!is_128k_family) {
-            memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
-            memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
-            memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
-            spectrum_refresh_visible_ram();
-            free(ram_buffer);
+// Moves the cursor to the next non-empty pulse; returns 0 at the end of the
+// tape, where silence still pending is dropped.
+static int tape_pulse_cursor_advance(TapePulseCursor* cursor, const TapeImage* image) {
+    uint64_t duration = 0;
+    int merge = 0;
+    while (tape_pulse_cursor_produce(cursor, image, &duration, &merge)) {
+        if (merge) {
+            duration += cursor->pending_silence;
+            cursor->pending_silence = 0;
         }
-
-        free(ext_header);
-
-        gate_array_7ffd_state = (uint8_t)(port_7ffd & 0x3Fu);
-        paging_disabled = (gate_array_7ffd_state & 0x20u) ? 1 : 0;
-        current_paged_bank = (uint8_t)(gate_array_7ffd_state & 0x07u);
-        if (target_model == SPECTRUM_MODEL_PLUS2A || target_model == SPECTRUM_MODEL_PLUS3) {
-            gate_array_1ffd_state = (uint8_t)(port_1ffd & 0x07u);
-        } else {
-            gate_array_1ffd_state = 0u;
+        if (duration == 0) {
+            continue;
         }
-
-        spectrum_apply_memory_configuration();
-        spectrum_refresh_visible_ram();
+        cursor->current = duration > UINT32_MAX ? (uint64_t)UINT32_MAX : duration;
+        cursor->has_current = 1;
+        cursor->emitted++;
+        return 1;
     }
-
-    cpu->reg_PC = pc;
-
-    fclose(sf);
-
-    const char* version_label = header_pc_zero ? "V2/3" : "V1";
-    fprintf(stderr,
-            "Z80 snapshot '%s': version %s PC=%04X SP=%04X IM=%d border=%u\n",
-            path,
-            version_label,
-            (unsigned)cpu->reg_PC,
-            (unsigned)cpu->reg_SP,
-            cpu->interruptMode,
-            (unsigned)border_color_idx);
-    return 1;
+    cursor->current = 0;
+    cursor->has_current = 0;
+    return 0;
 }
 
-static int snapshot_load(const char* path, SnapshotFormat format, Z80* cpu) {
-    switch (format) {
-        case SNAPSHOT_FORMAT_SNA:
-            return snapshot_load_sna(path, cpu);
-        case SNAPSHOT_FORMAT_Z80:
-            return snapshot_load_z80(path, cpu);
-        default:
-            break;
+// Rewinds to the first pulse of the tape, which also settles initial_level.
+static void tape_pulse_cursor_reset(TapePulseCursor* cursor, const TapeImage* image) {
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->stage = TAPE_PULSE_STAGE_BLOCK_START;
+    cursor->initial_level = 1;
+    if (image) {
+        (void)tape_pulse_cursor_advance(cursor, image);
     }
-    return 0;
 }
 
-static int tape_create_blank_wav(const char* path, uint32_t sample_rate) {
-    if (!path) {
+// Records where every block starts in one walk over the tape. Pilot tones
+// are stepped over a whole tone at a time; other pulses are generated.
+static int tape_timeline_build(TapeImage* image) {
+    if (!image) {
         return 0;
     }
-
-    if (sample_rate == 0u) {
-        sample_rate = 44100u;
-    }
-
-    FILE* wf = fopen(path, "wb");
-    if (!wf) {
-        fprintf(stderr, "Failed to create WAV file '%s': %s\n", path, strerror(errno));
-        return 0;
+    if (image->timeline) {
+        return 1;
     }
-
-    uint8_t header[44];
-    memset(header, 0, sizeof(header));
-    memcpy(header + 0, "RIFF", 4);
-    uint32_t chunk_size = 36u;
-    header[4] = (uint8_t)(chunk_size & 0xFFu);
-    header[5] = (uint8_t)((chunk_size >> 8) & 0xFFu);
-    header[6] = (uint8_t)((chunk_size >> 16) & 0xFFu);
-    header[7] = (uint8_t)((chunk_size >> 24) & 0xFFu);
-    memcpy(header + 8, "WAVE", 4);
-    memcpy(header + 12, "fmt ", 4);
-    header[16] = 16;
-    header[20] = 1;
-    header[22] = 1;
-    header[24] = (uint8_t)(sample_rate & 0xFFu);
-    header[25] = (uint8_t)((sample_rate >> 8) & 0xFFu);
-    header[26] = (uint8_t)((sample_rate >> 16) & 0xFFu);
-    header[27] = (uint8_t)((sample_rate >> 24) & 0xFFu);
-
-    uint32_t byte_rate = sample_rate * sizeof(int16_t);
-    header[28] = (uint8_t)(byte_rate & 0xFFu);
-    header[29] = (uint8_t)((byte_rate >> 8) & 0xFFu);
-    header[30] = (uint8_t)((byte_rate >> 16) & 0xFFu);
-    header[31] = (uint8_t)((byte_rate >> 24) & 0xFFu);
-    header[32] = (uint8_t)(sizeof(int16_t));
-    header[34] = 16;
-    memcpy(header + 36, "data", 4);
-
-    if (fwrite(header, sizeof(header), 1, wf) != 1) {
-        fprintf(stderr, "Failed to write WAV header to '%s'\n", path);
-        fclose(wf);
+    TapeTimelineEntry* entries = (TapeTimelineEntry*)malloc((image->count + 1u) * sizeof(TapeTimelineEntry));
+    if (!entries) {
+        fprintf(stderr, "Out of memory while indexing tape\n");
         return 0;
     }
 
-    if (fclose(wf) != 0) {
-        fprintf(stderr, "Failed to finalize WAV file '%s': %s\n", path, strerror(errno));
-        return 0;
+    TapePulseCursor cursor;
+    tape_pulse_cursor_reset(&cursor, image);
+    uint64_t position = 0;
+    size_t next_block = 0;
+    for (;;) {
+        size_t block = cursor.has_current ? cursor.block_index : image->count;
+        while (next_block <= block && next_block <= image->count) {
+            entries[next_block].start_tstates = position;
+            entries[next_block].cursor = cursor;
+            ++next_block;
+        }
+        if (!cursor.has_current) {
+            break;
+        }
+        position += cursor.current;
+        if (cursor.stage == TAPE_PULSE_STAGE_PILOT) {
+            position += (uint64_t)cursor.index * cursor.pilot_pulse;
+            cursor.emitted += cursor.index;
+            cursor.index = 0;
+        }
+        (void)tape_pulse_cursor_advance(&cursor, image);
     }
 
+    image->timeline = entries;
+    image->length_tstates = position;
     return 1;
 }
 
-static int tape_load_wav(const char* path, TapePlaybackState* state) {
-    if (!path || !state) {
-        return 0;
-    }
-
-    FILE* wf = fopen(path, "rb");
-    if (!wf) {
-        if (errno != ENOENT) {
-            fprintf(stderr, "Failed to open WAV file '%s': %s\n", path, strerror(errno));
-            return 0;
-        }
-
-        uint32_t sample_rate = (audio_sample_rate > 0) ? (uint32_t)audio_sample_rate : 44100u;
-        if (!tape_create_blank_wav(path, sample_rate)) {
-            return 0;
+// Index of the block playing at `position`: the last one starting at or
+// before it, or image->count past the end.
+static size_t tape_timeline_find(const TapeImage* image, uint64_t position) {
+    size_t low = 0;
+    size_t high = image->count + 1u;
+    while (high - low > 1u) {
+        size_t mid = low + (high - low) / 2u;
+        if (image->timeline[mid].start_tstates <= position) {
+            low = mid;
+        } else {
+            high = mid;
         }
-        printf("Created empty WAV tape %s\n", path);
-        tape_free_image(&state->image);
-        tape_waveform_reset(&state->waveform);
-        state->waveform.sample_rate = sample_rate;
-        state->format = TAPE_FORMAT_WAV;
-        tape_wav_shared_position_tstates = 0;
-        return 1;
     }
+    return low;
+}
 
-    uint8_t riff_header[12];
-    if (fread(riff_header, sizeof(riff_header), 1, wf) != 1) {
-        fprintf(stderr, "Failed to read WAV header from '%s'\n", path);
-        fclose(wf);
-        return 0;
-    }
-
-    if (memcmp(riff_header, "RIFF", 4) != 0 || memcmp(riff_header + 8, "WAVE", 4) != 0) {
-        fprintf(stderr, "File '%s' is not a valid WAV image\n", path);
-        fclose(wf);
+static int tape_load_tap(const char* path, TapeImage* image) {
+    FILE* tf = fopen(path, "rb");
+    if (!tf) {
+        fprintf(stderr, "Failed to open TAP file '%s': %s\n", path, strerror(errno));
         return 0;
     }
 
-    uint16_t audio_format = 0;
-    uint16_t num_channels = 0;
-    uint32_t sample_rate = 0;
-    uint16_t bits_per_sample = 0;
-    uint8_t* data_buffer = NULL;
-    uint32_t data_size = 0;
-    int have_fmt = 0;
-    int have_data = 0;
-
-    for (;;) {
-        uint8_t chunk_header[8];
-        if (fread(chunk_header, sizeof(chunk_header), 1, wf) != 1) {
-            break;
-        }
-
-        uint32_t chunk_size = (uint32_t)chunk_header[4] |
-                               ((uint32_t)chunk_header[5] << 8) |
-                               ((uint32_t)chunk_header[6] << 16) |
-                               ((uint32_t)chunk_header[7] << 24);
-
-        if (memcmp(chunk_header, "fmt ", 4) == 0) {
-            if (chunk_size < 16) {
-                fprintf(stderr, "Invalid WAV fmt chunk in '%s'\n", path);
-                fclose(wf);
-                free(data_buffer);
+    uint8_t length_bytes[2];
+    while (fread(length_bytes, sizeof(length_bytes), 1, tf) == 1) {
+        uint32_t block_length = (uint32_t)length_bytes[0] | ((uint32_t)length_bytes[1] << 8);
+        uint8_t* buffer = NULL;
+        if (block_length > 0) {
+            buffer = (uint8_t*)malloc(block_length);
+            if (!buffer) {
+                fprintf(stderr, "Out of memory while reading TAP block\n");
+                fclose(tf);
                 return 0;
             }
-            uint8_t* fmt_data = (uint8_t*)malloc(chunk_size);
-            if (!fmt_data) {
-                fprintf(stderr, "Out of memory while reading WAV fmt chunk\n");
-                fclose(wf);
-                free(data_buffer);
+            if (fread(buffer, block_length, 1, tf) != 1) {
+                fprintf(stderr, "Failed to read TAP block payload\n");
+                free(buffer);
+                fclose(tf);
                 return 0;
             }
-            if (fread(fmt_data, chunk_size, 1, wf) != 1) {
-                fprintf(stderr, "Failed to read WAV fmt chunk\n");
-                free(fmt_data);
-                fclose(wf);
-                free(data_buffer);
+        }
+
+        uint32_t pause_ms = 1000u;
+        if (buffer) {
+            if (!tape_image_add_block(image, buffer, block_length, pause_ms)) {
+                fprintf(stderr, "Failed to store TAP block\n");
+                free(buffer);
+                fclose(tf);
                 return 0;
             }
-            audio_format = (uint16_t)fmt_data[0] | ((uint16_t)fmt_data[1] << 8);
-            num_channels = (uint16_t)fmt_data[2] | ((uint16_t)fmt_data[3] << 8);
-            sample_rate = (uint32_t)fmt_data[4] |
-                          ((uint32_t)fmt_data[5] << 8) |
-                          ((uint32_t)fmt_data[6] << 16) |
-                          ((uint32_t)fmt_data[7] << 24);
-            bits_per_sample = (uint16_t)fmt_data[14] | ((uint16_t)fmt_data[15] << 8);
-            free(fmt_data);
-            have_fmt = 1;
-        } else if (memcmp(chunk_header, "data", 4) == 0) {
-            if (chunk_size == 0) {
-                free(data_buffer);
-                data_buffer = NULL;
-                data_size = 0;
-                have_data = 1;
-            } else {
-                uint8_t* buffer = (uint8_t*)malloc(chunk_size);
-                if (!buffer) {
-                    fprintf(stderr, "Out of memory while reading WAV data chunk\n");
-                    fclose(wf);
-                    free(data_buffer);
-                    return 0;
-                }
-                if (fread(buffer, chunk_size, 1, wf) != 1) {
-                    fprintf(stderr, "Failed to read WAV data chunk\n");
-                    free(buffer);
-                    fclose(wf);
-                    free(data_buffer);
-                    return 0;
-                }
-                free(data_buffer);
-                data_buffer = buffer;
-                data_size = chunk_size;
-                have_data = 1;
-            }
+            free(buffer);
         } else {
-            if (fseek(wf, chunk_size, SEEK_CUR) != 0) {
-                fprintf(stderr, "Failed to skip WAV chunk in '%s'\n", path);
-                fclose(wf);
-                free(data_buffer);
-                return 0;
-            }
-        }
-
-        if (chunk_size & 1u) {
-            if (fseek(wf, 1, SEEK_CUR) != 0) {
-                fprintf(stderr, "Failed to align WAV chunk in '%s'\n", path);
-                fclose(wf);
-                free(data_buffer);
+            uint8_t empty = 0;
+            if (!tape_image_add_block(image, &empty, 0u, pause_ms)) {
+                fprintf(stderr, "Failed to store empty TAP block\n");
+                fclose(tf);
                 return 0;
             }
         }
-
-        if (have_fmt && have_data) {
-            break;
-        }
     }
 
-    fclose(wf);
-
-    if (!have_fmt || !have_data) {
-        fprintf(stderr, "WAV file '%s' is missing required chunks\n", path);
-        free(data_buffer);
+    if (!feof(tf)) {
+        fprintf(stderr, "Failed to read TAP file '%s' completely\n", path);
+        fclose(tf);
         return 0;
     }
 
-    if (audio_format != 1) {
-        fprintf(stderr, "WAV file '%s' is not PCM encoded\n", path);
-        free(data_buffer);
-        return 0;
+    fclose(tf);
+    if (tape_debug_logging) {
+        tape_log("Loaded TAP '%s' with %zu blocks\n", path, image->count);
     }
+    return 1;
+}
 
-    if (num_channels != 1) {
-        fprintf(stderr, "WAV file '%s' must be mono for tape loading\n", path);
-        free(data_buffer);
+// Size of the TZX block body at `body` (after the ID byte), or 0 when the
+// ID is unknown or the block runs past `available` bytes.
+static size_t tape_tzx_block_size(int block_id, const uint8_t* body, size_t available) {
+    size_t fixed = 0;
+    size_t variable = 0;
+    switch (block_id) {
+        case 0x10: fixed = 4u; break;
+        case 0x11: fixed = 18u; break;
+        case 0x12: fixed = 4u; break;
+        case 0x13: fixed = 1u; break;
+        case 0x14: fixed = 10u; break;
+        case 0x15: fixed = 8u; break;
+        case 0x20: fixed = 2u; break;
+        case 0x21: fixed = 1u; break;
+        case 0x22: fixed = 0u; break;
+        case 0x30: fixed = 1u; break;
+        case 0x31: fixed = 2u; break;
+        case 0x32: fixed = 2u; break;
+        case 0x33: fixed = 1u; break;
+        case 0x35: fixed = 20u; break;
+        case 0x5A: fixed = 9u; break;
+        default:
+            return 0;
+    }
+    if (available < fixed) {
         return 0;
     }
-
-    if (bits_per_sample != 8 && bits_per_sample != 16) {
-        fprintf(stderr, "Unsupported WAV bit depth (%u) in '%s'\n", (unsigned)bits_per_sample, path);
-        free(data_buffer);
+    switch (block_id) {
+        case 0x10: variable = tape_read_le16(body + 2); break;
+        case 0x11: variable = tape_read_le24(body + 15); break;
+        case 0x13: variable = (size_t)body[0] * 2u; break;
+        case 0x14: variable = tape_read_le24(body + 7); break;
+        case 0x15: variable = tape_read_le24(body + 5); break;
+        case 0x21: variable = body[0]; break;
+        case 0x30: variable = body[0]; break;
+        case 0x31: variable = body[1]; break;
+        case 0x32: variable = tape_read_le16(body); break;
+        case 0x33: variable = (size_t)body[0] * 3u; break;
+        case 0x35: variable = tape_read_le32(body + 16); break;
+        default: break;
+    }
+    if (available - fixed < variable) {
         return 0;
     }
+    return fixed + variable;
+}
 
-    if (sample_rate == 0) {
-        fprintf(stderr, "Invalid WAV sample rate in '%s'\n", path);
-        free(data_buffer);
-        return 0;
+// Starts a block whose payload stays in the image's arena.
+static TapeBlock* tape_tzx_arena_block(TapeImage* image,
+                                       TapeBlockType type,
+                                       uint8_t* payload,
+                                       uint32_t length,
+                                       uint32_t pause_ms) {
+    TapeBlock* block = tape_image_new_block(image);
+    if (!block) {
+        return NULL;
     }
+    block->type = type;
+    block->data = length > 0u ? payload : NULL;
+    block->length = length;
+    block->pause_ms = pause_ms == 0xFFFFu ? 0u : pause_ms;
+    block->in_arena = 1;
+    return block;
+}
 
-    int bytes_per_sample = bits_per_sample / 8;
-    if (bytes_per_sample <= 0) {
-        free(data_buffer);
+// Reads the whole file into one buffer that becomes the image's arena,
+// checks every block's length against it, sizes the block array once and
+// then points the blocks at their payloads in place. Only pulse sequences
+// (0x13) are copied, into host-order durations. Descriptive blocks are
+// skipped and 0x20 becomes a pause.
+static int tape_load_tzx(const char* path, TapeImage* image) {
+    FILE* tf = fopen(path, "rb");
+    if (!tf) {
+        fprintf(stderr, "Failed to open TZX file '%s': %s\n", path, strerror(errno));
         return 0;
     }
-
-    if (data_size % (uint32_t)bytes_per_sample != 0u) {
-        fprintf(stderr, "Corrupt WAV data chunk in '%s'\n", path);
-        free(data_buffer);
+    long file_size = -1;
+    if (fseek(tf, 0, SEEK_END) == 0) {
+        file_size = ftell(tf);
+    }
+    if (file_size < 0 || fseek(tf, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to determine size of TZX file '%s'\n", path);
+        fclose(tf);
         return 0;
     }
-
-    size_t total_samples = data_size / (size_t)bytes_per_sample;
-
-    tape_free_image(&state->image);
-    tape_waveform_reset(&state->waveform);
-    state->waveform.sample_rate = sample_rate;
-    state->format = TAPE_FORMAT_WAV;
-
-    if (total_samples == 0) {
-        free(data_buffer);
-        return 1;
+    size_t size = (size_t)file_size;
+    uint8_t* arena = (uint8_t*)malloc(size > 0u ? size : 1u);
+    if (!arena) {
+        fprintf(stderr, "Out of memory while reading TZX file\n");
+        fclose(tf);
+        return 0;
     }
-
-    size_t offset = 0;
-    int32_t first_value = 0;
-    if (bits_per_sample == 16) {
-        first_value = (int16_t)((uint16_t)data_buffer[offset] | ((uint16_t)data_buffer[offset + 1] << 8));
-    } else {
-        first_value = (int32_t)data_buffer[offset] - 128;
+    if (size > 0u && fread(arena, size, 1, tf) != 1) {
+        fprintf(stderr, "Failed to read TZX file '%s'\n", path);
+        free(arena);
+        fclose(tf);
+        return 0;
     }
-    int previous_level = (first_value >= 0) ? 1 : 0;
-    state->waveform.initial_level = previous_level;
-    size_t run_length = 1;
-    offset += (size_t)bytes_per_sample;
-
-    double tstates_per_sample = CPU_CLOCK_HZ / (double)sample_rate;
+    fclose(tf);
 
-    for (size_t sample_index = 1; sample_index < total_samples; ++sample_index) {
-        int32_t sample_value = 0;
-        if (bits_per_sample == 16) {
-            sample_value = (int16_t)((uint16_t)data_buffer[offset] | ((uint16_t)data_buffer[offset + 1] << 8));
-        } else {
-            sample_value = (int32_t)data_buffer[offset] - 128;
-        }
-        int level = (sample_value >= 0) ? 1 : 0;
+    if (size < 10u || memcmp(arena, "ZXTape!\x1A", 8) != 0) {
+        fprintf(stderr, "File '%s' is not a valid TZX image\n", path);
+        free(arena);
+        return 0;
+    }
 
-        if (level == previous_level) {
-            run_length++;
-        } else {
-            uint64_t duration = (uint64_t)(tstates_per_sample * (double)run_length + 0.5);
-            if (duration == 0 && run_length > 0) {
-                duration = 1;
-            }
-            if (!tape_waveform_add_pulse(&state->waveform, duration)) {
-                fprintf(stderr, "Out of memory while decoding WAV tape\n");
-                free(data_buffer);
-                tape_waveform_reset(&state->waveform);
-                state->format = TAPE_FORMAT_NONE;
-                return 0;
+    size_t block_count = 0;
+    for (size_t offset = 10u; offset < size;) {
+        int block_id = arena[offset++];
+        size_t body_size = tape_tzx_block_size(block_id, arena + offset, size - offset);
+        if (body_size == 0u && block_id != 0x22) {
+            if (block_id >= 0x10 && block_id <= 0x15) {
+                fprintf(stderr, "Truncated TZX block 0x%02X in '%s'\n", block_id, path);
+            } else {
+                fprintf(stderr, "Unsupported TZX block type 0x%02X in '%s'\n", block_id, path);
             }
-            previous_level = level;
-            run_length = 1;
+            free(arena);
+            return 0;
         }
-
-        offset += (size_t)bytes_per_sample;
-    }
-
-    free(data_buffer);
-    if (state == &tape_playback) {
-        tape_wav_shared_position_tstates = 0;
+        if ((block_id >= 0x10 && block_id <= 0x15 && !(block_id == 0x13 && arena[offset] == 0u)) ||
+            block_id == 0x20) {
+            ++block_count;
+        }
+        offset += body_size;
     }
-    return 1;
-}
 
-static int string_ends_with_case_insensitive(const char* str, const char* suffix) {
-    if (!str || !suffix) {
+    if (!tape_image_reserve(image, block_count)) {
+        fprintf(stderr, "Out of memory while reading TZX file\n");
+        free(arena);
         return 0;
     }
+    image->arena = arena;
 
-    size_t str_len = strlen(str);
-    size_t suffix_len = strlen(suffix);
-    if (suffix_len == 0 || suffix_len > str_len) {
-        return 0;
-    }
+    for (size_t offset = 10u; offset < size;) {
+        int block_id = arena[offset++];
+        uint8_t* body = arena + offset;
+        offset += tape_tzx_block_size(block_id, body, size - offset);
 
-    const char* str_tail = str + (str_len - suffix_len);
-    for (size_t i = 0; i < suffix_len; ++i) {
-        char a = str_tail[i];
-        char b = suffix[i];
-        if (a >= 'A' && a <= 'Z') {
-            a = (char)(a - 'A' + 'a');
-        }
-        if (b >= 'A' && b <= 'Z') {
-            b = (char)(b - 'A' + 'a');
+        TapeBlock* block = NULL;
+        switch (block_id) {
+            case 0x10:
+                block = tape_tzx_arena_block(image, TAPE_BLOCK_TYPE_STANDARD, body + 4, tape_read_le16(body + 2),
+                                             tape_read_le16(body));
+                break;
+            case 0x11:
+            case 0x14: {
+                // Both pulses of a bit share one duration in TZX.
+                const uint8_t* timing = block_id == 0x11 ? body + 6 : body;
+                uint8_t* tail = block_id == 0x11 ? body + 12 : body + 4;
+                block = tape_tzx_arena_block(image,
+                                             block_id == 0x11 ? TAPE_BLOCK_TYPE_TURBO : TAPE_BLOCK_TYPE_PURE_DATA,
+                                             tail + 6,
+                                             tape_read_le24(tail + 3),
+                                             tape_read_le16(tail + 1));
+                if (!block) {
+                    break;
+                }
+                if (block_id == 0x11) {
+                    block->pilot_pulse_tstates = tape_read_le16(body);
+                    block->sync_first_pulse_tstates = tape_read_le16(body + 2);
+                    block->sync_second_pulse_tstates = tape_read_le16(body + 4);
+                    block->pilot_pulse_count = tape_read_le16(body + 10);
+                } else {
+                    block->pilot_pulse_tstates = 0u;
+                    block->sync_first_pulse_tstates = 0u;
+                    block->sync_second_pulse_tstates = 0u;
+                }
+                block->bit0_first_pulse_tstates = block->bit0_second_pulse_tstates = tape_read_le16(timing);
+                block->bit1_first_pulse_tstates = block->bit1_second_pulse_tstates = tape_read_le16(timing + 2);
+                block->used_bits_in_last_byte = tail[0] == 0u ? 8u : tail[0];
+                break;
+            }
+            case 0x12:
+                block = tape_tzx_arena_block(image, TAPE_BLOCK_TYPE_PURE_TONE, NULL, 0u, 0u);
+                if (block) {
+                    block->tone_pulse_tstates = tape_read_le16(body);
+                    block->tone_pulse_count = tape_read_le16(body + 2);
+                }
+                break;
+            case 0x13:
+                if (body[0] == 0u) {
+                    continue;
+                }
+                block = tape_tzx_arena_block(image, TAPE_BLOCK_TYPE_PULSE_SEQUENCE, NULL, 0u, 0u);
+                if (block) {
+                    block->pulse_sequence_durations = (uint16_t*)malloc((size_t)body[0] * sizeof(uint16_t));
+                    if (!block->pulse_sequence_durations) {
+                        block = NULL;
+                        break;
+                    }
+                    for (size_t i = 0; i < body[0]; ++i) {
+                        block->pulse_sequence_durations[i] = tape_read_le16(body + 1 + i * 2u);
+                    }
+                    block->pulse_sequence_count = body[0];
+                }
+                break;
+            case 0x15: {
+                uint32_t sample_bytes = tape_read_le24(body + 5);
+                block = tape_tzx_arena_block(image,
+                                             TAPE_BLOCK_TYPE_DIRECT_RECORDING,
+                                             NULL,
+                                             0u,
+                                             tape_read_le16(body + 2));
+                if (!block) {
+                    break;
+                }
+                block->direct_tstates_per_sample = tape_read_le16(body);
+                block->used_bits_in_last_byte = body[4] == 0u ? 8u : body[4];
+                block->direct_samples = sample_bytes > 0u ? body + 8 : NULL;
+                uint32_t total_bits = sample_bytes * 8u;
+                if (sample_bytes > 0u && block->used_bits_in_last_byte < 8u) {
+                    total_bits -= (uint32_t)(8u - block->used_bits_in_last_byte);
+                }
+                block->direct_sample_count = total_bits;
+                block->direct_initial_level = (total_bits > 0u && (body[8] & 0x80u)) ? 1 : 0;
+                break;
+            }
+            case 0x20:
+                block = tape_tzx_arena_block(image, TAPE_BLOCK_TYPE_PULSE_SEQUENCE, NULL, 0u, tape_read_le16(body));
+                break;
+            default:
+                continue;
         }
-        if (a != b) {
+        if (!block) {
+            fprintf(stderr, "Failed to store TZX block 0x%02X\n", block_id);
             return 0;
         }
+        tape_log_block_summary(block, image->count);
+        image->count++;
     }
 
     return 1;
 }
 
-static TapeFormat tape_format_from_extension(const char* path) {
-    if (!path) {
-        return TAPE_FORMAT_NONE;
+// --- Inflate ---
+// Just enough of zlib (RFC 1950/1951) to unpack CSW Z-RLE data on load.
+// Codes are decoded a bit at a time from canonical code counts, which is
+// slow but small; the RLE it produces is about a byte a pulse.
+#define TAPE_INFLATE_MAX_BITS 15
+
+typedef struct TapeInflateCode {
+    uint16_t counts[TAPE_INFLATE_MAX_BITS + 1];
+    uint16_t symbols[288];
+} TapeInflateCode;
+
+typedef struct TapeInflate {
+    const uint8_t* src;
+    size_t src_len;
+    size_t src_pos;
+    uint32_t bit_buffer;
+    int bit_count;
+    uint8_t* out;
+    size_t out_len;
+    size_t out_capacity;
+    int failed;
+} TapeInflate;
+
+static const uint16_t tape_inflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t tape_inflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t tape_inflate_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t tape_inflate_distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint32_t tape_inflate_bits(TapeInflate* z, int count) {
+    while (z->bit_count < count) {
+        if (z->src_pos >= z->src_len) {
+            z->failed = 1;
+            return 0;
+        }
+        z->bit_buffer |= (uint32_t)z->src[z->src_pos++] << z->bit_count;
+        z->bit_count += 8;
     }
+    uint32_t value = z->bit_buffer & ((1u << count) - 1u);
+    z->bit_buffer >>= count;
+    z->bit_count -= count;
+    return value;
+}
 
-    if (string_ends_with_case_insensitive(path, ".tap")) {
-        return TAPE_FORMAT_TAP;
+static void tape_inflate_build(TapeInflateCode* code, const uint8_t* lengths, int count) {
+    uint16_t offsets[TAPE_INFLATE_MAX_BITS + 1];
+    memset(code->counts, 0, sizeof(code->counts));
+    for (int i = 0; i < count; ++i) {
+        code->counts[lengths[i]]++;
     }
-    if (string_ends_with_case_insensitive(path, ".tzx")) {
-        return TAPE_FORMAT_TZX;
+    code->counts[0] = 0;
+    offsets[1] = 0;
+    for (int length = 1; length < TAPE_INFLATE_MAX_BITS; ++length) {
+        offsets[length + 1] = (uint16_t)(offsets[length] + code->counts[length]);
     }
-    if (string_ends_with_case_insensitive(path, ".wav")) {
-        return TAPE_FORMAT_WAV;
+    for (int i = 0; i < count; ++i) {
+        if (lengths[i]) {
+            code->symbols[offsets[lengths[i]]++] = (uint16_t)i;
+        }
     }
-
-    return TAPE_FORMAT_NONE;
 }
 
-static void tape_set_input_path(const char* path) {
-    if (path && *path) {
-        size_t length = strlen(path);
-        if (length >= sizeof(tape_input_path_storage)) {
-            length = sizeof(tape_input_path_storage) - 1u;
+static int tape_inflate_decode(TapeInflate* z, const TapeInflateCode* code) {
+    int value = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length <= TAPE_INFLATE_MAX_BITS; ++length) {
+        value |= (int)tape_inflate_bits(z, 1);
+        int count = code->counts[length];
+        if (value - first < count) {
+            return code->symbols[index + value - first];
         }
-        memcpy(tape_input_path_storage, path, length);
-        tape_input_path_storage[length] = '\0';
-        tape_input_path = tape_input_path_storage;
-    } else {
-        tape_input_path_storage[0] = '\0';
-        tape_input_path = NULL;
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
     }
+    z->failed = 1;
+    return -1;
 }
 
-static int tape_load_image(const char* path, TapeFormat format, TapeImage* image) {
-    if (!path || !image || format == TAPE_FORMAT_NONE) {
-        return 0;
+static int tape_inflate_put(TapeInflate* z, uint8_t value) {
+    if (z->out_len == z->out_capacity) {
+        size_t capacity = z->out_capacity ? z->out_capacity * 2u : 4096u;
+        uint8_t* grown = (uint8_t*)realloc(z->out, capacity);
+        if (!grown) {
+            z->failed = 1;
+            return 0;
+        }
+        z->out = grown;
+        z->out_capacity = capacity;
     }
+    z->out[z->out_len++] = value;
+    return 1;
+}
 
-    tape_free_image(image);
-
-    switch (format) {
-        case TAPE_FORMAT_TAP:
-            return tape_load_tap(path, image);
-        case TAPE_FORMAT_TZX:
-            return tape_load_tzx(path, image);
-        default:
-            break;
+static int tape_inflate_block(TapeInflate* z, const TapeInflateCode* lengths, const TapeInflateCode* distances) {
+    for (;;) {
+        int symbol = tape_inflate_decode(z, lengths);
+        if (z->failed) {
+            return 0;
+        }
+        if (symbol < 256) {
+            if (!tape_inflate_put(z, (uint8_t)symbol)) {
+                return 0;
+            }
+            continue;
+        }
+        if (symbol == 256) {
+            return 1;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return 0;
+        }
+        size_t length = tape_inflate_length_base[symbol] + tape_inflate_bits(z, tape_inflate_length_extra[symbol]);
+        int distance_symbol = tape_inflate_decode(z, distances);
+        if (z->failed || distance_symbol >= 30) {
+            return 0;
+        }
+        size_t distance = tape_inflate_distance_base[distance_symbol] +
+                          tape_inflate_bits(z, tape_inflate_distance_extra[distance_symbol]);
+        if (z->failed || distance > z->out_len) {
+            return 0;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (!tape_inflate_put(z, z->out[z->out_len - distance])) {
+                return 0;
+            }
+        }
     }
-
-    return 0;
 }
 
-static int speaker_component_amplitude(int level) {
-    return level ? 1 : -1;
-}
+static int tape_inflate_dynamic_block(TapeInflate* z) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    int literal_count = (int)tape_inflate_bits(z, 5) + 257;
+    int distance_count = (int)tape_inflate_bits(z, 5) + 1;
+    int code_count = (int)tape_inflate_bits(z, 4) + 4;
+    if (z->failed || literal_count > 286 || distance_count > 30) {
+        return 0;
+    }
 
-static int speaker_calculate_output_level(void) {
-    int combined = speaker_component_amplitude(beeper_state);
-    combined += speaker_component_amplitude(speaker_tape_playback_level);
-    combined += speaker_component_amplitude(speaker_tape_record_level);
-    return combined;
-}
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < code_count; ++i) {
+        lengths[order[i]] = (uint8_t)tape_inflate_bits(z, 3);
+    }
+    TapeInflateCode length_code;
+    tape_inflate_build(&length_code, lengths, 19);
 
-static void speaker_update_output(uint64_t t_state, int emit_event) {
-    int new_level = speaker_calculate_output_level();
-    if (new_level != speaker_output_level) {
-        speaker_output_level = new_level;
-        if (emit_event) {
-            beeper_push_event(t_state, new_level);
+    int total = literal_count + distance_count;
+    int index = 0;
+    memset(lengths, 0, sizeof(lengths));
+    while (index < total) {
+        int symbol = tape_inflate_decode(z, &length_code);
+        if (z->failed) {
+            return 0;
+        }
+        if (symbol < 16) {
+            lengths[index++] = (uint8_t)symbol;
+            continue;
+        }
+        uint8_t value = 0;
+        int repeat = 0;
+        if (symbol == 16) {
+            if (index == 0) {
+                return 0;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + (int)tape_inflate_bits(z, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + (int)tape_inflate_bits(z, 3);
+        } else {
+            repeat = 11 + (int)tape_inflate_bits(z, 7);
+        }
+        if (z->failed || index + repeat > total) {
+            return 0;
+        }
+        while (repeat-- > 0) {
+            lengths[index++] = value;
         }
     }
-}
 
-static double ay_clamp_pan(double value) {
-    if (value < -1.0) {
-        return -1.0;
-    }
-    if (value > 1.0) {
-        return 1.0;
-    }
-    return value;
+    TapeInflateCode literals;
+    TapeInflateCode distances;
+    tape_inflate_build(&literals, lengths, literal_count);
+    tape_inflate_build(&distances, lengths + literal_count, distance_count);
+    return tape_inflate_block(z, &literals, &distances);
 }
 
-static void ay_compute_pan_gains(double pan, double* left_gain, double* right_gain) {
-    if (!left_gain || !right_gain) {
-        return;
+// Unpacks a zlib stream into a new buffer in `*out`; the checksum is not
+// verified. Returns 0 on malformed input.
+static int tape_inflate_zlib(const uint8_t* src, size_t src_len, uint8_t** out, size_t* out_len) {
+    if (src_len < 2u || (src[0] & 0x0Fu) != 8u || (((unsigned)src[0] << 8) | src[1]) % 31u != 0u ||
+        (src[1] & 0x20u)) {
+        return 0;
     }
-    double clamped = ay_clamp_pan(pan);
-    double angle = (clamped + 1.0) * (M_PI * 0.25);
-    *left_gain = cos(angle);
-    *right_gain = sin(angle);
-}
 
-static double ay_highpass(double input, double* last_input, double* last_output) {
-    if (!last_input || !last_output) {
-        return 0.0;
+    TapeInflate z;
+    memset(&z, 0, sizeof(z));
+    z.src = src;
+    z.src_len = src_len;
+    z.src_pos = 2u;
+    int last = 0;
+    while (!last && !z.failed) {
+        last = (int)tape_inflate_bits(&z, 1);
+        uint32_t type = tape_inflate_bits(&z, 2);
+        if (z.failed) {
+            break;
+        }
+        if (type == 0u) {
+            z.bit_buffer = 0;
+            z.bit_count = 0;
+            if (z.src_len - z.src_pos < 4u) {
+                z.failed = 1;
+                break;
+            }
+            uint16_t length = tape_read_le16(z.src + z.src_pos);
+            uint16_t check = tape_read_le16(z.src + z.src_pos + 2u);
+            z.src_pos += 4u;
+            if ((uint16_t)~check != length || z.src_len - z.src_pos < length) {
+                z.failed = 1;
+                break;
+            }
+            for (uint16_t i = 0; i < length; ++i) {
+                if (!tape_inflate_put(&z, z.src[z.src_pos + i])) {
+                    break;
+                }
+            }
+            z.src_pos += length;
+        } else if (type == 1u) {
+            uint8_t lengths[288 + 30];
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 112);
+            memset(lengths + 256, 7, 24);
+            memset(lengths + 280, 8, 8);
+            memset(lengths + 288, 5, 30);
+            TapeInflateCode literals;
+            TapeInflateCode distances;
+            tape_inflate_build(&literals, lengths, 288);
+            tape_inflate_build(&distances, lengths + 288, 30);
+            if (!tape_inflate_block(&z, &literals, &distances)) {
+                z.failed = 1;
+            }
+        } else if (type == 2u) {
+            if (!tape_inflate_dynamic_block(&z)) {
+                z.failed = 1;
+            }
+        } else {
+            z.failed = 1;
+        }
     }
-    double filtered = input - *last_input + BEEPER_HP_ALPHA * (*last_output);
-    *last_input = input;
-    *last_output = filtered;
-    return filtered;
-}
 
-static void ay_refresh_tone_period(int channel) {
-    if (channel < 0 || channel > 2) {
-        return;
-    }
-    uint8_t low = ay_registers[channel * 2];
-    uint8_t high = (uint8_t)(ay_registers[channel * 2 + 1] & 0x0Fu);
-    uint16_t period = (uint16_t)low | ((uint16_t)high << 8);
-    if (period == 0u) {
-        period = 1u;
-    }
-    double cycles = (double)period * 16.0;
-    ay_state.tone_period[channel] = cycles;
-    if (ay_state.tone_counter[channel] <= 0.0 || ay_state.tone_counter[channel] > cycles) {
-        ay_state.tone_counter[channel] = cycles;
+    if (z.failed) {
+        free(z.out);
+        return 0;
     }
+    *out = z.out;
+    *out_len = z.out_len;
+    return 1;
 }
 
-static void ay_refresh_noise_period(void) {
-    uint8_t value = (uint8_t)(ay_registers[6] & 0x1Fu);
-    if (value == 0u) {
-        value = 1u;
+// CSW v1 and v2 (RLE or Z-RLE). The pulse stream is kept as RLE, unpacked
+// first if compressed, and played by the pulse cursor as one block.
+static int tape_load_csw(const char* path, TapeImage* image) {
+    FILE* tf = fopen(path, "rb");
+    if (!tf) {
+        fprintf(stderr, "Failed to open CSW file '%s': %s\n", path, strerror(errno));
+        return 0;
     }
-    double cycles = (double)value * 16.0;
-    ay_state.noise_period = cycles;
-    if (ay_state.noise_counter <= 0.0 || ay_state.noise_counter > cycles) {
-        ay_state.noise_counter = cycles;
+    long file_size = -1;
+    if (fseek(tf, 0, SEEK_END) == 0) {
+        file_size = ftell(tf);
     }
-}
-
-static void ay_refresh_envelope_period(void) {
-    uint16_t period = (uint16_t)ay_registers[11] | ((uint16_t)ay_registers[12] << 8);
-    if (period == 0u) {
-        period = 1u;
+    if (file_size < 0 || fseek(tf, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to determine size of CSW file '%s'\n", path);
+        fclose(tf);
+        return 0;
     }
-    double cycles = (double)period * 256.0;
-    ay_state.envelope_period = cycles;
-    if (ay_state.envelope_counter <= 0.0 || ay_state.envelope_counter > cycles) {
-        ay_state.envelope_counter = cycles;
+    uint8_t* file = (uint8_t*)malloc(file_size > 0 ? (size_t)file_size : 1u);
+    if (!file) {
+        fprintf(stderr, "Out of memory while reading CSW file\n");
+        fclose(tf);
+        return 0;
     }
-}
+    size_t size = fread(file, 1u, (size_t)file_size, tf);
+    fclose(tf);
 
-static void ay_restart_envelope(void) {
-    uint8_t shape = (uint8_t)(ay_registers[13] & 0x0Fu);
-    ay_state.envelope_continue = (shape >> 3) & 0x01;
-    ay_state.envelope_direction = ((shape >> 2) & 0x01) ? 1 : -1;
-    ay_state.envelope_alternate = (shape >> 1) & 0x01;
-    ay_state.envelope_hold = shape & 0x01;
-    if (!ay_state.envelope_continue) {
-        ay_state.envelope_hold = 1;
-        ay_state.envelope_alternate = 0;
-    }
-    ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 0u : 15u);
-    ay_state.envelope_active = 1;
-    if (ay_state.envelope_counter <= 0.0) {
-        ay_state.envelope_counter = ay_state.envelope_period > 0.0 ? ay_state.envelope_period : 1.0;
+    if (size < 0x20u || memcmp(file, "Compressed Square Wave\x1A", 23) != 0) {
+        fprintf(stderr, "File '%s' is not a valid CSW image\n", path);
+        free(file);
+        return 0;
     }
-}
 
-static void ay_handle_envelope_limit(void) {
-    if (!ay_state.envelope_continue) {
-        ay_state.envelope_active = 0;
-        ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 15u : 0u);
-        return;
+    uint8_t major = file[0x17];
+    uint32_t sample_rate = 0;
+    uint8_t compression = 0;
+    uint8_t flags = 0;
+    size_t data_offset = 0;
+    if (major == 1u) {
+        sample_rate = tape_read_le16(file + 0x19);
+        compression = file[0x1B];
+        flags = file[0x1C];
+        data_offset = 0x20u;
+    } else if (major == 2u && size >= 0x34u) {
+        sample_rate = tape_read_le32(file + 0x19);
+        compression = file[0x21];
+        flags = file[0x22];
+        data_offset = 0x34u + file[0x23];
+    }
+    if (sample_rate == 0u || data_offset > size || (compression != 1u && !(major == 2u && compression == 2u))) {
+        fprintf(stderr, "Unsupported CSW layout in '%s' (version %u, compression %u)\n",
+                path,
+                (unsigned)major,
+                (unsigned)compression);
+        free(file);
+        return 0;
     }
 
-    if (ay_state.envelope_hold) {
-        ay_state.envelope_active = 0;
-        if (ay_state.envelope_alternate) {
-            ay_state.envelope_direction = -ay_state.envelope_direction;
+    uint8_t* rle = NULL;
+    size_t rle_length = 0;
+    if (compression == 2u) {
+        if (!tape_inflate_zlib(file + data_offset, size - data_offset, &rle, &rle_length)) {
+            fprintf(stderr, "Failed to unpack Z-RLE data in '%s'\n", path);
+            free(file);
+            return 0;
         }
-        ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 15u : 0u);
-        return;
+        free(file);
+    } else {
+        rle_length = size - data_offset;
+        memmove(file, file + data_offset, rle_length);
+        rle = file;
+    }
+    if (rle_length > UINT32_MAX) {
+        fprintf(stderr, "CSW file '%s' is too long\n", path);
+        free(rle);
+        return 0;
     }
 
-    if (ay_state.envelope_alternate) {
-        ay_state.envelope_direction = -ay_state.envelope_direction;
+    size_t index = image->count;
+    if (!tape_image_add_stream_block(image, TAPE_BLOCK_TYPE_CSW, rle, (uint32_t)rle_length, 0u)) {
+        fprintf(stderr, "Failed to store CSW pulse stream\n");
+        return 0;
     }
-    ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 0u : 15u);
+    image->blocks[index].csw_sample_rate = sample_rate;
+    image->blocks[index].direct_initial_level = (flags & 0x01u) ? 1 : 0;
+    return 1;
 }
 
-static void ay_step_envelope(void) {
-    if (!ay_state.envelope_active) {
-        return;
+// PZX: PULS and DATA bodies are played in place, PAUS becomes a pause and
+// the descriptive blocks are skipped. Levels are taken as relative: only
+// the first block's starting level is honoured, as loaders time edges.
+static int tape_load_pzx(const char* path, TapeImage* image) {
+    FILE* tf = fopen(path, "rb");
+    if (!tf) {
+        fprintf(stderr, "Failed to open PZX file '%s': %s\n", path, strerror(errno));
+        return 0;
     }
-    if (ay_state.envelope_direction > 0) {
-        if (ay_state.envelope_volume < 15u) {
-            ++ay_state.envelope_volume;
-            return;
+    long file_size = -1;
+    if (fseek(tf, 0, SEEK_END) == 0) {
+        file_size = ftell(tf);
+    }
+    if (file_size < 0 || fseek(tf, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to determine size of PZX file '%s'\n", path);
+        fclose(tf);
+        return 0;
+    }
+
+    // Block sizes are checked against what is left of the file before
+    // anything is allocated or skipped.
+    int first = 1;
+    long offset = 0;
+    uint8_t header[8];
+    while (fread(header, sizeof(header), 1, tf) == 1) {
+        offset += (long)sizeof(header);
+        uint32_t size = tape_read_le32(header + 4);
+        if (first && memcmp(header, "PZXT", 4) != 0) {
+            fprintf(stderr, "File '%s' is not a valid PZX image\n", path);
+            fclose(tf);
+            return 0;
         }
-    } else {
-        if (ay_state.envelope_volume > 0u) {
-            --ay_state.envelope_volume;
-            return;
+        first = 0;
+        if ((uint64_t)size > (uint64_t)(file_size - offset)) {
+            fprintf(stderr, "Truncated PZX block\n");
+            fclose(tf);
+            return 0;
         }
-    }
-    ay_handle_envelope_limit();
-}
+        offset += (long)size;
 
-static void ay_step_generators(double elapsed_cycles) {
-    for (int ch = 0; ch < 3; ++ch) {
-        double period = ay_state.tone_period[ch];
-        if (period <= 0.0) {
-            ay_state.tone_output[ch] = 1;
-            ay_state.tone_counter[ch] = 1.0;
+        int is_pulses = memcmp(header, "PULS", 4) == 0;
+        int is_data = memcmp(header, "DATA", 4) == 0;
+        int is_pause = memcmp(header, "PAUS", 4) == 0;
+        if (!is_pulses && !is_data && !is_pause) {
+            if (fseek(tf, offset, SEEK_SET) != 0) {
+                fprintf(stderr, "Truncated PZX block\n");
+                fclose(tf);
+                return 0;
+            }
             continue;
         }
-        double counter = ay_state.tone_counter[ch] - elapsed_cycles;
-        while (counter <= 0.0) {
-            counter += period;
-            ay_state.tone_output[ch] ^= 1;
+
+        uint8_t* body = (uint8_t*)malloc(size > 0u ? size : 1u);
+        if (!body) {
+            fprintf(stderr, "Out of memory while reading PZX block\n");
+            fclose(tf);
+            return 0;
+        }
+        if (size > 0u && fread(body, size, 1, tf) != 1) {
+            fprintf(stderr, "Failed to read PZX block payload\n");
+            free(body);
+            fclose(tf);
+            return 0;
         }
-        ay_state.tone_counter[ch] = counter;
-    }
 
-    double noise_period = ay_state.noise_period > 0.0 ? ay_state.noise_period : 1.0;
-    double noise_counter = ay_state.noise_counter - elapsed_cycles;
-    while (noise_counter <= 0.0) {
-        noise_counter += noise_period;
-        uint32_t lfsr = ay_state.noise_lfsr & 0x1FFFFu;
-        uint32_t feedback = (uint32_t)(((lfsr ^ (lfsr >> 3)) & 0x01u));
-        lfsr = (lfsr >> 1) | (feedback << 16);
-        if (lfsr == 0u) {
-            lfsr = 0x1FFFFu;
+        int stored = 0;
+        if (is_pause) {
+            uint32_t tstates = size >= 4u ? tape_read_le32(body) & 0x7FFFFFFFu : 0u;
+            free(body);
+            uint32_t pause_ms = (uint32_t)(((uint64_t)tstates * 1000u + (uint64_t)(CPU_CLOCK_HZ / 2.0)) /
+                                           (uint64_t)CPU_CLOCK_HZ);
+            stored = tape_image_add_pulse_sequence_block(image, NULL, 0u, pause_ms);
+        } else if (is_data) {
+            uint64_t needed = 8u;
+            if (size >= 8u) {
+                uint64_t bits = tape_read_le32(body) & 0x7FFFFFFFu;
+                needed += ((uint64_t)body[6] + body[7]) * 2u + (bits + 7u) / 8u;
+            }
+            if (size < needed) {
+                fprintf(stderr, "Truncated PZX data block\n");
+                free(body);
+                fclose(tf);
+                return 0;
+            }
+            stored = tape_image_add_stream_block(image, TAPE_BLOCK_TYPE_PZX_DATA, body, size, 0u);
+        } else {
+            stored = tape_image_add_stream_block(image, TAPE_BLOCK_TYPE_PZX_PULSES, body, size, 0u);
+        }
+        if (!stored) {
+            fprintf(stderr, "Failed to store PZX block\n");
+            fclose(tf);
+            return 0;
         }
-        ay_state.noise_lfsr = lfsr & 0x1FFFFu;
-        ay_state.noise_output = (int)(lfsr & 0x01u);
     }
-    ay_state.noise_counter = noise_counter;
 
-    double env_period = ay_state.envelope_period > 0.0 ? ay_state.envelope_period : 1.0;
-    double env_counter = ay_state.envelope_counter - elapsed_cycles;
-    while (env_counter <= 0.0) {
-        env_counter += env_period;
-        ay_step_envelope();
+    fclose(tf);
+    if (first) {
+        fprintf(stderr, "File '%s' is not a valid PZX image\n", path);
+        return 0;
     }
-    ay_state.envelope_counter = env_counter;
+    return 1;
 }
 
-static double ay_channel_volume_value(int channel) {
-    if (channel < 0 || channel > 2) {
-        return 0.0;
-    }
-    uint8_t reg = ay_registers[8 + channel];
-    if (reg & 0x10u) {
-        return ay_volume_table[ay_state.envelope_volume & 0x0Fu];
+static int z80_decompress_stream(FILE* sf, uint8_t* dest, size_t dest_size) {
+    if (!sf || !dest) {
+        return 0;
     }
-    return ay_volume_table[reg & 0x0Fu];
-}
 
-static double ay_channel_level(int channel) {
-    uint8_t mixer = ay_registers[7];
-    int tone_disabled = (mixer >> channel) & 0x01;
-    int noise_disabled = (mixer >> (channel + 3)) & 0x01;
-    int tone = tone_disabled ? 1 : ay_state.tone_output[channel];
-    int noise = noise_disabled ? 1 : ay_state.noise_output;
-    int active = tone & noise;
-    if (!active) {
-        return 0.0;
+    size_t dest_index = 0;
+    while (dest_index < dest_size) {
+        int byte_value = fgetc(sf);
+        if (byte_value == EOF) {
+            return 0;
+        }
+        if (byte_value != 0xED) {
+            dest[dest_index++] = (uint8_t)byte_value;
+            continue;
+        }
+
+        int next_value = fgetc(sf);
+        if (next_value == EOF) {
+            return 0;
+        }
+        if (next_value != 0xED) {
+            dest[dest_index++] = 0xED;
+            if (ungetc(next_value, sf) == EOF) {
+                return 0;
+            }
+            continue;
+        }
+
+        int count_value = fgetc(sf);
+        int data_value = fgetc(sf);
+        if (count_value == EOF || data_value == EOF) {
+            return 0;
+        }
+        size_t repeat = (count_value == 0) ? 256u : (size_t)count_value;
+        for (size_t i = 0; i < repeat; ++i) {
+            if (dest_index >= dest_size) {
+                return 0;
+            }
+            dest[dest_index++] = (uint8_t)data_value;
+        }
     }
-    return ay_channel_volume_value(channel);
+
+    return 1;
 }
 
-static void ay_reset_state_internal(void) {
-    memset(&ay_state, 0, sizeof(ay_state));
-    ay_state.noise_lfsr = 0x1FFFFu;
-    ay_state.noise_output = 1;
-    for (int ch = 0; ch < 3; ++ch) {
-        ay_refresh_tone_period(ch);
-        ay_state.tone_output[ch] = 0;
-    }
-    ay_refresh_noise_period();
-    ay_refresh_envelope_period();
-    ay_restart_envelope();
-    ay_hp_last_input_left = 0.0;
-    ay_hp_last_output_left = 0.0;
-    ay_hp_last_input_right = 0.0;
-    ay_hp_last_output_right = 0.0;
-}
-
-static void ay_reset_state(void) {
-    int locked = 0;
-    if (audio_available) {
-        audio_backend_lock();
-        locked = 1;
-    }
-    ay_reset_state_internal();
-    if (locked) {
-        audio_backend_unlock();
-    }
-}
-
-static void ay_set_sample_rate(int sample_rate) {
-    if (sample_rate <= 0) {
-        ay_cycles_per_sample = 0.0;
-        return;
-    }
-    ay_cycles_per_sample = AY_CLOCK_HZ / (double)sample_rate;
-}
-
-static void ay_mix_sample(double elapsed_cycles, double* left_out, double* right_out) {
-    if (!left_out || !right_out) {
-        return;
-    }
-    if (ay_cycles_per_sample <= 0.0) {
-        *left_out = 0.0;
-        *right_out = 0.0;
-        return;
+static int z80_decompress_block_buffer(const uint8_t* src,
+                                       size_t src_len,
+                                       uint8_t* dest,
+                                       size_t dest_len) {
+    if (!src || !dest) {
+        return 0;
     }
 
-    double step_cycles = (elapsed_cycles > 0.0) ? elapsed_cycles : ay_cycles_per_sample;
-    ay_step_generators(step_cycles);
-
-    double left = 0.0;
-    double right = 0.0;
-    for (int ch = 0; ch < 3; ++ch) {
-        double level = ay_channel_level(ch);
-        if (level <= 0.0) {
+    size_t src_index = 0;
+    size_t dest_index = 0;
+    while (dest_index < dest_len && src_index < src_len) {
+        uint8_t value = src[src_index++];
+        if (value != 0xED || src_index >= src_len) {
+            dest[dest_index++] = value;
             continue;
         }
-        double pan_left = 0.0;
-        double pan_right = 0.0;
-        ay_compute_pan_gains(ay_channel_pan[ch], &pan_left, &pan_right);
-        left += level * pan_left;
-        right += level * pan_right;
-    }
-
-    double filtered_left = ay_highpass(left, &ay_hp_last_input_left, &ay_hp_last_output_left);
-    double filtered_right = ay_highpass(right, &ay_hp_last_input_right, &ay_hp_last_output_right);
-
-    *left_out = filtered_left * ay_global_gain;
-    *right_out = filtered_right * ay_global_gain;
-}
-
-static void ay_write_register(uint8_t reg, uint8_t value) {
-    uint8_t index = (uint8_t)(reg & 0x0Fu);
-    ay_registers[index] = value;
-    int locked = 0;
-    if (audio_available) {
-        audio_backend_lock();
-        locked = 1;
-    }
-    switch (index) {
-        case 0:
-        case 1:
-            ay_refresh_tone_period(0);
-            break;
-        case 2:
-        case 3:
-            ay_refresh_tone_period(1);
-            break;
-        case 4:
-        case 5:
-            ay_refresh_tone_period(2);
-            break;
-        case 6:
-            ay_refresh_noise_period();
-            break;
-        case 11:
-        case 12:
-            ay_refresh_envelope_period();
-            break;
-        case 13:
-            ay_restart_envelope();
-            break;
-        default:
-            break;
-    }
-    if (locked) {
-        audio_backend_unlock();
-    }
-}
 
-static int ay_parse_pan_spec(const char* spec) {
-    if (!spec) {
-        return 0;
-    }
-    double parsed[3];
-    size_t index = 0;
-    const char* cursor = spec;
-    while (index < 3) {
-        while (*cursor && isspace((unsigned char)*cursor)) {
-            ++cursor;
-        }
-        if (*cursor == '\0') {
-            return 0;
+        uint8_t next = src[src_index];
+        if (next != 0xED) {
+            dest[dest_index++] = value;
+            continue;
         }
-        char* endptr = NULL;
-        double value = strtod(cursor, &endptr);
-        if (endptr == cursor) {
+
+        src_index++;
+        if (src_index + 2 > src_len) {
             return 0;
         }
-        parsed[index++] = ay_clamp_pan(value);
-        cursor = endptr;
-        while (*cursor && isspace((unsigned char)*cursor)) {
-            ++cursor;
-        }
-        if (index < 3) {
-            if (*cursor != ',' && *cursor != ';' && *cursor != '/') {
+        uint8_t count_byte = src[src_index++];
+        uint8_t data_byte = src[src_index++];
+        size_t repeat = (count_byte == 0) ? 256u : (size_t)count_byte;
+        for (size_t i = 0; i < repeat; ++i) {
+            if (dest_index >= dest_len) {
                 return 0;
             }
-            ++cursor;
-        } else if (*cursor != '\0') {
-            return 0;
+            dest[dest_index++] = data_byte;
         }
     }
-    for (size_t i = 0; i < 3; ++i) {
-        ay_channel_pan[i] = parsed[i];
-    }
-    return 1;
-}
 
-static void tape_reset_playback(TapePlaybackState* state) {
-    if (!state) {
-        return;
-    }
-    state->current_block = 0;
-    state->phase = TAPE_PHASE_IDLE;
-    state->pilot_pulses_remaining = 0;
-    state->data_byte_index = 0;
-    state->data_bit_mask = 0x80u;
-    state->data_pulse_half = 0;
-    state->next_transition_tstate = 0;
-    state->pause_end_tstate = 0;
-    state->playing = 0;
-    state->waveform_index = 0;
-    state->paused_transition_remaining = 0;
-    state->paused_pause_remaining = 0;
-    state->position_tstates = 0;
-    state->position_start_tstate = 0;
-    state->last_transition_tstate = 0;
-    if (state == &tape_playback &&
-        (state->format == TAPE_FORMAT_WAV || tape_recorder.output_format == TAPE_OUTPUT_WAV)) {
-        tape_wav_shared_position_tstates = 0;
-    }
-    if ((state->format == TAPE_FORMAT_WAV) ||
-        (state->use_waveform_playback && state->waveform.count > 0)) {
-        state->level = state->waveform.initial_level ? 1 : 0;
-        tape_ear_state = state->level;
-    } else {
-        state->level = 1;
-        tape_ear_state = 1;
-    }
-    speaker_tape_playback_level = tape_ear_state;
-    speaker_update_output(total_t_states, 0);
+    return dest_index == dest_len;
 }
 
-static int tape_current_block_pilot_count(const TapePlaybackState* state) {
-    if (!state || state->current_block >= state->image.count) {
-        return TAPE_DATA_PILOT_COUNT;
-    }
-    const TapeBlock* block = &state->image.blocks[state->current_block];
-    if (block->length > 0 && block->data && block->data[0] == 0x00) {
-        return TAPE_HEADER_PILOT_COUNT;
+static SnapshotFormat snapshot_format_from_extension(const char* path) {
+    if (!path) {
+        return SNAPSHOT_FORMAT_NONE;
     }
-    return TAPE_DATA_PILOT_COUNT;
-}
 
-static int tape_begin_block(TapePlaybackState* state, size_t block_index, uint64_t start_time) {
-    if (!state || block_index >= state->image.count) {
-        return 0;
+    if (string_ends_with_case_insensitive(path, ".sna")) {
+        return SNAPSHOT_FORMAT_SNA;
     }
-
-    state->current_block = block_index;
-    if (tape_debug_logging) {
-        tape_log("Starting playback of block %zu at t=%llu\n",
-                 block_index,
-                 (unsigned long long)start_time);
-        tape_log_block_summary(&state->image.blocks[block_index], block_index);
+    if (string_ends_with_case_insensitive(path, ".z80")) {
+        return SNAPSHOT_FORMAT_Z80;
     }
-    state->pilot_pulses_remaining = tape_current_block_pilot_count(state);
-    state->data_byte_index = 0;
-    state->data_bit_mask = 0x80u;
-    state->data_pulse_half = 0;
-    state->phase = TAPE_PHASE_PILOT;
-    state->level = 1;
-    tape_ear_state = state->level;
-    speaker_tape_playback_level = tape_ear_state;
-    speaker_update_output(start_time, 1);
-    state->next_transition_tstate = start_time + (uint64_t)TAPE_PILOT_PULSE_TSTATES;
-    state->playing = 1;
-    state->last_transition_tstate = start_time;
-    state->paused_transition_remaining = 0;
-    state->paused_pause_remaining = 0;
-    return 1;
-}
 
-static void tape_start_playback(TapePlaybackState* state, uint64_t start_time) {
-    if (!state) {
-        return;
-    }
-    tape_reset_playback(state);
-    state->position_start_tstate = start_time;
-    state->last_transition_tstate = start_time;
-    int use_waveform = (state->format == TAPE_FORMAT_WAV) ||
-                       (state->use_waveform_playback && state->waveform.count > 0);
-    if (use_waveform) {
-        if (state->waveform.count == 0) {
-            return;
-        }
-        state->waveform_index = 0;
-        state->level = state->waveform.initial_level ? 1 : 0;
-        tape_ear_state = state->level;
-        speaker_tape_playback_level = tape_ear_state;
-        speaker_update_output(start_time, 1);
-        state->playing = 1;
-        state->next_transition_tstate = start_time + (uint64_t)state->waveform.pulses[0].duration;
-        state->paused_transition_remaining = 0;
-        state->paused_pause_remaining = 0;
-        return;
-    }
-    if (state->image.count == 0) {
-        return;
-    }
-    (void)tape_begin_block(state, 0u, start_time);
+    return SNAPSHOT_FORMAT_NONE;
 }
 
-static void tape_pause_playback(TapePlaybackState* state, uint64_t current_t_state) {
-    if (!state || !state->playing) {
-        return;
+static int snapshot_load_sna(const char* path, Z80* cpu) {
+    if (!path || !cpu) {
+        return 0;
     }
 
-    if (state->next_transition_tstate > current_t_state) {
-        state->paused_transition_remaining = state->next_transition_tstate - current_t_state;
-    } else {
-        state->paused_transition_remaining = 0;
+    FILE* sf = fopen(path, "rb");
+    if (!sf) {
+        fprintf(stderr, "Failed to open SNA snapshot '%s': %s\n", path, strerror(errno));
+        return 0;
     }
 
-    if (state->phase == TAPE_PHASE_PAUSE && state->pause_end_tstate > current_t_state) {
-        state->paused_pause_remaining = state->pause_end_tstate - current_t_state;
-    } else {
-        state->paused_pause_remaining = 0;
+    uint8_t header[27];
+    if (fread(header, sizeof(header), 1, sf) != 1) {
+        fprintf(stderr, "Failed to read SNA header from '%s'\n", path);
+        fclose(sf);
+        return 0;
     }
 
-    tape_playback_accumulate_elapsed(state, current_t_state);
-    state->last_transition_tstate = current_t_state;
-    state->playing = 0;
-    int use_waveform = (state->format == TAPE_FORMAT_WAV) ||
-                       (state->use_waveform_playback && state->waveform.count > 0);
-    if (state == &tape_playback && use_waveform) {
-        tape_wav_shared_position_tstates = state->position_tstates;
+    cpu->reg_I = header[0];
+    uint16_t hl_alt = (uint16_t)header[1] | ((uint16_t)header[2] << 8);
+    uint16_t de_alt = (uint16_t)header[3] | ((uint16_t)header[4] << 8);
+    uint16_t bc_alt = (uint16_t)header[5] | ((uint16_t)header[6] << 8);
+    uint16_t af_alt = (uint16_t)header[7] | ((uint16_t)header[8] << 8);
+    uint16_t hl = (uint16_t)header[9] | ((uint16_t)header[10] << 8);
+    uint16_t de = (uint16_t)header[11] | ((uint16_t)header[12] << 8);
+    uint16_t bc = (uint16_t)header[13] | ((uint16_t)header[14] << 8);
+    uint16_t iy = (uint16_t)header[15] | ((uint16_t)header[16] << 8);
+    uint16_t ix = (uint16_t)header[17] | ((uint16_t)header[18] << 8);
+    uint8_t iff2 = header[19];
+    uint8_t r = header[20];
+    uint16_t af = (uint16_t)header[21] | ((uint16_t)header[22] << 8);
+    uint16_t sp = (uint16_t)header[23] | ((uint16_t)header[24] << 8);
+    uint8_t interrupt_mode = header[25];
+    uint8_t border = header[26] & 0x07u;
+
+    cpu->alt_reg_L = (uint8_t)(hl_alt & 0xFFu);
+    cpu->alt_reg_H = (uint8_t)(hl_alt >> 8);
+    cpu->alt_reg_E = (uint8_t)(de_alt & 0xFFu);
+    cpu->alt_reg_D = (uint8_t)(de_alt >> 8);
+    cpu->alt_reg_C = (uint8_t)(bc_alt & 0xFFu);
+    cpu->alt_reg_B = (uint8_t)(bc_alt >> 8);
+    cpu->alt_reg_F = (uint8_t)(af_alt & 0xFFu);
+    cpu->alt_reg_A = (uint8_t)(af_alt >> 8);
+
+    cpu->reg_L = (uint8_t)(hl & 0xFFu);
+    cpu->reg_H = (uint8_t)(hl >> 8);
+    cpu->reg_E = (uint8_t)(de & 0xFFu);
+    cpu->reg_D = (uint8_t)(de >> 8);
+    cpu->reg_C = (uint8_t)(bc & 0xFFu);
+    cpu->reg_B = (uint8_t)(bc >> 8);
+    cpu->reg_IY = iy;
+    cpu->reg_IX = ix;
+    cpu->iff2 = (iff2 & 0x01u) ? 1 : 0;
+    cpu->iff1 = cpu->iff2;
+    cpu->reg_R = r;
+    cpu->reg_F = (uint8_t)(af & 0xFFu);
+    cpu->reg_A = (uint8_t)(af >> 8);
+    cpu->reg_SP = sp;
+    cpu->interruptMode = (int)(interrupt_mode & 0x03u);
+    cpu->ei_delay = 0;
+    cpu->halted = 0;
+
+    border_color_idx = border;
+
+    uint8_t* ram_buffer = (uint8_t*)malloc(0xC000u);
+    if (!ram_buffer) {
+        fprintf(stderr, "Out of memory loading SNA snapshot\n");
+        fclose(sf);
+        return 0;
     }
-}
 
-static int tape_resume_playback(TapePlaybackState* state, uint64_t current_t_state) {
-    if (!state || state->playing) {
+    if (fread(ram_buffer, 0xC000u, 1, sf) != 1) {
+        fprintf(stderr, "Failed to read SNA RAM image from '%s'\n", path);
+        free(ram_buffer);
+        fclose(sf);
         return 0;
     }
 
-    int use_waveform = (state->format == TAPE_FORMAT_WAV) ||
-                       (state->use_waveform_playback && state->waveform.count > 0);
-    if (use_waveform) {
-        if (state->waveform.count == 0 || state->waveform_index >= state->waveform.count) {
-            return 0;
-        }
-        uint64_t delay = state->paused_transition_remaining;
-        state->next_transition_tstate = current_t_state + delay;
-        if (delay == 0 && state->next_transition_tstate < current_t_state) {
-            state->next_transition_tstate = current_t_state;
-        }
-        state->playing = 1;
-    } else {
-        if (state->phase == TAPE_PHASE_IDLE) {
-            tape_start_playback(state, current_t_state);
-            return state->playing;
+    uint8_t pc_bytes[2];
+    if (fread(pc_bytes, sizeof(pc_bytes), 1, sf) != 1) {
+        fprintf(stderr, "Failed to read SNA program counter from '%s'\n", path);
+        free(ram_buffer);
+        fclose(sf);
+        return 0;
+    }
+    uint16_t pc = (uint16_t)pc_bytes[0] | ((uint16_t)pc_bytes[1] << 8);
+    cpu->reg_PC = pc;
+
+    long extension_pos = ftell(sf);
+    size_t extension_bytes = 0u;
+    if (extension_pos >= 0 && fseek(sf, 0, SEEK_END) == 0) {
+        long end_pos = ftell(sf);
+        if (end_pos >= extension_pos) {
+            extension_bytes = (size_t)(end_pos - extension_pos);
         }
-        if (state->phase == TAPE_PHASE_DONE) {
+        if (fseek(sf, extension_pos, SEEK_SET) != 0) {
+            fprintf(stderr, "Failed to seek within SNA snapshot '%s'\n", path);
+            free(ram_buffer);
+            fclose(sf);
             return 0;
         }
-        uint64_t delay = state->paused_transition_remaining;
-        state->next_transition_tstate = current_t_state + delay;
-        if (delay == 0 && state->next_transition_tstate < current_t_state) {
-            state->next_transition_tstate = current_t_state;
-        }
-        if (state->phase == TAPE_PHASE_PAUSE) {
-            uint64_t pause_delay = state->paused_pause_remaining;
-            state->pause_end_tstate = current_t_state + pause_delay;
-            if (pause_delay == 0 && state->pause_end_tstate < current_t_state) {
-                state->pause_end_tstate = current_t_state;
-            }
-        }
-        state->playing = 1;
     }
 
-    if (state->playing) {
-        state->position_start_tstate = current_t_state;
-        state->last_transition_tstate = current_t_state;
-    }
+    int loaded_ok = 0;
+    if (extension_bytes == 0u) {
+        spectrum_configure_model(SPECTRUM_MODEL_48K);
+        memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
+        memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
+        memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
+        spectrum_apply_memory_configuration();
+        spectrum_refresh_visible_ram();
+        loaded_ok = 1;
+    } else {
+        size_t required_bytes = 2u + (size_t)8u * 0x4000u;
+        if (extension_bytes < required_bytes) {
+            fprintf(stderr, "SNA snapshot '%s' truncated 128K payload (%zu bytes)\n",
+                    path,
+                    extension_bytes);
+        } else {
+            uint8_t port_7ffd = 0u;
+            uint8_t trdos_flag = 0u;
+            if (fread(&port_7ffd, 1, 1, sf) != 1 || fread(&trdos_flag, 1, 1, sf) != 1) {
+                fprintf(stderr, "Failed to read SNA 128K gate-array state from '%s'\n", path);
+            } else {
+                (void)trdos_flag;
+                loaded_ok = 1;
+                for (int bank = 0; bank < 8; ++bank) {
+                    if (fread(ram_pages[bank], 0x4000u, 1, sf) != 1) {
+                        fprintf(stderr, "Failed to read SNA 128K RAM bank %d from '%s'\n",
+                                bank,
+                                path);
+                        loaded_ok = 0;
+                        break;
+                    }
+                }
+            }
 
-    state->paused_transition_remaining = 0;
-    state->paused_pause_remaining = 0;
-    tape_ear_state = state->level;
-    speaker_tape_playback_level = tape_ear_state;
-    speaker_update_output(current_t_state, 1);
-    return 1;
-}
+            if (loaded_ok) {
+                size_t consumed = required_bytes;
+                uint8_t port_1ffd = 0u;
+                int have_1ffd = 0;
+                if (extension_bytes > consumed) {
+                    size_t remaining = extension_bytes - consumed;
+                    if (remaining >= 1u) {
+                        if (fread(&port_1ffd, 1, 1, sf) != 1) {
+                            fprintf(stderr, "Failed to read SNA 128K 1FFD state from '%s'\n", path);
+                            loaded_ok = 0;
+                        } else {
+                            have_1ffd = 1;
+                            consumed += 1u;
+                        }
+                    }
+                    if (loaded_ok && extension_bytes > consumed) {
+                        fprintf(stderr,
+                                "SNA snapshot '%s' has %zu unexpected padding bytes\n",
+                                path,
+                                extension_bytes - consumed);
+                        loaded_ok = 0;
+                    }
+                }
 
-static void tape_rewind_playback(TapePlaybackState* state) {
-    if (!state) {
-        return;
-    }
-    tape_reset_playback(state);
-}
+                if (loaded_ok) {
+                    SpectrumModel preferred = spectrum_model;
+                    SpectrumModel target_model;
+                    if (have_1ffd) {
+                        if (preferred == SPECTRUM_MODEL_PLUS2A || preferred == SPECTRUM_MODEL_PLUS3) {
+                            target_model = preferred;
+                        } else {
+                            target_model = SPECTRUM_MODEL_PLUS2A;
+                        }
+                    } else {
+                        if (preferred == SPECTRUM_MODEL_128K ||
+                            preferred == SPECTRUM_MODEL_PLUS2A ||
+                            preferred == SPECTRUM_MODEL_PLUS3) {
+                            target_model = preferred;
+                        } else {
+                            target_model = SPECTRUM_MODEL_128K;
+                        }
+                    }
 
-static void tape_playback_accumulate_elapsed(TapePlaybackState* state, uint64_t stop_t_state) {
-    if (!state) {
-        return;
-    }
+                    spectrum_configure_model(target_model);
 
-    if (stop_t_state < state->position_start_tstate) {
-        stop_t_state = state->position_start_tstate;
-    }
+                    gate_array_7ffd_state = (uint8_t)(port_7ffd & 0x3Fu);
+                    paging_disabled = (gate_array_7ffd_state & 0x20u) ? 1 : 0;
+                    current_paged_bank = (uint8_t)(gate_array_7ffd_state & 0x07u);
+                    if (target_model == SPECTRUM_MODEL_PLUS2A || target_model == SPECTRUM_MODEL_PLUS3) {
+                        gate_array_1ffd_state = have_1ffd ? (uint8_t)(port_1ffd & 0x07u) : 0u;
+                    } else {
+                        gate_array_1ffd_state = 0u;
+                    }
 
-    if (stop_t_state > state->position_start_tstate) {
-        state->position_tstates += stop_t_state - state->position_start_tstate;
+                    spectrum_apply_memory_configuration();
+                    spectrum_refresh_visible_ram();
+                }
+            }
+        }
     }
 
-    state->position_start_tstate = stop_t_state;
-}
+    free(ram_buffer);
 
-static uint64_t tape_playback_elapsed_tstates(const TapePlaybackState* state, uint64_t current_t_state) {
-    if (!state) {
+    if (!loaded_ok) {
+        fclose(sf);
         return 0;
     }
 
-    uint64_t elapsed = state->position_tstates;
-    if (state->playing && current_t_state > state->position_start_tstate) {
-        elapsed += current_t_state - state->position_start_tstate;
-    }
+    fclose(sf);
 
-    return elapsed;
+    fprintf(stderr,
+            "SNA snapshot '%s': model=%s PC=%04X SP=%04X IM=%d border=%u bank=%u rom=%u %s\n",
+            path,
+            spectrum_model_to_string(spectrum_model),
+            (unsigned)cpu->reg_PC,
+            (unsigned)cpu->reg_SP,
+            cpu->interruptMode,
+            (unsigned)border,
+            (unsigned)current_paged_bank,
+            (unsigned)current_rom_page,
+            paging_disabled ? "paging=locked" : "paging=unlocked");
+    return 1;
 }
 
-static uint64_t tape_recorder_elapsed_tstates(uint64_t current_t_state) {
-    if (!tape_recorder.enabled) {
-        return 0;
-    }
-
-    uint64_t elapsed = tape_recorder.position_tstates;
-    if (tape_recorder.recording && current_t_state > tape_recorder.position_start_tstate) {
-        elapsed += current_t_state - tape_recorder.position_start_tstate;
-    }
-
-    return elapsed;
-}
-
-static const TapeOverlayGlyph* tape_overlay_find_glyph(char ch) {
-    size_t glyph_count = sizeof(tape_overlay_font) / sizeof(tape_overlay_font[0]);
-    for (size_t i = 0; i < glyph_count; ++i) {
-        if (tape_overlay_font[i].ch == ch) {
-            return &tape_overlay_font[i];
-        }
+static SpectrumModel z80_hardware_mode_to_model(uint8_t hardware_mode) {
+    switch (hardware_mode) {
+        case 3:
+        case 4:
+        case 5:
+            return SPECTRUM_MODEL_128K;
+        case 6:
+            return SPECTRUM_MODEL_PLUS2A;
+        case 7:
+            return SPECTRUM_MODEL_PLUS3;
+        case 0:
+        case 1:
+        case 2:
+        default:
+            return SPECTRUM_MODEL_48K;
     }
-    return &tape_overlay_font[0];
 }
 
-static int tape_overlay_text_width(const char* text, int scale, int spacing) {
-    if (!text) {
+static int z80_map_page_id_to_offset(int page_id, size_t* offset, uint8_t* mask_bit) {
+    if (!offset || !mask_bit) {
         return 0;
     }
 
-    int width = 0;
-    int first = 1;
-    for (const char* c = text; *c; ++c) {
-        if (!first) {
-            width += spacing;
-        }
-        first = 0;
-        width += TAPE_OVERLAY_FONT_WIDTH * scale;
+    switch (page_id) {
+        case 8:
+            *offset = 0x0000u;
+            *mask_bit = 0x01u;
+            return 1;
+        case 4:
+            *offset = 0x4000u;
+            *mask_bit = 0x02u;
+            return 1;
+        case 5:
+            *offset = 0x8000u;
+            *mask_bit = 0x04u;
+            return 1;
+        default:
+            break;
     }
 
-    return width;
+    return 0;
 }
 
-static void tape_overlay_draw_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color) {
-    if (!text) {
-        return;
+static int z80_map_page_id_to_bank(int page_id, uint8_t* bank, uint16_t* mask_bit) {
+    if (!bank || !mask_bit) {
+        return 0;
     }
 
-    int cursor_x = origin_x;
-    for (const char* c = text; *c; ++c) {
-        char ch = *c;
-        if (ch >= 'a' && ch <= 'z') {
-            ch = (char)(ch - 'a' + 'A');
-        }
-        const TapeOverlayGlyph* glyph = tape_overlay_find_glyph(ch);
-        for (int row = 0; row < TAPE_OVERLAY_FONT_HEIGHT; ++row) {
-            uint8_t bits = glyph->rows[row];
-            for (int col = 0; col < TAPE_OVERLAY_FONT_WIDTH; ++col) {
-                int bit_index = TAPE_OVERLAY_FONT_WIDTH - 1 - col;
-                if (bits & (1u << bit_index)) {
-                    for (int dy = 0; dy < scale; ++dy) {
-                        int py = origin_y + row * scale + dy;
-                        if (py < 0 || py >= TOTAL_HEIGHT) {
-                            continue;
-                        }
-                        for (int dx = 0; dx < scale; ++dx) {
-                            int px = cursor_x + col * scale + dx;
-                            if (px < 0 || px >= TOTAL_WIDTH) {
-                                continue;
-                            }
-                            pixels[py * TOTAL_WIDTH + px] = color;
-                        }
-                    }
-                }
-            }
-        }
-        cursor_x += TAPE_OVERLAY_FONT_WIDTH * scale + spacing;
+    if (page_id >= 0 && page_id <= 7) {
+        *bank = (uint8_t)page_id;
+        *mask_bit = (uint16_t)(1u << page_id);
+        return 1;
     }
-}
 
-static void tape_overlay_draw_rect(int x, int y, int width, int height, uint32_t fill_color, uint32_t border_color) {
-    if (width <= 0 || height <= 0) {
-        return;
+    switch (page_id) {
+        case 8:
+            *bank = 0u;
+            *mask_bit = 1u;
+            return 1;
+        case 9:
+            *bank = 1u;
+            *mask_bit = 2u;
+            return 1;
+        case 10:
+            *bank = 2u;
+            *mask_bit = 4u;
+            return 1;
+        default:
+            break;
     }
 
-    for (int yy = 0; yy < height; ++yy) {
-        int py = y + yy;
-        if (py < 0 || py >= TOTAL_HEIGHT) {
-            continue;
-        }
-        for (int xx = 0; xx < width; ++xx) {
-            int px = x + xx;
-            if (px < 0 || px >= TOTAL_WIDTH) {
-                continue;
-            }
-            int is_border = (yy == 0 || yy == height - 1 || xx == 0 || xx == width - 1);
-            pixels[py * TOTAL_WIDTH + px] = is_border ? border_color : fill_color;
-        }
-    }
+    return 0;
 }
 
-static int tape_use_recorder_time(void) {
-    int use_recorder_time = 0;
-
-    if (tape_recorder.recording) {
-        use_recorder_time = 1;
-    } else if (!tape_playback.playing) {
-        switch (tape_deck_status) {
-            case TAPE_DECK_STATUS_RECORD:
-                use_recorder_time = 1;
-                break;
-            default:
-                break;
-        }
+static int snapshot_load_z80(const char* path, Z80* cpu) {
+    if (!path || !cpu) {
+        return 0;
     }
 
-    if (!use_recorder_time && !tape_input_enabled && tape_recorder.enabled) {
-        use_recorder_time = 1;
+    FILE* sf = fopen(path, "rb");
+    if (!sf) {
+        fprintf(stderr, "Failed to open Z80 snapshot '%s': %s\n", path, strerror(errno));
+        return 0;
     }
 
-    return use_recorder_time;
-}
+    uint8_t header[30];
+    if (fread(header, sizeof(header), 1, sf) != 1) {
+        fprintf(stderr, "Failed to read Z80 header from '%s'\n", path);
+        fclose(sf);
+        return 0;
+    }
 
-static uint64_t tape_current_elapsed_tstates(void) {
-    int use_recorder_time = tape_use_recorder_time();
-    int shared_wav = (tape_input_format == TAPE_FORMAT_WAV) ||
-                     (tape_recorder.output_format == TAPE_OUTPUT_WAV);
+    uint16_t pc = (uint16_t)header[6] | ((uint16_t)header[7] << 8);
+    int header_pc_zero = (pc == 0u);
+    uint16_t sp = (uint16_t)header[8] | ((uint16_t)header[9] << 8);
+    uint8_t flags = header[12];
+    uint8_t compressed_flag = (flags & 0x20u) ? 1u : 0u;
+    uint8_t r_bit_7 = (flags & 0x01u) ? 0x80u : 0u;
+    border_color_idx = (flags >> 1) & 0x07u;
 
-    uint64_t elapsed = 0ull;
+    uint8_t hardware_mode = 0u;
 
-    if (shared_wav) {
-        if (tape_recorder.recording) {
-            elapsed = tape_recorder_elapsed_tstates(total_t_states);
-        } else if (tape_playback.playing) {
-            elapsed = tape_playback_elapsed_tstates(&tape_playback, total_t_states);
-        } else if (tape_recorder.enabled && tape_recorder.output_format == TAPE_OUTPUT_WAV) {
-            elapsed = tape_recorder.position_tstates;
-        } else {
-            elapsed = tape_wav_shared_position_tstates;
-        }
-    } else if (use_recorder_time) {
-        elapsed = tape_recorder_elapsed_tstates(total_t_states);
-    } else if (tape_input_enabled) {
-        elapsed = tape_playback_elapsed_tstates(&tape_playback, total_t_states);
-    }
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
 
-    if (elapsed == 0ull) {
-        if (tape_playback.position_tstates > 0ull) {
-            elapsed = tape_playback.position_tstates;
-        } else if (tape_recorder.position_tstates > 0ull) {
-            elapsed = tape_recorder.position_tstates;
-        } else if ((tape_input_format == TAPE_FORMAT_WAV ||
-                    tape_recorder.output_format == TAPE_OUTPUT_WAV) &&
-                   tape_wav_shared_position_tstates > 0ull) {
-            elapsed = tape_wav_shared_position_tstates;
-        }
-    }
+    cpu->reg_A = header[0];
+    cpu->reg_F = header[1];
+    cpu->reg_C = header[2];
+    cpu->reg_B = header[3];
+    cpu->reg_L = header[4];
+    cpu->reg_H = header[5];
+    cpu->reg_SP = sp;
+    cpu->reg_I = header[10];
+    cpu->reg_R = (uint8_t)((header[11] & 0x7Fu) | r_bit_7);
 
-    return elapsed;
-}
+    cpu->reg_E = header[13];
+    cpu->reg_D = header[14];
+    cpu->alt_reg_C = header[15];
+    cpu->alt_reg_B = header[16];
+    cpu->alt_reg_E = header[17];
+    cpu->alt_reg_D = header[18];
+    cpu->alt_reg_L = header[19];
+    cpu->alt_reg_H = header[20];
+    cpu->alt_reg_A = header[21];
+    cpu->alt_reg_F = header[22];
+    cpu->reg_IY = (uint16_t)header[23] | ((uint16_t)header[24] << 8);
+    cpu->reg_IX = (uint16_t)header[25] | ((uint16_t)header[26] << 8);
+    cpu->iff1 = (header[27] & 0x01u) ? 1 : 0;
+    cpu->iff2 = (header[28] & 0x01u) ? 1 : 0;
 
-static void tape_format_counter_text(char* buffer, size_t buffer_size) {
-    if (!buffer || buffer_size == 0u) {
-        return;
-    }
+    uint8_t interrupt_mode = header[29];
+    cpu->interruptMode = (int)(interrupt_mode & 0x03u);
 
-    uint64_t elapsed_tstates = tape_current_elapsed_tstates();
-    uint64_t clock_hz = (uint64_t)(CPU_CLOCK_HZ + 0.5);
-    if (clock_hz == 0ull) {
-        clock_hz = 1ull;
-    }
+    cpu->ei_delay = 0;
+    cpu->halted = 0;
 
-    uint64_t total_tenths = (elapsed_tstates * 10ull + clock_hz / 2ull) / clock_hz;
-    uint64_t minutes = total_tenths / 600ull;
-    uint64_t seconds = (total_tenths / 10ull) % 60ull;
-    uint64_t tenths = total_tenths % 10ull;
+    uint8_t port_7ffd = 0u;
+    uint8_t port_1ffd = 0u;
+    uint8_t* ram_buffer = NULL;
 
-    if (minutes > 99ull) {
-        minutes = 99ull;
-    }
+    if (pc != 0) {
+        ram_buffer = (uint8_t*)malloc(0xC000u);
+        if (!ram_buffer) {
+            fprintf(stderr, "Out of memory loading Z80 snapshot\n");
+            fclose(sf);
+            return 0;
+        }
 
-    (void)snprintf(buffer,
-                   buffer_size,
-                   "%02llu:%02llu.%1llu",
-                   (unsigned long long)minutes,
-                   (unsigned long long)seconds,
-                   (unsigned long long)tenths);
+        if (compressed_flag) {
+            if (!z80_decompress_stream(sf, ram_buffer, 0xC000u)) {
+                fprintf(stderr, "Failed to decompress V1 Z80 snapshot '%s'\n", path);
+                free(ram_buffer);
+                fclose(sf);
+                return 0;
+            }
+        } else {
+            if (fread(ram_buffer, 0xC000u, 1, sf) != 1) {
+                fprintf(stderr, "Failed to read V1 Z80 RAM image from '%s'\n", path);
+                free(ram_buffer);
+                fclose(sf);
+                return 0;
+            }
+        }
+
+        memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
+        memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
+        memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
+        spectrum_refresh_visible_ram();
+        free(ram_buffer);
+        spectrum_apply_memory_configuration();
+    } else {
+        uint8_t ext_len_bytes[2];
+        if (fread(ext_len_bytes, sizeof(ext_len_bytes), 1, sf) != 1) {
+            fprintf(stderr, "Failed to read Z80 extended header length from '%s'\n", path);
+            fclose(sf);
+            return 0;
+        }
+        uint16_t ext_len = (uint16_t)ext_len_bytes[0] | ((uint16_t)ext_len_bytes[1] << 8);
+        uint8_t* ext_header = NULL;
+        if (ext_len > 0u) {
+            ext_header = (uint8_t*)malloc(ext_len);
+            if (!ext_header) {
+                fprintf(stderr, "Out of memory reading Z80 extended header\n");
+                fclose(sf);
+                return 0;
+            }
+            if (fread(ext_header, ext_len, 1, sf) != 1) {
+                fprintf(stderr, "Failed to read Z80 extended header from '%s'\n", path);
+                free(ext_header);
+                fclose(sf);
+                return 0;
+            }
+        }
+
+        if (ext_header && ext_len >= 2u) {
+            pc = (uint16_t)ext_header[0] | ((uint16_t)ext_header[1] << 8);
+        }
+        hardware_mode = (ext_header && ext_len >= 3u) ? ext_header[2] : 0u;
+        port_7ffd = (ext_header && ext_len >= 4u) ? ext_header[3] : 0u;
+        port_1ffd = (ext_header && ext_len >= 5u) ? ext_header[4] : 0u;
+
+        SpectrumModel target_model = z80_hardware_mode_to_model(hardware_mode);
+        spectrum_configure_model(target_model);
+
+        int is_128k_family = (target_model != SPECTRUM_MODEL_48K);
+        uint16_t loaded_mask = 0u;
+        uint16_t expected_mask = is_128k_family ? 0xFFu : 0x07u;
+
+        if (!is_128k_family) {
+            ram_buffer = (uint8_t*)malloc(0xC000u);
+            if (!ram_buffer) {
+                fprintf(stderr, "Out of memory loading Z80 snapshot\n");
+                free(ext_header);
+                fclose(sf);
+                return 0;
+            }
+        }
+
+        while (loaded_mask != expected_mask) {
+            uint8_t len_bytes[2];
+            if (fread(len_bytes, sizeof(len_bytes), 1, sf) != 1) {
+                if (feof(sf) && loaded_mask != 0u) {
+                    break;
+                }
+                fprintf(stderr, "Truncated Z80 memory block in '%s'\n", path);
+                free(ram_buffer);
+                free(ext_header);
+                fclose(sf);
+                return 0;
+            }
+            uint16_t block_len = (uint16_t)len_bytes[0] | ((uint16_t)len_bytes[1] << 8);
+            int page_id = fgetc(sf);
+            if (page_id == EOF) {
+                fprintf(stderr, "Truncated Z80 memory block header in '%s'\n", path);
+                free(ram_buffer);
+                free(ext_header);
+                fclose(sf);
+                return 0;
+            }
+
+            uint8_t* segment = NULL;
+            uint16_t mask_bit = 0u;
+            if (is_128k_family) {
+                uint8_t bank = 0u;
+                if (!z80_map_page_id_to_bank(page_id, &bank, &mask_bit)) {
+                    fprintf(stderr, "Z80 snapshot '%s' contains unsupported memory page id %d\n", path, page_id);
+                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
+                        fprintf(stderr, "Failed to seek past unsupported block in '%s'\n", path);
+                        free(ram_buffer);
+                        free(ext_header);
+                        fclose(sf);
+                        return 0;
+                    }
+                    continue;
+                }
+                if ((loaded_mask & mask_bit) != 0u) {
+                    fprintf(stderr, "Z80 snapshot '%s' repeats memory page id %d\n", path, page_id);
+                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
+                        fprintf(stderr, "Failed to seek past repeated block in '%s'\n", path);
+                        free(ram_buffer);
+                        free(ext_header);
+                        fclose(sf);
+                        return 0;
+                    }
+                    continue;
+                }
+                segment = ram_pages[bank];
+            } else {
+                size_t segment_offset = 0u;
+                uint8_t offset_mask = 0u;
+                if (!z80_map_page_id_to_offset(page_id, &segment_offset, &offset_mask)) {
+                    fprintf(stderr, "Z80 snapshot '%s' contains unsupported memory page id %d\n", path, page_id);
+                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
+                        fprintf(stderr, "Failed to seek past unsupported block in '%s'\n", path);
+                        free(ram_buffer);
+                        free(ext_header);
+                        fclose(sf);
+                        return 0;
+                    }
+                    continue;
+                }
+                mask_bit = offset_mask;
+                if ((loaded_mask & mask_bit) != 0u) {
+                    fprintf(stderr, "Z80 snapshot '%s' repeats memory page id %d\n", path, page_id);
+                    if (fseek(sf, block_len, SEEK_CUR) != 0) {
+                        fprintf(stderr, "Failed to seek past repeated block in '%s'\n", path);
+                        free(ram_buffer);
+                        free(ext_header);
+                        fclose(sf);
+                        return 0;
+                    }
+                    continue;
+                }
+                segment = ram_buffer + segment_offset;
+            }
+
+            if (block_len == 0xFFFFu) {
+                if (fread(segment, 0x4000u, 1, sf) != 1) {
+                    fprintf(stderr, "Failed to read uncompressed block from '%s'\n", path);
+                    free(ram_buffer);
+                    free(ext_header);
+                    fclose(sf);
+                    return 0;
+                }
+            } else {
+                uint8_t* block_data = (uint8_t*)malloc(block_len);
+                if (!block_data) {
+                    fprintf(stderr, "Out of memory reading Z80 block\n");
+                    free(ram_buffer);
+                    free(ext_header);
+                    fclose(sf);
+                    return 0;
+                }
+                if (fread(block_data, block_len, 1, sf) != 1) {
+                    fprintf(stderr, "Failed to read Z80 block payload from '%s'\n", path);
+                    free(block_data);
+                    free(ram_buffer);
+                    free(ext_header);
+                    fclose(sf);
+                    return 0;
+                }
+                if (!z80_decompress_block_buffer(block_data, block_len, segment, 0x4000u)) {
+                    fprintf(stderr, "Failed to decompress Z80 block from '%s'\n", path);
+                    free(block_data);
+                    free(ram_buffer);
+                    free(ext_header);
+                    fclose(sf);
+                    return 0;
+                }
+                free(block_data);
+            }
+
+            loaded_mask |= mask_bit;
+        }
+
+        if (!is_128k_family) {
+            memcpy(ram_pages[5], ram_buffer + 0x0000u, 0x4000u);
+            memcpy(ram_pages[2], ram_buffer + 0x4000u, 0x4000u);
+            memcpy(ram_pages[7], ram_buffer + 0x8000u, 0x4000u);
+            spectrum_refresh_visible_ram();
+            free(ram_buffer);
+        }
+
+        free(ext_header);
+
+        gate_array_7ffd_state = (uint8_t)(port_7ffd & 0x3Fu);
+        paging_disabled = (gate_array_7ffd_state & 0x20u) ? 1 : 0;
+        current_paged_bank = (uint8_t)(gate_array_7ffd_state & 0x07u);
+        if (target_model == SPECTRUM_MODEL_PLUS2A || target_model == SPECTRUM_MODEL_PLUS3) {
+            gate_array_1ffd_state = (uint8_t)(port_1ffd & 0x07u);
+        } else {
+            gate_array_1ffd_state = 0u;
+        }
+
+        spectrum_apply_memory_configuration();
+        spectrum_refresh_visible_ram();
+    }
+
+    cpu->reg_PC = pc;
+
+    fclose(sf);
+
+    const char* version_label = header_pc_zero ? "V2/3" : "V1";
+    fprintf(stderr,
+            "Z80 snapshot '%s': version %s PC=%04X SP=%04X IM=%d border=%u\n",
+            path,
+            version_label,
+            (unsigned)cpu->reg_PC,
+            (unsigned)cpu->reg_SP,
+            cpu->interruptMode,
+            (unsigned)border_color_idx);
+    return 1;
+}
+
+static int snapshot_load(const char* path, SnapshotFormat format, Z80* cpu) {
+    switch (format) {
+        case SNAPSHOT_FORMAT_SNA:
+            return snapshot_load_sna(path, cpu);
+        case SNAPSHOT_FORMAT_Z80:
+            return snapshot_load_z80(path, cpu);
+        default:
+            break;
+    }
+    return 0;
+}
+
+static int tape_create_blank_wav(const char* path, uint32_t sample_rate) {
+    if (!path) {
+        return 0;
+    }
+
+    if (sample_rate == 0u) {
+        sample_rate = 44100u;
+    }
+
+    FILE* wf = fopen(path, "wb");
+    if (!wf) {
+        fprintf(stderr, "Failed to create WAV file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    uint8_t header[44];
+    memset(header, 0, sizeof(header));
+    memcpy(header + 0, "RIFF", 4);
+    uint32_t chunk_size = 36u;
+    header[4] = (uint8_t)(chunk_size & 0xFFu);
+    header[5] = (uint8_t)((chunk_size >> 8) & 0xFFu);
+    header[6] = (uint8_t)((chunk_size >> 16) & 0xFFu);
+    header[7] = (uint8_t)((chunk_size >> 24) & 0xFFu);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    header[16] = 16;
+    header[20] = 1;
+    header[22] = 1;
+    header[24] = (uint8_t)(sample_rate & 0xFFu);
+    header[25] = (uint8_t)((sample_rate >> 8) & 0xFFu);
+    header[26] = (uint8_t)((sample_rate >> 16) & 0xFFu);
+    header[27] = (uint8_t)((sample_rate >> 24) & 0xFFu);
+
+    uint32_t byte_rate = sample_rate * sizeof(int16_t);
+    header[28] = (uint8_t)(byte_rate & 0xFFu);
+    header[29] = (uint8_t)((byte_rate >> 8) & 0xFFu);
+    header[30] = (uint8_t)((byte_rate >> 16) & 0xFFu);
+    header[31] = (uint8_t)((byte_rate >> 24) & 0xFFu);
+    header[32] = (uint8_t)(sizeof(int16_t));
+    header[34] = 16;
+    memcpy(header + 36, "data", 4);
+
+    if (fwrite(header, sizeof(header), 1, wf) != 1) {
+        fprintf(stderr, "Failed to write WAV header to '%s'\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (fclose(wf) != 0) {
+        fprintf(stderr, "Failed to finalize WAV file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+// --- WAV Tape Streaming ---
+#define TAPE_WAV_CHUNK_FRAMES 4096u
+#define TAPE_WAV_BATCH_PULSES 1024u
+#define TAPE_WAV_HYSTERESIS 256 // 16-bit units either side of zero
+
+static int tape_wav_stream_use_mmap = 1;
+
+static void tape_wav_stream_close(TapeWavStream* stream) {
+#if defined(SPECTRUM_HAS_MMAP)
+    if (stream->mapped) {
+        munmap((void*)stream->mapped, stream->mapped_size);
+    }
+#endif
+    if (stream->file) {
+        fclose(stream->file);
+    }
+    free(stream->raw);
+    free(stream->samples);
+    free(stream->classes);
+    memset(stream, 0, sizeof(*stream));
+}
+
+// Brings the next chunk's first-channel samples into `samples`; returns the
+// frame count, 0 at the end of the data chunk or on a read error.
+static size_t tape_wav_stream_read_chunk(TapeWavStream* stream) {
+    uint64_t remaining = (stream->data_bytes - stream->consumed) / stream->frame_bytes;
+    size_t frames = remaining < TAPE_WAV_CHUNK_FRAMES ? (size_t)remaining : (size_t)TAPE_WAV_CHUNK_FRAMES;
+    if (frames == 0) {
+        return 0;
+    }
+    const uint8_t* src = NULL;
+    if (stream->mapped) {
+        src = stream->mapped + stream->data_offset + stream->consumed;
+    } else {
+        if (!stream->file || fread(stream->raw, stream->frame_bytes, frames, stream->file) != frames) {
+            fprintf(stderr, "Failed to read WAV tape data\n");
+            stream->consumed = stream->data_bytes;
+            return 0;
+        }
+        src = stream->raw;
+    }
+    stream->consumed += (uint64_t)frames * stream->frame_bytes;
+
+    uint32_t stride = stream->frame_bytes;
+    int16_t* dst = stream->samples;
+    if (stream->bytes_per_sample == 2u) {
+        for (size_t i = 0; i < frames; ++i) {
+            const uint8_t* frame = src + i * stride;
+            dst[i] = (int16_t)((uint16_t)frame[0] | ((uint16_t)frame[1] << 8));
+        }
+    } else {
+        for (size_t i = 0; i < frames; ++i) {
+            dst[i] = (int16_t)(((int)src[i * stride] - 128) * 256);
+        }
+    }
+    return frames;
+}
+
+// Flags each sample that is past the hysteresis band: bit 0 above it, bit 1
+// below it. Branch-free so the compiler can vectorise it.
+static void tape_wav_classify(const int16_t* samples, uint8_t* classes, size_t count, int threshold) {
+    for (size_t i = 0; i < count; ++i) {
+        int value = samples[i];
+        classes[i] = (uint8_t)((value >= threshold) | ((value < -threshold) << 1));
+    }
+}
+
+// Turns a chunk into pulses. The level flips only when a sample crosses the
+// far side of the band; runs between flips are skipped in a tight loop.
+static int tape_wav_stream_scan(TapeWavStream* stream, TapeWaveform* waveform, size_t frames) {
+    size_t i = 0;
+    if (!stream->started) {
+        stream->started = 1;
+        stream->level = stream->samples[0] >= 0 ? 1 : 0;
+        stream->initial_level = stream->level;
+        stream->run_length = 1;
+        i = 1;
+    }
+    tape_wav_classify(stream->samples, stream->classes, frames, TAPE_WAV_HYSTERESIS);
+    while (i < frames) {
+        uint8_t flip = stream->level ? 2u : 1u;
+        size_t run_start = i;
+        while (i < frames && !(stream->classes[i] & flip)) {
+            ++i;
+        }
+        stream->run_length += (uint64_t)(i - run_start);
+        if (i == frames) {
+            break;
+        }
+        uint64_t duration = (uint64_t)(stream->tstates_per_sample * (double)stream->run_length + 0.5);
+        if (duration == 0) {
+            duration = 1;
+        }
+        if (!tape_waveform_add_pulse(waveform, duration)) {
+            fprintf(stderr, "Out of memory while decoding WAV tape\n");
+            return 0;
+        }
+        stream->level ^= 1;
+        stream->run_length = 1;
+        ++i;
+    }
+    return 1;
+}
+
+// Replaces the consumed batch with the next one; returns 0 once the tape has
+// no more edges.
+static int tape_wav_stream_fill(TapeWavStream* stream, TapeWaveform* waveform, TapeWaveformReader* reader) {
+    tape_waveform_clear(waveform);
+    reader->run = 0;
+    reader->offset = 0;
+    while (waveform->count < TAPE_WAV_BATCH_PULSES) {
+        size_t frames = tape_wav_stream_read_chunk(stream);
+        if (frames == 0) {
+            break;
+        }
+        if (!tape_wav_stream_scan(stream, waveform, frames)) {
+            tape_waveform_clear(waveform);
+            stream->consumed = stream->data_bytes;
+            break;
+        }
+    }
+    stream->pulses += waveform->count;
+    return waveform->count > 0;
+}
+
+// Restarts edge detection at `frame`, clamped to the end of the data; the
+// first pulse then runs from that frame to the next edge. Returns the frame.
+static uint64_t tape_wav_stream_seek(TapeWavStream* stream,
+                                     TapeWaveform* waveform,
+                                     TapeWaveformReader* reader,
+                                     uint64_t frame) {
+    uint64_t frames = stream->data_bytes / stream->frame_bytes;
+    if (frame > frames) {
+        frame = frames;
+    }
+    stream->consumed = frame * stream->frame_bytes;
+    stream->started = 0;
+    stream->run_length = 0;
+    if (stream->file && !stream->mapped &&
+        fseek(stream->file, (long)(stream->data_offset + stream->consumed), SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to seek WAV tape\n");
+        stream->consumed = stream->data_bytes;
+    }
+    (void)tape_wav_stream_fill(stream, waveform, reader);
+    waveform->initial_level = stream->started ? stream->initial_level : 1;
+    return frame;
+}
+
+static void tape_wav_stream_rewind(TapeWavStream* stream, TapeWaveform* waveform, TapeWaveformReader* reader) {
+    stream->pulses = 0;
+    (void)tape_wav_stream_seek(stream, waveform, reader, 0u);
+}
+
+// Prepares `stream` to read `data_bytes` of PCM at `data_offset` in `file`,
+// which it takes over. The data is mapped in place when the host allows it.
+static int tape_wav_stream_open(TapeWavStream* stream,
+                                FILE* file,
+                                uint64_t data_offset,
+                                uint64_t data_bytes,
+                                uint16_t channels,
+                                uint16_t bits_per_sample,
+                                uint32_t sample_rate) {
+    memset(stream, 0, sizeof(*stream));
+    stream->file = file;
+    // The data chunk's size comes from the header; never map or read past
+    // the end of a truncated file.
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+    if (file_size < 0 || fseek(file, (long)data_offset, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to determine size of WAV tape\n");
+        tape_wav_stream_close(stream);
+        return 0;
+    }
+    uint64_t available = (uint64_t)file_size > data_offset ? (uint64_t)file_size - data_offset : 0u;
+    if (data_bytes > available) {
+        fprintf(stderr, "WAV data chunk claims %llu bytes but only %llu are present\n",
+                (unsigned long long)data_bytes,
+                (unsigned long long)available);
+        data_bytes = available;
+    }
+    stream->data_offset = data_offset;
+    stream->bytes_per_sample = (uint16_t)(bits_per_sample / 8u);
+    stream->frame_bytes = (uint32_t)stream->bytes_per_sample * channels;
+    stream->data_bytes = data_bytes - data_bytes % stream->frame_bytes;
+    stream->tstates_per_sample = CPU_CLOCK_HZ / (double)sample_rate;
+    stream->samples = (int16_t*)malloc(TAPE_WAV_CHUNK_FRAMES * sizeof(int16_t));
+    stream->classes = (uint8_t*)malloc(TAPE_WAV_CHUNK_FRAMES);
+    if (!stream->samples || !stream->classes) {
+        fprintf(stderr, "Out of memory while opening WAV tape\n");
+        tape_wav_stream_close(stream);
+        return 0;
+    }
+#if defined(SPECTRUM_HAS_MMAP)
+    if (tape_wav_stream_use_mmap && stream->data_bytes > 0u) {
+        size_t size = (size_t)(data_offset + stream->data_bytes);
+        void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (mapped != MAP_FAILED) {
+#if defined(MADV_SEQUENTIAL)
+            madvise(mapped, size, MADV_SEQUENTIAL);
+#endif
+            stream->mapped = (const uint8_t*)mapped;
+            stream->mapped_size = size;
+            return 1;
+        }
+    }
+#endif
+    stream->raw = (uint8_t*)malloc((size_t)TAPE_WAV_CHUNK_FRAMES * stream->frame_bytes);
+    if (!stream->raw) {
+        fprintf(stderr, "Out of memory while opening WAV tape\n");
+        tape_wav_stream_close(stream);
+        return 0;
+    }
+    return 1;
+}
+
+static int tape_load_wav(const char* path, TapePlaybackState* state) {
+    if (!path || !state) {
+        return 0;
+    }
+
+    tape_wav_stream_close(&state->wav_stream);
+    FILE* wf = fopen(path, "rb");
+    if (!wf) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Failed to open WAV file '%s': %s\n", path, strerror(errno));
+            return 0;
+        }
+
+        uint32_t sample_rate = (audio_sample_rate > 0) ? (uint32_t)audio_sample_rate : 44100u;
+        if (!tape_create_blank_wav(path, sample_rate)) {
+            return 0;
+        }
+        printf("Created empty WAV tape %s\n", path);
+        tape_free_image(&state->image);
+        tape_waveform_reset(&state->waveform);
+        state->waveform.sample_rate = sample_rate;
+        state->format = TAPE_FORMAT_WAV;
+        tape_wav_shared_position_tstates = 0;
+        return 1;
+    }
+
+    uint8_t riff_header[12];
+    if (fread(riff_header, sizeof(riff_header), 1, wf) != 1) {
+        fprintf(stderr, "Failed to read WAV header from '%s'\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (memcmp(riff_header, "RIFF", 4) != 0 || memcmp(riff_header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "File '%s' is not a valid WAV image\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    uint16_t audio_format = 0;
+    uint16_t num_channels = 0;
+    uint32_t sample_rate = 0;
+    uint16_t bits_per_sample = 0;
+    long data_offset = 0;
+    uint32_t data_size = 0;
+    int have_fmt = 0;
+    int have_data = 0;
+
+    for (;;) {
+        uint8_t chunk_header[8];
+        if (fread(chunk_header, sizeof(chunk_header), 1, wf) != 1) {
+            break;
+        }
+
+        uint32_t chunk_size = (uint32_t)chunk_header[4] |
+                               ((uint32_t)chunk_header[5] << 8) |
+                               ((uint32_t)chunk_header[6] << 16) |
+                               ((uint32_t)chunk_header[7] << 24);
+
+        if (memcmp(chunk_header, "fmt ", 4) == 0) {
+            if (chunk_size < 16) {
+                fprintf(stderr, "Invalid WAV fmt chunk in '%s'\n", path);
+                fclose(wf);
+                return 0;
+            }
+            uint8_t* fmt_data = (uint8_t*)malloc(chunk_size);
+            if (!fmt_data) {
+                fprintf(stderr, "Out of memory while reading WAV fmt chunk\n");
+                fclose(wf);
+                return 0;
+            }
+            if (fread(fmt_data, chunk_size, 1, wf) != 1) {
+                fprintf(stderr, "Failed to read WAV fmt chunk\n");
+                free(fmt_data);
+                fclose(wf);
+                return 0;
+            }
+            audio_format = (uint16_t)fmt_data[0] | ((uint16_t)fmt_data[1] << 8);
+            num_channels = (uint16_t)fmt_data[2] | ((uint16_t)fmt_data[3] << 8);
+            sample_rate = (uint32_t)fmt_data[4] |
+                          ((uint32_t)fmt_data[5] << 8) |
+                          ((uint32_t)fmt_data[6] << 16) |
+                          ((uint32_t)fmt_data[7] << 24);
+            bits_per_sample = (uint16_t)fmt_data[14] | ((uint16_t)fmt_data[15] << 8);
+            free(fmt_data);
+            have_fmt = 1;
+        } else if (memcmp(chunk_header, "data", 4) == 0) {
+            // Only the position is noted; the samples are streamed later.
+            data_offset = ftell(wf);
+            data_size = chunk_size;
+            have_data = 1;
+            if (data_offset < 0 || fseek(wf, chunk_size, SEEK_CUR) != 0) {
+                fprintf(stderr, "Failed to skip WAV data chunk in '%s'\n", path);
+                fclose(wf);
+                return 0;
+            }
+        } else {
+            if (fseek(wf, chunk_size, SEEK_CUR) != 0) {
+                fprintf(stderr, "Failed to skip WAV chunk in '%s'\n", path);
+                fclose(wf);
+                return 0;
+            }
+        }
+
+        if (chunk_size & 1u) {
+            if (fseek(wf, 1, SEEK_CUR) != 0) {
+                fprintf(stderr, "Failed to align WAV chunk in '%s'\n", path);
+                fclose(wf);
+                return 0;
+            }
+        }
+
+        if (have_fmt && have_data) {
+            break;
+        }
+    }
+
+    if (!have_fmt || !have_data) {
+        fprintf(stderr, "WAV file '%s' is missing required chunks\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (audio_format != 1) {
+        fprintf(stderr, "WAV file '%s' is not PCM encoded\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (num_channels == 0) {
+        fprintf(stderr, "WAV file '%s' has no channels\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (bits_per_sample != 8 && bits_per_sample != 16) {
+        fprintf(stderr, "Unsupported WAV bit depth (%u) in '%s'\n", (unsigned)bits_per_sample, path);
+        fclose(wf);
+        return 0;
+    }
+
+    if (sample_rate == 0) {
+        fprintf(stderr, "Invalid WAV sample rate in '%s'\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    uint32_t frame_bytes = (uint32_t)(bits_per_sample / 8u) * num_channels;
+    if (data_size % frame_bytes != 0u) {
+        fprintf(stderr, "Corrupt WAV data chunk in '%s'\n", path);
+        fclose(wf);
+        return 0;
+    }
+
+    tape_free_image(&state->image);
+    tape_waveform_reset(&state->waveform);
+    if (!tape_wav_stream_open(&state->wav_stream, wf, (uint64_t)data_offset, data_size, num_channels,
+                              bits_per_sample, sample_rate)) {
+        fprintf(stderr, "Failed to open WAV tape '%s'\n", path);
+        return 0;
+    }
+    state->waveform.sample_rate = sample_rate;
+    state->format = TAPE_FORMAT_WAV;
+    if (state == &tape_playback) {
+        tape_wav_shared_position_tstates = 0;
+    }
+    return 1;
+}
+
+static int string_ends_with_case_insensitive(const char* str, const char* suffix) {
+    if (!str || !suffix) {
+        return 0;
+    }
+
+    size_t str_len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    if (suffix_len == 0 || suffix_len > str_len) {
+        return 0;
+    }
+
+    const char* str_tail = str + (str_len - suffix_len);
+    for (size_t i = 0; i < suffix_len; ++i) {
+        char a = str_tail[i];
+        char b = suffix[i];
+        if (a >= 'A' && a <= 'Z') {
+            a = (char)(a - 'A' + 'a');
+        }
+        if (b >= 'A' && b <= 'Z') {
+            b = (char)(b - 'A' + 'a');
+        }
+        if (a != b) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static TapeFormat tape_format_from_extension(const char* path) {
+    if (!path) {
+        return TAPE_FORMAT_NONE;
+    }
+
+    if (string_ends_with_case_insensitive(path, ".tap")) {
+        return TAPE_FORMAT_TAP;
+    }
+    if (string_ends_with_case_insensitive(path, ".tzx")) {
+        return TAPE_FORMAT_TZX;
+    }
+    if (string_ends_with_case_insensitive(path, ".wav")) {
+        return TAPE_FORMAT_WAV;
+    }
+    if (string_ends_with_case_insensitive(path, ".csw")) {
+        return TAPE_FORMAT_CSW;
+    }
+    if (string_ends_with_case_insensitive(path, ".pzx")) {
+        return TAPE_FORMAT_PZX;
+    }
+
+    return TAPE_FORMAT_NONE;
+}
+
+static void tape_set_input_path(const char* path) {
+    if (path && *path) {
+        size_t length = strlen(path);
+        if (length >= sizeof(tape_input_path_storage)) {
+            length = sizeof(tape_input_path_storage) - 1u;
+        }
+        memcpy(tape_input_path_storage, path, length);
+        tape_input_path_storage[length] = '\0';
+        tape_input_path = tape_input_path_storage;
+    } else {
+        tape_input_path_storage[0] = '\0';
+        tape_input_path = NULL;
+    }
+}
+
+static int tape_load_image(const char* path, TapeFormat format, TapeImage* image) {
+    if (!path || !image || format == TAPE_FORMAT_NONE) {
+        return 0;
+    }
+
+    tape_free_image(image);
+
+    switch (format) {
+        case TAPE_FORMAT_TAP:
+            return tape_load_tap(path, image);
+        case TAPE_FORMAT_TZX:
+            return tape_load_tzx(path, image);
+        case TAPE_FORMAT_CSW:
+            return tape_load_csw(path, image);
+        case TAPE_FORMAT_PZX:
+            return tape_load_pzx(path, image);
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static int speaker_component_amplitude(int level) {
+    return level ? 1 : -1;
+}
+
+static int speaker_calculate_output_level(void) {
+    int combined = speaker_component_amplitude(beeper_state);
+    combined += speaker_component_amplitude(speaker_tape_playback_level);
+    combined += speaker_component_amplitude(speaker_tape_record_level);
+    return combined;
+}
+
+static void speaker_update_output(uint64_t t_state, int emit_event) {
+    int new_level = speaker_calculate_output_level();
+    if (new_level != speaker_output_level) {
+        speaker_output_level = new_level;
+        if (emit_event && !tape_warp_active) {
+            beeper_push_event(t_state, new_level);
+        }
+    }
+}
+
+static double ay_clamp_pan(double value) {
+    if (value < -1.0) {
+        return -1.0;
+    }
+    if (value > 1.0) {
+        return 1.0;
+    }
+    return value;
+}
+
+static void ay_compute_pan_gains(double pan, double* left_gain, double* right_gain) {
+    if (!left_gain || !right_gain) {
+        return;
+    }
+    double clamped = ay_clamp_pan(pan);
+    double angle = (clamped + 1.0) * (M_PI * 0.25);
+    *left_gain = cos(angle);
+    *right_gain = sin(angle);
+}
+
+static void ay_refresh_tone_period(int channel) {
+    if (channel < 0 || channel > 2) {
+        return;
+    }
+    uint8_t low = ay_state.registers[channel * 2];
+    uint8_t high = (uint8_t)(ay_state.registers[channel * 2 + 1] & 0x0Fu);
+    uint32_t period = (uint32_t)low | ((uint32_t)high << 8);
+    if (period == 0u) {
+        period = 1u;
+    }
+    ay_state.tone_period[channel] = period;
+    if (ay_state.tone_counter[channel] >= period) {
+        ay_state.tone_counter[channel] = period - 1u;
+    }
+}
+
+static void ay_refresh_noise_period(void) {
+    uint32_t value = (uint32_t)(ay_state.registers[6] & 0x1Fu);
+    if (value == 0u) {
+        value = 1u;
+    }
+    uint32_t period = value * 2u;
+    ay_state.noise_period = period;
+    if (ay_state.noise_counter >= period) {
+        ay_state.noise_counter = period - 1u;
+    }
+}
+
+static void ay_refresh_envelope_period(void) {
+    uint32_t value = (uint32_t)ay_state.registers[11] | ((uint32_t)ay_state.registers[12] << 8);
+    if (value == 0u) {
+        value = 1u;
+    }
+    uint32_t period = value * 2u;
+    ay_state.envelope_period = period;
+    if (ay_state.envelope_counter >= period) {
+        ay_state.envelope_counter = period - 1u;
+    }
+}
+
+static void ay_restart_envelope(void) {
+    uint8_t shape = (uint8_t)(ay_state.registers[13] & 0x0Fu);
+    ay_state.envelope_continue = (shape >> 3) & 0x01;
+    ay_state.envelope_direction = ((shape >> 2) & 0x01) ? 1 : -1;
+    ay_state.envelope_alternate = (shape >> 1) & 0x01;
+    ay_state.envelope_hold = shape & 0x01;
+    if (!ay_state.envelope_continue) {
+        ay_state.envelope_hold = 1;
+        ay_state.envelope_alternate = 0;
+    }
+    ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 0u : 15u);
+    ay_state.envelope_active = 1;
+    ay_state.envelope_counter = 0u;
+}
+
+static void ay_handle_envelope_limit(void) {
+    if (!ay_state.envelope_continue) {
+        ay_state.envelope_active = 0;
+        ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 15u : 0u);
+        return;
+    }
+
+    if (ay_state.envelope_hold) {
+        ay_state.envelope_active = 0;
+        if (ay_state.envelope_alternate) {
+            ay_state.envelope_direction = -ay_state.envelope_direction;
+        }
+        ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 15u : 0u);
+        return;
+    }
+
+    if (ay_state.envelope_alternate) {
+        ay_state.envelope_direction = -ay_state.envelope_direction;
+    }
+    ay_state.envelope_volume = (uint8_t)((ay_state.envelope_direction > 0) ? 0u : 15u);
+}
+
+static void ay_step_envelope(void) {
+    if (!ay_state.envelope_active) {
+        return;
+    }
+    if (ay_state.envelope_direction > 0) {
+        if (ay_state.envelope_volume < 15u) {
+            ++ay_state.envelope_volume;
+            return;
+        }
+    } else {
+        if (ay_state.envelope_volume > 0u) {
+            --ay_state.envelope_volume;
+            return;
+        }
+    }
+    ay_handle_envelope_limit();
+}
+
+// Advances every generator by `ticks` AY_STEP_HZ ticks. A sample spans
+// about five ticks at 44.1kHz, so the loops run a handful of times at most.
+static void ay_step_generators(uint32_t ticks) {
+    for (int ch = 0; ch < 3; ++ch) {
+        uint32_t period = ay_state.tone_period[ch];
+        uint32_t counter = ay_state.tone_counter[ch] + ticks;
+        while (counter >= period) {
+            counter -= period;
+            ay_state.tone_output[ch] ^= 1;
+        }
+        ay_state.tone_counter[ch] = counter;
+    }
+
+    uint32_t noise_counter = ay_state.noise_counter + ticks;
+    while (noise_counter >= ay_state.noise_period) {
+        noise_counter -= ay_state.noise_period;
+        uint32_t lfsr = ay_state.noise_lfsr & 0x1FFFFu;
+        uint32_t feedback = (uint32_t)(((lfsr ^ (lfsr >> 3)) & 0x01u));
+        lfsr = (lfsr >> 1) | (feedback << 16);
+        if (lfsr == 0u) {
+            lfsr = 0x1FFFFu;
+        }
+        ay_state.noise_lfsr = lfsr & 0x1FFFFu;
+        ay_state.noise_output = (int)(lfsr & 0x01u);
+    }
+    ay_state.noise_counter = noise_counter;
+
+    if (!ay_state.envelope_active) {
+        return;
+    }
+    uint32_t env_counter = ay_state.envelope_counter + ticks;
+    while (env_counter >= ay_state.envelope_period) {
+        env_counter -= ay_state.envelope_period;
+        ay_step_envelope();
+    }
+    ay_state.envelope_counter = env_counter;
+}
+
+static void ay_reset_state_internal(void) {
+    memset(&ay_state, 0, sizeof(ay_state));
+    ay_state.noise_lfsr = 0x1FFFFu;
+    ay_state.noise_output = 1;
+    for (int ch = 0; ch < 3; ++ch) {
+        ay_refresh_tone_period(ch);
+        ay_state.tone_output[ch] = 0;
+    }
+    ay_refresh_noise_period();
+    ay_refresh_envelope_period();
+    ay_restart_envelope();
+    ay_step_phase = 0u;
+    memset(&ay_highpass_left, 0, sizeof(ay_highpass_left));
+    memset(&ay_highpass_right, 0, sizeof(ay_highpass_right));
+    ay_event_head.store(0, std::memory_order_relaxed);
+    ay_event_tail.store(0, std::memory_order_relaxed);
+    ay_last_event_t_state = 0;
+    ay_dirty_registers = 0u;
+}
+
+static void ay_reset_state(void) {
+    int locked = 0;
+    if (audio_available) {
+        audio_backend_lock();
+        locked = 1;
+    }
+    ay_reset_state_internal();
+    if (locked) {
+        audio_backend_unlock();
+    }
+}
+
+// Folds volume, pan and ay_global_gain into one lookup per channel, so mixing
+// a sample is three table reads per side. Only rebuilt when the pan changes.
+static void ay_refresh_mix_table(void) {
+    for (int ch = 0; ch < 3; ++ch) {
+        double pan_left = 0.0;
+        double pan_right = 0.0;
+        ay_compute_pan_gains(ay_channel_pan[ch], &pan_left, &pan_right);
+        for (int volume = 0; volume < 16; ++volume) {
+            double amplitude = ay_volume_table[volume] * ay_global_gain;
+            ay_mix_table_left[ch][volume] = (int32_t)lround(amplitude * pan_left);
+            ay_mix_table_right[ch][volume] = (int32_t)lround(amplitude * pan_right);
+        }
+    }
+}
+
+static void ay_set_sample_rate(int sample_rate) {
+    if (sample_rate <= 0) {
+        ay_step_increment = 0u;
+        return;
+    }
+    ay_step_increment = (uint32_t)lround(AY_STEP_HZ * 65536.0 / (double)sample_rate);
+    ay_refresh_mix_table();
+}
+
+// Renders `frames` consecutive samples with the current register set. The
+// caller splits the buffer at register-change points, so nothing here has to
+// look at the event queue.
+static void ay_render_block(int32_t* left, int32_t* right, int frames, uint32_t increment) {
+    if (!left || !right || frames <= 0) {
+        return;
+    }
+    if (increment == 0u) {
+        memset(left, 0, (size_t)frames * sizeof(int32_t));
+        memset(right, 0, (size_t)frames * sizeof(int32_t));
+        return;
+    }
+
+    uint8_t mixer = ay_state.registers[7];
+    uint32_t phase = ay_step_phase;
+    for (int i = 0; i < frames; ++i) {
+        phase += increment;
+        ay_step_generators(phase >> 16);
+        phase &= 0xFFFFu;
+
+        int32_t mix_left = 0;
+        int32_t mix_right = 0;
+        for (int ch = 0; ch < 3; ++ch) {
+            int tone = ((mixer >> ch) & 0x01u) ? 1 : ay_state.tone_output[ch];
+            int noise = ((mixer >> (ch + 3)) & 0x01u) ? 1 : ay_state.noise_output;
+            if (!(tone & noise)) {
+                continue;
+            }
+            uint8_t volume = ay_state.registers[8 + ch];
+            int level = (volume & 0x10u) ? (ay_state.envelope_volume & 0x0F) : (volume & 0x0F);
+            mix_left += ay_mix_table_left[ch][level];
+            mix_right += ay_mix_table_right[ch][level];
+        }
+
+        left[i] = audio_highpass_run(&ay_highpass_left, mix_left);
+        right[i] = audio_highpass_run(&ay_highpass_right, mix_right);
+    }
+    ay_step_phase = phase;
+}
+
+// Audio-side half of a register write: updates the generator's copy and the
+// derived periods. Only the audio consumer calls this while output runs.
+static void ay_apply_register(uint8_t reg, uint8_t value) {
+    uint8_t index = (uint8_t)(reg & 0x0Fu);
+    ay_state.registers[index] = value;
+    switch (index) {
+        case 0:
+        case 1:
+            ay_refresh_tone_period(0);
+            break;
+        case 2:
+        case 3:
+            ay_refresh_tone_period(1);
+            break;
+        case 4:
+        case 5:
+            ay_refresh_tone_period(2);
+            break;
+        case 6:
+            ay_refresh_noise_period();
+            break;
+        case 11:
+        case 12:
+            ay_refresh_envelope_period();
+            break;
+        case 13:
+            ay_restart_envelope();
+            break;
+        default:
+            break;
+    }
+}
+
+static size_t ay_apply_events_until(uint64_t t_state) {
+    size_t head = ay_event_head.load(std::memory_order_relaxed);
+    size_t tail = ay_event_tail.load(std::memory_order_acquire);
+    size_t applied = 0;
+    while (head != tail && ay_events[head].t_state <= t_state) {
+        ay_apply_register(ay_events[head].reg, ay_events[head].value);
+        head = (head + 1) % AY_EVENT_CAPACITY;
+        ++applied;
+    }
+    ay_event_head.store(head, std::memory_order_release);
+    return applied;
+}
+
+// Applies every queued write up to (not including) ring index `end`,
+// whatever its timestamp.
+static void ay_apply_events_before(size_t end) {
+    size_t head = ay_event_head.load(std::memory_order_relaxed);
+    while (head != end) {
+        ay_apply_register(ay_events[head].reg, ay_events[head].value);
+        head = (head + 1) % AY_EVENT_CAPACITY;
+    }
+    ay_event_head.store(head, std::memory_order_release);
+}
+
+static int ay_queue_push(uint64_t t_state, uint8_t reg, uint8_t value) {
+    size_t tail = ay_event_tail.load(std::memory_order_relaxed);
+    size_t next_tail = (tail + 1) % AY_EVENT_CAPACITY;
+    if (next_tail == ay_event_head.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    ay_events[tail].t_state = t_state;
+    ay_events[tail].reg = reg;
+    ay_events[tail].value = value;
+    ay_event_tail.store(next_tail, std::memory_order_release);
+    return 1;
+}
+
+static int ay_output_silent(void) {
+    for (int ch = 0; ch < 3; ++ch) {
+        uint8_t volume = ay_state.registers[8 + ch];
+        if ((volume & 0x10u) || (volume & 0x0Fu)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Re-sends registers whose earlier writes never reached the queue.
+static void ay_queue_dirty_registers(uint64_t t_state) {
+    while (ay_dirty_registers != 0u) {
+        int dirty = 0;
+        while (!(ay_dirty_registers & (1u << dirty))) {
+            ++dirty;
+        }
+        if (!ay_queue_push(t_state, (uint8_t)dirty, ay_registers[dirty])) {
+            break;
+        }
+        ay_dirty_registers = (uint16_t)(ay_dirty_registers & ~(1u << dirty));
+    }
+}
+
+static void ay_write_register(uint8_t reg, uint8_t value, uint64_t t_state) {
+    uint8_t index = (uint8_t)(reg & 0x0Fu);
+    ay_registers[index] = value;
+
+    // Without an audio consumer nothing would drain the queue, so the write
+    // lands on the generator straight away.
+    if (ay_step_increment == 0u) {
+        ay_apply_register(index, value);
+        return;
+    }
+    // Warp holds audio back; the latest values go out when it ends.
+    if (tape_warp_active) {
+        ay_dirty_registers = (uint16_t)(ay_dirty_registers | (1u << index));
+        return;
+    }
+
+    if (t_state < ay_last_event_t_state) {
+        t_state = ay_last_event_t_state;
+    } else {
+        ay_last_event_t_state = t_state;
+    }
+    ay_queue_dirty_registers(t_state);
+    ay_dirty_registers = (uint16_t)(ay_dirty_registers & ~(1u << index));
+    if (!ay_queue_push(t_state, index, value)) {
+        ay_dirty_registers = (uint16_t)(ay_dirty_registers | (1u << index));
+        ay_events_dropped.fetch_add(1u, std::memory_order_relaxed);
+    }
+}
+
+static int ay_parse_pan_spec(const char* spec) {
+    if (!spec) {
+        return 0;
+    }
+    double parsed[3];
+    size_t index = 0;
+    const char* cursor = spec;
+    while (index < 3) {
+        while (*cursor && isspace((unsigned char)*cursor)) {
+            ++cursor;
+        }
+        if (*cursor == '\0') {
+            return 0;
+        }
+        char* endptr = NULL;
+        double value = strtod(cursor, &endptr);
+        if (endptr == cursor) {
+            return 0;
+        }
+        parsed[index++] = ay_clamp_pan(value);
+        cursor = endptr;
+        while (*cursor && isspace((unsigned char)*cursor)) {
+            ++cursor;
+        }
+        if (index < 3) {
+            if (*cursor != ',' && *cursor != ';' && *cursor != '/') {
+                return 0;
+            }
+            ++cursor;
+        } else if (*cursor != '\0') {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        ay_channel_pan[i] = parsed[i];
+    }
+    ay_refresh_mix_table();
+    return 1;
+}
+
+// WAV tapes play from a batch of pulses refilled from the stream; tape
+// images generate their pulses as they go. waveform_index counts the pulse being timed.
+static int tape_playback_uses_edges(const TapePlaybackState* state) {
+    if (state->format == TAPE_FORMAT_WAV) {
+        return state->wav_stream.pulses > 0;
+    }
+    return state->use_waveform_playback && state->image.count > 0;
+}
+
+static int tape_playback_has_pulse(const TapePlaybackState* state) {
+    if (state->format == TAPE_FORMAT_WAV) {
+        return tape_waveform_reader_has_pulse(&state->waveform, &state->waveform_reader);
+    }
+    return state->pulse_cursor.has_current;
+}
+
+static uint64_t tape_playback_pulse_duration(const TapePlaybackState* state) {
+    if (state->format == TAPE_FORMAT_WAV) {
+        return (uint64_t)tape_waveform_reader_duration(&state->waveform, &state->waveform_reader);
+    }
+    return state->pulse_cursor.current;
+}
+
+// Moves on to the following pulse; returns 0 once the tape has run out.
+static int tape_playback_next_pulse(TapePlaybackState* state) {
+    state->waveform_index++;
+    if (state->format == TAPE_FORMAT_WAV) {
+        if (tape_waveform_reader_next(&state->waveform, &state->waveform_reader)) {
+            return 1;
+        }
+        return tape_wav_stream_fill(&state->wav_stream, &state->waveform, &state->waveform_reader);
+    }
+    return tape_pulse_cursor_advance(&state->pulse_cursor, &state->image);
+}
+
+static void tape_reset_playback(TapePlaybackState* state) {
+    if (!state) {
+        return;
+    }
+    state->waveform_reader.run = 0;
+    state->waveform_reader.offset = 0;
+    if (state->format != TAPE_FORMAT_WAV) {
+        tape_pulse_cursor_reset(&state->pulse_cursor, &state->image);
+    } else if (state->wav_stream.samples) {
+        tape_wav_stream_rewind(&state->wav_stream, &state->waveform, &state->waveform_reader);
+    }
+    state->current_block = 0;
+    state->phase = TAPE_PHASE_IDLE;
+    state->pilot_pulses_remaining = 0;
+    state->data_byte_index = 0;
+    state->data_bit_mask = 0x80u;
+    state->data_pulse_half = 0;
+    state->next_transition_tstate = 0;
+    state->pause_end_tstate = 0;
+    state->playing = 0;
+    state->waveform_index = 0;
+    state->paused_transition_remaining = 0;
+    state->paused_pause_remaining = 0;
+    state->position_tstates = 0;
+    state->position_start_tstate = 0;
+    state->last_transition_tstate = 0;
+    if (state == &tape_playback &&
+        (state->format == TAPE_FORMAT_WAV || tape_recorder.output_format == TAPE_OUTPUT_WAV)) {
+        tape_wav_shared_position_tstates = 0;
+    }
+    if (state->format == TAPE_FORMAT_WAV) {
+        state->level = state->waveform.initial_level ? 1 : 0;
+        tape_ear_state = state->level;
+    } else if (tape_playback_uses_edges(state)) {
+        state->level = state->pulse_cursor.initial_level ? 1 : 0;
+        tape_ear_state = state->level;
+    } else {
+        state->level = 1;
+        tape_ear_state = 1;
+    }
+    speaker_tape_playback_level = tape_ear_state;
+    speaker_update_output(total_t_states, 0);
+}
+
+static int tape_current_block_pilot_count(const TapePlaybackState* state) {
+    if (!state || state->current_block >= state->image.count) {
+        return TAPE_DATA_PILOT_COUNT;
+    }
+    const TapeBlock* block = &state->image.blocks[state->current_block];
+    if (block->length > 0 && block->data && block->data[0] == 0x00) {
+        return TAPE_HEADER_PILOT_COUNT;
+    }
+    return TAPE_DATA_PILOT_COUNT;
+}
+
+static int tape_begin_block(TapePlaybackState* state, size_t block_index, uint64_t start_time) {
+    if (!state || block_index >= state->image.count) {
+        return 0;
+    }
+
+    state->current_block = block_index;
+    if (tape_debug_logging) {
+        tape_log("Starting playback of block %zu at t=%llu\n",
+                 block_index,
+                 (unsigned long long)start_time);
+        tape_log_block_summary(&state->image.blocks[block_index], block_index);
+    }
+    state->pilot_pulses_remaining = tape_current_block_pilot_count(state);
+    state->data_byte_index = 0;
+    state->data_bit_mask = 0x80u;
+    state->data_pulse_half = 0;
+    state->phase = TAPE_PHASE_PILOT;
+    state->level = 1;
+    tape_ear_state = state->level;
+    speaker_tape_playback_level = tape_ear_state;
+    speaker_update_output(start_time, 1);
+    state->next_transition_tstate = start_time + (uint64_t)TAPE_PILOT_PULSE_TSTATES;
+    state->playing = 1;
+    state->last_transition_tstate = start_time;
+    state->paused_transition_remaining = 0;
+    state->paused_pause_remaining = 0;
+    return 1;
+}
+
+static void tape_start_playback(TapePlaybackState* state, uint64_t start_time) {
+    if (!state) {
+        return;
+    }
+    tape_reset_playback(state);
+    state->position_start_tstate = start_time;
+    state->last_transition_tstate = start_time;
+    if (state->format == TAPE_FORMAT_WAV || state->use_waveform_playback) {
+        if (!tape_playback_uses_edges(state) || !tape_playback_has_pulse(state)) {
+            return;
+        }
+        speaker_tape_playback_level = tape_ear_state;
+        speaker_update_output(start_time, 1);
+        state->playing = 1;
+        state->next_transition_tstate = start_time + tape_playback_pulse_duration(state);
+        state->paused_transition_remaining = 0;
+        state->paused_pause_remaining = 0;
+        return;
+    }
+    if (state->image.count == 0) {
+        return;
+    }
+    (void)tape_begin_block(state, 0u, start_time);
+}
+
+static void tape_pause_playback(TapePlaybackState* state, uint64_t current_t_state) {
+    if (!state || !state->playing) {
+        return;
+    }
+
+    if (state->next_transition_tstate > current_t_state) {
+        state->paused_transition_remaining = state->next_transition_tstate - current_t_state;
+    } else {
+        state->paused_transition_remaining = 0;
+    }
+
+    if (state->phase == TAPE_PHASE_PAUSE && state->pause_end_tstate > current_t_state) {
+        state->paused_pause_remaining = state->pause_end_tstate - current_t_state;
+    } else {
+        state->paused_pause_remaining = 0;
+    }
+
+    tape_playback_accumulate_elapsed(state, current_t_state);
+    state->last_transition_tstate = current_t_state;
+    state->playing = 0;
+    if (state == &tape_playback && tape_playback_uses_edges(state)) {
+        tape_wav_shared_position_tstates = state->position_tstates;
+    }
+}
+
+static int tape_resume_playback(TapePlaybackState* state, uint64_t current_t_state) {
+    if (!state || state->playing) {
+        return 0;
+    }
+
+    if (tape_playback_uses_edges(state)) {
+        if (!tape_playback_has_pulse(state)) {
+            return 0;
+        }
+        uint64_t delay = state->paused_transition_remaining;
+        state->next_transition_tstate = current_t_state + delay;
+        if (delay == 0 && state->next_transition_tstate < current_t_state) {
+            state->next_transition_tstate = current_t_state;
+        }
+        state->playing = 1;
+    } else {
+        if (state->phase == TAPE_PHASE_IDLE) {
+            tape_start_playback(state, current_t_state);
+            return state->playing;
+        }
+        if (state->phase == TAPE_PHASE_DONE) {
+            return 0;
+        }
+        uint64_t delay = state->paused_transition_remaining;
+        state->next_transition_tstate = current_t_state + delay;
+        if (delay == 0 && state->next_transition_tstate < current_t_state) {
+            state->next_transition_tstate = current_t_state;
+        }
+        if (state->phase == TAPE_PHASE_PAUSE) {
+            uint64_t pause_delay = state->paused_pause_remaining;
+            state->pause_end_tstate = current_t_state + pause_delay;
+            if (pause_delay == 0 && state->pause_end_tstate < current_t_state) {
+                state->pause_end_tstate = current_t_state;
+            }
+        }
+        state->playing = 1;
+    }
+
+    if (state->playing) {
+        state->position_start_tstate = current_t_state;
+        state->last_transition_tstate = current_t_state;
+    }
+
+    state->paused_transition_remaining = 0;
+    state->paused_pause_remaining = 0;
+    tape_ear_state = state->level;
+    speaker_tape_playback_level = tape_ear_state;
+    speaker_update_output(current_t_state, 1);
+    return 1;
+}
+
+static void tape_rewind_playback(TapePlaybackState* state) {
+    if (!state) {
+        return;
+    }
+    tape_reset_playback(state);
+}
+
+// Leaves playback paused `position` tstates into the tape. Images jump to
+// the block through the timeline and step its pulses from there; WAV tapes
+// restart edge detection at the matching sample. Block-level playback can
+// only stop at block boundaries, so it rounds down to the block start.
+static int tape_seek_playback(TapePlaybackState* state, uint64_t position) {
+    if (!state) {
+        return 0;
+    }
+    tape_reset_playback(state);
+
+    if (state->format == TAPE_FORMAT_WAV) {
+        TapeWavStream* stream = &state->wav_stream;
+        if (!stream->samples || stream->tstates_per_sample <= 0.0) {
+            return 0;
+        }
+        uint64_t frame = (uint64_t)((double)position / stream->tstates_per_sample);
+        frame = tape_wav_stream_seek(stream, &state->waveform, &state->waveform_reader, frame);
+        position = (uint64_t)((double)frame * stream->tstates_per_sample + 0.5);
+        state->level = state->waveform.initial_level ? 1 : 0;
+        state->paused_transition_remaining =
+            tape_playback_has_pulse(state) ? tape_playback_pulse_duration(state) : 0u;
+    } else {
+        TapeImage* image = &state->image;
+        if (!tape_timeline_build(image)) {
+            return 0;
+        }
+        if (position > image->length_tstates) {
+            position = image->length_tstates;
+        }
+        size_t block = tape_timeline_find(image, position);
+        uint64_t start = image->timeline[block].start_tstates;
+        if (!tape_playback_uses_edges(state)) {
+            position = start;
+            state->current_block = block;
+            state->phase = block < image->count ? TAPE_PHASE_PAUSE : TAPE_PHASE_DONE;
+        } else {
+            TapePulseCursor* cursor = &state->pulse_cursor;
+            *cursor = image->timeline[block].cursor;
+            while (cursor->has_current && start + cursor->current <= position) {
+                start += cursor->current;
+                if (cursor->stage == TAPE_PULSE_STAGE_PILOT && cursor->pilot_pulse > 0u) {
+                    uint64_t skip = (position - start) / cursor->pilot_pulse;
+                    if (skip > cursor->index) {
+                        skip = cursor->index;
+                    }
+                    cursor->index -= (uint32_t)skip;
+                    cursor->emitted += skip;
+                    start += skip * cursor->pilot_pulse;
+                }
+                (void)tape_pulse_cursor_advance(cursor, image);
+            }
+            state->waveform_index = cursor->emitted > 0u ? (size_t)(cursor->emitted - 1u) : 0u;
+            state->current_block = cursor->has_current ? cursor->block_index : image->count;
+            state->level = (cursor->initial_level ? 1 : 0) ^ (int)(state->waveform_index & 1u);
+            state->paused_transition_remaining = cursor->has_current ? start + cursor->current - position : 0u;
+        }
+    }
+
+    state->position_tstates = position;
+    if (state == &tape_playback) {
+        tape_ear_state = state->level;
+        speaker_tape_playback_level = tape_ear_state;
+        speaker_update_output(total_t_states, 0);
+        if (state->format == TAPE_FORMAT_WAV || tape_recorder.output_format == TAPE_OUTPUT_WAV) {
+            tape_wav_shared_position_tstates = position;
+        }
+    }
+    return 1;
+}
+
+static void tape_playback_accumulate_elapsed(TapePlaybackState* state, uint64_t stop_t_state) {
+    if (!state) {
+        return;
+    }
+
+    if (stop_t_state < state->position_start_tstate) {
+        stop_t_state = state->position_start_tstate;
+    }
+
+    if (stop_t_state > state->position_start_tstate) {
+        state->position_tstates += stop_t_state - state->position_start_tstate;
+    }
+
+    state->position_start_tstate = stop_t_state;
+}
+
+static uint64_t tape_playback_elapsed_tstates(const TapePlaybackState* state, uint64_t current_t_state) {
+    if (!state) {
+        return 0;
+    }
+
+    uint64_t elapsed = state->position_tstates;
+    if (state->playing && current_t_state > state->position_start_tstate) {
+        elapsed += current_t_state - state->position_start_tstate;
+    }
+
+    return elapsed;
+}
+
+static uint64_t tape_recorder_elapsed_tstates(uint64_t current_t_state) {
+    if (!tape_recorder.enabled) {
+        return 0;
+    }
+
+    uint64_t elapsed = tape_recorder.position_tstates;
+    if (tape_recorder.recording && current_t_state > tape_recorder.position_start_tstate) {
+        elapsed += current_t_state - tape_recorder.position_start_tstate;
+    }
+
+    return elapsed;
+}
+
+static const TapeOverlayGlyph* tape_overlay_find_glyph(char ch) {
+    size_t glyph_count = sizeof(tape_overlay_font) / sizeof(tape_overlay_font[0]);
+    for (size_t i = 0; i < glyph_count; ++i) {
+        if (tape_overlay_font[i].ch == ch) {
+            return &tape_overlay_font[i];
+        }
+    }
+    return &tape_overlay_font[0];
+}
+
+static int tape_overlay_text_width(const char* text, int scale, int spacing) {
+    if (!text) {
+        return 0;
+    }
+
+    int width = 0;
+    int first = 1;
+    for (const char* c = text; *c; ++c) {
+        if (!first) {
+            width += spacing;
+        }
+        first = 0;
+        width += TAPE_OVERLAY_FONT_WIDTH * scale;
+    }
+
+    return width;
+}
+
+// The paint helpers write pixels[] and never look at the display list, so
+// the render thread can replay one while the emulation thread records the
+// next. The draw wrappers record while a frame is being captured.
+static void tape_overlay_paint_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color) {
+    if (!text) {
+        return;
+    }
+
+    uint8_t color_index = video_palette_index(color);
+    int cursor_x = origin_x;
+    for (const char* c = text; *c; ++c) {
+        char ch = *c;
+        if (ch >= 'a' && ch <= 'z') {
+            ch = (char)(ch - 'a' + 'A');
+        }
+        const TapeOverlayGlyph* glyph = tape_overlay_find_glyph(ch);
+        for (int row = 0; row < TAPE_OVERLAY_FONT_HEIGHT; ++row) {
+            uint8_t bits = glyph->rows[row];
+            for (int col = 0; col < TAPE_OVERLAY_FONT_WIDTH; ++col) {
+                int bit_index = TAPE_OVERLAY_FONT_WIDTH - 1 - col;
+                if (bits & (1u << bit_index)) {
+                    for (int dy = 0; dy < scale; ++dy) {
+                        int py = origin_y + row * scale + dy;
+                        if (py < 0 || py >= TOTAL_HEIGHT) {
+                            continue;
+                        }
+                        for (int dx = 0; dx < scale; ++dx) {
+                            int px = cursor_x + col * scale + dx;
+                            if (px < 0 || px >= TOTAL_WIDTH) {
+                                continue;
+                            }
+                            pixels[py * TOTAL_WIDTH + px] = color_index;
+                        }
+                    }
+                }
+            }
+        }
+        cursor_x += TAPE_OVERLAY_FONT_WIDTH * scale + spacing;
+    }
+}
+
+static void tape_overlay_draw_text(int origin_x, int origin_y, const char* text, int scale, int spacing, uint32_t color) {
+    if (video_overlay_recording) {
+        video_overlay_record_text(origin_x, origin_y, text, scale, spacing, color);
+        return;
+    }
+    tape_overlay_paint_text(origin_x, origin_y, text, scale, spacing, color);
+}
+
+static void tape_overlay_paint_rect(int x, int y, int width, int height, uint32_t fill_color, uint32_t border_color) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    uint8_t fill_index = video_palette_index(fill_color);
+    uint8_t border_index = video_palette_index(border_color);
+    for (int yy = 0; yy < height; ++yy) {
+        int py = y + yy;
+        if (py < 0 || py >= TOTAL_HEIGHT) {
+            continue;
+        }
+        for (int xx = 0; xx < width; ++xx) {
+            int px = x + xx;
+            if (px < 0 || px >= TOTAL_WIDTH) {
+                continue;
+            }
+            int is_border = (yy == 0 || yy == height - 1 || xx == 0 || xx == width - 1);
+            pixels[py * TOTAL_WIDTH + px] = is_border ? border_index : fill_index;
+        }
+    }
+}
+
+static void tape_overlay_draw_rect(int x, int y, int width, int height, uint32_t fill_color, uint32_t border_color) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    if (video_overlay_recording) {
+        VideoOverlayCommand* command = video_overlay_append(VIDEO_OVERLAY_COMMAND_RECT);
+        if (command) {
+            command->x = (int16_t)x;
+            command->y = (int16_t)y;
+            command->width = (int16_t)width;
+            command->height = (int16_t)height;
+            command->color = fill_color;
+            command->border_color = border_color;
+        }
+        return;
+    }
+    tape_overlay_paint_rect(x, y, width, height, fill_color, border_color);
+}
+
+static int tape_use_recorder_time(void) {
+    int use_recorder_time = 0;
+
+    if (tape_recorder.recording) {
+        use_recorder_time = 1;
+    } else if (!tape_playback.playing) {
+        switch (tape_deck_status) {
+            case TAPE_DECK_STATUS_RECORD:
+                use_recorder_time = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!use_recorder_time && !tape_input_enabled && tape_recorder.enabled) {
+        use_recorder_time = 1;
+    }
+
+    return use_recorder_time;
+}
+
+static uint64_t tape_current_elapsed_tstates(void) {
+    int use_recorder_time = tape_use_recorder_time();
+    int shared_wav = (tape_input_format == TAPE_FORMAT_WAV) ||
+                     (tape_recorder.output_format == TAPE_OUTPUT_WAV);
+
+    uint64_t elapsed = 0ull;
+
+    if (shared_wav) {
+        if (tape_recorder.recording) {
+            elapsed = tape_recorder_elapsed_tstates(total_t_states);
+        } else if (tape_playback.playing) {
+            elapsed = tape_playback_elapsed_tstates(&tape_playback, total_t_states);
+        } else if (tape_recorder.enabled && tape_recorder.output_format == TAPE_OUTPUT_WAV) {
+            elapsed = tape_recorder.position_tstates;
+        } else {
+            elapsed = tape_wav_shared_position_tstates;
+        }
+    } else if (use_recorder_time) {
+        elapsed = tape_recorder_elapsed_tstates(total_t_states);
+    } else if (tape_input_enabled) {
+        elapsed = tape_playback_elapsed_tstates(&tape_playback, total_t_states);
+    }
+
+    if (elapsed == 0ull) {
+        if (tape_playback.position_tstates > 0ull) {
+            elapsed = tape_playback.position_tstates;
+        } else if (tape_recorder.position_tstates > 0ull) {
+            elapsed = tape_recorder.position_tstates;
+        } else if ((tape_input_format == TAPE_FORMAT_WAV ||
+                    tape_recorder.output_format == TAPE_OUTPUT_WAV) &&
+                   tape_wav_shared_position_tstates > 0ull) {
+            elapsed = tape_wav_shared_position_tstates;
+        }
+    }
+
+    return elapsed;
+}
+
+static void tape_format_counter_text(char* buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0u) {
+        return;
+    }
+
+    uint64_t elapsed_tstates = tape_current_elapsed_tstates();
+    uint64_t clock_hz = (uint64_t)(CPU_CLOCK_HZ + 0.5);
+    if (clock_hz == 0ull) {
+        clock_hz = 1ull;
+    }
+
+    uint64_t total_tenths = (elapsed_tstates * 10ull + clock_hz / 2ull) / clock_hz;
+    uint64_t minutes = total_tenths / 600ull;
+    uint64_t seconds = (total_tenths / 10ull) % 60ull;
+    uint64_t tenths = total_tenths % 10ull;
+
+    if (minutes > 99ull) {
+        minutes = 99ull;
+    }
+
+    (void)snprintf(buffer,
+                   buffer_size,
+                   "%02llu:%02llu.%1llu",
+                   (unsigned long long)minutes,
+                   (unsigned long long)seconds,
+                   (unsigned long long)tenths);
 }
 
 static const TapeControlIcon* tape_control_find_icon(TapeControlAction action) {
@@ -5389,11 +8553,12 @@ static TapeControlAction tape_control_action_from_status(TapeDeckStatus status)
     return TAPE_CONTROL_ACTION_NONE;
 }
 
-static void tape_overlay_draw_icon(int origin_x, int origin_y, const TapeControlIcon* icon, int scale, uint32_t color) {
+static void tape_overlay_paint_icon(int origin_x, int origin_y, const TapeControlIcon* icon, int scale, uint32_t color) {
     if (!icon) {
         return;
     }
 
+    uint8_t color_index = video_palette_index(color);
     for (int row = 0; row < TAPE_CONTROL_ICON_HEIGHT; ++row) {
         uint8_t bits = icon->rows[row];
         for (int col = 0; col < TAPE_CONTROL_ICON_WIDTH; ++col) {
@@ -5409,7 +8574,7 @@ static void tape_overlay_draw_icon(int origin_x, int origin_y, const TapeControl
                         if (px < 0 || px >= TOTAL_WIDTH) {
                             continue;
                         }
-                        pixels[py * TOTAL_WIDTH + px] = color;
+                        pixels[py * TOTAL_WIDTH + px] = color_index;
                     }
                 }
             }
@@ -5417,6 +8582,24 @@ static void tape_overlay_draw_icon(int origin_x, int origin_y, const TapeControl
     }
 }
 
+static void tape_overlay_draw_icon(int origin_x, int origin_y, const TapeControlIcon* icon, int scale, uint32_t color) {
+    if (!icon) {
+        return;
+    }
+    if (video_overlay_recording) {
+        VideoOverlayCommand* command = video_overlay_append(VIDEO_OVERLAY_COMMAND_ICON);
+        if (command) {
+            command->x = (int16_t)origin_x;
+            command->y = (int16_t)origin_y;
+            command->icon = icon;
+            command->scale = (uint8_t)scale;
+            command->color = color;
+        }
+        return;
+    }
+    tape_overlay_paint_icon(origin_x, origin_y, icon, scale, color);
+}
+
 static void tape_overlay_draw_control_button(int x,
                                              int y,
                                              int size,
@@ -5444,20 +8627,7 @@ static void tape_overlay_draw_control_button(int x,
         }
     }
 
-    for (int yy = 0; yy < size; ++yy) {
-        int py = y + yy;
-        if (py < 0 || py >= TOTAL_HEIGHT) {
-            continue;
-        }
-        for (int xx = 0; xx < size; ++xx) {
-            int px = x + xx;
-            if (px < 0 || px >= TOTAL_WIDTH) {
-                continue;
-            }
-            int is_border = (yy == 0 || yy == size - 1 || xx == 0 || xx == size - 1);
-            pixels[py * TOTAL_WIDTH + px] = is_border ? border_color : background_color;
-        }
-    }
+    tape_overlay_draw_rect(x, y, size, size, background_color, border_color);
 
     int icon_pixel_width = TAPE_CONTROL_ICON_WIDTH * scale;
     int icon_pixel_height = TAPE_CONTROL_ICON_HEIGHT * scale;
@@ -6048,6 +9218,7 @@ static void tape_manager_eject_tape(void) {
     tape_recorder_stop_session(total_t_states, 1);
     tape_free_image(&tape_playback.image);
     tape_waveform_reset(&tape_playback.waveform);
+    tape_wav_stream_close(&tape_playback.wav_stream);
     tape_playback.format = TAPE_FORMAT_NONE;
     tape_playback.use_waveform_playback = 0;
     tape_playback.playing = 0;
@@ -6175,6 +9346,7 @@ static int tape_manager_load_path(const char* path) {
         if (!tape_load_wav(path, &new_state)) {
             tape_free_image(&new_state.image);
             tape_waveform_reset(&new_state.waveform);
+            tape_wav_stream_close(&new_state.wav_stream);
             tape_manager_set_status("FAILED TO LOAD WAV TAPE");
             return 0;
         }
@@ -6185,12 +9357,6 @@ static int tape_manager_load_path(const char* path) {
             tape_manager_set_status("FAILED TO LOAD TAPE IMAGE");
             return 0;
         }
-        if (!tape_generate_waveform_from_image(&new_state.image, &new_state.waveform)) {
-            tape_free_image(&new_state.image);
-            tape_waveform_reset(&new_state.waveform);
-            tape_manager_set_status("FAILED TO PREPARE TAPE AUDIO");
-            return 0;
-        }
         new_state.use_waveform_playback = 1;
     }
 
@@ -6200,6 +9366,7 @@ static int tape_manager_load_path(const char* path) {
     tape_recorder_stop_session(total_t_states, 1);
     tape_free_image(&tape_playback.image);
     tape_waveform_reset(&tape_playback.waveform);
+    tape_wav_stream_close(&tape_playback.wav_stream);
 
     tape_playback = new_state;
     tape_input_format = format;
@@ -6214,11 +9381,14 @@ static int tape_manager_load_path(const char* path) {
     if (format == TAPE_FORMAT_WAV) {
         tape_input_enabled = 1;
         tape_wav_shared_position_tstates = 0;
-        printf("Loaded WAV tape %s (%zu transitions @ %u Hz)\n",
+        printf("Loaded WAV tape %s (%.1f s @ %u Hz, streamed)\n",
                tape_input_path,
-               tape_playback.waveform.count,
+               tape_playback.wav_stream.frame_bytes
+                   ? (double)(tape_playback.wav_stream.data_bytes / tape_playback.wav_stream.frame_bytes) /
+                         (double)tape_playback.waveform.sample_rate
+                   : 0.0,
                (unsigned)tape_playback.waveform.sample_rate);
-        if (tape_playback.waveform.count == 0) {
+        if (tape_playback.wav_stream.pulses == 0) {
             fprintf(stderr, "Warning: WAV tape '%s' contains no transitions\n", tape_input_path);
         }
     } else {
@@ -6430,6 +9600,15 @@ layout_retry:
             shortcuts_width = shortcuts_line_widths[shortcuts_line_count];
         }
         shortcuts_line_count++;
+
+        shortcuts_lines[shortcuts_line_count] =
+            "Q PREVIOUS BLOCK  F NEXT BLOCK";
+        shortcuts_line_widths[shortcuts_line_count] =
+            tape_overlay_text_width(shortcuts_lines[shortcuts_line_count], scale, spacing);
+        if (shortcuts_line_widths[shortcuts_line_count] > shortcuts_width) {
+            shortcuts_width = shortcuts_line_widths[shortcuts_line_count];
+        }
+        shortcuts_line_count++;
     } else if (tape_manager_mode == TAPE_MANAGER_MODE_FILE_BROWSER) {
         shortcuts_lines[shortcuts_line_count] =
             "ARROWS MOVE  RETURN OPEN/LOAD  BACKSPACE UP";
@@ -6876,10 +10055,8 @@ static void tape_update(uint64_t current_t_state) {
         return;
     }
 
-    int use_waveform = (state->format == TAPE_FORMAT_WAV) ||
-                       (state->use_waveform_playback && state->waveform.count > 0);
-    if (use_waveform) {
-        while (state->playing && state->waveform_index < state->waveform.count &&
+    if (tape_playback_uses_edges(state)) {
+        while (state->playing && tape_playback_has_pulse(state) &&
                current_t_state >= state->next_transition_tstate) {
             uint64_t transition_time = state->next_transition_tstate;
             if (transition_time < state->last_transition_tstate) {
@@ -6889,11 +10066,9 @@ static void tape_update(uint64_t current_t_state) {
             tape_ear_state = state->level;
             speaker_tape_playback_level = tape_ear_state;
             speaker_update_output(transition_time, 1);
-            state->waveform_index++;
             state->last_transition_tstate = transition_time;
-            if (state->waveform_index < state->waveform.count) {
-                uint64_t duration = (uint64_t)state->waveform.pulses[state->waveform_index].duration;
-                state->next_transition_tstate = transition_time + duration;
+            if (tape_playback_next_pulse(state)) {
+                state->next_transition_tstate = transition_time + tape_playback_pulse_duration(state);
             } else {
                 state->playing = 0;
                 tape_playback_accumulate_elapsed(state, transition_time);
@@ -7077,31 +10252,22 @@ static void tape_update(uint64_t current_t_state) {
 }
 
 static void tape_recorder_reset_pulses(void) {
-    if (tape_recorder.pulses) {
-        free(tape_recorder.pulses);
-        tape_recorder.pulses = NULL;
-    }
-    tape_recorder.pulse_count = 0;
-    tape_recorder.pulse_capacity = 0;
+    tape_waveform_reset(&tape_recorder.pulses);
 }
 
+// Closes the session's output file as it stands; a finished session goes
+// through tape_recorder_write_wav() first so the header is up to date.
 static void tape_recorder_reset_audio(void) {
-    if (tape_recorder.audio_samples) {
-        free(tape_recorder.audio_samples);
-        tape_recorder.audio_samples = NULL;
-    }
-    tape_recorder.audio_sample_count = 0;
-    tape_recorder.audio_sample_capacity = 0;
-}
-
-static void tape_recorder_reset_wav_prefix(void) {
-    if (tape_recorder.wav_prefix_samples) {
-        free(tape_recorder.wav_prefix_samples);
-        tape_recorder.wav_prefix_samples = NULL;
-    }
-    tape_recorder.wav_prefix_sample_count = 0;
-    tape_recorder.wav_existing_samples = 0;
-    tape_recorder.wav_head_samples = 0;
+    if (tape_recorder.wav_file) {
+        fclose(tape_recorder.wav_file);
+        tape_recorder.wav_file = NULL;
+    }
+    free(tape_recorder.wav_buffer);
+    tape_recorder.wav_buffer = NULL;
+    tape_recorder.wav_buffered = 0;
+    tape_recorder.wav_bytes_per_sample = 0;
+    tape_recorder.wav_data_chunk_offset = 0;
+    tape_recorder.wav_data_bytes = 0;
     tape_recorder.wav_requires_truncate = 0;
 }
 
@@ -7274,10 +10440,6 @@ static int tape_recorder_prepare_append_wav(uint32_t* data_chunk_offset,
 }
 
 static int tape_recorder_prepare_wav_session(uint64_t head_tstates) {
-    tape_recorder.wav_existing_samples = 0;
-    tape_recorder.wav_head_samples = 0;
-    tape_recorder.wav_requires_truncate = 0;
-
     if (!tape_recorder.output_path) {
         return 0;
     }
@@ -7300,7 +10462,10 @@ static int tape_recorder_prepare_wav_session(uint64_t head_tstates) {
             sample_rate = 44100u;
         }
         tape_recorder.sample_rate = sample_rate;
-        return 1;
+        if (!tape_create_blank_wav(tape_recorder.output_path, sample_rate)) {
+            return 0;
+        }
+        return tape_recorder_open_wav(36u, (uint16_t)sizeof(int16_t), 0u);
     }
 
     uint8_t riff_header[12];
@@ -7422,12 +10587,15 @@ static int tape_recorder_prepare_wav_session(uint64_t head_tstates) {
         return 0;
     }
 
-    uint16_t bytes_per_sample = (uint16_t)(bits_per_sample / 8u);
-    if (bytes_per_sample == 0u) {
+    if (bits_per_sample != 8u && bits_per_sample != 16u) {
+        fprintf(stderr,
+                "Tape RECORD failed: '%s' must be 8-bit or 16-bit\n",
+                tape_recorder.output_path);
         fclose(wf);
         return 0;
     }
 
+    uint16_t bytes_per_sample = (uint16_t)(bits_per_sample / 8u);
     if (data_size % bytes_per_sample != 0u) {
         fprintf(stderr,
                 "Tape RECORD failed: '%s' contains incomplete samples\n",
@@ -7436,76 +10604,21 @@ static int tape_recorder_prepare_wav_session(uint64_t head_tstates) {
         return 0;
     }
 
-    uint64_t existing_samples = data_size / bytes_per_sample;
-    tape_recorder.wav_existing_samples = existing_samples;
+    fclose(wf);
 
+    uint64_t existing_samples = data_size / bytes_per_sample;
     tape_recorder.sample_rate = sample_rate ? sample_rate : tape_recorder.sample_rate;
     if (tape_recorder.sample_rate == 0u) {
         tape_recorder.sample_rate = 44100u;
     }
 
-    uint64_t requested_samples = tape_recorder_samples_from_tstates(head_tstates);
-    if (requested_samples > existing_samples) {
-        requested_samples = existing_samples;
-    }
-
-    tape_recorder.wav_head_samples = requested_samples;
-    tape_recorder.wav_prefix_sample_count = (size_t)requested_samples;
-    tape_recorder.wav_requires_truncate = (requested_samples < existing_samples);
-
-    if (tape_recorder.wav_prefix_sample_count > 0) {
-        if (fseek(wf, (long)data_offset + 8l, SEEK_SET) != 0) {
-            fclose(wf);
-            return 0;
-        }
-
-        size_t prefix_samples = tape_recorder.wav_prefix_sample_count;
-        size_t prefix_bytes = prefix_samples * sizeof(int16_t);
-        tape_recorder.wav_prefix_samples = (int16_t*)malloc(prefix_bytes);
-        if (!tape_recorder.wav_prefix_samples) {
-            fprintf(stderr, "Tape RECORD failed: out of memory\n");
-            fclose(wf);
-            return 0;
-        }
-
-        if (bytes_per_sample == sizeof(int16_t)) {
-            if (fread(tape_recorder.wav_prefix_samples, sizeof(int16_t), prefix_samples, wf) != prefix_samples) {
-                fprintf(stderr, "Tape RECORD failed: unable to read WAV data\n");
-                free(tape_recorder.wav_prefix_samples);
-                tape_recorder.wav_prefix_samples = NULL;
-                tape_recorder.wav_prefix_sample_count = 0;
-                fclose(wf);
-                return 0;
-            }
-        } else {
-            uint8_t* temp = (uint8_t*)malloc(prefix_samples);
-            if (!temp) {
-                fprintf(stderr, "Tape RECORD failed: out of memory\n");
-                free(tape_recorder.wav_prefix_samples);
-                tape_recorder.wav_prefix_samples = NULL;
-                tape_recorder.wav_prefix_sample_count = 0;
-                fclose(wf);
-                return 0;
-            }
-            if (fread(temp, 1, prefix_samples, wf) != prefix_samples) {
-                fprintf(stderr, "Tape RECORD failed: unable to read WAV data\n");
-                free(temp);
-                free(tape_recorder.wav_prefix_samples);
-                tape_recorder.wav_prefix_samples = NULL;
-                tape_recorder.wav_prefix_sample_count = 0;
-                fclose(wf);
-                return 0;
-            }
-            for (size_t i = 0; i < prefix_samples; ++i) {
-                int16_t converted = (int16_t)(((int32_t)temp[i] - 128) << 8);
-                tape_recorder.wav_prefix_samples[i] = converted;
-            }
-            free(temp);
-        }
+    // Recording overwrites from the head onwards in the file's own format;
+    // whatever followed is cut off when the session is saved.
+    uint64_t head_samples = tape_recorder_samples_from_tstates(head_tstates);
+    if (head_samples > existing_samples) {
+        head_samples = existing_samples;
     }
-
-    fclose(wf);
-    return 1;
+    return tape_recorder_open_wav(data_offset, bytes_per_sample, head_samples * bytes_per_sample);
 }
 
 static void tape_recorder_enable(const char* path, TapeOutputFormat format) {
@@ -7522,12 +10635,9 @@ static void tape_recorder_enable(const char* path, TapeOutputFormat format) {
     tape_recorder.position_tstates = 0;
     tape_recorder.position_start_tstate = 0;
     tape_recorder.append_mode = 0;
-    tape_recorder.append_data_chunk_offset = 0;
-    tape_recorder.append_existing_data_bytes = 0;
     tape_recorder_reset_pulses();
     tape_free_image(&tape_recorder.recorded);
     tape_recorder_reset_audio();
-    tape_recorder_reset_wav_prefix();
     tape_recorder.idle_start_tstate = 0;
 }
 
@@ -7546,7 +10656,6 @@ static int tape_recorder_start_session(uint64_t current_t_state, int append_mode
     tape_recorder_reset_pulses();
     tape_free_image(&tape_recorder.recorded);
     tape_recorder_reset_audio();
-    tape_recorder_reset_wav_prefix();
     tape_recorder.session_dirty = 0;
     tape_recorder.append_mode = use_append;
 
@@ -7560,15 +10669,15 @@ static int tape_recorder_start_session(uint64_t current_t_state, int append_mode
                 tape_recorder.append_mode = 0;
                 return 0;
             }
-            tape_recorder.append_data_chunk_offset = data_offset;
-            tape_recorder.append_existing_data_bytes = existing_bytes;
             tape_recorder.sample_rate = sample_rate;
+            if (!tape_recorder_open_wav(data_offset, (uint16_t)sizeof(int16_t), existing_bytes)) {
+                tape_recorder.append_mode = 0;
+                return 0;
+            }
             uint64_t existing_samples = existing_bytes / sizeof(int16_t);
             tape_recorder.position_tstates = tape_recorder_tstates_from_samples(existing_samples);
             tape_wav_shared_position_tstates = tape_recorder.position_tstates;
         } else {
-            tape_recorder.append_data_chunk_offset = 0;
-            tape_recorder.append_existing_data_bytes = 0;
             if (head_tstates == 0 && tape_recorder.position_tstates > 0) {
                 head_tstates = tape_recorder.position_tstates;
                 tape_wav_shared_position_tstates = head_tstates;
@@ -7586,8 +10695,6 @@ static int tape_recorder_start_session(uint64_t current_t_state, int append_mode
             printf("Tape RECORD append is only supported for WAV outputs; starting new capture\n");
             tape_recorder.append_mode = 0;
         }
-        tape_recorder.append_data_chunk_offset = 0;
-        tape_recorder.append_existing_data_bytes = 0;
         tape_recorder.position_tstates = 0;
         if (tape_recorder.output_path) {
             (void)remove(tape_recorder.output_path);
@@ -7627,6 +10734,13 @@ static void tape_recorder_stop_session(uint64_t current_t_state, int finalize_ou
     speaker_update_output(current_t_state, 1);
 
     if (finalize_output && tape_recorder.session_dirty) {
+        if (tape_recorder.output_format == TAPE_OUTPUT_WAV && tape_input_format == TAPE_FORMAT_WAV &&
+            tape_input_path && tape_recorder.output_path &&
+            strcmp(tape_input_path, tape_recorder.output_path) == 0) {
+            // The recording rewrites the file the tape streams from; it is
+            // reopened below.
+            tape_wav_stream_close(&tape_playback.wav_stream);
+        }
         if (!tape_recorder_write_output()) {
             fprintf(stderr, "Failed to save tape recording\n");
         }
@@ -7640,6 +10754,7 @@ static void tape_recorder_stop_session(uint64_t current_t_state, int finalize_ou
             strcmp(tape_input_path, tape_recorder.output_path) == 0) {
             if (!tape_load_wav(tape_input_path, &tape_playback)) {
                 tape_waveform_reset(&tape_playback.waveform);
+                tape_wav_stream_close(&tape_playback.wav_stream);
                 tape_input_enabled = 0;
             } else {
                 tape_reset_playback(&tape_playback);
@@ -7648,27 +10763,16 @@ static void tape_recorder_stop_session(uint64_t current_t_state, int finalize_ou
         }
     }
 
-    tape_recorder_reset_wav_prefix();
+    tape_recorder_reset_audio();
 }
 
 static int tape_recorder_append_pulse(uint64_t duration) {
     if (duration == 0) {
         return 1;
     }
-    if (duration > UINT32_MAX) {
-        duration = UINT32_MAX;
-    }
-    if (tape_recorder.pulse_count == tape_recorder.pulse_capacity) {
-        size_t new_capacity = tape_recorder.pulse_capacity ? tape_recorder.pulse_capacity * 2 : 512;
-        TapePulse* new_pulses = (TapePulse*)realloc(tape_recorder.pulses, new_capacity * sizeof(TapePulse));
-        if (!new_pulses) {
-            return 0;
-        }
-        tape_recorder.pulses = new_pulses;
-        tape_recorder.pulse_capacity = new_capacity;
+    if (!tape_waveform_add_pulse(&tape_recorder.pulses, duration)) {
+        return 0;
     }
-    tape_recorder.pulses[tape_recorder.pulse_count].duration = (uint32_t)duration;
-    tape_recorder.pulse_count++;
     tape_recorder.session_dirty = 1;
     return 1;
 }
@@ -7720,445 +10824,419 @@ static int tape_recorder_append_audio_samples(int level, size_t sample_count) {
     if (sample_count == 0) {
         return 1;
     }
-    if (tape_recorder.audio_sample_count > SIZE_MAX - sample_count) {
-        return 0;
-    }
-    size_t required = tape_recorder.audio_sample_count + sample_count;
-    if (required > tape_recorder.audio_sample_capacity) {
-        size_t new_capacity = tape_recorder.audio_sample_capacity ? tape_recorder.audio_sample_capacity : 4096;
-        while (new_capacity < required) {
-            new_capacity *= 2;
-        }
-        int16_t* new_samples = (int16_t*)realloc(tape_recorder.audio_samples, new_capacity * sizeof(int16_t));
-        if (!new_samples) {
-            return 0;
-        }
-        tape_recorder.audio_samples = new_samples;
-        tape_recorder.audio_sample_capacity = new_capacity;
-    }
-
-    int16_t value = level ? TAPE_WAV_AMPLITUDE : (int16_t)(-TAPE_WAV_AMPLITUDE);
-    int16_t* dest = tape_recorder.audio_samples + tape_recorder.audio_sample_count;
-    for (size_t i = 0; i < sample_count; ++i) {
-        dest[i] = value;
-    }
-    tape_recorder.audio_sample_count += sample_count;
-    if (sample_count > 0) {
-        tape_recorder.session_dirty = 1;
-    }
-    return 1;
-}
-
-static void tape_recorder_append_block_audio(uint64_t idle_cycles) {
-    if (tape_recorder.output_format != TAPE_OUTPUT_WAV) {
-        return;
-    }
-
-    if (tape_recorder.pulse_count == 0) {
-        if (idle_cycles > 0 && tape_recorder.last_level >= 0) {
-            size_t idle_samples = tape_recorder_samples_from_tstates(idle_cycles);
-            if (!tape_recorder_append_audio_samples(tape_recorder.last_level ? 1 : 0, idle_samples)) {
-                fprintf(stderr, "Warning: failed to store recorded tape audio\n");
-            }
-        }
-        return;
-    }
-
-    int level = tape_recorder.block_start_level ? 1 : 0;
-    for (size_t i = 0; i < tape_recorder.pulse_count; ++i) {
-        uint32_t duration = tape_recorder.pulses[i].duration;
-        size_t samples = tape_recorder_samples_from_tstates(duration);
-        if (!tape_recorder_append_audio_samples(level, samples)) {
-            fprintf(stderr, "Warning: failed to store recorded tape audio\n");
-            return;
-        }
-        level = level ? 0 : 1;
-    }
-
-    if (idle_cycles > 0 && tape_recorder.last_level >= 0) {
-        size_t idle_samples = tape_recorder_samples_from_tstates(idle_cycles);
-        if (!tape_recorder_append_audio_samples(tape_recorder.last_level ? 1 : 0, idle_samples)) {
-            fprintf(stderr, "Warning: failed to store recorded tape audio\n");
-        }
-    }
-}
-
-static int tape_recorder_write_wav(void) {
-    if (!tape_recorder.output_path) {
-        return 1;
-    }
-
-    uint32_t sample_rate = tape_recorder.sample_rate ? tape_recorder.sample_rate : 44100u;
-    size_t sample_count = tape_recorder.audio_sample_count;
-    size_t prefix_samples = tape_recorder.wav_prefix_sample_count;
-    if (tape_recorder.append_mode) {
-        if (sample_count == 0) {
-            tape_recorder.session_dirty = 0;
-            return 1;
-        }
-
-        uint64_t append_bytes = (uint64_t)sample_count * sizeof(int16_t);
-        if (append_bytes > UINT32_MAX) {
-            fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
-            return 0;
-        }
-
-        uint32_t data_offset = tape_recorder.append_data_chunk_offset;
-        uint32_t existing_bytes = tape_recorder.append_existing_data_bytes;
-        uint64_t total_bytes = (uint64_t)existing_bytes + append_bytes;
-        if (total_bytes > UINT32_MAX) {
-            fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
-            return 0;
-        }
-
-        FILE* tf = fopen(tape_recorder.output_path, "rb+");
-        if (!tf) {
-            fprintf(stderr,
-                    "Failed to open tape output '%s': %s\n",
-                    tape_recorder.output_path,
-                    strerror(errno));
-            return 0;
-        }
-
-        if (fseek(tf, 0, SEEK_END) != 0) {
-            fclose(tf);
-            return 0;
-        }
-
-        if (sample_count > 0) {
-            if (fwrite(tape_recorder.audio_samples, sizeof(int16_t), sample_count, tf) != sample_count) {
-                fprintf(stderr, "Failed to append WAV data\n");
-                fclose(tf);
-                return 0;
-            }
-        }
-
-        long final_pos = ftell(tf);
-        if (final_pos < 0) {
-            fclose(tf);
-            return 0;
-        }
-
-        uint64_t chunk_size_64 = (uint64_t)final_pos - 8u;
-        if (chunk_size_64 > UINT32_MAX) {
-            fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
-            fclose(tf);
-            return 0;
-        }
-        uint32_t chunk_size = (uint32_t)chunk_size_64;
-        uint32_t data_bytes = (uint32_t)total_bytes;
+    if (!tape_recorder.wav_buffer) {
+        return 0;
+    }
 
-        if (fseek(tf, 4, SEEK_SET) != 0) {
-            fclose(tf);
+    int16_t value = level ? TAPE_WAV_AMPLITUDE : (int16_t)(-TAPE_WAV_AMPLITUDE);
+    while (sample_count > 0) {
+        if (tape_recorder.wav_buffered == TAPE_RECORDER_WAV_BUFFER_SAMPLES && !tape_recorder_flush_wav()) {
             return 0;
         }
-        uint8_t chunk_size_bytes[4];
-        chunk_size_bytes[0] = (uint8_t)(chunk_size & 0xFFu);
-        chunk_size_bytes[1] = (uint8_t)((chunk_size >> 8) & 0xFFu);
-        chunk_size_bytes[2] = (uint8_t)((chunk_size >> 16) & 0xFFu);
-        chunk_size_bytes[3] = (uint8_t)((chunk_size >> 24) & 0xFFu);
-        if (fwrite(chunk_size_bytes, sizeof(chunk_size_bytes), 1, tf) != 1) {
-            fprintf(stderr, "Failed to update WAV header\n");
-            fclose(tf);
-            return 0;
+        size_t space = TAPE_RECORDER_WAV_BUFFER_SAMPLES - tape_recorder.wav_buffered;
+        size_t count = sample_count < space ? sample_count : space;
+        int16_t* dest = tape_recorder.wav_buffer + tape_recorder.wav_buffered;
+        for (size_t i = 0; i < count; ++i) {
+            dest[i] = value;
         }
+        tape_recorder.wav_buffered += count;
+        sample_count -= count;
+    }
+    tape_recorder.session_dirty = 1;
+    return 1;
+}
 
-        if (data_offset > (uint32_t)LONG_MAX - 4u) {
-            fclose(tf);
-            return 0;
-        }
-        long data_size_pos = (long)data_offset + 4l;
-        if (data_size_pos < 0 || fseek(tf, data_size_pos, SEEK_SET) != 0) {
-            fclose(tf);
-            return 0;
+static void tape_recorder_append_block_audio(uint64_t idle_cycles) {
+    if (tape_recorder.output_format != TAPE_OUTPUT_WAV) {
+        return;
+    }
+
+    if (tape_recorder.pulses.count == 0) {
+        if (idle_cycles > 0 && tape_recorder.last_level >= 0) {
+            size_t idle_samples = tape_recorder_samples_from_tstates(idle_cycles);
+            if (!tape_recorder_append_audio_samples(tape_recorder.last_level ? 1 : 0, idle_samples)) {
+                fprintf(stderr, "Warning: failed to store recorded tape audio\n");
+            }
         }
-        uint8_t data_bytes_array[4];
-        data_bytes_array[0] = (uint8_t)(data_bytes & 0xFFu);
-        data_bytes_array[1] = (uint8_t)((data_bytes >> 8) & 0xFFu);
-        data_bytes_array[2] = (uint8_t)((data_bytes >> 16) & 0xFFu);
-        data_bytes_array[3] = (uint8_t)((data_bytes >> 24) & 0xFFu);
-        if (fwrite(data_bytes_array, sizeof(data_bytes_array), 1, tf) != 1) {
-            fprintf(stderr, "Failed to update WAV header\n");
-            fclose(tf);
-            return 0;
+        return;
+    }
+
+    int level = tape_recorder.block_start_level ? 1 : 0;
+    const TapeWaveform* pulses = &tape_recorder.pulses;
+    for (size_t r = 0; r < pulses->run_count; ++r) {
+        const TapePulseRun* run = &pulses->runs[r];
+        for (uint32_t i = 0; i < run->count; ++i) {
+            size_t samples = tape_recorder_samples_from_tstates(tape_waveform_run_duration(pulses, run, i));
+            if (!tape_recorder_append_audio_samples(level, samples)) {
+                fprintf(stderr, "Warning: failed to store recorded tape audio\n");
+                return;
+            }
+            level = level ? 0 : 1;
         }
+    }
 
-        if (fclose(tf) != 0) {
-            fprintf(stderr,
-                    "Failed to finalize tape output '%s': %s\n",
-                    tape_recorder.output_path,
-                    strerror(errno));
-            return 0;
+    if (idle_cycles > 0 && tape_recorder.last_level >= 0) {
+        size_t idle_samples = tape_recorder_samples_from_tstates(idle_cycles);
+        if (!tape_recorder_append_audio_samples(tape_recorder.last_level ? 1 : 0, idle_samples)) {
+            fprintf(stderr, "Warning: failed to store recorded tape audio\n");
         }
+    }
+}
 
-        tape_recorder.append_existing_data_bytes = data_bytes;
-        tape_recorder.session_dirty = 0;
-        printf("Tape recording saved to %s\n", tape_recorder.output_path);
-        return 1;
+// Opens the output for in-place writing `start_bytes` into the data chunk
+// whose header is at `data_chunk_offset`. Anything already past that point
+// is cut off when the session is saved.
+static int tape_recorder_open_wav(uint32_t data_chunk_offset, uint16_t bytes_per_sample, uint64_t start_bytes) {
+    uint64_t start = (uint64_t)data_chunk_offset + 8u + start_bytes;
+    if (start > (uint64_t)LONG_MAX) {
+        return 0;
     }
 
-    uint64_t total_samples = (uint64_t)prefix_samples + (uint64_t)sample_count;
-    uint64_t data_bytes_64 = total_samples * sizeof(int16_t);
-    if (data_bytes_64 > UINT32_MAX) {
-        fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
+    FILE* wf = fopen(tape_recorder.output_path, "rb+");
+    if (!wf) {
+        fprintf(stderr,
+                "Tape RECORD failed: unable to open '%s': %s\n",
+                tape_recorder.output_path,
+                strerror(errno));
         return 0;
     }
-    uint32_t data_bytes = (uint32_t)data_bytes_64;
-    uint32_t chunk_size = 36u + data_bytes;
-    if (chunk_size < data_bytes) {
-        fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
+
+    long file_end = -1;
+    if (fseek(wf, 0, SEEK_END) == 0) {
+        file_end = ftell(wf);
+    }
+    if (file_end < 0 || fseek(wf, (long)start, SEEK_SET) != 0) {
+        fprintf(stderr, "Tape RECORD failed: unable to seek in '%s'\n", tape_recorder.output_path);
+        fclose(wf);
         return 0;
     }
 
-    FILE* tf = fopen(tape_recorder.output_path, "wb");
-    if (!tf) {
-        fprintf(stderr, "Failed to open tape output '%s': %s\n", tape_recorder.output_path, strerror(errno));
+    int16_t* buffer = (int16_t*)malloc(TAPE_RECORDER_WAV_BUFFER_SAMPLES * sizeof(int16_t));
+    if (!buffer) {
+        fprintf(stderr, "Tape RECORD failed: out of memory\n");
+        fclose(wf);
         return 0;
     }
 
-    uint8_t header[44];
-    memset(header, 0, sizeof(header));
-    memcpy(header + 0, "RIFF", 4);
-    header[4] = (uint8_t)(chunk_size & 0xFFu);
-    header[5] = (uint8_t)((chunk_size >> 8) & 0xFFu);
-    header[6] = (uint8_t)((chunk_size >> 16) & 0xFFu);
-    header[7] = (uint8_t)((chunk_size >> 24) & 0xFFu);
-    memcpy(header + 8, "WAVE", 4);
-    memcpy(header + 12, "fmt ", 4);
-    header[16] = 16;
-    header[20] = 1;
-    header[22] = 1;
-    header[24] = (uint8_t)(sample_rate & 0xFFu);
-    header[25] = (uint8_t)((sample_rate >> 8) & 0xFFu);
-    header[26] = (uint8_t)((sample_rate >> 16) & 0xFFu);
-    header[27] = (uint8_t)((sample_rate >> 24) & 0xFFu);
-    uint32_t byte_rate = sample_rate * 2u;
-    header[28] = (uint8_t)(byte_rate & 0xFFu);
-    header[29] = (uint8_t)((byte_rate >> 8) & 0xFFu);
-    header[30] = (uint8_t)((byte_rate >> 16) & 0xFFu);
-    header[31] = (uint8_t)((byte_rate >> 24) & 0xFFu);
-    header[32] = 2;
-    header[34] = 16;
-    memcpy(header + 36, "data", 4);
-    header[40] = (uint8_t)(data_bytes & 0xFFu);
-    header[41] = (uint8_t)((data_bytes >> 8) & 0xFFu);
-    header[42] = (uint8_t)((data_bytes >> 16) & 0xFFu);
-    header[43] = (uint8_t)((data_bytes >> 24) & 0xFFu);
+    tape_recorder_reset_audio();
+    tape_recorder.wav_file = wf;
+    tape_recorder.wav_buffer = buffer;
+    tape_recorder.wav_bytes_per_sample = bytes_per_sample;
+    tape_recorder.wav_data_chunk_offset = data_chunk_offset;
+    tape_recorder.wav_data_bytes = start_bytes;
+    tape_recorder.wav_requires_truncate = (uint64_t)file_end > start;
+    return 1;
+}
 
-    if (fwrite(header, sizeof(header), 1, tf) != 1) {
-        fprintf(stderr, "Failed to write WAV header\n");
-        fclose(tf);
+// Writes the buffered samples out and brings the RIFF and data sizes up to
+// date, so the file stays playable if the session is never stopped cleanly.
+static int tape_recorder_flush_wav(void) {
+    FILE* wf = tape_recorder.wav_file;
+    if (!wf) {
         return 0;
     }
 
-    if (prefix_samples > 0) {
-        if (!tape_recorder.wav_prefix_samples) {
-            fprintf(stderr, "Failed to access recorded WAV prefix data\n");
-            fclose(tf);
-            return 0;
+    size_t count = tape_recorder.wav_buffered;
+    uint64_t data_bytes = tape_recorder.wav_data_bytes + (uint64_t)count * tape_recorder.wav_bytes_per_sample;
+    uint64_t data_end = (uint64_t)tape_recorder.wav_data_chunk_offset + 8u + data_bytes;
+    if (data_end > UINT32_MAX || data_end > (uint64_t)LONG_MAX) {
+        fprintf(stderr, "Recorded audio exceeds WAV size limits\n");
+        return 0;
+    }
+
+    size_t written = 0;
+    if (tape_recorder.wav_bytes_per_sample == sizeof(int16_t)) {
+        written = fwrite(tape_recorder.wav_buffer, sizeof(int16_t), count, wf);
+    } else {
+        uint8_t bytes[256];
+        while (written < count) {
+            size_t chunk = count - written < sizeof(bytes) ? count - written : sizeof(bytes);
+            for (size_t i = 0; i < chunk; ++i) {
+                bytes[i] = (uint8_t)((tape_recorder.wav_buffer[written + i] >> 8) + 128);
+            }
+            if (fwrite(bytes, 1, chunk, wf) != chunk) {
+                break;
+            }
+            written += chunk;
         }
-        if (fwrite(tape_recorder.wav_prefix_samples, sizeof(int16_t), prefix_samples, tf) != prefix_samples) {
-            fprintf(stderr, "Failed to write WAV data\n");
-            fclose(tf);
+    }
+    if (written != count) {
+        fprintf(stderr, "Failed to write WAV data\n");
+        return 0;
+    }
+    tape_recorder.wav_data_bytes = data_bytes;
+    tape_recorder.wav_buffered = 0;
+
+    uint32_t sizes[2] = {(uint32_t)(data_end - 8u), (uint32_t)data_bytes};
+    long positions[2] = {4l, (long)tape_recorder.wav_data_chunk_offset + 4l};
+    for (int i = 0; i < 2; ++i) {
+        uint8_t size_bytes[4];
+        size_bytes[0] = (uint8_t)(sizes[i] & 0xFFu);
+        size_bytes[1] = (uint8_t)((sizes[i] >> 8) & 0xFFu);
+        size_bytes[2] = (uint8_t)((sizes[i] >> 16) & 0xFFu);
+        size_bytes[3] = (uint8_t)((sizes[i] >> 24) & 0xFFu);
+        if (fseek(wf, positions[i], SEEK_SET) != 0 || fwrite(size_bytes, sizeof(size_bytes), 1, wf) != 1) {
+            fprintf(stderr, "Failed to update WAV header\n");
             return 0;
         }
     }
+    // fflush only hands the data to the OS; sync it so a power cut mid
+    // session still leaves the file on disk.
+    if (fseek(wf, (long)data_end, SEEK_SET) != 0 || fflush(wf) != 0 || TAPE_SYNC(wf) != 0) {
+        fprintf(stderr, "Failed to update WAV header\n");
+        return 0;
+    }
+    return 1;
+}
 
-    if (sample_count > 0) {
-        if (fwrite(tape_recorder.audio_samples, sizeof(int16_t), sample_count, tf) != sample_count) {
-            fprintf(stderr, "Failed to write WAV data\n");
-            fclose(tf);
+static int tape_recorder_write_wav(void) {
+    if (!tape_recorder.output_path) {
+        return 1;
+    }
+    if (!tape_recorder.wav_file) {
+        fprintf(stderr, "Tape output '%s' is not open\n", tape_recorder.output_path);
+        return 0;
+    }
+    if (!tape_recorder_flush_wav()) {
+        return 0;
+    }
+
+    FILE* tf = tape_recorder.wav_file;
+    if (tape_recorder.wav_requires_truncate) {
+        uint64_t data_end = (uint64_t)tape_recorder.wav_data_chunk_offset + 8u + tape_recorder.wav_data_bytes;
+        if (TAPE_TRUNCATE(tf, data_end) != 0) {
+            fprintf(stderr,
+                    "Failed to truncate tape output '%s': %s\n",
+                    tape_recorder.output_path,
+                    strerror(errno));
             return 0;
         }
+        tape_recorder.wav_requires_truncate = 0;
     }
 
+    tape_recorder.wav_file = NULL;
     if (fclose(tf) != 0) {
         fprintf(stderr, "Failed to finalize tape output '%s': %s\n", tape_recorder.output_path, strerror(errno));
         return 0;
     }
 
     tape_recorder.session_dirty = 0;
-    tape_recorder.wav_prefix_sample_count = prefix_samples + sample_count;
-    tape_recorder.wav_existing_samples = tape_recorder.wav_prefix_sample_count;
-    tape_recorder.wav_head_samples = tape_recorder.wav_existing_samples;
     printf("Tape recording saved to %s\n", tape_recorder.output_path);
-
     return 1;
 }
 
-static int tape_decode_pulses_to_block(const TapePulse* pulses, size_t count, uint32_t pause_ms, TapeBlock* out_block) {
-    if (!pulses || count == 0 || !out_block) {
+#define TAPE_DECODE_HISTOGRAM_BUCKETS 256u
+#define TAPE_DECODE_BUCKET_TSTATES 32u
+#define TAPE_DECODE_MIN_PILOT_PULSES 256u
+#define TAPE_DECODE_MAX_LEAD_IN 16u
+#define TAPE_DECODE_MIN_DATA_PULSES 16u
+
+static uint16_t tape_decode_clamp_duration(uint64_t duration) {
+    return duration > 0xFFFFu ? (uint16_t)0xFFFFu : (uint16_t)duration;
+}
+
+// Turns one recorded block back into bytes without assuming ROM timings.
+// The pilot is the leading stretch of near-equal pulses, and it must be
+// followed by two shorter sync pulses; without one the block is pure data.
+// The data pulses are histogrammed and split into bit-0 and bit-1 at the
+// threshold that best separates the two clusters (Otsu's method), then each
+// bit is judged on its pulse pair's sum. The block comes out as a standard
+// one when every class is within tolerance of the ROM's timings, and as a
+// turbo (TZX 0x11) or pure-data (0x14) block with the measured timings
+// otherwise. The pulses are read twice, once for the histogram and once to
+// decode, and never backtracked over.
+static int tape_decode_pulses_to_block(const TapeWaveform* pulses, uint32_t pause_ms, TapeBlock* out_block) {
+    if (!pulses || pulses->count == 0 || !out_block) {
         return 0;
     }
 
+    size_t count = pulses->count;
     size_t index = 0;
     size_t pilot_count = 0;
-    size_t search_index = 0;
-    size_t pilot_start = 0;
-    const int pilot_tolerance = tape_duration_tolerance(TAPE_PILOT_PULSE_TSTATES);
-    while (search_index < count) {
-        if (!tape_duration_matches(pulses[search_index].duration, TAPE_PILOT_PULSE_TSTATES, pilot_tolerance)) {
-            ++search_index;
-            continue;
-        }
-
-        size_t run_start = search_index;
-        while (search_index < count && tape_duration_matches(pulses[search_index].duration, TAPE_PILOT_PULSE_TSTATES, pilot_tolerance)) {
-            ++search_index;
-        }
-
-        pilot_count = search_index - run_start;
-        if (pilot_count >= 100) {
-            pilot_start = run_start;
-            index = search_index;
+    uint64_t pilot_sum = 0;
+    uint32_t pilot_reference = 0;
+    int pilot_tolerance = 0;
+    TapeWaveformReader reader = {0, 0};
+    while (index < count) {
+        uint32_t duration = tape_waveform_reader_duration(pulses, &reader);
+        if (pilot_count > 0 && tape_duration_matches(duration, (int)pilot_reference, pilot_tolerance)) {
+            ++pilot_count;
+            pilot_sum += duration;
+        } else if (pilot_count >= TAPE_DECODE_MIN_PILOT_PULSES) {
+            break;
+        } else if (index < TAPE_DECODE_MAX_LEAD_IN) {
+            pilot_reference = duration;
+            pilot_tolerance = tape_duration_tolerance((int)duration);
+            pilot_count = 1;
+            pilot_sum = duration;
+        } else {
+            pilot_count = 0;
             break;
         }
+        tape_waveform_reader_next(pulses, &reader);
+        ++index;
     }
 
-    if (pilot_count < 100) {
-        return 0;
+    uint32_t pilot_average = 0;
+    uint32_t sync1_duration = 0;
+    uint32_t sync2_duration = 0;
+    if (pilot_count >= TAPE_DECODE_MIN_PILOT_PULSES && index + 2u < count) {
+        pilot_average = (uint32_t)(pilot_sum / pilot_count);
+        sync1_duration = tape_waveform_reader_duration(pulses, &reader);
+        tape_waveform_reader_next(pulses, &reader);
+        sync2_duration = tape_waveform_reader_duration(pulses, &reader);
+        tape_waveform_reader_next(pulses, &reader);
+        index += 2u;
+        if ((uint64_t)sync1_duration * 4u >= (uint64_t)pilot_average * 3u ||
+            (uint64_t)sync2_duration * 4u >= (uint64_t)pilot_average * 3u) {
+            pilot_count = 0;
+        }
+    } else {
+        pilot_count = 0;
+    }
+    if (pilot_count == 0) {
+        // The streak was data after all.
+        pilot_average = 0;
+        index = 0;
+        reader.run = 0;
+        reader.offset = 0;
     }
 
-    if (index + 1 >= count) {
+    // An odd pulse at the end is the edge that closes the block.
+    size_t data_pulses = (count - index) & ~(size_t)1u;
+    if (data_pulses < TAPE_DECODE_MIN_DATA_PULSES) {
         return 0;
     }
 
-    double scale = 1.0;
-    if (pilot_count > 0) {
-        size_t sample_count = pilot_count;
-        if (sample_count > 4096) {
-            sample_count = 4096;
-        }
-        if (sample_count == 0) {
-            sample_count = 1;
+    const TapeWaveformReader data_reader = reader;
+    uint32_t histogram[TAPE_DECODE_HISTOGRAM_BUCKETS];
+    memset(histogram, 0, sizeof(histogram));
+    uint64_t weighted_total = 0;
+    for (size_t i = 0; i < data_pulses; ++i) {
+        uint32_t bucket = tape_waveform_reader_duration(pulses, &reader) / TAPE_DECODE_BUCKET_TSTATES;
+        if (bucket >= TAPE_DECODE_HISTOGRAM_BUCKETS) {
+            bucket = TAPE_DECODE_HISTOGRAM_BUCKETS - 1u;
+        }
+        ++histogram[bucket];
+        weighted_total += bucket;
+        tape_waveform_reader_next(pulses, &reader);
+    }
+
+    double best_separation = -1.0;
+    double short_mean = 0.0;
+    double long_mean = 0.0;
+    uint32_t threshold = 0;
+    uint64_t short_weight = 0;
+    uint64_t short_sum = 0;
+    for (uint32_t bucket = 0; bucket + 1u < TAPE_DECODE_HISTOGRAM_BUCKETS; ++bucket) {
+        short_weight += histogram[bucket];
+        short_sum += (uint64_t)bucket * histogram[bucket];
+        uint64_t long_weight = data_pulses - short_weight;
+        if (short_weight == 0) {
+            continue;
         }
-        uint64_t pilot_sum = 0;
-        for (size_t i = 0; i < sample_count; ++i) {
-            pilot_sum += pulses[pilot_start + i].duration;
+        if (long_weight == 0) {
+            break;
         }
-        double pilot_average = (double)pilot_sum / (double)sample_count;
-        if (pilot_average > 0.0) {
-            scale = pilot_average / (double)TAPE_PILOT_PULSE_TSTATES;
-            if (scale < 0.5) {
-                scale = 0.5;
-            } else if (scale > 2.0) {
-                scale = 2.0;
-            }
+        double mean0 = (double)short_sum / (double)short_weight + 0.5;
+        double mean1 = (double)(weighted_total - short_sum) / (double)long_weight + 0.5;
+        double separation = (double)short_weight * (double)long_weight * (mean1 - mean0) * (mean1 - mean0);
+        if (separation > best_separation) {
+            best_separation = separation;
+            short_mean = mean0;
+            long_mean = mean1;
+            threshold = (bucket + 1u) * TAPE_DECODE_BUCKET_TSTATES;
         }
     }
-
-    int sync1_reference = (int)((double)TAPE_SYNC_FIRST_PULSE_TSTATES * scale + 0.5);
-    int sync2_reference = (int)((double)TAPE_SYNC_SECOND_PULSE_TSTATES * scale + 0.5);
-    if (sync1_reference <= 0) {
-        sync1_reference = TAPE_SYNC_FIRST_PULSE_TSTATES;
-    }
-    if (sync2_reference <= 0) {
-        sync2_reference = TAPE_SYNC_SECOND_PULSE_TSTATES;
-    }
-
-    const int sync1_tolerance = tape_duration_tolerance(sync1_reference);
-    const int sync2_tolerance = tape_duration_tolerance(sync2_reference);
-    if (!tape_duration_matches(pulses[index].duration, sync1_reference, sync1_tolerance) ||
-        !tape_duration_matches(pulses[index + 1].duration, sync2_reference, sync2_tolerance)) {
-        return 0;
-    }
-
-    index += 2;
-
-    size_t data_limit = count;
-    while (data_limit > index && ((data_limit - index) % 2u) != 0u) {
-        --data_limit;
-    }
-
-    if (data_limit <= index) {
-        return 0;
-    }
-
-    const size_t bits_per_byte = 8u;
-    size_t bit_pairs = (data_limit - index) / 2u;
-    while (bit_pairs > 0 && (bit_pairs % bits_per_byte) != 0u) {
-        data_limit -= 2u;
-        bit_pairs = (data_limit - index) / 2u;
-    }
-
-    if (bit_pairs == 0 || (bit_pairs % bits_per_byte) != 0u) {
-        return 0;
+    if (best_separation < 0.0 || long_mean < short_mean * 1.4) {
+        // One cluster: every bit has the same value. Only the pilot can say
+        // which; the ROM's bit pulses sit at 0.39 and 0.79 of it.
+        if (pilot_average == 0) {
+            return 0;
+        }
+        threshold = (uint32_t)((uint64_t)pilot_average * 3u / 5u);
     }
 
-    size_t byte_count = bit_pairs / bits_per_byte;
-    uint8_t* data = (uint8_t*)malloc(byte_count ? byte_count : 1u);
+    size_t bit_count = data_pulses / 2u;
+    size_t byte_count = (bit_count + 7u) / 8u;
+    uint8_t* data = (uint8_t*)calloc(byte_count, 1u);
     if (!data) {
         return 0;
     }
-    memset(data, 0, byte_count ? byte_count : 1u);
-
-    int bit0_reference = (int)((double)TAPE_BIT0_PULSE_TSTATES * scale + 0.5);
-    int bit1_reference = (int)((double)TAPE_BIT1_PULSE_TSTATES * scale + 0.5);
-    if (bit0_reference <= 0) {
-        bit0_reference = TAPE_BIT0_PULSE_TSTATES;
-    }
-    if (bit1_reference <= 0) {
-        bit1_reference = TAPE_BIT1_PULSE_TSTATES;
+    uint64_t class_sums[2] = {0, 0};
+    size_t class_pairs[2] = {0, 0};
+    size_t mixed_pairs = 0;
+    reader = data_reader;
+    for (size_t bit = 0; bit < bit_count; ++bit) {
+        uint32_t d1 = tape_waveform_reader_duration(pulses, &reader);
+        tape_waveform_reader_next(pulses, &reader);
+        uint32_t d2 = tape_waveform_reader_duration(pulses, &reader);
+        tape_waveform_reader_next(pulses, &reader);
+        int is_one = (uint64_t)d1 + d2 >= (uint64_t)threshold * 2u;
+        mixed_pairs += (d1 >= threshold) != (d2 >= threshold);
+        class_sums[is_one] += (uint64_t)d1 + d2;
+        class_pairs[is_one]++;
+        if (is_one) {
+            data[bit >> 3] |= (uint8_t)(0x80u >> (bit & 7u));
+        }
+    }
+    if (mixed_pairs * 16u > bit_count) {
+        free(data);
+        return 0;
     }
 
-    const int bit0_tolerance = tape_duration_tolerance(bit0_reference);
-    const int bit1_tolerance = tape_duration_tolerance(bit1_reference);
-    const int bit0_pair_reference = bit0_reference * 2;
-    const int bit1_pair_reference = bit1_reference * 2;
-    const int bit0_pair_tolerance = tape_duration_tolerance(bit0_pair_reference);
-    const int bit1_pair_tolerance = tape_duration_tolerance(bit1_pair_reference);
-
-    for (size_t byte_index = 0; byte_index < byte_count; ++byte_index) {
-        uint8_t value = 0;
-        for (size_t bit = 0; bit < 8; ++bit) {
-            if (index >= data_limit) {
-                free(data);
-                return 0;
-            }
-            uint32_t d1 = pulses[index].duration;
-            uint32_t d2 = pulses[index + 1].duration;
-            index += 2;
-            int is_one = tape_duration_matches(d1, bit1_reference, bit1_tolerance) &&
-                         tape_duration_matches(d2, bit1_reference, bit1_tolerance);
-            int is_zero = tape_duration_matches(d1, bit0_reference, bit0_tolerance) &&
-                          tape_duration_matches(d2, bit0_reference, bit0_tolerance);
-            uint32_t pair_sum = d1 + d2;
-            if (!is_one && !is_zero) {
-                int sum_diff_one = abs((int)pair_sum - bit1_pair_reference);
-                int sum_diff_zero = abs((int)pair_sum - bit0_pair_reference);
-                if (sum_diff_one <= bit1_pair_tolerance && sum_diff_one < sum_diff_zero) {
-                    is_one = 1;
-                } else if (sum_diff_zero <= bit0_pair_tolerance) {
-                    is_zero = 1;
-                } else {
-                    int score_one = abs((int)d1 - bit1_reference) + abs((int)d2 - bit1_reference);
-                    int score_zero = abs((int)d1 - bit0_reference) + abs((int)d2 - bit0_reference);
-                    if (score_one < score_zero && score_one <= bit1_tolerance * 4) {
-                        is_one = 1;
-                    } else if (score_zero <= score_one && score_zero <= bit0_tolerance * 4) {
-                        is_zero = 1;
-                    } else {
-                        free(data);
-                        return 0;
-                    }
-                }
-            }
-            if (is_one) {
-                value |= (uint8_t)(1u << (7 - bit));
-            }
-        }
-
-        data[byte_index] = value;
-    }
+    uint32_t bit0 = class_pairs[0] ? (uint32_t)(class_sums[0] / (class_pairs[0] * 2u)) : 0u;
+    uint32_t bit1 = class_pairs[1] ? (uint32_t)(class_sums[1] / (class_pairs[1] * 2u)) : 0u;
+    if (bit0 == 0) {
+        bit0 = bit1 / 2u;
+    } else if (bit1 == 0) {
+        bit1 = bit0 * 2u;
+    }
+
+    int standard = pilot_count > 0 &&
+                   tape_duration_matches(pilot_average, TAPE_PILOT_PULSE_TSTATES,
+                                         tape_duration_tolerance(TAPE_PILOT_PULSE_TSTATES)) &&
+                   tape_duration_matches(sync1_duration, TAPE_SYNC_FIRST_PULSE_TSTATES,
+                                         tape_duration_tolerance(TAPE_SYNC_FIRST_PULSE_TSTATES)) &&
+                   tape_duration_matches(sync2_duration, TAPE_SYNC_SECOND_PULSE_TSTATES,
+                                         tape_duration_tolerance(TAPE_SYNC_SECOND_PULSE_TSTATES)) &&
+                   tape_duration_matches(bit0, TAPE_BIT0_PULSE_TSTATES,
+                                         tape_duration_tolerance(TAPE_BIT0_PULSE_TSTATES)) &&
+                   tape_duration_matches(bit1, TAPE_BIT1_PULSE_TSTATES,
+                                         tape_duration_tolerance(TAPE_BIT1_PULSE_TSTATES)) &&
+                   bit_count >= 8u;
+    uint8_t used_bits = (uint8_t)(bit_count % 8u ? bit_count % 8u : 8u);
 
     out_block->data = data;
     out_block->length = (uint32_t)byte_count;
     out_block->pause_ms = pause_ms;
+    out_block->used_bits_in_last_byte = used_bits;
+    out_block->pilot_pulse_count = (uint32_t)pilot_count;
+    if (standard) {
+        // Standard blocks carry whole bytes; stray trailing bits are noise.
+        out_block->type = TAPE_BLOCK_TYPE_STANDARD;
+        out_block->length = (uint32_t)(bit_count / 8u);
+        out_block->used_bits_in_last_byte = 8u;
+        out_block->pilot_pulse_tstates = (uint16_t)TAPE_PILOT_PULSE_TSTATES;
+        out_block->sync_first_pulse_tstates = (uint16_t)TAPE_SYNC_FIRST_PULSE_TSTATES;
+        out_block->sync_second_pulse_tstates = (uint16_t)TAPE_SYNC_SECOND_PULSE_TSTATES;
+        bit0 = (uint32_t)TAPE_BIT0_PULSE_TSTATES;
+        bit1 = (uint32_t)TAPE_BIT1_PULSE_TSTATES;
+    } else {
+        out_block->type = pilot_count > 0 ? TAPE_BLOCK_TYPE_TURBO : TAPE_BLOCK_TYPE_PURE_DATA;
+        out_block->pilot_pulse_tstates = tape_decode_clamp_duration(pilot_average);
+        out_block->sync_first_pulse_tstates = tape_decode_clamp_duration(sync1_duration);
+        out_block->sync_second_pulse_tstates = tape_decode_clamp_duration(sync2_duration);
+    }
+    out_block->bit0_first_pulse_tstates = tape_decode_clamp_duration(bit0);
+    out_block->bit0_second_pulse_tstates = out_block->bit0_first_pulse_tstates;
+    out_block->bit1_first_pulse_tstates = tape_decode_clamp_duration(bit1);
+    out_block->bit1_second_pulse_tstates = out_block->bit1_first_pulse_tstates;
     return 1;
 }
 
 static int tape_recorder_finalize_block(uint64_t current_t_state, int force_flush) {
-    if (!tape_recorder.block_active || tape_recorder.pulse_count == 0) {
+    if (!tape_recorder.block_active || tape_recorder.pulses.count == 0) {
         if (force_flush) {
             tape_recorder.block_active = 0;
             tape_recorder.idle_start_tstate = 0;
@@ -8186,13 +11264,42 @@ static int tape_recorder_finalize_block(uint64_t current_t_state, int force_flus
         }
     }
 
-    size_t pulse_count = tape_recorder.pulse_count;
-    if (tape_recorder.output_format == TAPE_OUTPUT_TAP && pulse_count >= 100) {
+    size_t pulse_count = tape_recorder.pulses.count;
+    if ((tape_recorder.output_format == TAPE_OUTPUT_TAP || tape_recorder.output_format == TAPE_OUTPUT_TZX) &&
+        pulse_count >= 100) {
         TapeBlock block = {TAPE_BLOCK_TYPE_STANDARD};
-        if (!tape_decode_pulses_to_block(tape_recorder.pulses, pulse_count, pause_ms, &block)) {
+        if (!tape_decode_pulses_to_block(&tape_recorder.pulses, pause_ms, &block)) {
             fprintf(stderr, "Warning: failed to decode saved tape block (%zu pulses)\n", pulse_count);
         } else {
-            if (!tape_image_add_block(&tape_recorder.recorded, block.data, block.length, block.pause_ms)) {
+            int stored = 0;
+            if (block.type == TAPE_BLOCK_TYPE_STANDARD) {
+                stored = tape_image_add_block(&tape_recorder.recorded, block.data, block.length, block.pause_ms);
+            } else if (block.type == TAPE_BLOCK_TYPE_TURBO) {
+                stored = tape_image_add_turbo_block(&tape_recorder.recorded,
+                                                    block.data,
+                                                    block.length,
+                                                    block.pause_ms,
+                                                    block.pilot_pulse_tstates,
+                                                    block.pilot_pulse_count,
+                                                    block.sync_first_pulse_tstates,
+                                                    block.sync_second_pulse_tstates,
+                                                    block.bit0_first_pulse_tstates,
+                                                    block.bit0_second_pulse_tstates,
+                                                    block.bit1_first_pulse_tstates,
+                                                    block.bit1_second_pulse_tstates,
+                                                    block.used_bits_in_last_byte);
+            } else {
+                stored = tape_image_add_pure_data_block(&tape_recorder.recorded,
+                                                        block.data,
+                                                        block.length,
+                                                        block.pause_ms,
+                                                        block.bit0_first_pulse_tstates,
+                                                        block.bit0_second_pulse_tstates,
+                                                        block.bit1_first_pulse_tstates,
+                                                        block.bit1_second_pulse_tstates,
+                                                        block.used_bits_in_last_byte);
+            }
+            if (!stored) {
                 fprintf(stderr, "Warning: failed to store recorded tape block\n");
             }
             free(block.data);
@@ -8202,7 +11309,7 @@ static int tape_recorder_finalize_block(uint64_t current_t_state, int force_flus
     tape_recorder_append_block_audio(idle_cycles);
 
     tape_recorder.block_active = 0;
-    tape_recorder.pulse_count = 0;
+    tape_waveform_clear(&tape_recorder.pulses);
     tape_recorder.last_transition_tstate = current_t_state;
     if (force_flush) {
         tape_recorder.idle_start_tstate = 0;
@@ -8266,6 +11373,60 @@ static void tape_recorder_update(uint64_t current_t_state, int force_flush) {
     }
 }
 
+// Writes one data block in TZX layout: standard blocks as 0x10, turbo as
+// 0x11 and pure data as 0x14. Each bit is written with its first pulse's
+// timing, as TZX has one duration per bit value.
+static int tape_write_tzx_block(FILE* tf, const TapeBlock* block) {
+    uint8_t bytes[19];
+    size_t size = 0;
+    uint32_t pause_ms = block->pause_ms > 0xFFFFu ? 0xFFFFu : block->pause_ms;
+    uint32_t length = block->length;
+    if (block->type == TAPE_BLOCK_TYPE_STANDARD && length <= 0xFFFFu) {
+        bytes[size++] = 0x10;
+    } else {
+        if (length > 0xFFFFFFu) {
+            fprintf(stderr, "Recorded tape block is too long for TZX\n");
+            return 0;
+        }
+        uint32_t words[6] = {block->pilot_pulse_tstates,
+                             block->sync_first_pulse_tstates,
+                             block->sync_second_pulse_tstates,
+                             block->bit0_first_pulse_tstates,
+                             block->bit1_first_pulse_tstates,
+                             block->pilot_pulse_count > 0xFFFFu ? 0xFFFFu : block->pilot_pulse_count};
+        // A turbo block with no pilot or sync pulses is pure data.
+        int pure_data = block->type == TAPE_BLOCK_TYPE_PURE_DATA ||
+                        (block->pilot_pulse_count == 0u && block->sync_first_pulse_tstates == 0u &&
+                         block->sync_second_pulse_tstates == 0u);
+        size_t first_word = 0;
+        if (pure_data) {
+            bytes[size++] = 0x14;
+            first_word = 3;
+        } else {
+            bytes[size++] = 0x11;
+        }
+        size_t last_word = pure_data ? 5 : 6;
+        for (size_t w = first_word; w < last_word; ++w) {
+            bytes[size++] = (uint8_t)(words[w] & 0xFFu);
+            bytes[size++] = (uint8_t)((words[w] >> 8) & 0xFFu);
+        }
+        bytes[size++] = block->used_bits_in_last_byte ? block->used_bits_in_last_byte : 8u;
+    }
+    bytes[size++] = (uint8_t)(pause_ms & 0xFFu);
+    bytes[size++] = (uint8_t)((pause_ms >> 8) & 0xFFu);
+    bytes[size++] = (uint8_t)(length & 0xFFu);
+    bytes[size++] = (uint8_t)((length >> 8) & 0xFFu);
+    if (bytes[0] != 0x10) {
+        bytes[size++] = (uint8_t)((length >> 16) & 0xFFu);
+    }
+
+    if (fwrite(bytes, size, 1, tf) != 1 || (length > 0 && block->data && fwrite(block->data, length, 1, tf) != 1)) {
+        fprintf(stderr, "Failed to write TZX block\n");
+        return 0;
+    }
+    return 1;
+}
+
 static int tape_recorder_write_output(void) {
     if (!tape_recorder.enabled || !tape_recorder.output_path) {
         return 1;
@@ -8287,7 +11448,16 @@ static int tape_recorder_write_output(void) {
 
     int success = 1;
 
-    if (tape_recorder.recorded.count > 0) {
+    if (tape_recorder.output_format == TAPE_OUTPUT_TZX) {
+        static const uint8_t header[10] = {'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A, 0x01, 0x14};
+        if (fwrite(header, sizeof(header), 1, tf) != 1) {
+            fprintf(stderr, "Failed to write TZX header\n");
+            success = 0;
+        }
+        for (size_t i = 0; i < tape_recorder.recorded.count && success; ++i) {
+            success = tape_write_tzx_block(tf, &tape_recorder.recorded.blocks[i]);
+        }
+    } else if (tape_recorder.recorded.count > 0) {
         for (size_t i = 0; i < tape_recorder.recorded.count && success; ++i) {
             const TapeBlock* block = &tape_recorder.recorded.blocks[i];
             uint16_t length = (uint16_t)block->length;
@@ -8328,10 +11498,10 @@ static void tape_shutdown(void) {
     tape_recorder_stop_session(total_t_states, 1);
     tape_free_image(&tape_playback.image);
     tape_waveform_reset(&tape_playback.waveform);
+    tape_wav_stream_close(&tape_playback.wav_stream);
     tape_free_image(&tape_recorder.recorded);
     tape_recorder_reset_pulses();
     tape_recorder_reset_audio();
-    tape_recorder_reset_wav_prefix();
 }
 
 static void tape_deck_play(uint64_t current_t_state) {
@@ -8347,7 +11517,7 @@ static void tape_deck_play(uint64_t current_t_state) {
     }
 
     if (state->format == TAPE_FORMAT_WAV) {
-        if (state->waveform.count == 0) {
+        if (state->wav_stream.pulses == 0) {
             printf("Tape PLAY ignored (empty tape)\n");
             return;
         }
@@ -8398,6 +11568,66 @@ static void tape_deck_rewind(uint64_t current_t_state) {
     tape_deck_status = TAPE_DECK_STATUS_REWIND;
 }
 
+// Moves to the next block, or back to the start of the current one, or to
+// the block before if playback is within half a second of that start. WAV
+// tapes have no blocks and move TAPE_DECK_WAV_SKIP_SECONDS instead. Not bound
+// to a key here: hosts call it from their own previous/next block input.
+#define TAPE_DECK_WAV_SKIP_SECONDS 10u
+
+static void tape_deck_skip_block(uint64_t current_t_state, int direction) {
+    TapePlaybackState* state = &tape_playback;
+    if (!tape_input_enabled) {
+        printf("Tape SKIP ignored (no tape loaded)\n");
+        return;
+    }
+
+    int was_playing = state->playing;
+    tape_pause_playback(state, current_t_state);
+    tape_recorder_stop_session(current_t_state, 1);
+
+    uint64_t position = state->position_tstates;
+    uint64_t target = 0;
+    if (state->format == TAPE_FORMAT_WAV) {
+        uint64_t step = (uint64_t)(CPU_CLOCK_HZ + 0.5) * TAPE_DECK_WAV_SKIP_SECONDS;
+        if (direction > 0) {
+            target = position + step;
+        } else {
+            target = position > step ? position - step : 0u;
+        }
+    } else {
+        if (!tape_timeline_build(&state->image)) {
+            return;
+        }
+        size_t block = tape_timeline_find(&state->image, position);
+        if (direction > 0) {
+            if (block < state->image.count) {
+                ++block;
+            }
+        } else if (block > 0 &&
+                   position - state->image.timeline[block].start_tstates < (uint64_t)(CPU_CLOCK_HZ / 2.0)) {
+            --block;
+        }
+        target = state->image.timeline[block].start_tstates;
+    }
+
+    if (!tape_seek_playback(state, target)) {
+        printf("Tape SKIP failed\n");
+        return;
+    }
+    tape_recorder.position_tstates = state->position_tstates;
+    tape_recorder.position_start_tstate = current_t_state;
+    if (state->format == TAPE_FORMAT_WAV) {
+        printf("Tape SKIP to %.1f s\n", (double)state->position_tstates / CPU_CLOCK_HZ);
+    } else {
+        printf("Tape SKIP to block %zu\n", state->current_block);
+    }
+
+    if (was_playing) {
+        (void)tape_resume_playback(state, current_t_state);
+    }
+    tape_deck_status = state->playing ? TAPE_DECK_STATUS_PLAY : TAPE_DECK_STATUS_STOP;
+}
+
 static void tape_deck_record(uint64_t current_t_state, int append_mode) {
     if (!tape_recorder.enabled) {
         if (tape_input_format == TAPE_FORMAT_WAV && tape_input_path) {
@@ -8421,88 +11651,59 @@ static void tape_deck_record(uint64_t current_t_state, int append_mode) {
     }
 }
 
-static size_t beeper_catch_up_to(double catch_up_position, double playback_position_snapshot) {
-    if (beeper_cycles_per_sample <= 0.0) {
+static size_t beeper_catch_up_to(uint64_t catch_up_position) {
+    if (beeper_step_position == 0u) {
         return 0;
     }
 
-    double playback_position = playback_position_snapshot;
-    if (catch_up_position <= playback_position) {
+    BeeperCursor playback = beeper_playback;
+    if (catch_up_position <= playback.position) {
         return 0;
     }
 
-    double cycles_per_sample = beeper_cycles_per_sample;
-    double last_input = beeper_hp_last_input;
-    double last_output = beeper_hp_last_output;
+    AudioHighpass highpass = beeper_highpass;
     int level = beeper_playback_level;
-    size_t head = beeper_event_head;
+    size_t head = beeper_event_head.load(std::memory_order_relaxed);
+    size_t tail = beeper_event_tail.load(std::memory_order_acquire);
     size_t consumed = 0;
 
-    while (playback_position + cycles_per_sample < catch_up_position) {
-        double target_position = playback_position + cycles_per_sample;
-
-        while (head != beeper_event_tail &&
-               (double)beeper_events[head].t_state <= target_position) {
-            level = beeper_events[head].level;
-            head = (head + 1) % BEEPER_EVENT_CAPACITY;
-            ++consumed;
-        }
-
-        double raw_sample = (double)level * (double)AUDIO_AMPLITUDE;
-        double filtered_sample = raw_sample - last_input + BEEPER_HP_ALPHA * last_output;
-        last_input = raw_sample;
-        last_output = filtered_sample;
-
-        playback_position = target_position;
-    }
-
-    if (playback_position < catch_up_position) {
-        double target_position = playback_position + cycles_per_sample;
+    // Runs the filter over the skipped samples so the output resumes without a
+    // step, stopping on the first sample boundary at or past the target.
+    while (playback.position < catch_up_position) {
+        beeper_cursor_advance(&playback, 1u);
+        uint64_t target_t_state = playback.position >> BEEPER_POSITION_FRACTION_BITS;
 
-        while (head != beeper_event_tail &&
-               (double)beeper_events[head].t_state <= target_position) {
+        while (head != tail && beeper_events[head].t_state <= target_t_state) {
             level = beeper_events[head].level;
             head = (head + 1) % BEEPER_EVENT_CAPACITY;
             ++consumed;
         }
 
-        double raw_sample = (double)level * (double)AUDIO_AMPLITUDE;
-        double filtered_sample = raw_sample - last_input + BEEPER_HP_ALPHA * last_output;
-        last_input = raw_sample;
-        last_output = filtered_sample;
-
-        playback_position = target_position;
+        audio_highpass_run(&highpass, level * AUDIO_AMPLITUDE);
     }
 
-    while (head != beeper_event_tail &&
-           (double)beeper_events[head].t_state <= catch_up_position) {
+    uint64_t catch_up_t_state = catch_up_position >> BEEPER_POSITION_FRACTION_BITS;
+    while (head != tail && beeper_events[head].t_state <= catch_up_t_state) {
         level = beeper_events[head].level;
         head = (head + 1) % BEEPER_EVENT_CAPACITY;
         ++consumed;
     }
 
-    beeper_event_head = head;
-    beeper_playback_position = playback_position;
+    beeper_event_head.store(head, std::memory_order_release);
+    ay_apply_events_until(playback.position >> BEEPER_POSITION_FRACTION_BITS);
+    beeper_playback = playback;
     beeper_playback_level = level;
-    beeper_hp_last_input = last_input;
-    beeper_hp_last_output = last_output;
-    if (beeper_writer_cursor < playback_position) {
-        beeper_writer_cursor = playback_position;
-    }
+    beeper_highpass = highpass;
+    beeper_blep_reset(level);
+    beeper_playback_published.store(playback.position, std::memory_order_release);
 
     return consumed;
 }
 
 static void beeper_push_event(uint64_t t_state, int level) {
-    int locked_audio = 0;
-    if (audio_available) {
-        audio_backend_lock();
-        locked_audio = 1;
-    }
-
     uint64_t original_t_state = t_state;
     int was_idle = beeper_idle_log_active;
-    double playback_snapshot = beeper_playback_position;
+    double playback_snapshot = beeper_playback_tstates();
     size_t pending_before = beeper_pending_event_count();
     if (beeper_cycles_per_sample > 0.0) {
         double event_offset_cycles = (double)t_state - playback_snapshot;
@@ -8522,16 +11723,15 @@ static void beeper_push_event(uint64_t t_state, int level) {
                 playback_snapshot,
                 pending_before);
 
-            beeper_force_resync(t_state);
-            playback_snapshot = beeper_playback_position;
+            beeper_request_resync(t_state);
+            playback_snapshot = (double)t_state;
             pending_before = 0;
             was_idle = 0;
         }
     }
 
-    if (beeper_cycles_per_sample > 0.0) {
-        double playback_position_snapshot = beeper_playback_position;
-        double latency_cycles = (double)t_state - playback_position_snapshot;
+    if (beeper_cycles_per_sample > 0.0 && !audio_lockstep) {
+        double latency_cycles = (double)t_state - playback_snapshot;
         double max_latency_cycles = beeper_cycles_per_sample * beeper_max_latency_samples;
 
         if (latency_cycles > max_latency_cycles) {
@@ -8541,16 +11741,15 @@ static void beeper_push_event(uint64_t t_state, int level) {
                     catch_up_position = 0.0;
                 }
                 size_t pending_before = beeper_pending_event_count();
-                size_t consumed = beeper_catch_up_to(catch_up_position, playback_position_snapshot);
+                size_t consumed = beeper_catch_up_to(beeper_position_from_tstates(catch_up_position));
 
-                double new_latency_cycles = (double)t_state - beeper_playback_position;
+                double new_latency_cycles = (double)t_state - beeper_playback_tstates();
                 double queued_samples_before = latency_cycles / beeper_cycles_per_sample;
                 double queued_samples_after = new_latency_cycles / beeper_cycles_per_sample;
                 size_t pending_after = beeper_pending_event_count();
                 double catch_up_error_samples = 0.0;
                 if (beeper_cycles_per_sample > 0.0) {
-                    catch_up_error_samples = (catch_up_position - beeper_playback_position) /
-                                             beeper_cycles_per_sample;
+                    catch_up_error_samples = (catch_up_position - beeper_playback_tstates()) / beeper_cycles_per_sample;
                 }
 
                 BEEPER_LOG(
@@ -8565,12 +11764,27 @@ static void beeper_push_event(uint64_t t_state, int level) {
                 uint64_t catch_up_cycles = (uint64_t)catch_up_position;
                 if (catch_up_cycles > beeper_last_event_t_state) {
                     beeper_last_event_t_state = catch_up_cycles;
+                    beeper_writer_cursor.store(catch_up_cycles << BEEPER_POSITION_FRACTION_BITS,
+                                               std::memory_order_relaxed);
                 }
             } else {
-                double throttle_cycles = beeper_cycles_per_sample * beeper_latency_throttle_samples;
+                double throttle_samples = beeper_latency_throttle_samples;
+                double trim_samples = beeper_latency_trim_samples;
+                if (audio_rate_control_setting.load(std::memory_order_relaxed)) {
+                    // The control loop owns normal drift; only trim backlogs it
+                    // cannot absorb, and skip back to its target rather than below.
+                    double target = (double)audio_rate_target_published.load(std::memory_order_relaxed);
+                    if (throttle_samples < target) {
+                        throttle_samples = target;
+                    }
+                    if (trim_samples < target * AUDIO_RATE_TRIM_FACTOR) {
+                        trim_samples = target * AUDIO_RATE_TRIM_FACTOR;
+                    }
+                }
+                double throttle_cycles = beeper_cycles_per_sample * throttle_samples;
 
                 if (throttle_cycles > 0.0 && latency_cycles > throttle_cycles) {
-                    double trim_cycles = beeper_cycles_per_sample * beeper_latency_trim_samples;
+                    double trim_cycles = beeper_cycles_per_sample * trim_samples;
                     int should_trim = trim_cycles > throttle_cycles && latency_cycles > trim_cycles;
 
                     if (should_trim) {
@@ -8579,36 +11793,27 @@ static void beeper_push_event(uint64_t t_state, int level) {
                             catch_up_position = 0.0;
                         }
 
-                        double playback_snapshot = beeper_playback_position;
-                        size_t pending_before = beeper_pending_event_count();
-                        size_t consumed = beeper_catch_up_to(catch_up_position, playback_snapshot);
-                        double new_latency_cycles = (double)t_state - beeper_playback_position;
-                        double queued_samples_before = latency_cycles / beeper_cycles_per_sample;
-                        double queued_samples_after = new_latency_cycles / beeper_cycles_per_sample;
-                        size_t pending_after = beeper_pending_event_count();
-                        double catch_up_error_samples = 0.0;
-                        if (beeper_cycles_per_sample > 0.0) {
-                            catch_up_error_samples = (catch_up_position - beeper_playback_position) /
-                                                     beeper_cycles_per_sample;
-                        }
-
-                        if (consumed > 0 || queued_samples_after < queued_samples_before) {
+                        // The skip itself moves beeper_event_head, so it is left to the
+                        // consumer; one request is outstanding at a time.
+                        uint64_t catch_up_target = beeper_position_from_tstates(catch_up_position);
+                        uint64_t expected = 0;
+                        if (catch_up_target != 0u &&
+                            beeper_catch_up_request.compare_exchange_strong(expected, catch_up_target,
+                                                                            std::memory_order_acq_rel)) {
+                            audio_overrun_count.fetch_add(1u, std::memory_order_relaxed);
                             BEEPER_LOG(
-                                "[BEEPER] trimmed backlog %.2f -> %.2f samples (consumed %zu events, queue %zu -> %zu, catch-up err %.4f samples)\n",
-                                queued_samples_before,
-                                queued_samples_after,
-                                consumed,
-                                pending_before,
-                                pending_after,
-                                catch_up_error_samples);
+                                "[BEEPER] trimming backlog %.2f -> %.2f samples (queue %zu)\n",
+                                latency_cycles / beeper_cycles_per_sample,
+                                throttle_cycles / beeper_cycles_per_sample,
+                                pending_before);
                         }
 
                         uint64_t catch_up_cycles = (uint64_t)catch_up_position;
                         if (catch_up_cycles > beeper_last_event_t_state) {
                             beeper_last_event_t_state = catch_up_cycles;
+                            beeper_writer_cursor.store(catch_up_cycles << BEEPER_POSITION_FRACTION_BITS,
+                                                       std::memory_order_relaxed);
                         }
-
-                        latency_cycles = new_latency_cycles;
                     }
                 }
             }
@@ -8634,9 +11839,9 @@ static void beeper_push_event(uint64_t t_state, int level) {
         beeper_last_event_t_state = t_state;
     }
 
-    double event_cursor = (double)t_state;
-    if (event_cursor > beeper_writer_cursor) {
-        beeper_writer_cursor = event_cursor;
+    uint64_t event_cursor = t_state << BEEPER_POSITION_FRACTION_BITS;
+    if (event_cursor > beeper_writer_cursor.load(std::memory_order_relaxed)) {
+        beeper_writer_cursor.store(event_cursor, std::memory_order_relaxed);
     }
 
     if (was_idle) {
@@ -8650,21 +11855,10 @@ static void beeper_push_event(uint64_t t_state, int level) {
             delta_samples,
             playback_snapshot,
             pending_before);
-        beeper_idle_log_active = 0;
-    }
-
-    size_t next_tail = (beeper_event_tail + 1) % BEEPER_EVENT_CAPACITY;
-    if (next_tail == beeper_event_head) {
-        beeper_event_head = (beeper_event_head + 1) % BEEPER_EVENT_CAPACITY;
+        beeper_idle_log_active = 0;
     }
 
-    beeper_events[beeper_event_tail].t_state = t_state;
-    beeper_events[beeper_event_tail].level = (int8_t)level;
-    beeper_event_tail = next_tail;
-
-    if (locked_audio) {
-        audio_backend_unlock();
-    }
+    beeper_queue_push(t_state, level);
 }
 
 void io_write(uint16_t port, uint8_t value) {
@@ -8688,7 +11882,8 @@ void io_write(uint16_t port, uint8_t value) {
         }
         if (ay_port == 0x8000u) {
             uint8_t reg = (uint8_t)(ay_selected_register & 0x0Fu);
-            ay_write_register(reg, value);
+            ay_write_register(reg, value, access_t_state);
+            ay_log_record(reg, value, access_t_state);
             ay_register_latched = 1;
             return;
         }
@@ -8728,10 +11923,86 @@ void io_write(uint16_t port, uint8_t value) {
     (void)port;
     (void)value;
 }
+
+// --- Tape Loading Warp ---
+// A loader spins on IN from port 0xFE in a short edge loop: hundreds of EAR
+// reads a frame from a handful of addresses. Once a few consecutive frames
+// look like that while the tape plays, warp engages; it ends when the tape
+// stops, or after half a second without the pattern. Lockstep renders are
+// already unpaced and keep every sample, so they never warp.
+#define TAPE_WARP_MIN_EAR_READS 256u
+#define TAPE_WARP_PC_WINDOW 0x100u
+#define TAPE_WARP_ENGAGE_FRAMES 3
+#define TAPE_WARP_RELEASE_FRAMES 25
+
+static void tape_warp_set_active(int active, uint64_t t_state) {
+    if (active == tape_warp_active) {
+        return;
+    }
+    tape_warp_active = active;
+    tape_warp_streak = 0;
+    if (tape_debug_logging) {
+        tape_log("%s warp at t=%llu\n", active ? "Entering" : "Leaving", (unsigned long long)t_state);
+    }
+    if (active) {
+        return;
+    }
+    // Audio restarts at the present instead of replaying the skipped time.
+    beeper_request_resync(t_state);
+    if (ay_step_increment != 0u) {
+        ay_queue_dirty_registers(t_state);
+    }
+    video_frameskip_countdown = 0;
+}
+
+static void tape_warp_note_ear_read(void) {
+    uint16_t pc = tape_warp_cpu ? tape_warp_cpu->reg_PC : 0u;
+    if (tape_warp_ear_reads == 0u) {
+        tape_warp_pc_min = pc;
+        tape_warp_pc_max = pc;
+    } else if (pc < tape_warp_pc_min) {
+        tape_warp_pc_min = pc;
+    } else if (pc > tape_warp_pc_max) {
+        tape_warp_pc_max = pc;
+    }
+    ++tape_warp_ear_reads;
+}
+
+static void tape_warp_frame_end(uint64_t t_state) {
+    int tape_running = tape_warp_enabled && !audio_lockstep && tape_input_enabled && tape_playback.playing;
+    int loading = tape_running && tape_warp_ear_reads >= TAPE_WARP_MIN_EAR_READS &&
+                  (uint32_t)(tape_warp_pc_max - tape_warp_pc_min) < TAPE_WARP_PC_WINDOW;
+    tape_warp_ear_reads = 0;
+    if (loading == tape_warp_active) {
+        tape_warp_streak = 0;
+        return;
+    }
+    int needed = loading ? TAPE_WARP_ENGAGE_FRAMES : (tape_running ? TAPE_WARP_RELEASE_FRAMES : 1);
+    if (++tape_warp_streak >= needed) {
+        tape_warp_set_active(loading, t_state);
+    }
+}
+
+// Allows (default) or forbids automatic warp while a tape loads.
+void tape_set_auto_warp(int enabled) {
+    tape_warp_enabled = enabled ? 1 : 0;
+    if (!tape_warp_enabled) {
+        tape_warp_set_active(0, total_t_states);
+    }
+}
+
+// Non-zero while a loader is running; frame pacing should be skipped.
+int emulator_warp_active(void) {
+    return tape_warp_active;
+}
+
 uint8_t io_read(uint16_t port) {
     if ((port & 1) == 0) {
         tape_update(total_t_states);
         tape_recorder_update(total_t_states, 0);
+        if (tape_playback.playing) {
+            tape_warp_note_ear_read();
+        }
 
         uint8_t result = 0xFF;
         uint8_t high_byte = (port >> 8) & 0xFF;
@@ -9447,11 +12718,165 @@ int cpu_interrupt(Z80* cpu, uint8_t data_bus) {
     return t_states;
 }
 
+// --- ROM Tape Trap ---
+// LD-BYTES (0x0556) sets the border and interrupts up and then enters the
+// edge loop at LD-START (0x056C) with the expected flag byte in A' and the
+// LOAD/VERIFY choice in the carry of F'. When the tape is positioned on a
+// standard-speed block the trap copies it straight to IX/DE, leaves the
+// registers as the ROM loop would and resumes at the RET at 0x05E2, which
+// returns through SA/LD-RET. Turbo and custom blocks load from real edges.
+#define TAPE_TRAP_LD_BYTES 0x0556u
+#define TAPE_TRAP_LD_START 0x056Cu
+#define TAPE_TRAP_LD_RET 0x05E2u
+
+// Turns the LD-BYTES trap on (default) or off.
+void tape_set_fast_load(int enabled) {
+    tape_fast_load_enabled = enabled ? 1 : 0;
+}
+
+// Checks the mapped ROM, whichever bank it is, still holds the 48K loader.
+static int tape_rom_trap_rom_matches(void) {
+    static const uint8_t ld_bytes[] = {0x14, 0x08, 0x15, 0xF3, 0x3E, 0x0F, 0xD3, 0xFE};
+    static const uint8_t ld_start[] = {0xCD, 0xE7, 0x05};
+    if (spectrum_pages[0].type != MEMORY_PAGE_ROM) {
+        return 0;
+    }
+    return memcmp(&memory[TAPE_TRAP_LD_BYTES], ld_bytes, sizeof(ld_bytes)) == 0 &&
+           memcmp(&memory[TAPE_TRAP_LD_START], ld_start, sizeof(ld_start)) == 0 &&
+           memory[TAPE_TRAP_LD_RET] == 0xC9u;
+}
+
+// Steps the playback cursor past the rest of its current block, keeping the
+// level, pulse count and tape counter where real playback would have left
+// them. The block's trailing pause stays folded into the next pulse.
+static void tape_rom_trap_skip_block(TapePlaybackState* state, uint64_t now) {
+    TapePulseCursor* cursor = &state->pulse_cursor;
+    size_t block_index = cursor->block_index;
+    uint64_t skipped = 0;
+    while (cursor->has_current && cursor->block_index == block_index) {
+        skipped += cursor->current;
+        state->level = state->level ? 0 : 1;
+        (void)tape_playback_next_pulse(state);
+    }
+    state->position_tstates += skipped;
+    tape_ear_state = state->level;
+    speaker_tape_playback_level = tape_ear_state;
+    if (!state->playing) {
+        return;
+    }
+    speaker_update_output(now, 1);
+    state->last_transition_tstate = now;
+    state->position_start_tstate = now;
+    if (tape_playback_has_pulse(state)) {
+        state->next_transition_tstate = now + tape_playback_pulse_duration(state);
+        return;
+    }
+    state->playing = 0;
+    if (tape_recorder.output_format == TAPE_OUTPUT_WAV) {
+        tape_wav_shared_position_tstates = state->position_tstates;
+    }
+    tape_deck_status = TAPE_DECK_STATUS_STOP;
+}
+
+// Loads the next standard block as LD-BYTES would (after Fuse's
+// trap_load_block); returns 0 to let the ROM read the edges itself.
+static int tape_rom_trap_load_block(Z80* cpu) {
+    TapePlaybackState* state = &tape_playback;
+    if (!tape_input_enabled || state->format == TAPE_FORMAT_WAV ||
+        !tape_playback_uses_edges(state) || !state->pulse_cursor.has_current) {
+        return 0;
+    }
+    size_t block_index = state->pulse_cursor.block_index;
+    if (block_index >= state->image.count) {
+        return 0;
+    }
+    const TapeBlock* block = &state->image.blocks[block_index];
+    if (block->type != TAPE_BLOCK_TYPE_STANDARD || !tape_rom_trap_rom_matches()) {
+        return 0;
+    }
+
+    const uint8_t* data = block->data;
+    uint32_t length = data ? block->length : 0u;
+    int verify = (cpu->alt_reg_F & FLAG_C) ? 0 : 1;
+    uint8_t expected_flag = cpu->alt_reg_A;
+    uint16_t de = get_DE(cpu);
+    uint16_t read = 0;
+
+    if (tape_debug_logging) {
+        tape_log("ROM trap %s block %zu (%u bytes) to %04X+%04X\n",
+                 verify ? "verifying" : "loading",
+                 block_index,
+                 (unsigned)length,
+                 (unsigned)cpu->reg_IX,
+                 (unsigned)de);
+    }
+
+    if (length == 0u) {
+        cpu->reg_L = 0x01u;
+        set_flag(cpu, FLAG_C, 0);
+    } else {
+        uint8_t parity = data[0];
+        cpu->alt_reg_A = 0x01u;
+        cpu->alt_reg_F = 0x45u;
+        if (data[0] != expected_flag) {
+            cpu->reg_L = data[0];
+            set_flag(cpu, FLAG_C, 0);
+        } else {
+            uint32_t available = length - 1u;
+            uint16_t wanted = de;
+            if (available < (uint32_t)wanted) {
+                wanted = (uint16_t)available;
+            }
+            int mismatch = 0;
+            while (read < wanted) {
+                uint8_t value = data[1u + read];
+                uint16_t address = (uint16_t)(cpu->reg_IX + read);
+                cpu->reg_L = value;
+                parity ^= value;
+                if (verify) {
+                    if (readByte(address) != value) {
+                        mismatch = 1;
+                        break;
+                    }
+                } else {
+                    writeByte(address, value);
+                }
+                ++read;
+            }
+            if (mismatch) {
+                set_flag(cpu, FLAG_C, 0);
+            } else if (read == de && (uint32_t)read + 1u < length) {
+                // The ROM reads the parity byte into L like any other.
+                cpu->reg_L = data[1u + read];
+                parity ^= data[1u + read];
+                cpu->reg_A = parity;
+                cpu_sub(cpu, 0x01u, 0);
+                cpu->reg_B = 0xB0u;
+            } else {
+                // The ROM times out waiting for the first edge of a byte
+                // the block does not have.
+                cpu->reg_B = cpu_inc(cpu, 0xFFu);
+                cpu->reg_L = 0x01u;
+                set_flag(cpu, FLAG_C, 0);
+            }
+        }
+        cpu->reg_H = parity;
+    }
+
+    cpu->reg_C = 0x01u;
+    set_DE(cpu, (uint16_t)(de - read));
+    cpu->reg_IX = (uint16_t)(cpu->reg_IX + read);
+    cpu->reg_PC = TAPE_TRAP_LD_RET;
+    tape_rom_trap_skip_block(state, total_t_states);
+    return 1;
+}
+
 // --- The Main CPU Execution Step ---
 int cpu_step(Z80* cpu) { // Returns T-states
     ula_instruction_progress_ptr = NULL;
     if (cpu->ei_delay) { cpu->iff1 = cpu->iff2 = 1; cpu->ei_delay = 0; }
     if (cpu->halted) { cpu->reg_R = (cpu->reg_R+1)|(cpu->reg_R&0x80); return 4; }
+    if (cpu->reg_PC == TAPE_TRAP_LD_START && tape_fast_load_enabled && tape_rom_trap_load_block(cpu)) { return 4; }
 
     int prefix=0;
     int t_states = 0;
@@ -9707,389 +13132,726 @@ static int string_equals_case_insensitive(const char* a, const char* b) {
     return *a == '\0' && *b == '\0';
 }
 
-static bool test_cb_sll_register(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    memory_clear();
-    cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x80;
-    memory[0x0000] = 0xCB;
-    memory[0x0001] = 0x30; // SLL B
+static bool test_cb_sll_register(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_B = 0x80;
+    memory[0x0000] = 0xCB;
+    memory[0x0001] = 0x30; // SLL B
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    return cpu.reg_B == 0x01 && get_flag(&cpu, FLAG_C) && !get_flag(&cpu, FLAG_Z) && t_states == 8 && cpu.reg_PC == 0x0002;
+}
+
+static bool test_cb_sll_memory(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x80;
+    cpu.reg_L = 0x00;
+    memory[0x8000] = 0x02;
+    memory[0x0000] = 0xCB;
+    memory[0x0001] = 0x36; // SLL (HL)
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    bool ok = memory[0x8000] == 0x05 && !get_flag(&cpu, FLAG_C) && t_states == 15 && cpu.reg_PC == 0x0002;
+    if (!ok) {
+        printf("    (HL) result=0x%02X, C=%d, t=%d, PC=0x%04X\n",
+               memory[0x8000], get_flag(&cpu, FLAG_C), t_states, cpu.reg_PC);
+    }
+    return ok;
+}
+
+static bool test_ddcb_register_result(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_IX = 0x8000;
+    cpu.reg_B = 0x00;
+    memory[0x8000] = 0x80;
+    memory[0x0000] = 0xDD;
+    memory[0x0001] = 0xCB;
+    memory[0x0002] = 0x00;
+    memory[0x0003] = 0x30; // SLL (IX+0),B
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    bool ok = cpu.reg_B == 0x01 && memory[0x8000] == 0x01 && get_flag(&cpu, FLAG_C) && t_states == 20;
+    if (!ok) {
+        printf("    (IX+d) result=0x%02X, C=%d, t=%d\n",
+               memory[0x8000], get_flag(&cpu, FLAG_C), t_states);
+    }
+    return ok;
+}
+
+static bool test_ddcb_memory_result(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_IY = 0x8100;
+    memory[0x8100] = 0x02;
+    memory[0x0000] = 0xFD;
+    memory[0x0001] = 0xCB;
+    memory[0x0002] = 0x00;
+    memory[0x0003] = 0x36; // SLL (IY+0)
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    bool ok = memory[0x8100] == 0x05 && !get_flag(&cpu, FLAG_C) && t_states == 23;
+    if (!ok) {
+        printf("    (IY+d) result=0x%02X, C=%d, t=%d\n",
+               memory[0x8100], get_flag(&cpu, FLAG_C), t_states);
+    }
+    return ok;
+}
+
+static bool test_neg_duplicates(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_A = 0x01;
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0x4C; // NEG duplicate
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    return cpu.reg_A == 0xFF && get_flag(&cpu, FLAG_C) && get_flag(&cpu, FLAG_N) && t_states == 8;
+}
+
+static bool test_im_modes(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    memory[0x0000] = 0xED; memory[0x0001] = 0x46; // IM 0
+    memory[0x0002] = 0xED; memory[0x0003] = 0x56; // IM 1
+    memory[0x0004] = 0xED; memory[0x0005] = 0x5E; // IM 2
+    total_t_states = 0;
+    (void)cpu_step(&cpu);
+    (void)cpu_step(&cpu);
+    (void)cpu_step(&cpu);
+    return cpu.interruptMode == 2;
+}
+
+static bool test_in_flags(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    cpu.reg_PC = 0x0000;
+    cpu.reg_B = 0x00;
+    cpu.reg_C = 0x01; // Non-ULA port
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0x40; // IN B,(C)
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+    total_t_states += t_states;
+    return cpu.reg_B == 0xFF && get_flag(&cpu, FLAG_H) && !get_flag(&cpu, FLAG_N);
+}
+
+static bool test_ini_flags(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    for (int i = 0; i < 8; ++i) {
+        keyboard_matrix[i] = 0xFF;
+    }
+    keyboard_matrix[0] = 0x12;
+
+    cpu.reg_PC = 0x0000;
+    cpu.reg_B = 0x02;
+    cpu.reg_C = 0x34;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
+    cpu.reg_F = FLAG_C;
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0xA2; // INI
+
+    total_t_states = 0;
+    int t_states = cpu_step(&cpu);
+
+    uint8_t stored = memory[0x4000];
+    bool ok = (t_states == 12) &&
+              (cpu.reg_B == 0x01) &&
+              (get_HL(&cpu) == 0x4001) &&
+              (stored == 0xF2) &&
+              !get_flag(&cpu, FLAG_S) &&
+              !get_flag(&cpu, FLAG_Z) &&
+              !get_flag(&cpu, FLAG_H) &&
+              get_flag(&cpu, FLAG_N) &&
+              get_flag(&cpu, FLAG_PV) &&
+              (cpu.reg_F & FLAG_C) &&
+              ((cpu.reg_F & 0x28u) == 0x20u);
+    keyboard_matrix[0] = 0xFF;
+    if (!ok) {
+        printf("    INI t=%d B=%02X HL=%04X stored=%02X F=%02X\n",
+               t_states, cpu.reg_B, get_HL(&cpu), stored, cpu.reg_F);
+    }
+    return ok;
+}
+
+static bool test_outd_flags(void) {
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory_clear();
+    for (int i = 0; i < 8; ++i) {
+        keyboard_matrix[i] = 0xFF;
+    }
+
+    cpu.reg_PC = 0x0000;
+    cpu.reg_B = 0x02;
+    cpu.reg_C = 0x01;
+    cpu.reg_H = 0x20;
+    cpu.reg_L = 0x01;
+    cpu.reg_F = FLAG_C;
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0xAB; // OUTD
+    memory[0x2001] = 0x40;
+
     total_t_states = 0;
     int t_states = cpu_step(&cpu);
-    return cpu.reg_B == 0x01 && get_flag(&cpu, FLAG_C) && !get_flag(&cpu, FLAG_Z) && t_states == 8 && cpu.reg_PC == 0x0002;
+
+    bool ok = (t_states == 12) &&
+              (cpu.reg_B == 0x01) &&
+              (get_HL(&cpu) == 0x2000) &&
+              !get_flag(&cpu, FLAG_S) &&
+              !get_flag(&cpu, FLAG_Z) &&
+              !get_flag(&cpu, FLAG_H) &&
+              !get_flag(&cpu, FLAG_N) &&
+              !get_flag(&cpu, FLAG_PV) &&
+              (cpu.reg_F & FLAG_C) &&
+              ((cpu.reg_F & 0x28u) == 0x00u);
+    if (!ok) {
+        printf("    OUTD t=%d B=%02X HL=%04X F=%02X\n",
+               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_F);
+    }
+    return ok;
 }
 
-static bool test_cb_sll_memory(void) {
+static bool test_inir_repeat(void) {
     Z80 cpu;
     cpu_reset_state(&cpu);
     memory_clear();
+    for (int i = 0; i < 8; ++i) {
+        keyboard_matrix[i] = 0xFF;
+    }
+
     cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x80;
+    cpu.reg_B = 0x02;
+    cpu.reg_C = 0x00;
+    cpu.reg_H = 0x40;
     cpu.reg_L = 0x00;
-    memory[0x8000] = 0x02;
-    memory[0x0000] = 0xCB;
-    memory[0x0001] = 0x36; // SLL (HL)
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0xB2; // INIR
+
     total_t_states = 0;
     int t_states = cpu_step(&cpu);
-    bool ok = memory[0x8000] == 0x05 && !get_flag(&cpu, FLAG_C) && t_states == 15 && cpu.reg_PC == 0x0002;
+
+    bool ok = (t_states == 21) &&
+              (cpu.reg_B == 0x01) &&
+              (get_HL(&cpu) == 0x4001) &&
+              (cpu.reg_PC == 0x0000);
     if (!ok) {
-        printf("    (HL) result=0x%02X, C=%d, t=%d, PC=0x%04X\n",
-               memory[0x8000], get_flag(&cpu, FLAG_C), t_states, cpu.reg_PC);
+        printf("    INIR t=%d B=%02X HL=%04X PC=%04X\n",
+               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_PC);
     }
     return ok;
 }
 
-static bool test_ddcb_register_result(void) {
+static bool test_otdr_repeat(void) {
     Z80 cpu;
     cpu_reset_state(&cpu);
     memory_clear();
+
     cpu.reg_PC = 0x0000;
-    cpu.reg_IX = 0x8000;
-    cpu.reg_B = 0x00;
-    memory[0x8000] = 0x80;
-    memory[0x0000] = 0xDD;
-    memory[0x0001] = 0xCB;
-    memory[0x0002] = 0x00;
-    memory[0x0003] = 0x30; // SLL (IX+0),B
+    cpu.reg_B = 0x02;
+    cpu.reg_C = 0x01;
+    cpu.reg_H = 0x20;
+    cpu.reg_L = 0x01;
+    memory[0x0000] = 0xED;
+    memory[0x0001] = 0xBB; // OTDR
+    memory[0x2001] = 0x7F;
+
     total_t_states = 0;
     int t_states = cpu_step(&cpu);
-    bool ok = cpu.reg_B == 0x01 && memory[0x8000] == 0x01 && get_flag(&cpu, FLAG_C) && t_states == 20;
+
+    bool ok = (t_states == 21) &&
+              (cpu.reg_B == 0x01) &&
+              (get_HL(&cpu) == 0x2000) &&
+              (cpu.reg_PC == 0x0000);
     if (!ok) {
-        printf("    (IX+d) result=0x%02X, C=%d, t=%d\n",
-               memory[0x8000], get_flag(&cpu, FLAG_C), t_states);
+        printf("    OTDR t=%d B=%02X HL=%04X PC=%04X\n",
+               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_PC);
     }
     return ok;
 }
 
-static bool test_ddcb_memory_result(void) {
+static bool test_interrupt_im2(void) {
     Z80 cpu;
     cpu_reset_state(&cpu);
     memory_clear();
-    cpu.reg_PC = 0x0000;
-    cpu.reg_IY = 0x8100;
-    memory[0x8100] = 0x02;
-    memory[0x0000] = 0xFD;
-    memory[0x0001] = 0xCB;
-    memory[0x0002] = 0x00;
-    memory[0x0003] = 0x36; // SLL (IY+0)
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
-    bool ok = memory[0x8100] == 0x05 && !get_flag(&cpu, FLAG_C) && t_states == 23;
+    cpu.interruptMode = 2;
+    cpu.reg_I = 0x80;
+    cpu.reg_SP = 0xFFFE;
+    cpu.reg_PC = 0x1234;
+    memory[0x80FF] = 0x78;
+    memory[0x8100] = 0x56;
+    int t_states = cpu_interrupt(&cpu, 0xFF);
+    bool ok = cpu.reg_PC == 0x5678 && cpu.reg_SP == 0xFFFC && memory[0xFFFC] == 0x34 &&
+              memory[0xFFFD] == 0x12 && t_states == 19;
     if (!ok) {
-        printf("    (IY+d) result=0x%02X, C=%d, t=%d\n",
-               memory[0x8100], get_flag(&cpu, FLAG_C), t_states);
+        printf("    IM2 PC=%04X SP=%04X stack=%02X%02X t=%d\n",
+               cpu.reg_PC, cpu.reg_SP, memory[0xFFFD], memory[0xFFFC], t_states);
     }
     return ok;
 }
 
-static bool test_neg_duplicates(void) {
+static bool test_interrupt_im1(void) {
     Z80 cpu;
     cpu_reset_state(&cpu);
     memory_clear();
-    cpu.reg_PC = 0x0000;
-    cpu.reg_A = 0x01;
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0x4C; // NEG duplicate
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
-    return cpu.reg_A == 0xFF && get_flag(&cpu, FLAG_C) && get_flag(&cpu, FLAG_N) && t_states == 8;
+    cpu.interruptMode = 1;
+    cpu.reg_SP = 0xFFFE;
+    cpu.reg_PC = 0x2222;
+    int t_states = cpu_interrupt(&cpu, 0xFF);
+    return cpu.reg_PC == 0x0038 && cpu.reg_SP == 0xFFFC && memory[0xFFFC] == 0x22 && memory[0xFFFD] == 0x22 && t_states == 13;
 }
 
-static bool test_im_modes(void) {
+static bool test_nmi_stack_behaviour(void) {
+    SpectrumModel previous_model = spectrum_model;
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+
     Z80 cpu;
     cpu_reset_state(&cpu);
-    memory_clear();
-    cpu.reg_PC = 0x0000;
-    memory[0x0000] = 0xED; memory[0x0001] = 0x46; // IM 0
-    memory[0x0002] = 0xED; memory[0x0003] = 0x56; // IM 1
-    memory[0x0004] = 0xED; memory[0x0005] = 0x5E; // IM 2
+    cpu.reg_PC = 0x1234;
+    cpu.reg_SP = 0xC100;
+    cpu.iff1 = 1;
+    cpu.iff2 = 0;
+
+    memory[0x0066] = 0xED;
+    memory[0x0067] = 0x45; // RETN
+
     total_t_states = 0;
-    (void)cpu_step(&cpu);
-    (void)cpu_step(&cpu);
-    (void)cpu_step(&cpu);
-    return cpu.interruptMode == 2;
+    int nmi_t = cpu_nmi(&cpu);
+    bool ok = (nmi_t == 11) &&
+              (cpu.reg_PC == 0x0066) &&
+              (cpu.reg_SP == 0xC0FE) &&
+              (cpu.iff1 == 0) &&
+              (cpu.iff2 == 1) &&
+              (memory[0xC0FF] == 0x12) &&
+              (memory[0xC0FE] == 0x34);
+
+    int retn_t = 0;
+    if (ok) {
+        retn_t = cpu_step(&cpu);
+        ok = (retn_t == 14) &&
+             (cpu.reg_PC == 0x1234) &&
+             (cpu.reg_SP == 0xC100) &&
+             (cpu.iff1 == 1) &&
+             (cpu.iff2 == 1);
+    }
+
+    if (!ok) {
+        printf("    NMI state PC=%04X SP=%04X IFF1=%d IFF2=%d stack=%02X%02X nmi_t=%d retn_t=%d\n",
+               cpu.reg_PC,
+               cpu.reg_SP,
+               cpu.iff1,
+               cpu.iff2,
+               memory[0xC0FF],
+               memory[0xC0FE],
+               nmi_t,
+               retn_t);
+    }
+
+    spectrum_configure_model(previous_model);
+    memory_clear();
+    return ok;
 }
 
-static bool test_in_flags(void) {
+static bool test_floating_bus_samples_screen_memory(void) {
+    SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+
+    memory[VRAM_START] = 0x3Cu;
+    memory[ATTR_START] = 0x5Au;
+    spectrum_reset_floating_bus();
+
     Z80 cpu;
     cpu_reset_state(&cpu);
-    memory_clear();
+    memory[0x0000] = 0xDB; // IN A,(n)
+    memory[0x0001] = 0xFF; // Port 0xFF (floating bus)
+
+    const uint64_t pixel_target = 14336u + 48u;
+    total_t_states = pixel_target - 4u;
     cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x00;
-    cpu.reg_C = 0x01; // Non-ULA port
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0x40; // IN B,(C)
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
-    total_t_states += t_states;
-    return cpu.reg_B == 0xFF && get_flag(&cpu, FLAG_H) && !get_flag(&cpu, FLAG_N);
+    int pixel_t = cpu_step(&cpu);
+    uint8_t pixel_sample = cpu.reg_A;
+
+    cpu_reset_state(&cpu);
+    spectrum_reset_floating_bus();
+    memory[0x0000] = 0xDB;
+    memory[0x0001] = 0xFF;
+    const uint64_t attr_target = 14336u + 50u;
+    total_t_states = attr_target - 4u;
+    cpu.reg_PC = 0x0000;
+    int attr_t = cpu_step(&cpu);
+    uint8_t attr_sample = cpu.reg_A;
+
+    bool timings_ok = (pixel_t >= 11) && (attr_t >= 11);
+    bool samples_ok = (pixel_sample == 0x3Cu) && (attr_sample == 0x5Au);
+
+    if (!(timings_ok && samples_ok)) {
+        printf("    floating bus debug pixel=%02X attr=%02X t_pix=%d t_attr=%d\n",
+               pixel_sample,
+               attr_sample,
+               pixel_t,
+               attr_t);
+    }
+
+    spectrum_configure_model(previous_model);
+    memory_clear();
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
+
+    return timings_ok && samples_ok;
 }
 
-static bool test_ini_flags(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
+static bool test_plus2a_contention_profile(void) {
+    SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+
+    spectrum_configure_model(SPECTRUM_MODEL_128K);
+    memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS2A);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+
+    spectrum_map_upper_bank(4u);
+    spectrum_update_contention_flags();
+    uint8_t contended_bank4 = page_contended[3];
+
+    spectrum_map_upper_bank(2u);
+    spectrum_update_contention_flags();
+    uint8_t contended_bank2 = page_contended[3];
+
+    uint8_t screen_flag = page_contended[1];
+
+    spectrum_configure_model(previous_model);
     memory_clear();
-    for (int i = 0; i < 8; ++i) {
-        keyboard_matrix[i] = 0xFF;
-    }
-    keyboard_matrix[0] = 0x12;
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
 
-    cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x02;
-    cpu.reg_C = 0x34;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    cpu.reg_F = FLAG_C;
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0xA2; // INI
+    return (contended_bank4 == 1u) && (contended_bank2 == 0u) && (screen_flag == 1u);
+}
 
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
+static bool test_plus3_rom_and_all_ram_paging(void) {
+    SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
 
-    uint8_t stored = memory[0x4000];
-    bool ok = (t_states == 12) &&
-              (cpu.reg_B == 0x01) &&
-              (get_HL(&cpu) == 0x4001) &&
-              (stored == 0xF2) &&
-              !get_flag(&cpu, FLAG_S) &&
-              !get_flag(&cpu, FLAG_Z) &&
-              !get_flag(&cpu, FLAG_H) &&
-              get_flag(&cpu, FLAG_N) &&
-              get_flag(&cpu, FLAG_PV) &&
-              (cpu.reg_F & FLAG_C) &&
-              ((cpu.reg_F & 0x28u) == 0x20u);
-    keyboard_matrix[0] = 0xFF;
-    if (!ok) {
-        printf("    INI t=%d B=%02X HL=%04X stored=%02X F=%02X\n",
-               t_states, cpu.reg_B, get_HL(&cpu), stored, cpu.reg_F);
-    }
-    return ok;
-}
+    uint8_t previous_rom_count = rom_page_count;
 
-static bool test_outd_flags(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
     memory_clear();
-    for (int i = 0; i < 8; ++i) {
-        keyboard_matrix[i] = 0xFF;
+    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+
+    rom_page_count = 4u;
+    for (uint8_t i = 0; i < 4u; ++i) {
+        memset(rom_pages[i], (int)(0x30u + i), 0x4000);
     }
+    spectrum_map_rom_page(0u);
 
-    cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x02;
-    cpu.reg_C = 0x01;
-    cpu.reg_H = 0x20;
-    cpu.reg_L = 0x01;
-    cpu.reg_F = FLAG_C;
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0xAB; // OUTD
-    memory[0x2001] = 0x40;
+    uint8_t rom0_val = readByte(0x0000);
+    bool rom0_ok = (rom0_val == 0x30u);
 
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
+    io_write(0x7FFD, 0x10u);
+    io_write(0x1FFD, 0x01u);
+    uint8_t rom3_val = readByte(0x0000);
+    bool rom3_ok = (rom3_val == 0x33u);
 
-    bool ok = (t_states == 12) &&
-              (cpu.reg_B == 0x01) &&
-              (get_HL(&cpu) == 0x2000) &&
-              !get_flag(&cpu, FLAG_S) &&
-              !get_flag(&cpu, FLAG_Z) &&
-              !get_flag(&cpu, FLAG_H) &&
-              !get_flag(&cpu, FLAG_N) &&
-              !get_flag(&cpu, FLAG_PV) &&
-              (cpu.reg_F & FLAG_C) &&
-              ((cpu.reg_F & 0x28u) == 0x00u);
-    if (!ok) {
-        printf("    OUTD t=%d B=%02X HL=%04X F=%02X\n",
-               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_F);
+    ram_pages[0][0] = 0xAAu;
+    io_write(0x1FFD, 0x02u);
+    uint8_t all_ram_val = readByte(0x0000);
+    bool all_ram_ok = (all_ram_val == 0xAAu);
+
+    io_write(0x1FFD, 0x01u);
+    uint8_t rom_restore_val = readByte(0x0000);
+    bool rom_restore_ok = (rom_restore_val == 0x33u);
+
+    if (!(rom0_ok && rom3_ok && all_ram_ok && rom_restore_ok)) {
+        printf("    plus3 rom debug: rom0=%02X rom3=%02X all_ram=%02X restore=%02X\n",
+               rom0_val,
+               rom3_val,
+               all_ram_val,
+               rom_restore_val);
     }
-    return ok;
-}
 
-static bool test_inir_repeat(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
+    spectrum_configure_model(previous_model);
     memory_clear();
-    for (int i = 0; i < 8; ++i) {
-        keyboard_matrix[i] = 0xFF;
-    }
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
+    rom_page_count = previous_rom_count;
+    spectrum_apply_memory_configuration();
 
-    cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x02;
-    cpu.reg_C = 0x00;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0xB2; // INIR
+    return rom0_ok && rom3_ok && all_ram_ok && rom_restore_ok;
+}
 
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
+static bool test_plus3_special_paging_modes(void) {
+    SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+    uint8_t previous_rom_count = rom_page_count;
 
-    bool ok = (t_states == 21) &&
-              (cpu.reg_B == 0x01) &&
-              (get_HL(&cpu) == 0x4001) &&
-              (cpu.reg_PC == 0x0000);
-    if (!ok) {
-        printf("    INIR t=%d B=%02X HL=%04X PC=%04X\n",
-               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_PC);
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
+    memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+
+    uint8_t markers[8];
+    for (uint8_t bank = 0; bank < 8u; ++bank) {
+        markers[bank] = (uint8_t)(0x40u + bank);
+        memset(ram_pages[bank], 0, 0x4000);
     }
-    return ok;
-}
 
-static bool test_otdr_repeat(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    memory_clear();
+    writeByte(0x4000, markers[5]);
+    writeByte(0x8000, markers[2]);
+    writeByte(0xC000, markers[0]);
+    for (uint8_t bank = 1; bank < 8u; ++bank) {
+        spectrum_map_upper_bank(bank);
+        writeByte(0xC000, markers[bank]);
+    }
+    spectrum_map_upper_bank(0u);
 
-    cpu.reg_PC = 0x0000;
-    cpu.reg_B = 0x02;
-    cpu.reg_C = 0x01;
-    cpu.reg_H = 0x20;
-    cpu.reg_L = 0x01;
-    memory[0x0000] = 0xED;
-    memory[0x0001] = 0xBB; // OTDR
-    memory[0x2001] = 0x7F;
+    static const uint8_t maps[4][4] = {
+        {0u, 1u, 2u, 3u},
+        {4u, 5u, 6u, 7u},
+        {4u, 5u, 6u, 3u},
+        {4u, 7u, 6u, 3u}
+    };
 
-    total_t_states = 0;
-    int t_states = cpu_step(&cpu);
+    bool mapping_ok = true;
+    for (uint8_t config = 0; config < 4u; ++config) {
+        io_write(0x1FFD, (uint8_t)(0x04u | config));
+        for (uint8_t page = 0; page < 4u; ++page) {
+            uint16_t addr = (uint16_t)(page * 0x4000u);
+            uint8_t expected = markers[maps[config][page]];
+            uint8_t observed = readByte(addr);
+            if (observed != expected) {
+                mapping_ok = false;
+                printf("    plus3 special debug config=%u page=%u expect=%02X got=%02X\n",
+                       (unsigned)config,
+                       (unsigned)page,
+                       expected,
+                       observed);
+            }
+        }
+        if (current_screen_bank != maps[config][1]) {
+            mapping_ok = false;
+            printf("    plus3 special screen config=%u expect bank %u got %u\n",
+                   (unsigned)config,
+                   (unsigned)maps[config][1],
+                   (unsigned)current_screen_bank);
+        }
+    }
 
-    bool ok = (t_states == 21) &&
-              (cpu.reg_B == 0x01) &&
-              (get_HL(&cpu) == 0x2000) &&
-              (cpu.reg_PC == 0x0000);
-    if (!ok) {
-        printf("    OTDR t=%d B=%02X HL=%04X PC=%04X\n",
-               t_states, cpu.reg_B, get_HL(&cpu), cpu.reg_PC);
+    io_write(0x1FFD, 0x04u);
+    io_write(0x7FFD, 0x20u);
+    io_write(0x1FFD, 0x05u);
+    uint8_t disable_low = readByte(0x0000);
+    uint8_t disable_high = readByte(0x4000);
+    bool disable_ok = (disable_low == markers[maps[0][0]]) &&
+                      (disable_high == markers[maps[0][1]]);
+    if (!disable_ok) {
+        printf("    plus3 special disable expect %02X/%02X got %02X/%02X\n",
+               markers[maps[0][0]],
+               markers[maps[0][1]],
+               disable_low,
+               disable_high);
     }
-    return ok;
-}
 
-static bool test_interrupt_im2(void) {
-    Z80 cpu;
-    cpu_reset_state(&cpu);
+    spectrum_configure_model(previous_model);
     memory_clear();
-    cpu.interruptMode = 2;
-    cpu.reg_I = 0x80;
-    cpu.reg_SP = 0xFFFE;
-    cpu.reg_PC = 0x1234;
-    memory[0x80FF] = 0x78;
-    memory[0x8100] = 0x56;
-    int t_states = cpu_interrupt(&cpu, 0xFF);
-    bool ok = cpu.reg_PC == 0x5678 && cpu.reg_SP == 0xFFFC && memory[0xFFFC] == 0x34 &&
-              memory[0xFFFD] == 0x12 && t_states == 19;
-    if (!ok) {
-        printf("    IM2 PC=%04X SP=%04X stack=%02X%02X t=%d\n",
-               cpu.reg_PC, cpu.reg_SP, memory[0xFFFD], memory[0xFFFC], t_states);
-    }
-    return ok;
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
+    rom_page_count = previous_rom_count;
+    spectrum_apply_memory_configuration();
+
+    return mapping_ok && disable_ok;
 }
 
-static bool test_interrupt_im1(void) {
+static bool test_peripheral_port_contention(void) {
+    SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+
+    memory[VRAM_START] = 0x66u;
+    memory[0x0000] = 0xDB;
+    memory[0x0001] = 0xFF;
+
     Z80 cpu;
     cpu_reset_state(&cpu);
+    total_t_states = (14336u + 48u) - 4u;
+    cpu.reg_PC = 0x0000;
+    int base_t = cpu_step(&cpu);
+
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0xDB;
+    memory[0x0001] = 0xFF;
+    spectrum_reset_floating_bus();
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_IF1);
+    total_t_states = (14336u + 48u) - 4u;
+    cpu.reg_PC = 0x0000;
+    int contended_t = cpu_step(&cpu);
+
+    bool contention_effective = contended_t > base_t;
+
+    spectrum_configure_model(previous_model);
     memory_clear();
-    cpu.interruptMode = 1;
-    cpu.reg_SP = 0xFFFE;
-    cpu.reg_PC = 0x2222;
-    int t_states = cpu_interrupt(&cpu, 0xFF);
-    return cpu.reg_PC == 0x0038 && cpu.reg_SP == 0xFFFC && memory[0xFFFC] == 0x22 && memory[0xFFFD] == 0x22 && t_states == 13;
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
+
+    return contention_effective;
 }
 
-static bool test_nmi_stack_behaviour(void) {
+static bool test_plus3_contention_penalty_shift(void) {
     SpectrumModel previous_model = spectrum_model;
+    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
+    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+
     spectrum_configure_model(SPECTRUM_MODEL_48K);
     memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
 
     Z80 cpu;
     cpu_reset_state(&cpu);
-    cpu.reg_PC = 0x1234;
-    cpu.reg_SP = 0xC100;
-    cpu.iff1 = 1;
-    cpu.iff2 = 0;
+    memory[0x0000] = 0x7E; // LD A,(HL)
+    memory[0x4000] = 0x11;
 
-    memory[0x0066] = 0xED;
-    memory[0x0067] = 0x45; // RETN
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
+    total_t_states = 0;
+    int base_48k = cpu_step(&cpu);
+
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0x7E;
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
+    total_t_states = 14336ULL;
+    int contended_48k = cpu_step(&cpu);
+
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
+    memory_clear();
+    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
 
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0x7E;
+    memory[0x4000] = 0x22;
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
     total_t_states = 0;
-    int nmi_t = cpu_nmi(&cpu);
-    bool ok = (nmi_t == 11) &&
-              (cpu.reg_PC == 0x0066) &&
-              (cpu.reg_SP == 0xC0FE) &&
-              (cpu.iff1 == 0) &&
-              (cpu.iff2 == 1) &&
-              (memory[0xC0FF] == 0x12) &&
-              (memory[0xC0FE] == 0x34);
+    int base_plus3 = cpu_step(&cpu);
 
-    int retn_t = 0;
-    if (ok) {
-        retn_t = cpu_step(&cpu);
-        ok = (retn_t == 14) &&
-             (cpu.reg_PC == 0x1234) &&
-             (cpu.reg_SP == 0xC100) &&
-             (cpu.iff1 == 1) &&
-             (cpu.iff2 == 1);
-    }
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0x7E;
+    memory[0x4000] = 0x33;
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
+    total_t_states = 14336ULL;
+    int plus3_phase0 = cpu_step(&cpu);
 
-    if (!ok) {
-        printf("    NMI state PC=%04X SP=%04X IFF1=%d IFF2=%d stack=%02X%02X nmi_t=%d retn_t=%d\n",
-               cpu.reg_PC,
-               cpu.reg_SP,
-               cpu.iff1,
-               cpu.iff2,
-               memory[0xC0FF],
-               memory[0xC0FE],
-               nmi_t,
-               retn_t);
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0x7E;
+    memory[0x4000] = 0x44;
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0x40;
+    cpu.reg_L = 0x00;
+    total_t_states = 14337ULL;
+    int plus3_phase1 = cpu_step(&cpu);
+
+    int early_penalty = contended_48k - base_48k;
+    int plus3_penalty0 = plus3_phase0 - base_plus3;
+    int plus3_penalty1 = plus3_phase1 - base_plus3;
+
+    bool base_matches = (base_plus3 == base_48k);
+    bool early_profile_penalises = (early_penalty > 0);
+    bool late_profile_offsets = base_matches &&
+                                (plus3_penalty0 == early_penalty + 1) &&
+                                (plus3_penalty1 == early_penalty) &&
+                                (plus3_phase0 > plus3_phase1);
+
+    if (!early_profile_penalises || !late_profile_offsets) {
+        printf("    late gate-array debug 48k=%d/%d(+%d) plus3=%d/%d/%d(+%d/+%d) base_match=%d\n",
+               contended_48k,
+               base_48k,
+               early_penalty,
+               base_plus3,
+               plus3_phase0,
+               plus3_phase1,
+               plus3_penalty0,
+               plus3_penalty1,
+               base_matches);
     }
 
     spectrum_configure_model(previous_model);
     memory_clear();
-    return ok;
+    spectrum_set_contention_profile(previous_profile);
+    spectrum_set_peripheral_contention_profile(previous_peripheral);
+
+    return early_profile_penalises && late_profile_offsets;
 }
 
-static bool test_floating_bus_samples_screen_memory(void) {
+static bool test_plus3_peripheral_wait_states(void) {
     SpectrumModel previous_model = spectrum_model;
     SpectrumContentionProfile previous_profile = spectrum_contention_profile;
     PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
 
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
     memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
+    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
     spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
 
-    memory[VRAM_START] = 0x3Cu;
-    memory[ATTR_START] = 0x5Au;
-    spectrum_reset_floating_bus();
-
     Z80 cpu;
     cpu_reset_state(&cpu);
     memory[0x0000] = 0xDB; // IN A,(n)
-    memory[0x0001] = 0xFF; // Port 0xFF (floating bus)
-
-    const uint64_t pixel_target = 14336u + 48u;
-    total_t_states = pixel_target - 4u;
+    memory[0x0001] = 0xFF;
+    cpu.reg_A = 0x00;
     cpu.reg_PC = 0x0000;
-    int pixel_t = cpu_step(&cpu);
-    uint8_t pixel_sample = cpu.reg_A;
+    total_t_states = 0;
+    int base_t = cpu_step(&cpu);
 
     cpu_reset_state(&cpu);
-    spectrum_reset_floating_bus();
     memory[0x0000] = 0xDB;
     memory[0x0001] = 0xFF;
-    const uint64_t attr_target = 14336u + 50u;
-    total_t_states = attr_target - 4u;
+    cpu.reg_A = 0x00;
     cpu.reg_PC = 0x0000;
-    int attr_t = cpu_step(&cpu);
-    uint8_t attr_sample = cpu.reg_A;
-
-    bool timings_ok = (pixel_t >= 11) && (attr_t >= 11);
-    bool samples_ok = (pixel_sample == 0x3Cu) && (attr_sample == 0x5Au);
+    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_PLUS3);
+    total_t_states = 0;
+    int plus3_t = cpu_step(&cpu);
 
-    if (!(timings_ok && samples_ok)) {
-        printf("    floating bus debug pixel=%02X attr=%02X t_pix=%d t_attr=%d\n",
-               pixel_sample,
-               attr_sample,
-               pixel_t,
-               attr_t);
+    bool wait_states_ok = (plus3_t == base_t + 3);
+    if (!wait_states_ok) {
+        printf("    plus3 peripheral wait debug base=%d wait=%d\n", base_t, plus3_t);
     }
 
     spectrum_configure_model(previous_model);
@@ -10097,1359 +13859,3053 @@ static bool test_floating_bus_samples_screen_memory(void) {
     spectrum_set_contention_profile(previous_profile);
     spectrum_set_peripheral_contention_profile(previous_peripheral);
 
-    return timings_ok && samples_ok;
+    return wait_states_ok;
+}
+
+static bool test_128k_bank_switching(void) {
+    SpectrumModel previous_model = spectrum_model;
+    spectrum_configure_model(SPECTRUM_MODEL_128K);
+    memory_clear();
+
+    writeByte(0xC000, 0x12);
+    uint8_t before_flag = page_contended[3];
+
+    io_write(0x7FFD, 0x01); // Page bank 1 into 0xC000
+    uint8_t during_flag = page_contended[3];
+    bool saved_bank0 = (ram_pages[0][0] == 0x12) && (memory[0xC000] == 0x00);
+
+    writeByte(0xC000, 0x77);
+    bool bank1_written = (ram_pages[1][0] == 0x77);
+
+    io_write(0x7FFD, 0x00); // Restore bank 0
+    uint8_t after_flag = page_contended[3];
+    bool restored = (memory[0xC000] == 0x12);
+
+    spectrum_configure_model(previous_model);
+    memory_clear();
+
+    return (before_flag == 0u) && (during_flag == 1u) && (after_flag == 0u) && saved_bank0 && bank1_written && restored;
+}
+
+static bool test_128k_contention_penalty(void) {
+    SpectrumModel previous_model = spectrum_model;
+    spectrum_configure_model(SPECTRUM_MODEL_128K);
+    memory_clear();
+
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    memory[0x0000] = 0x7E; // LD A,(HL)
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0xC0;
+    cpu.reg_L = 0x00;
+    writeByte(0xC000, 0x42); // Bank 0 (uncontended)
+    total_t_states = 14336ULL;
+    int uncontended_t = cpu_step(&cpu);
+    bool base_ok = (cpu.reg_A == 0x42);
+
+    cpu_reset_state(&cpu);
+    cpu.reg_PC = 0x0000;
+    cpu.reg_H = 0xC0;
+    cpu.reg_L = 0x00;
+    memory[0x0000] = 0x7E;
+    io_write(0x7FFD, 0x01); // Switch to contended bank 1
+    writeByte(0xC000, 0x24);
+    total_t_states = 14336ULL;
+    int contended_t = cpu_step(&cpu);
+    bool cont_ok = (cpu.reg_A == 0x24);
+    uint8_t observed_mem = memory[0xC000];
+    uint8_t observed_a = cpu.reg_A;
+    io_write(0x7FFD, 0x00);
+
+    spectrum_configure_model(previous_model);
+    memory_clear();
+
+    bool ok = base_ok && cont_ok && (contended_t > uncontended_t);
+    if (!ok) {
+        printf("    contention debug base=%d cont=%d base_ok=%d cont_ok=%d mem=%02X a=%02X\n",
+               uncontended_t,
+               contended_t,
+               base_ok,
+               cont_ok,
+               observed_mem,
+               observed_a);
+    }
+    return ok;
 }
 
-static bool test_plus2a_contention_profile(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
-
-    spectrum_configure_model(SPECTRUM_MODEL_128K);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS2A);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+static const char snapshot_fixture_default_dir[] = "tests/snapshots";
 
-    spectrum_map_upper_bank(4u);
-    spectrum_update_contention_flags();
-    uint8_t contended_bank4 = page_contended[3];
+static int snapshot_fixture_path(char* buffer,
+                                 size_t capacity,
+                                 const char* override_dir,
+                                 const char* filename) {
+    if (!buffer || capacity == 0u || !filename) {
+        return 0;
+    }
 
-    spectrum_map_upper_bank(2u);
-    spectrum_update_contention_flags();
-    uint8_t contended_bank2 = page_contended[3];
+    const char* base = snapshot_fixture_default_dir;
+    if (override_dir && override_dir[0] != '\0') {
+        base = override_dir;
+    }
 
-    uint8_t screen_flag = page_contended[1];
+    int required = snprintf(buffer, capacity, "%s/%s", base, filename);
+    if (required < 0 || (size_t)required >= capacity) {
+        return 0;
+    }
+    return 1;
+}
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
+static int snapshot_fixture_file_exists(const char* path) {
+    if (!path) {
+        return 0;
+    }
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    fclose(file);
+    return 1;
+}
 
-    return (contended_bank4 == 1u) && (contended_bank2 == 0u) && (screen_flag == 1u);
+static int snapshot_fixture_ensure_directory(const char* path) {
+    if (!path || path[0] == '\0') {
+        return 0;
+    }
+#ifdef _WIN32
+    if (_mkdir(path) == 0 || errno == EEXIST) {
+        return 1;
+    }
+#else
+    if (mkdir(path, 0777) == 0 || errno == EEXIST) {
+        return 1;
+    }
+#endif
+    fprintf(stderr, "Failed to create directory '%s': %s\n", path, strerror(errno));
+    return 0;
 }
 
-static bool test_plus3_rom_and_all_ram_paging(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+static int snapshot_fixture_uses_default_dir(const char* override_dir) {
+    if (!override_dir || override_dir[0] == '\0') {
+        return 1;
+    }
+    return strcmp(override_dir, snapshot_fixture_default_dir) == 0;
+}
 
-    uint8_t previous_rom_count = rom_page_count;
+static int snapshot_fixture_decode_base64(const char* source_path, const char* output_path) {
+    FILE* input = fopen(source_path, "rb");
+    if (!input) {
+        fprintf(stderr, "Failed to open Base64 snapshot '%s': %s\n", source_path, strerror(errno));
+        return 0;
+    }
 
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+    if (fseek(input, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Failed to seek within Base64 snapshot '%s'\n", source_path);
+        fclose(input);
+        return 0;
+    }
 
-    rom_page_count = 4u;
-    for (uint8_t i = 0; i < 4u; ++i) {
-        memset(rom_pages[i], (int)(0x30u + i), 0x4000);
+    long raw_size = ftell(input);
+    if (raw_size < 0) {
+        fprintf(stderr, "Failed to determine size of Base64 snapshot '%s'\n", source_path);
+        fclose(input);
+        return 0;
+    }
+    if (fseek(input, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to rewind Base64 snapshot '%s'\n", source_path);
+        fclose(input);
+        return 0;
     }
-    spectrum_map_rom_page(0u);
 
-    uint8_t rom0_val = readByte(0x0000);
-    bool rom0_ok = (rom0_val == 0x30u);
+    char* buffer = (char*)malloc((size_t)raw_size);
+    if (!buffer) {
+        fprintf(stderr, "Out of memory decoding Base64 snapshot '%s'\n", source_path);
+        fclose(input);
+        return 0;
+    }
 
-    io_write(0x7FFD, 0x10u);
-    io_write(0x1FFD, 0x01u);
-    uint8_t rom3_val = readByte(0x0000);
-    bool rom3_ok = (rom3_val == 0x33u);
+    size_t read = fread(buffer, 1u, (size_t)raw_size, input);
+    fclose(input);
+    if (read != (size_t)raw_size) {
+        fprintf(stderr, "Failed to read Base64 snapshot '%s'\n", source_path);
+        free(buffer);
+        return 0;
+    }
 
-    ram_pages[0][0] = 0xAAu;
-    io_write(0x1FFD, 0x02u);
-    uint8_t all_ram_val = readByte(0x0000);
-    bool all_ram_ok = (all_ram_val == 0xAAu);
+    size_t cleaned_length = 0u;
+    for (size_t i = 0; i < read; ++i) {
+        unsigned char ch = (unsigned char)buffer[i];
+        if (ch == '\r' || ch == '\n' || ch == '\t' || ch == ' ') {
+            continue;
+        }
+        buffer[cleaned_length++] = (char)ch;
+    }
 
-    io_write(0x1FFD, 0x01u);
-    uint8_t rom_restore_val = readByte(0x0000);
-    bool rom_restore_ok = (rom_restore_val == 0x33u);
+    if ((cleaned_length % 4u) != 0u) {
+        fprintf(stderr, "Base64 snapshot '%s' has invalid length\n", source_path);
+        free(buffer);
+        return 0;
+    }
 
-    if (!(rom0_ok && rom3_ok && all_ram_ok && rom_restore_ok)) {
-        printf("    plus3 rom debug: rom0=%02X rom3=%02X all_ram=%02X restore=%02X\n",
-               rom0_val,
-               rom3_val,
-               all_ram_val,
-               rom_restore_val);
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        fprintf(stderr, "Failed to create snapshot fixture '%s': %s\n", output_path, strerror(errno));
+        free(buffer);
+        return 0;
     }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
-    rom_page_count = previous_rom_count;
-    spectrum_apply_memory_configuration();
+    int success = 1;
+    for (size_t i = 0; i < cleaned_length; i += 4u) {
+        unsigned char c0 = (unsigned char)buffer[i + 0u];
+        unsigned char c1 = (unsigned char)buffer[i + 1u];
+        unsigned char c2 = (unsigned char)buffer[i + 2u];
+        unsigned char c3 = (unsigned char)buffer[i + 3u];
 
-    return rom0_ok && rom3_ok && all_ram_ok && rom_restore_ok;
-}
+        if (c0 == '=' || c1 == '=') {
+            success = 0;
+            break;
+        }
 
-static bool test_plus3_special_paging_modes(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
-    uint8_t previous_rom_count = rom_page_count;
+        int v0;
+        int v1;
+        int v2 = -1;
+        int v3 = -1;
 
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+        if (c0 >= 'A' && c0 <= 'Z') {
+            v0 = (int)(c0 - 'A');
+        } else if (c0 >= 'a' && c0 <= 'z') {
+            v0 = (int)(c0 - 'a' + 26);
+        } else if (c0 >= '0' && c0 <= '9') {
+            v0 = (int)(c0 - '0' + 52);
+        } else if (c0 == '+') {
+            v0 = 62;
+        } else if (c0 == '/') {
+            v0 = 63;
+        } else {
+            success = 0;
+            break;
+        }
 
-    uint8_t markers[8];
-    for (uint8_t bank = 0; bank < 8u; ++bank) {
-        markers[bank] = (uint8_t)(0x40u + bank);
-        memset(ram_pages[bank], 0, 0x4000);
-    }
+        if (c1 >= 'A' && c1 <= 'Z') {
+            v1 = (int)(c1 - 'A');
+        } else if (c1 >= 'a' && c1 <= 'z') {
+            v1 = (int)(c1 - 'a' + 26);
+        } else if (c1 >= '0' && c1 <= '9') {
+            v1 = (int)(c1 - '0' + 52);
+        } else if (c1 == '+') {
+            v1 = 62;
+        } else if (c1 == '/') {
+            v1 = 63;
+        } else {
+            success = 0;
+            break;
+        }
 
-    writeByte(0x4000, markers[5]);
-    writeByte(0x8000, markers[2]);
-    writeByte(0xC000, markers[0]);
-    for (uint8_t bank = 1; bank < 8u; ++bank) {
-        spectrum_map_upper_bank(bank);
-        writeByte(0xC000, markers[bank]);
-    }
-    spectrum_map_upper_bank(0u);
+        if (c2 != '=') {
+            if (c2 >= 'A' && c2 <= 'Z') {
+                v2 = (int)(c2 - 'A');
+            } else if (c2 >= 'a' && c2 <= 'z') {
+                v2 = (int)(c2 - 'a' + 26);
+            } else if (c2 >= '0' && c2 <= '9') {
+                v2 = (int)(c2 - '0' + 52);
+            } else if (c2 == '+') {
+                v2 = 62;
+            } else if (c2 == '/') {
+                v2 = 63;
+            } else {
+                success = 0;
+                break;
+            }
+        }
+
+        if (c3 != '=') {
+            if (c3 >= 'A' && c3 <= 'Z') {
+                v3 = (int)(c3 - 'A');
+            } else if (c3 >= 'a' && c3 <= 'z') {
+                v3 = (int)(c3 - 'a' + 26);
+            } else if (c3 >= '0' && c3 <= '9') {
+                v3 = (int)(c3 - '0' + 52);
+            } else if (c3 == '+') {
+                v3 = 62;
+            } else if (c3 == '/') {
+                v3 = 63;
+            } else {
+                success = 0;
+                break;
+            }
+        }
 
-    static const uint8_t maps[4][4] = {
-        {0u, 1u, 2u, 3u},
-        {4u, 5u, 6u, 7u},
-        {4u, 5u, 6u, 3u},
-        {4u, 7u, 6u, 3u}
-    };
+        uint32_t triple = ((uint32_t)v0 << 18) | ((uint32_t)v1 << 12);
+        if (c2 != '=') {
+            triple |= ((uint32_t)v2 << 6);
+        }
+        if (c3 != '=') {
+            triple |= (uint32_t)v3;
+        }
 
-    bool mapping_ok = true;
-    for (uint8_t config = 0; config < 4u; ++config) {
-        io_write(0x1FFD, (uint8_t)(0x04u | config));
-        for (uint8_t page = 0; page < 4u; ++page) {
-            uint16_t addr = (uint16_t)(page * 0x4000u);
-            uint8_t expected = markers[maps[config][page]];
-            uint8_t observed = readByte(addr);
-            if (observed != expected) {
-                mapping_ok = false;
-                printf("    plus3 special debug config=%u page=%u expect=%02X got=%02X\n",
-                       (unsigned)config,
-                       (unsigned)page,
-                       expected,
-                       observed);
+        fputc((int)((triple >> 16) & 0xFFu), output);
+        if (c2 != '=') {
+            fputc((int)((triple >> 8) & 0xFFu), output);
+            if (c3 != '=') {
+                fputc((int)(triple & 0xFFu), output);
             }
+        } else if (c3 != '=') {
+            success = 0;
+            break;
         }
-        if (current_screen_bank != maps[config][1]) {
-            mapping_ok = false;
-            printf("    plus3 special screen config=%u expect bank %u got %u\n",
-                   (unsigned)config,
-                   (unsigned)maps[config][1],
-                   (unsigned)current_screen_bank);
+
+        if ((c2 == '=' || c3 == '=') && (i + 4u) != cleaned_length) {
+            success = 0;
+            break;
         }
     }
 
-    io_write(0x1FFD, 0x04u);
-    io_write(0x7FFD, 0x20u);
-    io_write(0x1FFD, 0x05u);
-    uint8_t disable_low = readByte(0x0000);
-    uint8_t disable_high = readByte(0x4000);
-    bool disable_ok = (disable_low == markers[maps[0][0]]) &&
-                      (disable_high == markers[maps[0][1]]);
-    if (!disable_ok) {
-        printf("    plus3 special disable expect %02X/%02X got %02X/%02X\n",
-               markers[maps[0][0]],
-               markers[maps[0][1]],
-               disable_low,
-               disable_high);
+    free(buffer);
+
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Failed to finalize snapshot fixture '%s': %s\n", output_path, strerror(errno));
+        success = 0;
     }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
-    rom_page_count = previous_rom_count;
-    spectrum_apply_memory_configuration();
+    if (!success) {
+        fprintf(stderr, "Failed to decode Base64 snapshot '%s'\n", source_path);
+        remove(output_path);
+    }
 
-    return mapping_ok && disable_ok;
+    return success;
 }
 
-static bool test_peripheral_port_contention(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
-
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
-
-    memory[VRAM_START] = 0x66u;
-    memory[0x0000] = 0xDB;
-    memory[0x0001] = 0xFF;
-
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    total_t_states = (14336u + 48u) - 4u;
-    cpu.reg_PC = 0x0000;
-    int base_t = cpu_step(&cpu);
+static int snapshot_fixture_generate_base64(const char* filename, const char* output_path) {
+    if (!filename || !output_path) {
+        return 0;
+    }
 
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0xDB;
-    memory[0x0001] = 0xFF;
-    spectrum_reset_floating_bus();
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_IF1);
-    total_t_states = (14336u + 48u) - 4u;
-    cpu.reg_PC = 0x0000;
-    int contended_t = cpu_step(&cpu);
+    char encoded_name[256];
+    int encoded_len = snprintf(encoded_name, sizeof(encoded_name), "%s.b64", filename);
+    if (encoded_len < 0 || (size_t)encoded_len >= sizeof(encoded_name)) {
+        return 0;
+    }
 
-    bool contention_effective = contended_t > base_t;
+    char encoded_path[PATH_MAX];
+    if (!snapshot_fixture_path(encoded_path, sizeof(encoded_path), NULL, encoded_name)) {
+        return 0;
+    }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
+    if (!snapshot_fixture_file_exists(encoded_path)) {
+        return 0;
+    }
 
-    return contention_effective;
+    return snapshot_fixture_decode_base64(encoded_path, output_path);
 }
 
-static bool test_plus3_contention_penalty_shift(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
-
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_48K);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
-
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E; // LD A,(HL)
-    memory[0x4000] = 0x11;
-
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    total_t_states = 0;
-    int base_48k = cpu_step(&cpu);
-
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E;
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    total_t_states = 14336ULL;
-    int contended_48k = cpu_step(&cpu);
-
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
-
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E;
-    memory[0x4000] = 0x22;
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    total_t_states = 0;
-    int base_plus3 = cpu_step(&cpu);
-
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E;
-    memory[0x4000] = 0x33;
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    total_t_states = 14336ULL;
-    int plus3_phase0 = cpu_step(&cpu);
+static void snapshot_fixture_fill_standard_header(uint8_t header[27]) {
+    static const uint8_t snapshot_header_template[27] = {
+        0x3F,       // I
+        0x22, 0x11, // HL'
+        0x44, 0x33, // DE'
+        0x66, 0x55, // BC'
+        0x88, 0x77, // AF'
+        0xAA, 0x99, // HL
+        0xCC, 0xBB, // DE
+        0xEE, 0xDD, // BC
+        0x34, 0x12, // IY
+        0x78, 0x56, // IX
+        0x01,       // IFF2
+        0xA5,       // R
+        0xE1, 0xF0, // AF
+        0xE0, 0xFF, // SP
+        0x02,       // IM
+        0x04        // Border colour
+    };
+    memcpy(header, snapshot_header_template, sizeof(snapshot_header_template));
+}
 
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E;
-    memory[0x4000] = 0x44;
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0x40;
-    cpu.reg_L = 0x00;
-    total_t_states = 14337ULL;
-    int plus3_phase1 = cpu_step(&cpu);
+static int snapshot_fixture_write_ram_block(FILE* out, uint8_t value, size_t size) {
+    if (!out || size == 0u) {
+        return 0;
+    }
 
-    int early_penalty = contended_48k - base_48k;
-    int plus3_penalty0 = plus3_phase0 - base_plus3;
-    int plus3_penalty1 = plus3_phase1 - base_plus3;
+    uint8_t block[0x4000];
+    size_t chunk = sizeof(block);
+    while (size > 0u) {
+        size_t to_write = (size < chunk) ? size : chunk;
+        memset(block, value, to_write);
+        if (fwrite(block, 1u, to_write, out) != to_write) {
+            return 0;
+        }
+        size -= to_write;
+    }
+    return 1;
+}
 
-    bool base_matches = (base_plus3 == base_48k);
-    bool early_profile_penalises = (early_penalty > 0);
-    bool late_profile_offsets = base_matches &&
-                                (plus3_penalty0 == early_penalty + 1) &&
-                                (plus3_penalty1 == early_penalty) &&
-                                (plus3_phase0 > plus3_phase1);
+static int snapshot_fixture_generate_sna_48k(const char* output_path) {
+    FILE* out = fopen(output_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to create 48K SNA fixture '%s': %s\n", output_path, strerror(errno));
+        return 0;
+    }
 
-    if (!early_profile_penalises || !late_profile_offsets) {
-        printf("    late gate-array debug 48k=%d/%d(+%d) plus3=%d/%d/%d(+%d/+%d) base_match=%d\n",
-               contended_48k,
-               base_48k,
-               early_penalty,
-               base_plus3,
-               plus3_phase0,
-               plus3_phase1,
-               plus3_penalty0,
-               plus3_penalty1,
-               base_matches);
+    uint8_t header[27];
+    snapshot_fixture_fill_standard_header(header);
+    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x10u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x20u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x30u, 0x4000u);
+    uint8_t pc_bytes[2] = {0x00u, 0x40u};
+    if (ok) {
+        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
     }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
 
-    return early_profile_penalises && late_profile_offsets;
-}
+    if (!ok) {
+        fprintf(stderr, "Failed to synthesise 48K SNA fixture '%s'\n", output_path);
+        remove(output_path);
+    }
 
-static bool test_plus3_peripheral_wait_states(void) {
-    SpectrumModel previous_model = spectrum_model;
-    SpectrumContentionProfile previous_profile = spectrum_contention_profile;
-    PeripheralContentionProfile previous_peripheral = peripheral_contention_profile;
+    return ok;
+}
 
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    memory_clear();
-    spectrum_set_contention_profile(CONTENTION_PROFILE_128K_PLUS3);
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_NONE);
+static int snapshot_fixture_generate_sna_128k_locked(const char* output_path) {
+    FILE* out = fopen(output_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to create 128K SNA fixture '%s': %s\n", output_path, strerror(errno));
+        return 0;
+    }
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0xDB; // IN A,(n)
-    memory[0x0001] = 0xFF;
-    cpu.reg_A = 0x00;
-    cpu.reg_PC = 0x0000;
-    total_t_states = 0;
-    int base_t = cpu_step(&cpu);
+    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
 
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0xDB;
-    memory[0x0001] = 0xFF;
-    cpu.reg_A = 0x00;
-    cpu.reg_PC = 0x0000;
-    spectrum_set_peripheral_contention_profile(PERIPHERAL_CONTENTION_PLUS3);
-    total_t_states = 0;
-    int plus3_t = cpu_step(&cpu);
+    uint8_t header[27];
+    snapshot_fixture_fill_standard_header(header);
+    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x55u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x22u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x55u, 0x4000u);
+    uint8_t pc_bytes[2] = {0x00u, 0x40u};
+    if (ok) {
+        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
+    }
+    uint8_t ports[2] = {0x25u, 0x00u};
+    if (ok) {
+        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
+    }
+    for (int bank = 0; ok && bank < 8; ++bank) {
+        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    }
 
-    bool wait_states_ok = (plus3_t == base_t + 3);
-    if (!wait_states_ok) {
-        printf("    plus3 peripheral wait debug base=%d wait=%d\n", base_t, plus3_t);
+    if (fclose(out) != 0) {
+        ok = 0;
     }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
-    spectrum_set_contention_profile(previous_profile);
-    spectrum_set_peripheral_contention_profile(previous_peripheral);
+    if (!ok) {
+        fprintf(stderr, "Failed to synthesise 128K SNA fixture '%s'\n", output_path);
+        remove(output_path);
+    }
 
-    return wait_states_ok;
+    return ok;
 }
 
-static bool test_128k_bank_switching(void) {
-    SpectrumModel previous_model = spectrum_model;
-    spectrum_configure_model(SPECTRUM_MODEL_128K);
-    memory_clear();
-
-    writeByte(0xC000, 0x12);
-    uint8_t before_flag = page_contended[3];
+static int snapshot_fixture_generate_sna_plus2a_special(const char* output_path) {
+    FILE* out = fopen(output_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to create +2A SNA fixture '%s': %s\n", output_path, strerror(errno));
+        return 0;
+    }
 
-    io_write(0x7FFD, 0x01); // Page bank 1 into 0xC000
-    uint8_t during_flag = page_contended[3];
-    bool saved_bank0 = (ram_pages[0][0] == 0x12) && (memory[0xC000] == 0x00);
+    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
 
-    writeByte(0xC000, 0x77);
-    bool bank1_written = (ram_pages[1][0] == 0x77);
+    uint8_t header[27];
+    snapshot_fixture_fill_standard_header(header);
+    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
+    ok = ok && snapshot_fixture_write_ram_block(out, 0xAAu, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0xBBu, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0xCCu, 0x4000u);
+    uint8_t pc_bytes[2] = {0x00u, 0x40u};
+    if (ok) {
+        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
+    }
+    uint8_t ports[2] = {0x02u, 0x00u};
+    if (ok) {
+        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
+    }
+    for (int bank = 0; ok && bank < 8; ++bank) {
+        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    }
+    uint8_t port_1ffd = 0x05u;
+    if (ok) {
+        ok = (fwrite(&port_1ffd, 1u, 1u, out) == 1u);
+    }
 
-    io_write(0x7FFD, 0x00); // Restore bank 0
-    uint8_t after_flag = page_contended[3];
-    bool restored = (memory[0xC000] == 0x12);
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
+    if (!ok) {
+        fprintf(stderr, "Failed to synthesise +2A SNA fixture '%s'\n", output_path);
+        remove(output_path);
+    }
 
-    return (before_flag == 0u) && (during_flag == 1u) && (after_flag == 0u) && saved_bank0 && bank1_written && restored;
+    return ok;
 }
 
-static bool test_128k_contention_penalty(void) {
-    SpectrumModel previous_model = spectrum_model;
-    spectrum_configure_model(SPECTRUM_MODEL_128K);
-    memory_clear();
+static int snapshot_fixture_generate_sna_plus3_rompaging(const char* output_path) {
+    FILE* out = fopen(output_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to create +3 SNA fixture '%s': %s\n", output_path, strerror(errno));
+        return 0;
+    }
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    memory[0x0000] = 0x7E; // LD A,(HL)
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0xC0;
-    cpu.reg_L = 0x00;
-    writeByte(0xC000, 0x42); // Bank 0 (uncontended)
-    total_t_states = 14336ULL;
-    int uncontended_t = cpu_step(&cpu);
-    bool base_ok = (cpu.reg_A == 0x42);
+    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
 
-    cpu_reset_state(&cpu);
-    cpu.reg_PC = 0x0000;
-    cpu.reg_H = 0xC0;
-    cpu.reg_L = 0x00;
-    memory[0x0000] = 0x7E;
-    io_write(0x7FFD, 0x01); // Switch to contended bank 1
-    writeByte(0xC000, 0x24);
-    total_t_states = 14336ULL;
-    int contended_t = cpu_step(&cpu);
-    bool cont_ok = (cpu.reg_A == 0x24);
-    uint8_t observed_mem = memory[0xC000];
-    uint8_t observed_a = cpu.reg_A;
-    io_write(0x7FFD, 0x00);
+    uint8_t header[27];
+    snapshot_fixture_fill_standard_header(header);
+    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
+    ok = ok && snapshot_fixture_write_ram_block(out, 0x90u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0xA0u, 0x4000u);
+    ok = ok && snapshot_fixture_write_ram_block(out, 0xB0u, 0x4000u);
+    uint8_t pc_bytes[2] = {0x00u, 0x40u};
+    if (ok) {
+        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
+    }
+    uint8_t ports[2] = {0x14u, 0x00u};
+    if (ok) {
+        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
+    }
+    for (int bank = 0; ok && bank < 8; ++bank) {
+        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    }
+    uint8_t port_1ffd = 0x01u;
+    if (ok) {
+        ok = (fwrite(&port_1ffd, 1u, 1u, out) == 1u);
+    }
 
-    spectrum_configure_model(previous_model);
-    memory_clear();
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
 
-    bool ok = base_ok && cont_ok && (contended_t > uncontended_t);
     if (!ok) {
-        printf("    contention debug base=%d cont=%d base_ok=%d cont_ok=%d mem=%02X a=%02X\n",
-               uncontended_t,
-               contended_t,
-               base_ok,
-               cont_ok,
-               observed_mem,
-               observed_a);
+        fprintf(stderr, "Failed to synthesise +3 SNA fixture '%s'\n", output_path);
+        remove(output_path);
     }
+
     return ok;
 }
 
-static const char snapshot_fixture_default_dir[] = "tests/snapshots";
-
-static int snapshot_fixture_path(char* buffer,
-                                 size_t capacity,
-                                 const char* override_dir,
-                                 const char* filename) {
-    if (!buffer || capacity == 0u || !filename) {
+static int snapshot_fixture_generate_sna(const char* filename, const char* output_path) {
+    if (!filename || !output_path) {
         return 0;
     }
 
-    const char* base = snapshot_fixture_default_dir;
-    if (override_dir && override_dir[0] != '\0') {
-        base = override_dir;
+    if (strcmp(filename, "48k-basic.sna") == 0) {
+        return snapshot_fixture_generate_sna_48k(output_path);
     }
-
-    int required = snprintf(buffer, capacity, "%s/%s", base, filename);
-    if (required < 0 || (size_t)required >= capacity) {
-        return 0;
+    if (strcmp(filename, "128k-locked-bank5.sna") == 0) {
+        return snapshot_fixture_generate_sna_128k_locked(output_path);
     }
-    return 1;
+    if (strcmp(filename, "plus2a-special.sna") == 0) {
+        return snapshot_fixture_generate_sna_plus2a_special(output_path);
+    }
+    if (strcmp(filename, "plus3-rompaging.sna") == 0) {
+        return snapshot_fixture_generate_sna_plus3_rompaging(output_path);
+    }
+    return 0;
 }
 
-static int snapshot_fixture_file_exists(const char* path) {
-    if (!path) {
+static int snapshot_fixture_generate_default(char* buffer,
+                                             size_t capacity,
+                                             const char* filename) {
+    if (!buffer || capacity == 0u || !filename) {
         return 0;
     }
-    FILE* file = fopen(path, "rb");
-    if (!file) {
+
+    char generated_dir[PATH_MAX];
+    if (!snapshot_fixture_path(generated_dir, sizeof(generated_dir), snapshot_fixture_default_dir, "generated")) {
         return 0;
     }
-    fclose(file);
-    return 1;
-}
 
-static int snapshot_fixture_ensure_directory(const char* path) {
-    if (!path || path[0] == '\0') {
+    if (!snapshot_fixture_ensure_directory(generated_dir)) {
+        return 0;
+    }
+
+    if (!snapshot_fixture_path(buffer, capacity, generated_dir, filename)) {
         return 0;
     }
-#ifdef _WIN32
-    if (_mkdir(path) == 0 || errno == EEXIST) {
+
+    if (snapshot_fixture_generate_sna(filename, buffer)) {
         return 1;
     }
-#else
-    if (mkdir(path, 0777) == 0 || errno == EEXIST) {
+
+    if (snapshot_fixture_generate_base64(filename, buffer)) {
         return 1;
     }
-#endif
-    fprintf(stderr, "Failed to create directory '%s': %s\n", path, strerror(errno));
+
+    fprintf(stderr, "Snapshot fixture '%s' is missing (no generator or Base64 source)\n", filename);
+    remove(buffer);
     return 0;
 }
 
-static int snapshot_fixture_uses_default_dir(const char* override_dir) {
-    if (!override_dir || override_dir[0] == '\0') {
-        return 1;
+static int snapshot_fixture_resolve(char* buffer,
+                                    size_t capacity,
+                                    const char* override_dir,
+                                    const char* filename) {
+    if (!snapshot_fixture_path(buffer, capacity, override_dir, filename)) {
+        return 0;
     }
-    return strcmp(override_dir, snapshot_fixture_default_dir) == 0;
-}
 
-static int snapshot_fixture_decode_base64(const char* source_path, const char* output_path) {
-    FILE* input = fopen(source_path, "rb");
-    if (!input) {
-        fprintf(stderr, "Failed to open Base64 snapshot '%s': %s\n", source_path, strerror(errno));
-        return 0;
+    if (snapshot_fixture_file_exists(buffer)) {
+        return 1;
     }
 
-    if (fseek(input, 0, SEEK_END) != 0) {
-        fprintf(stderr, "Failed to seek within Base64 snapshot '%s'\n", source_path);
-        fclose(input);
+    if (!snapshot_fixture_uses_default_dir(override_dir)) {
+        fprintf(stderr, "Snapshot fixture '%s' not found in '%s'\n", filename, override_dir);
         return 0;
     }
 
-    long raw_size = ftell(input);
-    if (raw_size < 0) {
-        fprintf(stderr, "Failed to determine size of Base64 snapshot '%s'\n", source_path);
-        fclose(input);
-        return 0;
+    return snapshot_fixture_generate_default(buffer, capacity, filename);
+}
+
+static bool memory_block_matches(uint16_t base, uint8_t value) {
+    static const uint16_t offsets[] = {0x0000u, 0x1FFFu, 0x3FFFu};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        uint16_t addr = (uint16_t)(base + offsets[i]);
+        if (memory[addr] != value) {
+            return false;
+        }
     }
-    if (fseek(input, 0, SEEK_SET) != 0) {
-        fprintf(stderr, "Failed to rewind Base64 snapshot '%s'\n", source_path);
-        fclose(input);
-        return 0;
+    return true;
+}
+
+static bool test_snapshot_sna_48k(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "48k-basic.sna")) {
+        printf("    failed to prepare fixture 48k-basic.sna\n");
+        return false;
     }
 
-    char* buffer = (char*)malloc((size_t)raw_size);
-    if (!buffer) {
-        fprintf(stderr, "Out of memory decoding Base64 snapshot '%s'\n", source_path);
-        fclose(input);
-        return 0;
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
+
+    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
+        return false;
     }
 
-    size_t read = fread(buffer, 1u, (size_t)raw_size, input);
-    fclose(input);
-    if (read != (size_t)raw_size) {
-        fprintf(stderr, "Failed to read Base64 snapshot '%s'\n", source_path);
-        free(buffer);
-        return 0;
+    bool main_regs_ok = (cpu.reg_A == 0xF0u) && (cpu.reg_F == 0xE1u) &&
+                        (cpu.reg_B == 0xDDu) && (cpu.reg_C == 0xEEu) &&
+                        (cpu.reg_D == 0xBBu) && (cpu.reg_E == 0xCCu) &&
+                        (cpu.reg_H == 0x99u) && (cpu.reg_L == 0xAAu);
+    bool alt_regs_ok = (cpu.alt_reg_A == 0x77u) && (cpu.alt_reg_F == 0x88u) &&
+                       (cpu.alt_reg_B == 0x55u) && (cpu.alt_reg_C == 0x66u) &&
+                       (cpu.alt_reg_D == 0x33u) && (cpu.alt_reg_E == 0x44u) &&
+                       (cpu.alt_reg_H == 0x11u) && (cpu.alt_reg_L == 0x22u);
+    bool special_regs_ok = (cpu.reg_I == 0x3Fu) && (cpu.reg_R == 0xA5u) &&
+                           (cpu.reg_IX == 0x5678u) && (cpu.reg_IY == 0x1234u) &&
+                           (cpu.reg_SP == 0xFFE0u) && (cpu.reg_PC == 0x4000u);
+    bool interrupt_state_ok = (cpu.iff1 == 1) && (cpu.iff2 == 1) && (cpu.interruptMode == 2);
+    bool model_ok = (spectrum_model == SPECTRUM_MODEL_48K) &&
+                    (current_paged_bank == 7u) &&
+                    (current_rom_page == 0u) &&
+                    (paging_disabled == 0);
+    bool border_ok = (border_color_idx == 0x04u);
+    bool memory_ok = memory_block_matches(0x4000u, 0x10u) &&
+                     memory_block_matches(0x8000u, 0x20u) &&
+                     memory_block_matches(0xC000u, 0x30u);
+
+    if (!memory_ok) {
+        printf("    48K SNA memory mismatch: %02X %02X %02X\n",
+               memory[0x4000], memory[0x8000], memory[0xC000]);
+    }
+    if (!main_regs_ok || !alt_regs_ok || !special_regs_ok || !interrupt_state_ok || !model_ok || !border_ok) {
+        printf("    48K SNA state debug: A=%02X F=%02X PC=%04X SP=%04X IFF1=%d IFF2=%d model=%s border=%u\n",
+               cpu.reg_A,
+               cpu.reg_F,
+               cpu.reg_PC,
+               cpu.reg_SP,
+               cpu.iff1,
+               cpu.iff2,
+               spectrum_model_to_string(spectrum_model),
+               (unsigned)border_color_idx);
     }
 
-    size_t cleaned_length = 0u;
-    for (size_t i = 0; i < read; ++i) {
-        unsigned char ch = (unsigned char)buffer[i];
-        if (ch == '\r' || ch == '\n' || ch == '\t' || ch == ' ') {
-            continue;
-        }
-        buffer[cleaned_length++] = (char)ch;
+    return main_regs_ok && alt_regs_ok && special_regs_ok && interrupt_state_ok &&
+           model_ok && border_ok && memory_ok;
+}
+
+static bool test_snapshot_sna_128k_locked(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "128k-locked-bank5.sna")) {
+        printf("    failed to prepare fixture 128k-locked-bank5.sna\n");
+        return false;
     }
 
-    if ((cleaned_length % 4u) != 0u) {
-        fprintf(stderr, "Base64 snapshot '%s' has invalid length\n", source_path);
-        free(buffer);
-        return 0;
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
+
+    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
+        return false;
     }
 
-    FILE* output = fopen(output_path, "wb");
-    if (!output) {
-        fprintf(stderr, "Failed to create snapshot fixture '%s': %s\n", output_path, strerror(errno));
-        free(buffer);
-        return 0;
+    bool model_ok = (spectrum_model == SPECTRUM_MODEL_128K);
+    bool paging_ok = (paging_disabled == 1) &&
+                     (gate_array_7ffd_state == 0x25u) &&
+                     (current_paged_bank == 5u) &&
+                     (current_screen_bank == 5u) &&
+                     (gate_array_1ffd_state == 0u);
+    bool memory_ok = memory_block_matches(0x4000u, 0x55u) &&
+                     memory_block_matches(0x8000u, 0x22u) &&
+                     memory_block_matches(0xC000u, 0x55u);
+
+    if (!memory_ok || !paging_ok || !model_ok) {
+        printf("    128K SNA debug: model=%s paging=%d bank=%u screen=%u rom=%u 0x4000=%02X 0x8000=%02X 0xC000=%02X\n",
+               spectrum_model_to_string(spectrum_model),
+               paging_disabled,
+               (unsigned)current_paged_bank,
+               (unsigned)current_screen_bank,
+               (unsigned)current_rom_page,
+               memory[0x4000],
+               memory[0x8000],
+               memory[0xC000]);
     }
 
-    int success = 1;
-    for (size_t i = 0; i < cleaned_length; i += 4u) {
-        unsigned char c0 = (unsigned char)buffer[i + 0u];
-        unsigned char c1 = (unsigned char)buffer[i + 1u];
-        unsigned char c2 = (unsigned char)buffer[i + 2u];
-        unsigned char c3 = (unsigned char)buffer[i + 3u];
+    return model_ok && paging_ok && memory_ok;
+}
 
-        if (c0 == '=' || c1 == '=') {
-            success = 0;
-            break;
-        }
+static bool test_snapshot_sna_plus2a_special(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "plus2a-special.sna")) {
+        printf("    failed to prepare fixture plus2a-special.sna\n");
+        return false;
+    }
 
-        int v0;
-        int v1;
-        int v2 = -1;
-        int v3 = -1;
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
 
-        if (c0 >= 'A' && c0 <= 'Z') {
-            v0 = (int)(c0 - 'A');
-        } else if (c0 >= 'a' && c0 <= 'z') {
-            v0 = (int)(c0 - 'a' + 26);
-        } else if (c0 >= '0' && c0 <= '9') {
-            v0 = (int)(c0 - '0' + 52);
-        } else if (c0 == '+') {
-            v0 = 62;
-        } else if (c0 == '/') {
-            v0 = 63;
-        } else {
-            success = 0;
-            break;
-        }
+    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
+        return false;
+    }
 
-        if (c1 >= 'A' && c1 <= 'Z') {
-            v1 = (int)(c1 - 'A');
-        } else if (c1 >= 'a' && c1 <= 'z') {
-            v1 = (int)(c1 - 'a' + 26);
-        } else if (c1 >= '0' && c1 <= '9') {
-            v1 = (int)(c1 - '0' + 52);
-        } else if (c1 == '+') {
-            v1 = 62;
-        } else if (c1 == '/') {
-            v1 = 63;
-        } else {
-            success = 0;
-            break;
-        }
+    bool model_ok = (spectrum_model == SPECTRUM_MODEL_PLUS2A);
+    bool paging_ok = (gate_array_7ffd_state == 0x02u) &&
+                     (gate_array_1ffd_state == 0x05u) &&
+                     (paging_disabled == 0) &&
+                     (current_paged_bank == 2u);
+    bool mapping_ok = (spectrum_pages[0].type == MEMORY_PAGE_RAM && spectrum_pages[0].index == 4u) &&
+                      (spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == 5u) &&
+                      (spectrum_pages[2].type == MEMORY_PAGE_RAM && spectrum_pages[2].index == 6u) &&
+                      (spectrum_pages[3].type == MEMORY_PAGE_RAM && spectrum_pages[3].index == 7u);
+    bool memory_ok = memory_block_matches(0x0000u, 0x44u) &&
+                     memory_block_matches(0x4000u, 0x55u) &&
+                     memory_block_matches(0x8000u, 0x66u) &&
+                     memory_block_matches(0xC000u, 0x77u);
+
+    if (!memory_ok || !mapping_ok || !paging_ok || !model_ok) {
+        printf("    +2A SNA debug: model=%s 7FFD=%02X 1FFD=%02X pages=%u/%u/%u/%u mem=%02X/%02X/%02X/%02X\n",
+               spectrum_model_to_string(spectrum_model),
+               (unsigned)gate_array_7ffd_state,
+               (unsigned)gate_array_1ffd_state,
+               spectrum_pages[0].index,
+               spectrum_pages[1].index,
+               spectrum_pages[2].index,
+               spectrum_pages[3].index,
+               memory[0x0000],
+               memory[0x4000],
+               memory[0x8000],
+               memory[0xC000]);
+    }
 
-        if (c2 != '=') {
-            if (c2 >= 'A' && c2 <= 'Z') {
-                v2 = (int)(c2 - 'A');
-            } else if (c2 >= 'a' && c2 <= 'z') {
-                v2 = (int)(c2 - 'a' + 26);
-            } else if (c2 >= '0' && c2 <= '9') {
-                v2 = (int)(c2 - '0' + 52);
-            } else if (c2 == '+') {
-                v2 = 62;
-            } else if (c2 == '/') {
-                v2 = 63;
-            } else {
-                success = 0;
-                break;
-            }
-        }
+    return model_ok && paging_ok && mapping_ok && memory_ok;
+}
 
-        if (c3 != '=') {
-            if (c3 >= 'A' && c3 <= 'Z') {
-                v3 = (int)(c3 - 'A');
-            } else if (c3 >= 'a' && c3 <= 'z') {
-                v3 = (int)(c3 - 'a' + 26);
-            } else if (c3 >= '0' && c3 <= '9') {
-                v3 = (int)(c3 - '0' + 52);
-            } else if (c3 == '+') {
-                v3 = 62;
-            } else if (c3 == '/') {
-                v3 = 63;
-            } else {
-                success = 0;
-                break;
-            }
-        }
+static bool test_snapshot_sna_plus3_rom(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "plus3-rompaging.sna")) {
+        printf("    failed to prepare fixture plus3-rompaging.sna\n");
+        return false;
+    }
 
-        uint32_t triple = ((uint32_t)v0 << 18) | ((uint32_t)v1 << 12);
-        if (c2 != '=') {
-            triple |= ((uint32_t)v2 << 6);
-        }
-        if (c3 != '=') {
-            triple |= (uint32_t)v3;
-        }
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
+    memory_clear();
+    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
+    border_color_idx = 0u;
 
-        fputc((int)((triple >> 16) & 0xFFu), output);
-        if (c2 != '=') {
-            fputc((int)((triple >> 8) & 0xFFu), output);
-            if (c3 != '=') {
-                fputc((int)(triple & 0xFFu), output);
-            }
-        } else if (c3 != '=') {
-            success = 0;
-            break;
-        }
+    uint8_t previous_rom_count = rom_page_count;
+    rom_page_count = 4u;
 
-        if ((c2 == '=' || c3 == '=') && (i + 4u) != cleaned_length) {
-            success = 0;
-            break;
-        }
-    }
+    spectrum_model = SPECTRUM_MODEL_PLUS3;
+    bool loaded = snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu);
 
-    free(buffer);
+    rom_page_count = previous_rom_count;
 
-    if (fclose(output) != 0) {
-        fprintf(stderr, "Failed to finalize snapshot fixture '%s': %s\n", output_path, strerror(errno));
-        success = 0;
+    if (!loaded) {
+        return false;
     }
 
-    if (!success) {
-        fprintf(stderr, "Failed to decode Base64 snapshot '%s'\n", source_path);
-        remove(output_path);
+    bool model_ok = (spectrum_model == SPECTRUM_MODEL_PLUS3);
+    bool rom_ok = (current_rom_page == 3u) && (spectrum_pages[0].type == MEMORY_PAGE_ROM);
+    bool paging_ok = (paging_disabled == 0) &&
+                     (current_paged_bank == 4u) &&
+                     (gate_array_7ffd_state == 0x14u) &&
+                     (gate_array_1ffd_state == 0x01u);
+    bool screen_ok = (current_screen_bank == 5u);
+    bool memory_ok = memory_block_matches(0x4000u, 0x55u) &&
+                     memory_block_matches(0x8000u, 0x22u) &&
+                     memory_block_matches(0xC000u, 0x44u);
+
+    if (!memory_ok || !model_ok || !rom_ok || !paging_ok || !screen_ok) {
+        printf("    +3 SNA debug: model=%s rom=%u bank=%u screen=%u 7FFD=%02X 1FFD=%02X mem=%02X/%02X/%02X\n",
+               spectrum_model_to_string(spectrum_model),
+               (unsigned)current_rom_page,
+               (unsigned)current_paged_bank,
+               (unsigned)current_screen_bank,
+               (unsigned)gate_array_7ffd_state,
+               (unsigned)gate_array_1ffd_state,
+               memory[0x4000],
+               memory[0x8000],
+               memory[0xC000]);
     }
 
-    return success;
+    return model_ok && rom_ok && paging_ok && screen_ok && memory_ok;
 }
 
-static int snapshot_fixture_generate_base64(const char* filename, const char* output_path) {
-    if (!filename || !output_path) {
-        return 0;
+static bool test_snapshot_z80_v1_compressed(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "v1-compressed.z80")) {
+        printf("    failed to prepare fixture v1-compressed.z80\n");
+        return false;
     }
 
-    char encoded_name[256];
-    int encoded_len = snprintf(encoded_name, sizeof(encoded_name), "%s.b64", filename);
-    if (encoded_len < 0 || (size_t)encoded_len >= sizeof(encoded_name)) {
-        return 0;
-    }
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
 
-    char encoded_path[PATH_MAX];
-    if (!snapshot_fixture_path(encoded_path, sizeof(encoded_path), NULL, encoded_name)) {
-        return 0;
+    if (!snapshot_load(path, SNAPSHOT_FORMAT_Z80, &cpu)) {
+        return false;
     }
 
-    if (!snapshot_fixture_file_exists(encoded_path)) {
-        return 0;
+    bool registers_ok = (cpu.reg_A == 0x11u) && (cpu.reg_F == 0x22u) &&
+                        (cpu.reg_B == 0x44u) && (cpu.reg_C == 0x33u) &&
+                        (cpu.reg_D == 0x88u) && (cpu.reg_E == 0x77u) &&
+                        (cpu.reg_H == 0x66u) && (cpu.reg_L == 0x55u);
+    bool alt_ok = (cpu.alt_reg_A == 0xFFu) && (cpu.alt_reg_F == 0x00u) &&
+                  (cpu.alt_reg_B == 0xAAu) && (cpu.alt_reg_C == 0x99u) &&
+                  (cpu.alt_reg_D == 0xCCu) && (cpu.alt_reg_E == 0xBBu) &&
+                  (cpu.alt_reg_H == 0xEEu) && (cpu.alt_reg_L == 0xDDu);
+    bool special_ok = (cpu.reg_I == 0x99u) && (cpu.reg_R == 0xFFu) &&
+                      (cpu.reg_IX == 0x2468u) && (cpu.reg_IY == 0x1357u) &&
+                      (cpu.reg_SP == 0xD432u) && (cpu.reg_PC == 0x9ABCu);
+    bool interrupt_ok = (cpu.iff1 == 1) && (cpu.iff2 == 0) && (cpu.interruptMode == 1);
+    bool border_ok = (border_color_idx == 5u);
+    bool memory_ok = memory_block_matches(0x4000u, 0x41u) &&
+                     memory_block_matches(0x8000u, 0x52u) &&
+                     memory_block_matches(0xC000u, 0x63u);
+
+    if (!memory_ok || !registers_ok || !alt_ok || !special_ok || !interrupt_ok || !border_ok) {
+        printf("    Z80 V1 debug: A=%02X F=%02X PC=%04X R=%02X border=%u mem=%02X/%02X/%02X\n",
+               cpu.reg_A,
+               cpu.reg_F,
+               cpu.reg_PC,
+               cpu.reg_R,
+               (unsigned)border_color_idx,
+               memory[0x4000],
+               memory[0x8000],
+               memory[0xC000]);
     }
 
-    return snapshot_fixture_decode_base64(encoded_path, output_path);
+    return registers_ok && alt_ok && special_ok && interrupt_ok && border_ok && memory_ok;
 }
 
-static void snapshot_fixture_fill_standard_header(uint8_t header[27]) {
-    static const uint8_t snapshot_header_template[27] = {
-        0x3F,       // I
-        0x22, 0x11, // HL'
-        0x44, 0x33, // DE'
-        0x66, 0x55, // BC'
-        0x88, 0x77, // AF'
-        0xAA, 0x99, // HL
-        0xCC, 0xBB, // DE
-        0xEE, 0xDD, // BC
-        0x34, 0x12, // IY
-        0x78, 0x56, // IX
-        0x01,       // IFF2
-        0xA5,       // R
-        0xE1, 0xF0, // AF
-        0xE0, 0xFF, // SP
-        0x02,       // IM
-        0x04        // Border colour
-    };
-    memcpy(header, snapshot_header_template, sizeof(snapshot_header_template));
+static bool test_snapshot_z80_v3_extended(const char* override_dir) {
+    char path[512];
+    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "v3-128k.z80")) {
+        printf("    failed to prepare fixture v3-128k.z80\n");
+        return false;
+    }
+
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
+
+    if (!snapshot_load(path, SNAPSHOT_FORMAT_Z80, &cpu)) {
+        return false;
+    }
+
+    bool model_ok = (spectrum_model == SPECTRUM_MODEL_128K);
+    bool paging_ok = (gate_array_7ffd_state == 0x13u) &&
+                     (paging_disabled == 0) &&
+                     (current_paged_bank == 3u) &&
+                     (spectrum_pages[3].type == MEMORY_PAGE_RAM) &&
+                     (spectrum_pages[3].index == 3u);
+    bool registers_ok = (cpu.reg_A == 0xAAu) && (cpu.reg_F == 0x11u) &&
+                        (cpu.reg_PC == 0x1234u) && (cpu.reg_SP == 0xBEEFu);
+    bool refresh_ok = (cpu.reg_R == 0x83u) && (cpu.reg_I == 0xEDu);
+    bool border_ok = (border_color_idx == 6u);
+    bool interrupt_ok = (cpu.iff1 == 1) && (cpu.iff2 == 1) && (cpu.interruptMode == 2);
+    bool memory_ok = memory_block_matches(0x4000u, 0x45u) &&
+                     memory_block_matches(0x8000u, 0x42u) &&
+                     memory_block_matches(0xC000u, 0x43u);
+
+    if (!memory_ok || !registers_ok || !refresh_ok || !border_ok || !interrupt_ok || !paging_ok || !model_ok) {
+        printf("    Z80 V3 debug: model=%s PC=%04X SP=%04X R=%02X border=%u mem=%02X/%02X/%02X bank=%u\n",
+               spectrum_model_to_string(spectrum_model),
+               cpu.reg_PC,
+               cpu.reg_SP,
+               cpu.reg_R,
+               (unsigned)border_color_idx,
+               memory[0x4000],
+               memory[0x8000],
+               memory[0xC000],
+               (unsigned)current_paged_bank);
+    }
+
+    return model_ok && paging_ok && registers_ok && refresh_ok && border_ok && interrupt_ok && memory_ok;
 }
 
-static int snapshot_fixture_write_ram_block(FILE* out, uint8_t value, size_t size) {
-    if (!out || size == 0u) {
-        return 0;
+static bool snapshot_probe_load_file(const char* path, SnapshotFormat format) {
+    if (!path || format == SNAPSHOT_FORMAT_NONE) {
+        return false;
     }
 
-    uint8_t block[0x4000];
-    size_t chunk = sizeof(block);
-    while (size > 0u) {
-        size_t to_write = (size < chunk) ? size : chunk;
-        memset(block, value, to_write);
-        if (fwrite(block, 1u, to_write, out) != to_write) {
-            return 0;
-        }
-        size -= to_write;
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    spectrum_configure_model(SPECTRUM_MODEL_48K);
+    memory_clear();
+    border_color_idx = 0u;
+
+    return snapshot_load(path, format, &cpu) ? true : false;
+}
+
+static bool run_snapshot_probes(const char* override_dir) {
+    char probe_dir[PATH_MAX];
+    if (!snapshot_fixture_path(probe_dir, sizeof(probe_dir), override_dir, "probes")) {
+        return true;
     }
-    return 1;
-}
 
-static int snapshot_fixture_generate_sna_48k(const char* output_path) {
-    FILE* out = fopen(output_path, "wb");
-    if (!out) {
-        fprintf(stderr, "Failed to create 48K SNA fixture '%s': %s\n", output_path, strerror(errno));
-        return 0;
+    DIR* dir = opendir(probe_dir);
+    if (!dir) {
+        printf("Snapshot compatibility probes directory %s not found (skipping)\n", probe_dir);
+        return true;
     }
 
-    uint8_t header[27];
-    snapshot_fixture_fill_standard_header(header);
-    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x10u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x20u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x30u, 0x4000u);
-    uint8_t pc_bytes[2] = {0x00u, 0x40u};
-    if (ok) {
-        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
-    }
+    printf("Running snapshot compatibility probes in %s...\n", probe_dir);
 
-    if (fclose(out) != 0) {
-        ok = 0;
-    }
+    bool any_files = false;
+    bool all_passed = true;
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
 
-    if (!ok) {
-        fprintf(stderr, "Failed to synthesise 48K SNA fixture '%s'\n", output_path);
-        remove(output_path);
-    }
+        SnapshotFormat format = snapshot_format_from_extension(entry->d_name);
+        if (format == SNAPSHOT_FORMAT_NONE) {
+            continue;
+        }
 
-    return ok;
-}
+        char full_path[PATH_MAX];
+        int required = snprintf(full_path, sizeof(full_path), "%s/%s", probe_dir, entry->d_name);
+        if (required < 0 || (size_t)required >= sizeof(full_path)) {
+            printf("  %-28s SKIP (path too long)\n", entry->d_name);
+            continue;
+        }
 
-static int snapshot_fixture_generate_sna_128k_locked(const char* output_path) {
-    FILE* out = fopen(output_path, "wb");
-    if (!out) {
-        fprintf(stderr, "Failed to create 128K SNA fixture '%s': %s\n", output_path, strerror(errno));
-        return 0;
+        STAT_STRUCT info;
+        if (STAT_FUNC(full_path, &info) != 0 || STAT_ISDIR(info.st_mode)) {
+            continue;
+        }
+
+        any_files = true;
+        bool ok = snapshot_probe_load_file(full_path, format);
+        printf("  %-28s %s\n", entry->d_name, ok ? "PASS" : "FAIL");
+        if (!ok) {
+            all_passed = false;
+        }
     }
 
-    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
+    closedir(dir);
 
-    uint8_t header[27];
-    snapshot_fixture_fill_standard_header(header);
-    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x55u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x22u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x55u, 0x4000u);
-    uint8_t pc_bytes[2] = {0x00u, 0x40u};
-    if (ok) {
-        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
-    }
-    uint8_t ports[2] = {0x25u, 0x00u};
-    if (ok) {
-        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
-    }
-    for (int bank = 0; ok && bank < 8; ++bank) {
-        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    if (!any_files) {
+        printf("  (no .sna or .z80 files found in %s)\n", probe_dir);
     }
 
-    if (fclose(out) != 0) {
-        ok = 0;
+    return all_passed;
+}
+
+static bool run_snapshot_tests(const char* override_dir) {
+    struct {
+        const char* name;
+        bool (*fn)(const char* dir);
+    } tests[] = {
+        {"SNA 48K register restore", test_snapshot_sna_48k},
+        {"SNA 128K locked paging", test_snapshot_sna_128k_locked},
+        {"SNA +2A special map", test_snapshot_sna_plus2a_special},
+        {"SNA +3 ROM paging", test_snapshot_sna_plus3_rom},
+        {"Z80 V1 compressed RAM", test_snapshot_z80_v1_compressed},
+        {"Z80 V3 extended header", test_snapshot_z80_v3_extended},
+    };
+
+    printf("Running snapshot loader tests...\n");
+    bool all_passed = true;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        bool ok = tests[i].fn(override_dir);
+        printf("  %-28s %s\n", tests[i].name, ok ? "PASS" : "FAIL");
+        if (!ok) {
+            all_passed = false;
+        }
     }
 
-    if (!ok) {
-        fprintf(stderr, "Failed to synthesise 128K SNA fixture '%s'\n", output_path);
-        remove(output_path);
+    bool probes_ok = run_snapshot_probes(override_dir);
+    if (!probes_ok) {
+        all_passed = false;
     }
 
-    return ok;
+    return all_passed;
 }
 
-static int snapshot_fixture_generate_sna_plus2a_special(const char* output_path) {
-    FILE* out = fopen(output_path, "wb");
-    if (!out) {
-        fprintf(stderr, "Failed to create +2A SNA fixture '%s': %s\n", output_path, strerror(errno));
-        return 0;
-    }
-
-    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
+#if !defined(ESP_PLATFORM)
+static bool test_video_pipeline_matches_direct_render(void) {
+    static uint8_t expected[TOTAL_WIDTH * TOTAL_HEIGHT];
 
-    uint8_t header[27];
-    snapshot_fixture_fill_standard_header(header);
-    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
-    ok = ok && snapshot_fixture_write_ram_block(out, 0xAAu, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0xBBu, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0xCCu, 0x4000u);
-    uint8_t pc_bytes[2] = {0x00u, 0x40u};
-    if (ok) {
-        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
-    }
-    uint8_t ports[2] = {0x02u, 0x00u};
-    if (ok) {
-        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
-    }
-    for (int bank = 0; ok && bank < 8; ++bank) {
-        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    memory_clear();
+    for (size_t i = 0; i < 6144u; ++i) {
+        memory[VRAM_START + i] = (uint8_t)(i * 37u);
     }
-    uint8_t port_1ffd = 0x05u;
-    if (ok) {
-        ok = (fwrite(&port_1ffd, 1u, 1u, out) == 1u);
+    for (size_t i = 0; i < 768u; ++i) {
+        memory[ATTR_START + i] = (uint8_t)(i & 0x7Fu);
     }
+    total_t_states = 0;
+    border_frame_start_tstate = 0;
+    border_color_event_count = 0;
 
-    if (fclose(out) != 0) {
-        ok = 0;
+    render_screen();
+    memcpy(expected, pixels, sizeof(expected));
+    memset(pixels, 0, sizeof(pixels));
+
+    border_frame_start_tstate = 0;
+    if (!video_pipeline_start()) {
+        return false;
+    }
+    render_screen();
+    bool presented = false;
+    for (int spin = 0; spin < 2000 && !presented; ++spin) {
+        presented = video_frames_presented.load(std::memory_order_acquire) > 0u;
+        if (!presented) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
+    video_pipeline_stop();
 
+    bool ok = presented && memcmp(expected, pixels, sizeof(expected)) == 0;
     if (!ok) {
-        fprintf(stderr, "Failed to synthesise +2A SNA fixture '%s'\n", output_path);
-        remove(output_path);
+        printf("    presented=%d published=%llu\n",
+               presented ? 1 : 0,
+               (unsigned long long)video_frames_published.load());
     }
-
     return ok;
 }
 
-static int snapshot_fixture_generate_sna_plus3_rompaging(const char* output_path) {
-    FILE* out = fopen(output_path, "wb");
-    if (!out) {
-        fprintf(stderr, "Failed to create +3 SNA fixture '%s': %s\n", output_path, strerror(errno));
-        return 0;
+// Captures frames back to back with the tape manager open, so the emulation
+// thread records overlays while the render thread replays earlier ones. The
+// last frame presented must still match a direct render.
+static bool test_video_pipeline_with_overlay(void) {
+    enum { FRAMES = 300 };
+    static uint8_t expected[TOTAL_WIDTH * TOTAL_HEIGHT];
+
+    memory_clear();
+    for (size_t i = 0; i < 6144u; ++i) {
+        memory[VRAM_START + i] = (uint8_t)(i * 53u);
     }
+    total_t_states = 0;
+    border_frame_start_tstate = 0;
+    border_color_event_count = 0;
+    video_set_frameskip(1);
+    tape_manager_show_menu();
 
-    static const uint8_t bank_patterns[8] = {0x00u, 0x11u, 0x22u, 0x33u, 0x44u, 0x55u, 0x66u, 0x77u};
+    render_screen();
+    memcpy(expected, pixels, sizeof(expected));
+    memset(pixels, 0, sizeof(pixels));
 
-    uint8_t header[27];
-    snapshot_fixture_fill_standard_header(header);
-    int ok = (fwrite(header, 1u, sizeof(header), out) == sizeof(header));
-    ok = ok && snapshot_fixture_write_ram_block(out, 0x90u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0xA0u, 0x4000u);
-    ok = ok && snapshot_fixture_write_ram_block(out, 0xB0u, 0x4000u);
-    uint8_t pc_bytes[2] = {0x00u, 0x40u};
-    if (ok) {
-        ok = (fwrite(pc_bytes, 1u, sizeof(pc_bytes), out) == sizeof(pc_bytes));
-    }
-    uint8_t ports[2] = {0x14u, 0x00u};
-    if (ok) {
-        ok = (fwrite(ports, 1u, sizeof(ports), out) == sizeof(ports));
+    bool ok = video_pipeline_start() != 0;
+    uint64_t presented = 0;
+    for (int frame = 0; ok && frame < FRAMES; ++frame) {
+        border_frame_start_tstate = 0;
+        render_screen();
     }
-    for (int bank = 0; ok && bank < 8; ++bank) {
-        ok = snapshot_fixture_write_ram_block(out, bank_patterns[bank], 0x4000u);
+    for (int spin = 0; ok && spin < 2000; ++spin) {
+        presented = video_frames_presented.load(std::memory_order_acquire);
+        if (presented > 0u && (video_ready_slot.load(std::memory_order_acquire) & VIDEO_SLOT_FRESH) == 0u) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    uint8_t port_1ffd = 0x01u;
     if (ok) {
-        ok = (fwrite(&port_1ffd, 1u, 1u, out) == 1u);
+        video_pipeline_stop();
     }
+    tape_manager_hide();
+    video_set_frameskip(0);
 
-    if (fclose(out) != 0) {
-        ok = 0;
+    size_t overlay_pixels = 0;
+    for (size_t i = 0; i < sizeof(expected); ++i) {
+        overlay_pixels += expected[i] >= 16u;
     }
-
+    ok = ok && presented > 0u && overlay_pixels > 0u && memcmp(expected, pixels, sizeof(expected)) == 0;
     if (!ok) {
-        fprintf(stderr, "Failed to synthesise +3 SNA fixture '%s'\n", output_path);
-        remove(output_path);
+        printf("    presented=%llu overlay pixels=%zu\n", (unsigned long long)presented, overlay_pixels);
     }
-
     return ok;
 }
+#endif
 
-static int snapshot_fixture_generate_sna(const char* filename, const char* output_path) {
-    if (!filename || !output_path) {
-        return 0;
-    }
+static bool test_video_blit_layouts(void) {
+    static VideoBlitLayout layout;
+    static uint16_t dest[VIDEO_PANEL_DEFAULT_WIDTH * VIDEO_PANEL_DEFAULT_HEIGHT];
 
-    if (strcmp(filename, "48k-basic.sna") == 0) {
-        return snapshot_fixture_generate_sna_48k(output_path);
-    }
-    if (strcmp(filename, "128k-locked-bank5.sna") == 0) {
-        return snapshot_fixture_generate_sna_128k_locked(output_path);
-    }
-    if (strcmp(filename, "plus2a-special.sna") == 0) {
-        return snapshot_fixture_generate_sna_plus2a_special(output_path);
-    }
-    if (strcmp(filename, "plus3-rompaging.sna") == 0) {
-        return snapshot_fixture_generate_sna_plus3_rompaging(output_path);
+    video_palette_init();
+    for (int y = 0; y < TOTAL_HEIGHT; ++y) {
+        for (int x = 0; x < TOTAL_WIDTH; ++x) {
+            pixels[y * TOTAL_WIDTH + x] = (uint8_t)((x + y) & 0x0Fu);
+        }
     }
-    return 0;
-}
 
-static int snapshot_fixture_generate_default(char* buffer,
-                                             size_t capacity,
-                                             const char* filename) {
-    if (!buffer || capacity == 0u || !filename) {
-        return 0;
-    }
+    video_blit_compute_layout(&layout, VIDEO_BLIT_MODE_CENTER, VIDEO_PANEL_DEFAULT_WIDTH, VIDEO_PANEL_DEFAULT_HEIGHT);
+    bool ok = layout.dest_x == 64 && layout.dest_y == 16 &&
+              layout.dest_width == TOTAL_WIDTH && layout.dest_height == TOTAL_HEIGHT &&
+              layout.src_x[0] == 0 && layout.src_x[TOTAL_WIDTH - 1] == TOTAL_WIDTH - 1;
+    video_blit_frame(&layout, dest, NULL);
+    ok = ok && dest[17 * TOTAL_WIDTH + 5] == video_palette_565[(17 + 5) & 0x0F];
 
-    char generated_dir[PATH_MAX];
-    if (!snapshot_fixture_path(generated_dir, sizeof(generated_dir), snapshot_fixture_default_dir, "generated")) {
-        return 0;
-    }
+    video_blit_compute_layout(&layout, VIDEO_BLIT_MODE_FIT, VIDEO_PANEL_DEFAULT_WIDTH, VIDEO_PANEL_DEFAULT_HEIGHT);
+    ok = ok && layout.dest_height == VIDEO_PANEL_DEFAULT_HEIGHT && layout.dest_width == 391 &&
+         layout.dest_x == 44 && layout.dest_y == 0 &&
+         layout.src_y[0] == 0 && layout.src_y[layout.dest_height - 1] == TOTAL_HEIGHT - 1 &&
+         layout.src_x[layout.dest_width - 1] == TOTAL_WIDTH - 1;
+    video_blit_frame(&layout, dest, NULL);
+    int last = (layout.dest_height - 1) * layout.dest_width + layout.dest_width - 1;
+    ok = ok && dest[last] == video_palette_565[(TOTAL_WIDTH - 1 + TOTAL_HEIGHT - 1) & 0x0F];
 
-    if (!snapshot_fixture_ensure_directory(generated_dir)) {
-        return 0;
-    }
+    video_blit_compute_layout(&layout, VIDEO_BLIT_MODE_FILL, VIDEO_PANEL_DEFAULT_WIDTH, VIDEO_PANEL_DEFAULT_HEIGHT);
+    ok = ok && layout.dest_width == VIDEO_PANEL_DEFAULT_WIDTH && layout.dest_height == VIDEO_PANEL_DEFAULT_HEIGHT &&
+         layout.src_y[0] > 0 && layout.src_y[layout.dest_height - 1] < TOTAL_HEIGHT - 1;
 
-    if (!snapshot_fixture_path(buffer, capacity, generated_dir, filename)) {
-        return 0;
+    if (!ok) {
+        printf("    mode=%d dest=%dx%d@%d,%d\n",
+               (int)layout.mode,
+               layout.dest_width,
+               layout.dest_height,
+               layout.dest_x,
+               layout.dest_y);
     }
+    return ok;
+}
 
-    if (snapshot_fixture_generate_sna(filename, buffer)) {
-        return 1;
-    }
+static bool test_video_row_diffing(void) {
+    static VideoBlitLayout layout;
+    static uint16_t dest[VIDEO_PANEL_DEFAULT_WIDTH * VIDEO_PANEL_DEFAULT_HEIGHT];
+    static VideoRowCache cache;
+    static uint32_t hashes[TOTAL_HEIGHT];
+    static uint8_t dirty[TOTAL_HEIGHT];
 
-    if (snapshot_fixture_generate_base64(filename, buffer)) {
-        return 1;
-    }
+    video_palette_init();
+    memset(pixels, 1, sizeof(pixels));
+    video_blit_compute_layout(&layout, VIDEO_BLIT_MODE_FIT, VIDEO_PANEL_DEFAULT_WIDTH, VIDEO_PANEL_DEFAULT_HEIGHT);
+    cache.valid = 0;
 
-    fprintf(stderr, "Snapshot fixture '%s' is missing (no generator or Base64 source)\n", filename);
-    remove(buffer);
-    return 0;
-}
+    video_hash_frame_rows(hashes);
+    bool ok = video_row_cache_diff(&cache, hashes, dirty) == TOTAL_HEIGHT;
+    video_blit_frame(&layout, dest, dirty);
+    video_row_cache_store(&cache, hashes);
 
-static int snapshot_fixture_resolve(char* buffer,
-                                    size_t capacity,
-                                    const char* override_dir,
-                                    const char* filename) {
-    if (!snapshot_fixture_path(buffer, capacity, override_dir, filename)) {
-        return 0;
-    }
+    video_hash_frame_rows(hashes);
+    ok = ok && video_row_cache_diff(&cache, hashes, dirty) == 0;
 
-    if (snapshot_fixture_file_exists(buffer)) {
-        return 1;
-    }
+    pixels[100 * TOTAL_WIDTH + 10] = 2u;
+    video_hash_frame_rows(hashes);
+    ok = ok && video_row_cache_diff(&cache, hashes, dirty) == 1 && dirty[100];
 
-    if (!snapshot_fixture_uses_default_dir(override_dir)) {
-        fprintf(stderr, "Snapshot fixture '%s' not found in '%s'\n", filename, override_dir);
-        return 0;
+    // Poison the destination so we can see which rows the partial blit touches.
+    for (size_t i = 0; i < sizeof(dest) / sizeof(dest[0]); ++i) {
+        dest[i] = 0xDEADu;
+    }
+    video_blit_frame(&layout, dest, dirty);
+    for (int dy = 0; dy < layout.dest_height && ok; ++dy) {
+        uint16_t first = dest[(size_t)dy * (size_t)layout.dest_width];
+        if (layout.src_y[dy] == 100) {
+            ok = first == video_palette_565[1];
+        } else {
+            ok = first == 0xDEADu;
+        }
     }
-
-    return snapshot_fixture_generate_default(buffer, capacity, filename);
+    return ok;
 }
 
-static bool memory_block_matches(uint16_t base, uint8_t value) {
-    static const uint16_t offsets[] = {0x0000u, 0x1FFFu, 0x3FFFu};
-    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
-        uint16_t addr = (uint16_t)(base + offsets[i]);
-        if (memory[addr] != value) {
-            return false;
-        }
+static bool test_video_fixed_frameskip(void) {
+    memory_clear();
+    total_t_states = 0;
+    border_frame_start_tstate = 0;
+    border_color_event_count = 0;
+    video_frames_skipped = 0;
+    video_set_frameskip(3);
+
+    for (int i = 0; i < 6; ++i) {
+        border_record_event((uint64_t)i * T_STATES_PER_FRAME + 100u, (uint8_t)(i & 0x07));
+        render_screen();
+    }
+    bool ok = video_frames_skipped == 4u &&
+              border_frame_start_tstate == 6u * T_STATES_PER_FRAME &&
+              border_color_event_count == 0u &&
+              border_frame_color == 5u;
+    video_set_frameskip(0);
+    if (!ok) {
+        printf("    skipped=%llu border_start=%llu pending=%zu\n",
+               (unsigned long long)video_frames_skipped,
+               (unsigned long long)border_frame_start_tstate,
+               border_color_event_count);
     }
-    return true;
+    return ok;
 }
 
-static bool test_snapshot_sna_48k(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "48k-basic.sna")) {
-        printf("    failed to prepare fixture 48k-basic.sna\n");
-        return false;
+// Inline rendering must not probe below the interval its present cost needs,
+// and must only skip frames when presenting, not emulation, makes them late.
+static bool test_video_auto_frameskip_inline(void) {
+    int saved_pipeline = video_pipeline_active;
+    video_pipeline_active = 0;
+    video_set_frameskip(0);
+    video_frameskip_interval = 3;
+    video_frameskip_release_count = 0;
+    video_frameskip_last_frame_us = 0;
+    video_frame_period_us = 0;
+    video_present_cost_us.store(45000u, std::memory_order_relaxed);
+
+    uint64_t now = 1000000u;
+    for (int i = 0; i < VIDEO_FRAMESKIP_RELEASE_FRAMES * 3; ++i) {
+        now += VIDEO_FRAME_PERIOD_US;
+        video_frameskip_update(now);
+    }
+    bool held = video_frameskip_interval == 3;
+
+    video_present_cost_us.store(10000u, std::memory_order_relaxed);
+    for (int i = 0; i < VIDEO_FRAMESKIP_RELEASE_FRAMES * 3; ++i) {
+        now += VIDEO_FRAME_PERIOD_US;
+        video_frameskip_update(now);
+    }
+    bool released = video_frameskip_interval == 1;
+
+    // Late because emulation alone overruns the frame: skipping cannot help.
+    video_present_cost_us.store(2000u, std::memory_order_relaxed);
+    for (int i = 0; i < VIDEO_FRAMESKIP_RELEASE_FRAMES * 3; ++i) {
+        now += 28000u + 2000u / (uint32_t)video_frameskip_interval;
+        video_frameskip_update(now);
+    }
+    bool emulation_bound = video_frameskip_interval == 1;
+
+    // Late because of a 20ms present over 10ms of emulation: every second frame.
+    video_present_cost_us.store(20000u, std::memory_order_relaxed);
+    for (int i = 0; i < VIDEO_FRAMESKIP_RELEASE_FRAMES * 3; ++i) {
+        now += 10000u + 20000u / (uint32_t)video_frameskip_interval;
+        video_frameskip_update(now);
+    }
+    bool present_bound = video_frameskip_interval == 2;
+
+    video_frameskip_interval = 1;
+    video_frameskip_last_frame_us = 0;
+    video_frame_period_us = 0;
+    video_present_cost_us.store(0u, std::memory_order_relaxed);
+    video_pipeline_active = saved_pipeline;
+    bool ok = held && released && emulation_bound && present_bound;
+    if (!ok) {
+        printf("    held=%d released=%d emulation-bound=%d present-bound=%d\n",
+               held ? 1 : 0, released ? 1 : 0, emulation_bound ? 1 : 0, present_bound ? 1 : 0);
     }
+    return ok;
+}
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    border_color_idx = 0u;
+static bool test_ay_audio_mixing(void) {
+    total_t_states = 0;
+    memset(ay_registers, 0, sizeof(ay_registers));
+    ay_reset_state();
+    audio_set_output_format(44100, 2);
 
-    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
-        return false;
-    }
+    ay_write_register(0, 0x40u, 0u);
+    ay_write_register(7, 0x3Eu, 0u);
+    ay_write_register(8, 0x0Fu, 8000u);
+    bool queued = ay_registers[8] == 0x0Fu && ay_state.registers[8] == 0u;
 
-    bool main_regs_ok = (cpu.reg_A == 0xF0u) && (cpu.reg_F == 0xE1u) &&
-                        (cpu.reg_B == 0xDDu) && (cpu.reg_C == 0xEEu) &&
-                        (cpu.reg_D == 0xBBu) && (cpu.reg_E == 0xCCu) &&
-                        (cpu.reg_H == 0x99u) && (cpu.reg_L == 0xAAu);
-    bool alt_regs_ok = (cpu.alt_reg_A == 0x77u) && (cpu.alt_reg_F == 0x88u) &&
-                       (cpu.alt_reg_B == 0x55u) && (cpu.alt_reg_C == 0x66u) &&
-                       (cpu.alt_reg_D == 0x33u) && (cpu.alt_reg_E == 0x44u) &&
-                       (cpu.alt_reg_H == 0x11u) && (cpu.alt_reg_L == 0x22u);
-    bool special_regs_ok = (cpu.reg_I == 0x3Fu) && (cpu.reg_R == 0xA5u) &&
-                           (cpu.reg_IX == 0x5678u) && (cpu.reg_IY == 0x1234u) &&
-                           (cpu.reg_SP == 0xFFE0u) && (cpu.reg_PC == 0x4000u);
-    bool interrupt_state_ok = (cpu.iff1 == 1) && (cpu.iff2 == 1) && (cpu.interruptMode == 2);
-    bool model_ok = (spectrum_model == SPECTRUM_MODEL_48K) &&
-                    (current_paged_bank == 7u) &&
-                    (current_rom_page == 0u) &&
-                    (paging_disabled == 0);
-    bool border_ok = (border_color_idx == 0x04u);
-    bool memory_ok = memory_block_matches(0x4000u, 0x10u) &&
-                     memory_block_matches(0x8000u, 0x20u) &&
-                     memory_block_matches(0xC000u, 0x30u);
+    enum { FRAMES = 512 };
+    int16_t samples[FRAMES * 2];
+    audio_callback(NULL, (uint8_t*)samples, (int)sizeof(samples));
 
-    if (!memory_ok) {
-        printf("    48K SNA memory mismatch: %02X %02X %02X\n",
-               memory[0x4000], memory[0x8000], memory[0xC000]);
+    int early_peak = 0;
+    for (int i = 0; i < 100 * 2; ++i) {
+        int magnitude = abs((int)samples[i]);
+        if (magnitude > early_peak) {
+            early_peak = magnitude;
+        }
     }
-    if (!main_regs_ok || !alt_regs_ok || !special_regs_ok || !interrupt_state_ok || !model_ok || !border_ok) {
-        printf("    48K SNA state debug: A=%02X F=%02X PC=%04X SP=%04X IFF1=%d IFF2=%d model=%s border=%u\n",
-               cpu.reg_A,
-               cpu.reg_F,
-               cpu.reg_PC,
-               cpu.reg_SP,
-               cpu.iff1,
-               cpu.iff2,
-               spectrum_model_to_string(spectrum_model),
-               (unsigned)border_color_idx);
+    long long left_energy = 0;
+    long long right_energy = 0;
+    for (int i = 100; i < FRAMES; ++i) {
+        left_energy += llabs((long long)samples[i * 2]);
+        right_energy += llabs((long long)samples[i * 2 + 1]);
     }
+    bool drained = ay_event_head.load() == ay_event_tail.load() && ay_state.registers[8] == 0x0Fu;
 
-    return main_regs_ok && alt_regs_ok && special_regs_ok && interrupt_state_ok &&
-           model_ok && border_ok && memory_ok;
-}
+    audio_set_output_format(0, 1);
+    memset(ay_registers, 0, sizeof(ay_registers));
+    ay_reset_state();
 
-static bool test_snapshot_sna_128k_locked(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "128k-locked-bank5.sna")) {
-        printf("    failed to prepare fixture 128k-locked-bank5.sna\n");
-        return false;
+    bool ok = queued && drained && early_peak == 0 && left_energy > right_energy * 2 && right_energy > 0;
+    if (!ok) {
+        printf("    queued=%d drained=%d early_peak=%d left=%lld right=%lld\n",
+               queued ? 1 : 0,
+               drained ? 1 : 0,
+               early_peak,
+               left_energy,
+               right_energy);
     }
+    return ok;
+}
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    border_color_idx = 0u;
-
-    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
-        return false;
+static bool test_ay_integer_generators(void) {
+    ay_reset_state_internal();
+    ay_apply_register(0, 100u);
+    ay_apply_register(11, 1u);
+    ay_apply_register(13, 0x0Du);
+    ay_step_generators(250u);
+    bool counters_ok = ay_state.tone_output[0] == 0 && ay_state.tone_counter[0] == 50u &&
+                       ay_state.envelope_volume == 15u && !ay_state.envelope_active;
+
+    // Period 125 at 1.75MHz / 8 toggles at 1750Hz: an 875Hz square wave.
+    ay_reset_state_internal();
+    ay_set_sample_rate(44100);
+    ay_apply_register(0, 125u);
+    ay_apply_register(7, 0x3Eu);
+    ay_apply_register(8, 0x0Fu);
+    int32_t left[441];
+    int32_t right[441];
+    int rising_edges = 0;
+    int32_t previous = 0;
+    for (int block = 0; block < 100; ++block) {
+        ay_render_block(left, right, 441, ay_step_increment);
+        for (int i = 0; i < 441; ++i) {
+            if (previous <= 0 && left[i] > 0) {
+                ++rising_edges;
+            }
+            previous = left[i];
+        }
     }
+    ay_set_sample_rate(0);
+    ay_reset_state_internal();
 
-    bool model_ok = (spectrum_model == SPECTRUM_MODEL_128K);
-    bool paging_ok = (paging_disabled == 1) &&
-                     (gate_array_7ffd_state == 0x25u) &&
-                     (current_paged_bank == 5u) &&
-                     (current_screen_bank == 5u) &&
-                     (gate_array_1ffd_state == 0u);
-    bool memory_ok = memory_block_matches(0x4000u, 0x55u) &&
-                     memory_block_matches(0x8000u, 0x22u) &&
-                     memory_block_matches(0xC000u, 0x55u);
-
-    if (!memory_ok || !paging_ok || !model_ok) {
-        printf("    128K SNA debug: model=%s paging=%d bank=%u screen=%u rom=%u 0x4000=%02X 0x8000=%02X 0xC000=%02X\n",
-               spectrum_model_to_string(spectrum_model),
-               paging_disabled,
-               (unsigned)current_paged_bank,
-               (unsigned)current_screen_bank,
-               (unsigned)current_rom_page,
-               memory[0x4000],
-               memory[0x8000],
-               memory[0xC000]);
+    bool ok = counters_ok && rising_edges >= 873 && rising_edges <= 877;
+    if (!ok) {
+        printf("    counters_ok=%d rising_edges=%d\n", counters_ok ? 1 : 0, rising_edges);
     }
+    return ok;
+}
 
-    return model_ok && paging_ok && memory_ok;
+// Emulation paced by a clock 0.3% faster than the audio device: without rate
+// control the backlog grows by ~130 samples a second until it is trimmed.
+static bool test_audio_rate_control_drift(void) {
+    const int SAMPLE_RATE = 44100;
+    const int CALLBACK_FRAMES = 256;
+    const double EMULATION_SPEED = 1.003;
+    const int CALLBACK_COUNT = SAMPLE_RATE * 60 / CALLBACK_FRAMES;
+    const int WARMUP_CALLBACKS = SAMPLE_RATE * 15 / CALLBACK_FRAMES;
+    static int16_t out[CALLBACK_FRAMES];
+
+    int saved_available = audio_available;
+    total_t_states = 0;
+    audio_set_output_format(SAMPLE_RATE, 1);
+    audio_set_rate_control(1, 0);
+    audio_available = 1;
+
+    double half_period = CPU_CLOCK_HZ / (2.0 * 440.0);
+    double next_edge = half_period;
+    int level = 1;
+    uint64_t emulated = 0;
+    AudioRateStats start = {};
+    AudioRateStats warm = {};
+    AudioRateStats stats = {};
+    audio_get_rate_stats(&start);
+    for (int callback = 0; callback < CALLBACK_COUNT; ++callback) {
+        double wall_t_states = (double)callback * CALLBACK_FRAMES * CPU_CLOCK_HZ * EMULATION_SPEED / SAMPLE_RATE;
+        while ((double)emulated <= wall_t_states) {
+            emulated += T_STATES_PER_FRAME;
+            while ((uint64_t)next_edge < emulated) {
+                level = level == 1 ? 3 : 1;
+                beeper_push_event((uint64_t)next_edge, level);
+                next_edge += half_period;
+            }
+            audio_mark_frame_end(emulated);
+        }
+        audio_callback(NULL, (uint8_t*)out, (int)sizeof(out));
+        if (callback == WARMUP_CALLBACKS) {
+            audio_get_rate_stats(&warm);
+        }
+    }
+    audio_get_rate_stats(&stats);
+    audio_available = saved_available;
+    audio_set_output_format(0, 1);
+
+    bool ok = fabs(stats.ratio - EMULATION_SPEED) < 0.0005 &&
+              fabs(stats.fill_samples - stats.target_samples) < stats.target_samples * 0.25 &&
+              stats.underruns == warm.underruns &&
+              stats.overruns == start.overruns &&
+              stats.dropped_events == start.dropped_events;
+    printf("    ratio %.5f, fill %.1f / %.0f samples, underruns %u (%u after warm-up), overruns %u\n",
+           stats.ratio,
+           stats.fill_samples,
+           stats.target_samples,
+           stats.underruns - start.underruns,
+           stats.underruns - warm.underruns,
+           stats.overruns - start.overruns);
+    return ok;
 }
 
-static bool test_snapshot_sna_plus2a_special(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "plus2a-special.sna")) {
-        printf("    failed to prepare fixture plus2a-special.sna\n");
-        return false;
+// Feeds a square wave straight into the beeper queue one 20ms frame at a
+// time and renders it mono through audio_callback().
+static void beeper_test_render_square(double hz, int sample_rate, int16_t* out, int frames) {
+    total_t_states = 0;
+    audio_set_output_format(sample_rate, 1);
+    beeper_reset_audio_state(0, 1);
+    double half_period = CPU_CLOCK_HZ / (2.0 * hz);
+    double next_edge = half_period;
+    int level = 1;
+    int frame_samples = sample_rate / 50;
+    for (int done = 0; done < frames; done += frame_samples) {
+        uint64_t frame_end = (uint64_t)(done / frame_samples + 1) * T_STATES_PER_FRAME;
+        while ((uint64_t)next_edge < frame_end) {
+            level = level == 1 ? 3 : 1;
+            beeper_queue_push((uint64_t)next_edge, level);
+            beeper_last_event_t_state = (uint64_t)next_edge;
+            beeper_writer_cursor.store(beeper_position_from_tstates(next_edge), std::memory_order_relaxed);
+            next_edge += half_period;
+        }
+        int count = frames - done < frame_samples ? frames - done : frame_samples;
+        audio_callback(NULL, (uint8_t*)(out + done), count * (int)sizeof(int16_t));
+    }
+    audio_set_output_format(0, 1);
+}
+
+static double test_goertzel_power(const int16_t* samples, int count, double hz, int sample_rate) {
+    double coefficient = 2.0 * cos(2.0 * M_PI * hz / (double)sample_rate);
+    double s1 = 0.0;
+    double s2 = 0.0;
+    for (int i = 0; i < count; ++i) {
+        double s0 = (double)samples[i] + coefficient * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    return s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+}
+
+static bool test_beeper_band_limited_steps(void) {
+    // A 5kHz square at 22.05kHz: its 15kHz harmonic folds back to 7.05kHz.
+    enum { RATE = 22050 };
+    static int16_t point[RATE];
+    static int16_t blep[RATE];
+    audio_set_band_limited_beeper(0);
+    beeper_test_render_square(5000.0, RATE, point, RATE);
+    audio_set_band_limited_beeper(1);
+    beeper_test_render_square(5000.0, RATE, blep, RATE);
+
+    double point_alias = test_goertzel_power(point, RATE, 7050.0, RATE) /
+                         test_goertzel_power(point, RATE, 5000.0, RATE);
+    double blep_alias = test_goertzel_power(blep, RATE, 7050.0, RATE) /
+                        test_goertzel_power(blep, RATE, 5000.0, RATE);
+
+    bool ok = blep_alias * 100.0 < point_alias;
+    if (!ok) {
+        printf("    alias/fundamental power: point %.6f blep %.6f\n", point_alias, blep_alias);
     }
+    return ok;
+}
+
+// Runs a speaker-toggling loop for two seconds through the lockstep renderer:
+// the sample count must follow emulated time exactly and the tone must land
+// on the loop's frequency.
+static bool test_audio_offline_lockstep(void) {
+    const int RATE = 44100;
+    const uint32_t FRAMES = 100;
+    const int DELAY = 200;
+    static const uint8_t program[] = {
+        0xF3,             // DI
+        0x3E, 0x10,       // LD A,0x10
+        0xD3, 0xFE,       // loop: OUT (0xFE),A
+        0x06, (uint8_t)DELAY, // LD B,DELAY
+        0x10, 0xFE,       // DJNZ $
+        0xEE, 0x10,       // XOR 0x10
+        0x18, 0xF6,       // JR loop
+    };
+    // OUT + LD B + DJNZ + XOR + JR, per half period.
+    const double tone_hz = CPU_CLOCK_HZ / (2.0 * (11 + 7 + 13 * (DELAY - 1) + 8 + 7 + 12));
 
     Z80 cpu;
     cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
     memory_clear();
-    border_color_idx = 0u;
+    memcpy(memory + 0x8000, program, sizeof(program));
+    cpu.reg_PC = 0x8000;
+    total_t_states = 0;
 
-    if (!snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu)) {
+    FILE* output = tmpfile();
+    if (!output) {
         return false;
     }
-
-    bool model_ok = (spectrum_model == SPECTRUM_MODEL_PLUS2A);
-    bool paging_ok = (gate_array_7ffd_state == 0x02u) &&
-                     (gate_array_1ffd_state == 0x05u) &&
-                     (paging_disabled == 0) &&
-                     (current_paged_bank == 2u);
-    bool mapping_ok = (spectrum_pages[0].type == MEMORY_PAGE_RAM && spectrum_pages[0].index == 4u) &&
-                      (spectrum_pages[1].type == MEMORY_PAGE_RAM && spectrum_pages[1].index == 5u) &&
-                      (spectrum_pages[2].type == MEMORY_PAGE_RAM && spectrum_pages[2].index == 6u) &&
-                      (spectrum_pages[3].type == MEMORY_PAGE_RAM && spectrum_pages[3].index == 7u);
-    bool memory_ok = memory_block_matches(0x0000u, 0x44u) &&
-                     memory_block_matches(0x4000u, 0x55u) &&
-                     memory_block_matches(0x8000u, 0x66u) &&
-                     memory_block_matches(0xC000u, 0x77u);
-
-    if (!memory_ok || !mapping_ok || !paging_ok || !model_ok) {
-        printf("    +2A SNA debug: model=%s 7FFD=%02X 1FFD=%02X pages=%u/%u/%u/%u mem=%02X/%02X/%02X/%02X\n",
-               spectrum_model_to_string(spectrum_model),
-               (unsigned)gate_array_7ffd_state,
-               (unsigned)gate_array_1ffd_state,
-               spectrum_pages[0].index,
-               spectrum_pages[1].index,
-               spectrum_pages[2].index,
-               spectrum_pages[3].index,
-               memory[0x0000],
-               memory[0x4000],
-               memory[0x8000],
-               memory[0xC000]);
+    AudioFileSink file_sink;
+    audio_file_sink_init(&file_sink, output, 0);
+    AudioOfflineStats stats;
+    bool ok = audio_render_offline_frames(&cpu, FRAMES, &file_sink.sink, RATE, 1, &stats) != 0;
+
+    uint64_t expected = ((uint64_t)FRAMES * T_STATES_PER_FRAME * (uint64_t)RATE) / (uint64_t)CPU_CLOCK_HZ;
+    static int16_t samples[RATE * 2];
+    rewind(output);
+    size_t read = fread(samples, sizeof(int16_t), sizeof(samples) / sizeof(samples[0]), output);
+    fclose(output);
+
+    double tone = test_goertzel_power(samples + RATE / 2, RATE, tone_hz, RATE);
+    double off_tone = test_goertzel_power(samples + RATE / 2, RATE, tone_hz * 1.5, RATE);
+    ok = ok && stats.samples == expected && read == expected && tone > off_tone * 100.0;
+    printf("    %.1f s in %.1f ms (%.0fx real time), audio path %.2f ms per emulated second\n",
+           stats.emulated_seconds,
+           stats.wall_seconds * 1000.0,
+           stats.wall_seconds > 0.0 ? stats.emulated_seconds / stats.wall_seconds : 0.0,
+           stats.audio_seconds * 1000.0 / stats.emulated_seconds);
+    if (!ok) {
+        printf("    samples=%llu expected=%llu read=%zu tone=%.3g off=%.3g\n",
+               (unsigned long long)stats.samples,
+               (unsigned long long)expected,
+               read,
+               tone,
+               off_tone);
     }
-
-    return model_ok && paging_ok && mapping_ok && memory_ok;
+    return ok;
 }
 
-static bool test_snapshot_sna_plus3_rom(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "plus3-rompaging.sna")) {
-        printf("    failed to prepare fixture plus3-rompaging.sna\n");
-        return false;
+// Streams a TAP-style header/data pair and a direct recording through the
+// pulse cursor and checks the edges against the ROM timings.
+static bool test_tape_pulse_cursor(void) {
+    uint8_t header[19];
+    memset(header, 0, sizeof(header));
+    uint8_t data[2] = {0xFF, 0x81};
+    static const uint8_t direct[2] = {0xF0, 0x3C}; // 1111 0000 0011 1100
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    bool ok = tape_image_add_block(&image, header, sizeof(header), 1000u) &&
+              tape_image_add_block(&image, data, sizeof(data), 0u) &&
+              tape_image_add_direct_recording_block(&image, 100u, direct, sizeof(direct), 8u, 0u);
+
+    TapePulseCursor cursor;
+    tape_pulse_cursor_reset(&cursor, &image);
+    uint64_t pulses[16];
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t header_pulses = (uint64_t)TAPE_HEADER_PILOT_COUNT + 2u + sizeof(header) * 16u;
+    uint64_t data_pulses = (uint64_t)TAPE_DATA_PILOT_COUNT + 2u + sizeof(data) * 16u;
+    while (cursor.has_current) {
+        uint64_t index = count - header_pulses;
+        if (count >= header_pulses && index < 16u) {
+            pulses[index] = cursor.current;
+        }
+        if (count == header_pulses + data_pulses - 2u) {
+            // Second half of the last '1' bit of 0x81.
+            ok = ok && cursor.current == (uint64_t)TAPE_BIT1_PULSE_TSTATES;
+        }
+        total += cursor.current;
+        ++count;
+        tape_pulse_cursor_advance(&cursor, &image);
+    }
+
+    // The header's pause joins the first pilot pulse of the data block. The
+    // direct recording adds runs of 4, 6 and 4 samples; its final 2-sample
+    // run is left pending as trailing silence.
+    uint64_t expected_total = (uint64_t)TAPE_HEADER_PILOT_COUNT * TAPE_PILOT_PULSE_TSTATES +
+                              (uint64_t)TAPE_DATA_PILOT_COUNT * TAPE_PILOT_PULSE_TSTATES +
+                              2u * (TAPE_SYNC_FIRST_PULSE_TSTATES + TAPE_SYNC_SECOND_PULSE_TSTATES) +
+                              sizeof(header) * 16u * TAPE_BIT0_PULSE_TSTATES +
+                              (6u * 2u * TAPE_BIT0_PULSE_TSTATES + 10u * 2u * TAPE_BIT1_PULSE_TSTATES) +
+                              tape_pause_to_tstates(1000u) + (4u + 4u + 6u) * 100u;
+    ok = ok && count == header_pulses + data_pulses + 3u && total == expected_total &&
+         pulses[0] == tape_pause_to_tstates(1000u) + (uint64_t)TAPE_PILOT_PULSE_TSTATES &&
+         cursor.pending_silence == 2u * 100u && cursor.initial_level == 1;
+
+    // Regenerating from the start gives the same first edge.
+    tape_pulse_cursor_reset(&cursor, &image);
+    ok = ok && cursor.has_current && cursor.current == (uint64_t)TAPE_PILOT_PULSE_TSTATES;
+    if (!ok) {
+        printf("    pulses=%llu (expected %llu) total=%llu (expected %llu)\n",
+               (unsigned long long)count,
+               (unsigned long long)(header_pulses + data_pulses + 3u),
+               (unsigned long long)total,
+               (unsigned long long)expected_total);
     }
+    tape_free_image(&image);
+    return ok;
+}
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    memory_clear();
-    spectrum_configure_model(SPECTRUM_MODEL_PLUS3);
-    border_color_idx = 0u;
+// Stores a header and a data block as runs, once with exact timings and once
+// quantised to 44.1kHz samples as a WAV would give them: both read back
+// pulse for pulse in a fraction of four bytes a pulse, and the exact copy
+// still decodes to the data block's bytes.
+static bool test_tape_waveform_runs(void) {
+    uint8_t header[19];
+    uint8_t data[300];
+    for (size_t i = 0; i < sizeof(header); ++i) {
+        header[i] = (uint8_t)(i * 7u);
+    }
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t)((i * 37u) ^ (i >> 3));
+    }
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    bool ok = tape_image_add_block(&image, header, sizeof(header), 1000u) &&
+              tape_image_add_block(&image, data, sizeof(data), 0u);
+
+    TapeWaveform exact;
+    TapeWaveform sampled;
+    TapeWaveform first_block;
+    memset(&exact, 0, sizeof(exact));
+    memset(&sampled, 0, sizeof(sampled));
+    memset(&first_block, 0, sizeof(first_block));
+    const double tstates_per_sample = CPU_CLOCK_HZ / 44100.0;
+    double sample_error = 0.0;
+    TapePulseCursor cursor;
+    for (tape_pulse_cursor_reset(&cursor, &image); ok && cursor.has_current;
+         tape_pulse_cursor_advance(&cursor, &image)) {
+        double samples = (double)cursor.current / tstates_per_sample + sample_error;
+        uint64_t whole = (uint64_t)(samples + 0.5);
+        sample_error = samples - (double)whole;
+        ok = tape_waveform_add_pulse(&exact, cursor.current) &&
+             tape_waveform_add_pulse(&sampled, (uint64_t)((double)whole * tstates_per_sample + 0.5)) &&
+             (cursor.block_index != 0u || tape_waveform_add_pulse(&first_block, cursor.current));
+    }
+
+    const TapeWaveform* waveforms[2] = {&exact, &sampled};
+    for (int w = 0; ok && w < 2; ++w) {
+        TapeWaveformReader reader = {0, 0};
+        size_t count = 0;
+        sample_error = 0.0;
+        for (tape_pulse_cursor_reset(&cursor, &image); ok && cursor.has_current;
+             tape_pulse_cursor_advance(&cursor, &image)) {
+            uint64_t expected = cursor.current;
+            if (w == 1) {
+                double samples = (double)cursor.current / tstates_per_sample + sample_error;
+                uint64_t whole = (uint64_t)(samples + 0.5);
+                sample_error = samples - (double)whole;
+                expected = (uint64_t)((double)whole * tstates_per_sample + 0.5);
+            }
+            ok = tape_waveform_reader_has_pulse(waveforms[w], &reader) &&
+                 tape_waveform_reader_duration(waveforms[w], &reader) == expected;
+            tape_waveform_reader_next(waveforms[w], &reader);
+            ++count;
+        }
+        size_t bytes = tape_waveform_memory_bytes(waveforms[w]);
+        printf("    %s: %zu pulses in %zu runs, %zu bytes (was %zu)\n",
+               w == 0 ? "exact" : "44.1kHz",
+               count,
+               waveforms[w]->run_count,
+               bytes,
+               count * sizeof(uint32_t));
+        ok = ok && !tape_waveform_reader_has_pulse(waveforms[w], &reader) && count == waveforms[w]->count &&
+             bytes * (w == 0 ? 12u : 6u) < count * sizeof(uint32_t);
+    }
+
+    // The recorder decodes one block's pulses at a time.
+    TapeBlock block;
+    memset(&block, 0, sizeof(block));
+    ok = ok && tape_decode_pulses_to_block(&first_block, 0u, &block) && block.length == sizeof(header) &&
+         memcmp(block.data, header, sizeof(header)) == 0;
+    free(block.data);
+
+    tape_waveform_reset(&first_block);
+    tape_waveform_reset(&exact);
+    tape_waveform_reset(&sampled);
+    tape_free_image(&image);
+    return ok;
+}
 
-    uint8_t previous_rom_count = rom_page_count;
-    rom_page_count = 4u;
+// Streams a stereo WAV whose left channel carries a square wave with jitter
+// inside the hysteresis band; the right channel is noise. Both the mapped and
+// buffered paths must yield every edge, hold only a batch, and rewind.
+static bool test_tape_wav_streaming(void) {
+    const char* path = "tape_stream_test.wav";
+    const uint32_t SAMPLE_RATE = 44100u;
+    const size_t SEGMENTS = 3000;
+    size_t frames = 0;
+    for (size_t i = 0; i < SEGMENTS; ++i) {
+        frames += 8u + (i * 7u) % 23u;
+    }
+    uint32_t data_bytes = (uint32_t)(frames * 4u);
+    uint8_t header[44];
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x02\0\0\0\0\0\0\0\0\0\x04\0\x10\0data\0\0\0\0", 44);
+    uint32_t fields[4][2] = {{4u, 36u + data_bytes}, {24u, SAMPLE_RATE}, {28u, SAMPLE_RATE * 4u}, {40u, data_bytes}};
+    for (int f = 0; f < 4; ++f) {
+        for (int b = 0; b < 4; ++b) {
+            header[fields[f][0] + (uint32_t)b] = (uint8_t)(fields[f][1] >> (8 * b));
+        }
+    }
+    FILE* file = fopen(path, "wb");
+    bool ok = file && fwrite(header, sizeof(header), 1, file) == 1;
+    uint32_t noise = 12345u;
+    for (size_t i = 0; ok && i < SEGMENTS; ++i) {
+        size_t length = 8u + (i * 7u) % 23u;
+        for (size_t j = 0; ok && j < length; ++j) {
+            noise = noise * 1103515245u + 12345u;
+            int jitter = (int)((noise >> 16) % 401u) - 200;
+            int left = (j == 0 && i > 0) ? jitter : ((i & 1u) ? -12000 : 12000) + jitter;
+            int16_t frame[2] = {(int16_t)left, (int16_t)(noise >> 8)};
+            uint8_t bytes[4] = {(uint8_t)frame[0], (uint8_t)((uint16_t)frame[0] >> 8),
+                                (uint8_t)frame[1], (uint8_t)((uint16_t)frame[1] >> 8)};
+            ok = fwrite(bytes, sizeof(bytes), 1, file) == 1;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    const double tstates_per_sample = CPU_CLOCK_HZ / (double)SAMPLE_RATE;
+    for (int use_mmap = 1; ok && use_mmap >= 0; --use_mmap) {
+        tape_wav_stream_use_mmap = use_mmap;
+        TapePlaybackState state;
+        memset(&state, 0, sizeof(state));
+        ok = tape_load_wav(path, &state);
+        tape_reset_playback(&state);
+        ok = ok && state.waveform.initial_level == 1 && state.waveform.count < SEGMENTS / 2u;
+        for (int pass = 0; ok && pass < 2; ++pass) {
+            size_t count = 0;
+            size_t peak_count = 0;
+            for (; ok && count + 1u < SEGMENTS; ++count) {
+                // A pulse ends on the first sample past the band, which is one
+                // sample after the boundary's zero-level sample.
+                uint64_t samples = 8u + (count * 7u) % 23u + (count > 0 ? 0u : 1u);
+                uint64_t expected = (uint64_t)(tstates_per_sample * (double)samples + 0.5);
+                ok = tape_playback_has_pulse(&state) && tape_playback_pulse_duration(&state) == expected;
+                if (state.waveform.count > peak_count) {
+                    peak_count = state.waveform.count;
+                }
+                if (ok && !tape_playback_next_pulse(&state)) {
+                    ++count;
+                    break;
+                }
+            }
+            ok = ok && count == SEGMENTS - 1u && !tape_playback_has_pulse(&state) &&
+                 peak_count < SEGMENTS / 2u && state.wav_stream.pulses == SEGMENTS - 1u;
+            if (!ok) {
+                printf("    %s pass %d: stopped at pulse %zu of %zu\n",
+                       use_mmap ? "mapped" : "buffered", pass, count, SEGMENTS - 1u);
+            }
+            tape_reset_playback(&state);
+        }
+        tape_wav_stream_close(&state.wav_stream);
+        tape_waveform_reset(&state.waveform);
+    }
+    tape_wav_stream_use_mmap = 1;
+    remove(path);
+    return ok;
+}
 
-    spectrum_model = SPECTRUM_MODEL_PLUS3;
-    bool loaded = snapshot_load(path, SNAPSHOT_FORMAT_SNA, &cpu);
+// Records through the fixed buffer into a fresh WAV, checks the header is
+// kept current mid-session, then appends at the data end and finally
+// overwrites from a head position, which truncates the rest.
+static bool test_tape_recorder_streaming(void) {
+    const char* path = "tape_record_test.wav";
+    remove(path);
+    tape_recorder_enable(path, TAPE_OUTPUT_WAV);
+    tape_recorder.sample_rate = 44100u;
+    tape_wav_shared_position_tstates = 0;
 
-    rom_page_count = previous_rom_count;
+    bool ok = tape_recorder_start_session(0, 0) && tape_recorder_append_audio_samples(1, 20000u) &&
+              tape_recorder_append_audio_samples(0, 10000u) &&
+              tape_recorder.wav_buffered <= TAPE_RECORDER_WAV_BUFFER_SAMPLES;
+    size_t flushed = 30000u - tape_recorder.wav_buffered;
+    uint8_t header[44];
+    FILE* file = fopen(path, "rb");
+    ok = ok && file && fread(header, sizeof(header), 1, file) == 1 &&
+         ((uint32_t)header[40] | ((uint32_t)header[41] << 8) | ((uint32_t)header[42] << 16)) == flushed * 2u;
+    if (file) {
+        fclose(file);
+    }
+    tape_recorder_stop_session(0, 1);
+
+    ok = ok && tape_recorder_start_session(0, 1) && tape_recorder_append_audio_samples(1, 1000u);
+    tape_recorder_stop_session(0, 1);
+
+    const size_t total = 31000u;
+    int16_t* samples = (int16_t*)malloc(total * sizeof(int16_t));
+    file = fopen(path, "rb");
+    ok = ok && samples && file && fread(header, sizeof(header), 1, file) == 1 &&
+         fread(samples, sizeof(int16_t), total, file) == total && fgetc(file) == EOF;
+    for (size_t i = 0; ok && i < total; ++i) {
+        ok = samples[i] == ((i < 20000u || i >= 30000u) ? TAPE_WAV_AMPLITUDE : -TAPE_WAV_AMPLITUDE);
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    tape_wav_shared_position_tstates = tape_recorder_tstates_from_samples(5000u);
+    ok = ok && tape_recorder_start_session(0, 0) && tape_recorder_append_audio_samples(0, 100u);
+    tape_recorder_stop_session(0, 1);
+    file = fopen(path, "rb");
+    ok = ok && file && fread(header, sizeof(header), 1, file) == 1 &&
+         fread(samples, sizeof(int16_t), total, file) == 5100u && samples[4999] == TAPE_WAV_AMPLITUDE &&
+         samples[5000] == -TAPE_WAV_AMPLITUDE &&
+         ((uint32_t)header[4] | ((uint32_t)header[5] << 8)) == 36u + 5100u * 2u &&
+         ((uint32_t)header[40] | ((uint32_t)header[41] << 8)) == 5100u * 2u;
+    if (file) {
+        fclose(file);
+    }
+
+    free(samples);
+    tape_recorder_enable(NULL, TAPE_OUTPUT_NONE);
+    tape_wav_shared_position_tstates = 0;
+    remove(path);
+    return ok;
+}
 
-    if (!loaded) {
-        return false;
+// Feeds the classifier jittered turbo, pure-data and standard blocks as a
+// 44.1kHz capture would show them, then writes the turbo and pure-data
+// results to a TZX and loads them back.
+static bool test_tape_pulse_classifier(void) {
+    struct Case {
+        uint32_t pilot;
+        uint32_t pilot_pulses;
+        uint32_t sync1;
+        uint32_t sync2;
+        uint32_t bit0;
+        uint32_t bit1;
+        size_t bits;
+        TapeBlockType expected;
+    };
+    const Case cases[3] = {
+        {1200u, 1000u, 400u, 520u, 500u, 1000u, 50u * 8u, TAPE_BLOCK_TYPE_TURBO},
+        {0u, 0u, 0u, 0u, 600u, 1250u, 20u * 8u + 3u, TAPE_BLOCK_TYPE_PURE_DATA},
+        {(uint32_t)TAPE_PILOT_PULSE_TSTATES, 3223u, (uint32_t)TAPE_SYNC_FIRST_PULSE_TSTATES,
+         (uint32_t)TAPE_SYNC_SECOND_PULSE_TSTATES, (uint32_t)TAPE_BIT0_PULSE_TSTATES,
+         (uint32_t)TAPE_BIT1_PULSE_TSTATES, 100u * 8u, TAPE_BLOCK_TYPE_STANDARD},
+    };
+    uint8_t payload[100];
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)((i * 73u) ^ 0x5Au);
     }
+    uint32_t noise = 99u;
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    bool ok = true;
+    for (int c = 0; ok && c < 3; ++c) {
+        const Case& tc = cases[c];
+        TapeWaveform waveform;
+        memset(&waveform, 0, sizeof(waveform));
+        size_t pulse_total = tc.pilot_pulses + (tc.pilot_pulses ? 2u : 0u) + tc.bits * 2u + 1u;
+        for (size_t p = 0; ok && p < pulse_total; ++p) {
+            uint32_t duration = 945u;
+            if (p < tc.pilot_pulses) {
+                duration = tc.pilot;
+            } else if (tc.pilot_pulses && p == tc.pilot_pulses) {
+                duration = tc.sync1;
+            } else if (tc.pilot_pulses && p == tc.pilot_pulses + 1u) {
+                duration = tc.sync2;
+            } else if (p + 1u < pulse_total) {
+                size_t bit = (p - tc.pilot_pulses - (tc.pilot_pulses ? 2u : 0u)) / 2u;
+                duration = (payload[bit / 8u] & (0x80u >> (bit % 8u))) ? tc.bit1 : tc.bit0;
+            }
+            // Edges land on 79-tstate sample boundaries, give or take one.
+            noise = noise * 1103515245u + 12345u;
+            duration = duration - duration % 79u + 79u * ((noise >> 16) % 3u);
+            ok = tape_waveform_add_pulse(&waveform, duration) != 0;
+        }
+
+        TapeBlock block;
+        memset(&block, 0, sizeof(block));
+        ok = ok && tape_decode_pulses_to_block(&waveform, 250u, &block) && block.type == tc.expected &&
+             block.length == (tc.bits + 7u) / 8u && memcmp(block.data, payload, tc.bits / 8u) == 0 &&
+             block.used_bits_in_last_byte == (tc.bits % 8u ? tc.bits % 8u : 8u);
+        if (ok && tc.bits % 8u) {
+            uint8_t mask = (uint8_t)(0xFFu << (8u - tc.bits % 8u));
+            ok = (block.data[block.length - 1u] & mask) == (payload[block.length - 1u] & mask);
+        }
+        if (ok && tc.expected != TAPE_BLOCK_TYPE_STANDARD) {
+            ok = abs((int)block.bit0_first_pulse_tstates - (int)tc.bit0) <= 80 &&
+                 abs((int)block.bit1_first_pulse_tstates - (int)tc.bit1) <= 80 &&
+                 (tc.pilot_pulses == 0 || (abs((int)block.pilot_pulse_tstates - (int)tc.pilot) <= 80 &&
+                                           block.pilot_pulse_count == tc.pilot_pulses));
+            ok = ok && (tc.expected == TAPE_BLOCK_TYPE_TURBO
+                            ? tape_image_add_turbo_block(&image, block.data, block.length, block.pause_ms,
+                                                         block.pilot_pulse_tstates, block.pilot_pulse_count,
+                                                         block.sync_first_pulse_tstates,
+                                                         block.sync_second_pulse_tstates,
+                                                         block.bit0_first_pulse_tstates,
+                                                         block.bit0_second_pulse_tstates,
+                                                         block.bit1_first_pulse_tstates,
+                                                         block.bit1_second_pulse_tstates,
+                                                         block.used_bits_in_last_byte)
+                            : tape_image_add_pure_data_block(&image, block.data, block.length, block.pause_ms,
+                                                             block.bit0_first_pulse_tstates,
+                                                             block.bit0_second_pulse_tstates,
+                                                             block.bit1_first_pulse_tstates,
+                                                             block.bit1_second_pulse_tstates,
+                                                             block.used_bits_in_last_byte));
+        }
+        if (!ok) {
+            printf("    case %d: type %d, %u bytes\n", c, (int)block.type, (unsigned)block.length);
+        }
+        free(block.data);
+        tape_waveform_reset(&waveform);
+    }
+
+    const char* path = "tape_classifier_test.tzx";
+    FILE* file = fopen(path, "wb");
+    static const uint8_t header[10] = {'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A, 0x01, 0x14};
+    ok = ok && file && fwrite(header, sizeof(header), 1, file) == 1;
+    long block_offsets[2] = {0, 0};
+    for (size_t i = 0; ok && i < image.count && i < 2u; ++i) {
+        block_offsets[i] = ftell(file);
+        ok = tape_write_tzx_block(file, &image.blocks[i]) != 0;
+    }
+    if (file) {
+        fclose(file);
+    }
+    // The turbo case is written as 0x11 and the pilotless one as 0x14.
+    static const uint8_t expected_ids[2] = {0x11, 0x14};
+    file = ok ? fopen(path, "rb") : NULL;
+    ok = ok && file && image.count == 2u;
+    for (int i = 0; ok && i < 2; ++i) {
+        ok = fseek(file, block_offsets[i], SEEK_SET) == 0 && fgetc(file) == expected_ids[i];
+    }
+    if (file) {
+        fclose(file);
+    }
+    TapeImage loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    ok = ok && tape_load_image(path, TAPE_FORMAT_TZX, &loaded) && loaded.count == image.count;
+    for (size_t i = 0; ok && i < image.count; ++i) {
+        const TapeBlock* a = &image.blocks[i];
+        const TapeBlock* b = &loaded.blocks[i];
+        ok = a->type == b->type && a->length == b->length && a->pause_ms == b->pause_ms &&
+             a->used_bits_in_last_byte == b->used_bits_in_last_byte &&
+             a->pilot_pulse_tstates == b->pilot_pulse_tstates && a->pilot_pulse_count == b->pilot_pulse_count &&
+             a->sync_first_pulse_tstates == b->sync_first_pulse_tstates &&
+             a->sync_second_pulse_tstates == b->sync_second_pulse_tstates &&
+             a->bit0_second_pulse_tstates == b->bit0_second_pulse_tstates &&
+             a->bit1_second_pulse_tstates == b->bit1_second_pulse_tstates &&
+             memcmp(a->data, b->data, a->length) == 0;
+    }
+    tape_free_image(&loaded);
+    tape_free_image(&image);
+    remove(path);
+    return ok;
+}
 
-    bool model_ok = (spectrum_model == SPECTRUM_MODEL_PLUS3);
-    bool rom_ok = (current_rom_page == 3u) && (spectrum_pages[0].type == MEMORY_PAGE_ROM);
-    bool paging_ok = (paging_disabled == 0) &&
-                     (current_paged_bank == 4u) &&
-                     (gate_array_7ffd_state == 0x14u) &&
-                     (gate_array_1ffd_state == 0x01u);
-    bool screen_ok = (current_screen_bank == 5u);
-    bool memory_ok = memory_block_matches(0x4000u, 0x55u) &&
-                     memory_block_matches(0x8000u, 0x22u) &&
-                     memory_block_matches(0xC000u, 0x44u);
-
-    if (!memory_ok || !model_ok || !rom_ok || !paging_ok || !screen_ok) {
-        printf("    +3 SNA debug: model=%s rom=%u bank=%u screen=%u 7FFD=%02X 1FFD=%02X mem=%02X/%02X/%02X\n",
-               spectrum_model_to_string(spectrum_model),
-               (unsigned)current_rom_page,
-               (unsigned)current_paged_bank,
-               (unsigned)current_screen_bank,
-               (unsigned)gate_array_7ffd_state,
-               (unsigned)gate_array_1ffd_state,
-               memory[0x4000],
-               memory[0x8000],
-               memory[0xC000]);
+// Seeks a TZX-style tape to block starts and to points inside pilot tones,
+// data and a direct recording, and checks each lands on the same pulse, with
+// the same time left on it, as stepping the cursor from the start does.
+static bool test_tape_timeline_seek(void) {
+    uint8_t header[19];
+    uint8_t data[64];
+    memset(header, 0, sizeof(header));
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t)(i * 29u + 3u);
+    }
+    static const uint8_t direct[2] = {0xF0, 0x3C};
+    TapePlaybackState state;
+    memset(&state, 0, sizeof(state));
+    state.format = TAPE_FORMAT_TZX;
+    state.use_waveform_playback = 1;
+    bool ok = tape_image_add_block(&state.image, header, sizeof(header), 1000u) &&
+              tape_image_add_block(&state.image, data, sizeof(data), 500u) &&
+              tape_image_add_pure_tone_block(&state.image, 700u, 301u, 200u) &&
+              tape_image_add_direct_recording_block(&state.image, 100u, direct, sizeof(direct), 8u, 0u) &&
+              tape_image_add_block(&state.image, data, 32u, 0u);
+
+    size_t capacity = 32768u;
+    uint64_t* starts = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    size_t* blocks = (size_t*)malloc(capacity * sizeof(size_t));
+    size_t count = 0;
+    uint64_t total = 0;
+    TapePulseCursor cursor;
+    tape_pulse_cursor_reset(&cursor, &state.image);
+    while (ok && starts && blocks && cursor.has_current && count < capacity) {
+        starts[count] = total;
+        blocks[count] = cursor.block_index;
+        total += cursor.current;
+        ++count;
+        tape_pulse_cursor_advance(&cursor, &state.image);
+    }
+    ok = ok && starts && blocks && !cursor.has_current;
+
+    // Each block starts where its first pulse (and the pause before it) does.
+    ok = ok && tape_timeline_build(&state.image) && state.image.length_tstates == total;
+    for (size_t i = 0, block = 0; ok && i < count; ++i) {
+        if (blocks[i] == block) {
+            ok = state.image.timeline[block].start_tstates == starts[i] &&
+                 tape_timeline_find(&state.image, starts[i]) == block;
+            ++block;
+        }
+    }
+
+    for (uint32_t k = 0; ok && k <= 101u; ++k) {
+        uint64_t target = k < 101u ? total / 101u * k + k * 37u : total;
+        size_t expected = count;
+        if (target < total) {
+            size_t low = 0;
+            size_t high = count;
+            while (high - low > 1u) {
+                size_t mid = low + (high - low) / 2u;
+                if (starts[mid] <= target) {
+                    low = mid;
+                } else {
+                    high = mid;
+                }
+            }
+            expected = low;
+        }
+        ok = tape_seek_playback(&state, target) && state.position_tstates == target && !state.playing;
+        if (expected < count) {
+            uint64_t end = expected + 1u < count ? starts[expected + 1u] : total;
+            ok = ok && state.waveform_index == expected && state.current_block == blocks[expected] &&
+                 state.paused_transition_remaining == end - target &&
+                 state.level == (int)((1u ^ (unsigned)expected) & 1u);
+        } else {
+            ok = ok && !state.pulse_cursor.has_current && state.current_block == state.image.count &&
+                 state.paused_transition_remaining == 0u;
+        }
+        if (!ok) {
+            printf("    seek to %llu: pulse %zu (expected %zu)\n",
+                   (unsigned long long)target,
+                   state.waveform_index,
+                   expected);
+        }
     }
 
-    return model_ok && rom_ok && paging_ok && screen_ok && memory_ok;
+    // Adding a block drops the index; the next seek rebuilds it.
+    ok = ok && tape_image_add_block(&state.image, header, sizeof(header), 0u) && !state.image.timeline &&
+         tape_seek_playback(&state, total) && state.current_block == 5u &&
+         state.paused_transition_remaining == (uint64_t)TAPE_PILOT_PULSE_TSTATES;
+
+    free(starts);
+    free(blocks);
+    tape_free_image(&state.image);
+    tape_reset_playback(&tape_playback);
+    return ok;
 }
 
-static bool test_snapshot_z80_v1_compressed(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "v1-compressed.z80")) {
-        printf("    failed to prepare fixture v1-compressed.z80\n");
-        return false;
+// Steps through a TZX-style tape with the previous/next block calls, up to
+// the end of the tape and back, then moves a WAV tape ten seconds at a time.
+static bool test_tape_deck_skip_block(void) {
+    uint8_t header[19];
+    memset(header, 0, sizeof(header));
+    int saved_enabled = tape_input_enabled;
+    TapeFormat saved_format = tape_playback.format;
+    TapeDeckStatus saved_status = tape_deck_status;
+    tape_input_enabled = 1;
+    tape_reset_playback(&tape_playback);
+    tape_playback.format = TAPE_FORMAT_TZX;
+    tape_playback.use_waveform_playback = 1;
+    TapeImage* image = &tape_playback.image;
+    bool ok = tape_image_add_block(image, header, sizeof(header), 1000u) &&
+              tape_image_add_block(image, header, sizeof(header), 1000u) &&
+              tape_image_add_block(image, header, sizeof(header), 1000u) && tape_timeline_build(image);
+
+    // Next block walks to the end-of-tape entry and stays there.
+    for (size_t block = 1; ok && block <= 4u; ++block) {
+        size_t expected = block < image->count ? block : image->count;
+        tape_deck_skip_block(0, 1);
+        ok = tape_playback.current_block == expected &&
+             tape_playback.position_tstates == image->timeline[expected].start_tstates && !tape_playback.playing;
+    }
+    ok = ok && tape_playback.position_tstates == image->length_tstates;
+
+    // Within half a second of a block start, previous goes to the block before.
+    tape_deck_skip_block(0, -1);
+    ok = ok && tape_playback.current_block == 2u;
+    tape_deck_skip_block(0, -1);
+    ok = ok && tape_playback.current_block == 1u &&
+         tape_playback.position_tstates == image->timeline[1].start_tstates;
+
+    // Further in, it returns to the start of the current block.
+    ok = ok && tape_seek_playback(&tape_playback, image->timeline[1].start_tstates + (uint64_t)CPU_CLOCK_HZ);
+    tape_deck_skip_block(0, -1);
+    ok = ok && tape_playback.current_block == 1u &&
+         tape_playback.position_tstates == image->timeline[1].start_tstates;
+    if (!ok) {
+        printf("    block skip: block %zu at %llu\n",
+               tape_playback.current_block,
+               (unsigned long long)tape_playback.position_tstates);
     }
+    tape_free_image(image);
+    tape_reset_playback(&tape_playback);
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    border_color_idx = 0u;
+    // 25 seconds of a square wave at 4kHz, one edge every 50 samples.
+    const char* path = "tape_skip_test.wav";
+    const uint32_t SAMPLE_RATE = 4000u;
+    const uint32_t frames = SAMPLE_RATE * 25u;
+    uint8_t wav_header[44];
+    memcpy(wav_header, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x01\0\0\0\0\0\0\0\0\0\x02\0\x10\0data\0\0\0\0", 44);
+    uint32_t fields[4][2] = {{4u, 36u + frames * 2u}, {24u, SAMPLE_RATE}, {28u, SAMPLE_RATE * 2u}, {40u, frames * 2u}};
+    for (int f = 0; f < 4; ++f) {
+        for (int b = 0; b < 4; ++b) {
+            wav_header[fields[f][0] + (uint32_t)b] = (uint8_t)(fields[f][1] >> (8 * b));
+        }
+    }
+    FILE* file = fopen(path, "wb");
+    bool wav_ok = file && fwrite(wav_header, sizeof(wav_header), 1, file) == 1;
+    for (uint32_t i = 0; wav_ok && i < frames; ++i) {
+        int16_t sample = ((i / 50u) & 1u) ? -12000 : 12000;
+        uint8_t bytes[2] = {(uint8_t)sample, (uint8_t)((uint16_t)sample >> 8)};
+        wav_ok = fwrite(bytes, sizeof(bytes), 1, file) == 1;
+    }
+    if (file) {
+        fclose(file);
+    }
+    wav_ok = wav_ok && tape_load_wav(path, &tape_playback);
+    tape_reset_playback(&tape_playback);
 
-    if (!snapshot_load(path, SNAPSHOT_FORMAT_Z80, &cpu)) {
-        return false;
+    const uint64_t step = (uint64_t)CPU_CLOCK_HZ * 10u;
+    static const int directions[4] = {1, 1, -1, -1};
+    static const uint64_t expected[4] = {1u, 2u, 1u, 0u};
+    for (int i = 0; wav_ok && i < 4; ++i) {
+        if (i == 3) {
+            // Less than ten seconds in, previous stops at the start.
+            wav_ok = tape_seek_playback(&tape_playback, step * 4u / 10u);
+        }
+        tape_deck_skip_block(0, directions[i]);
+        wav_ok = wav_ok && tape_playback.position_tstates == expected[i] * step && !tape_playback.playing;
+        if (!wav_ok) {
+            printf("    WAV skip %d: at %llu\n", i, (unsigned long long)tape_playback.position_tstates);
+        }
     }
+    tape_wav_stream_close(&tape_playback.wav_stream);
+    tape_waveform_reset(&tape_playback.waveform);
+    tape_reset_playback(&tape_playback);
+    remove(path);
 
-    bool registers_ok = (cpu.reg_A == 0x11u) && (cpu.reg_F == 0x22u) &&
-                        (cpu.reg_B == 0x44u) && (cpu.reg_C == 0x33u) &&
-                        (cpu.reg_D == 0x88u) && (cpu.reg_E == 0x77u) &&
-                        (cpu.reg_H == 0x66u) && (cpu.reg_L == 0x55u);
-    bool alt_ok = (cpu.alt_reg_A == 0xFFu) && (cpu.alt_reg_F == 0x00u) &&
-                  (cpu.alt_reg_B == 0xAAu) && (cpu.alt_reg_C == 0x99u) &&
-                  (cpu.alt_reg_D == 0xCCu) && (cpu.alt_reg_E == 0xBBu) &&
-                  (cpu.alt_reg_H == 0xEEu) && (cpu.alt_reg_L == 0xDDu);
-    bool special_ok = (cpu.reg_I == 0x99u) && (cpu.reg_R == 0xFFu) &&
-                      (cpu.reg_IX == 0x2468u) && (cpu.reg_IY == 0x1357u) &&
-                      (cpu.reg_SP == 0xD432u) && (cpu.reg_PC == 0x9ABCu);
-    bool interrupt_ok = (cpu.iff1 == 1) && (cpu.iff2 == 0) && (cpu.interruptMode == 1);
-    bool border_ok = (border_color_idx == 5u);
-    bool memory_ok = memory_block_matches(0x4000u, 0x41u) &&
-                     memory_block_matches(0x8000u, 0x52u) &&
-                     memory_block_matches(0xC000u, 0x63u);
-
-    if (!memory_ok || !registers_ok || !alt_ok || !special_ok || !interrupt_ok || !border_ok) {
-        printf("    Z80 V1 debug: A=%02X F=%02X PC=%04X R=%02X border=%u mem=%02X/%02X/%02X\n",
-               cpu.reg_A,
-               cpu.reg_F,
-               cpu.reg_PC,
-               cpu.reg_R,
-               (unsigned)border_color_idx,
-               memory[0x4000],
-               memory[0x8000],
-               memory[0xC000]);
+    tape_playback.format = saved_format;
+    tape_input_enabled = saved_enabled;
+    tape_deck_status = saved_status;
+    tape_wav_shared_position_tstates = 0;
+    tape_recorder.position_tstates = 0;
+    return ok && wav_ok;
+}
+
+// Loads a Z-RLE CSW v2 file (dynamic Huffman), an RLE CSW v1 file and a
+// PZX file with pulse runs, two data encodings, a pause and a browse point,
+// and checks the cursor plays back every pulse at the expected length.
+static bool test_tape_csw_pzx(void) {
+    static const uint8_t fixed_stream[13] = {
+        0x78, 0xDA, 0x63, 0x65, 0x67, 0x05, 0x42, 0x4E, 0x00, 0x00, 0xAF, 0x00, 0x2E};
+    static const uint8_t fixed_expected[7] = {5, 7, 5, 7, 5, 7, 9};
+    static const uint8_t zrle[] = {
+        0x78, 0xDA, 0x35, 0x91, 0x4B, 0x6E, 0xC4, 0x40, 0x08, 0x05, 0x27, 0x62, 0x85, 0xC4, 0x26, 0x9C,
+        0x82, 0xE3, 0xE5, 0xFE, 0xAB, 0x54, 0x3D, 0x7B, 0x6C, 0xD9, 0xDD, 0x0D, 0x34, 0xEF, 0xC3, 0x5D,
+        0xEF, 0x2E, 0xDF, 0x4D, 0xB1, 0x16, 0xEF, 0x5D, 0x57, 0xD5, 0x55, 0x77, 0x6F, 0xF7, 0x11, 0x1D,
+        0x76, 0x3B, 0xC4, 0x86, 0x80, 0x7B, 0x6A, 0x48, 0x5B, 0x75, 0x64, 0xC7, 0x2B, 0x9B, 0xED, 0xD5,
+        0x59, 0x40, 0x72, 0x78, 0xB9, 0x64, 0x8B, 0x4E, 0x82, 0xF3, 0xE5, 0xFA, 0x3D, 0xA1, 0xE3, 0x4C,
+        0x03, 0x52, 0x9C, 0xA8, 0xAB, 0x75, 0x49, 0x5F, 0x0F, 0x60, 0x0E, 0x0F, 0x2D, 0xC0, 0x4A, 0xFF,
+        0x00, 0xA7, 0xEE, 0x85, 0x28, 0x2F, 0xB0, 0x08, 0x95, 0x92, 0x0D, 0x48, 0x4A, 0x69, 0x8D, 0xA4,
+        0x5C, 0x21, 0xBA, 0xA1, 0x01, 0x09, 0x44, 0x28, 0x56, 0x05, 0x2B, 0xBB, 0x0B, 0xB9, 0x8D, 0x80,
+        0x7A, 0x59, 0x89, 0xC2, 0x71, 0x04, 0x92, 0x60, 0xA4, 0x54, 0x34, 0xC0, 0xD5, 0x72, 0x5B, 0x54,
+        0x38, 0x6E, 0x40, 0x24, 0x21, 0x19, 0x1A, 0x11, 0x0C, 0x49, 0x1B, 0x57, 0xEC, 0x12, 0x0B, 0x34,
+        0xB9, 0x44, 0x6A, 0xDB, 0xEB, 0xC2, 0xC8, 0x5A, 0x13, 0xE4, 0x25, 0x31, 0x21, 0xCC, 0x18, 0x46,
+        0x82, 0x83, 0xF0, 0x10, 0x41, 0xA7, 0x3C, 0xFB, 0xB1, 0xF6, 0x1D, 0x04, 0x58, 0x21, 0xB5, 0xC9,
+        0x9F, 0x53, 0x53, 0x4D, 0x6D, 0xFC, 0x51, 0x42, 0x66, 0x10, 0xD9, 0x8F, 0xEB, 0x17, 0x34, 0x47,
+        0x38, 0x8F, 0x25, 0x29, 0x48, 0x45, 0x85, 0x79, 0xB6, 0xF1, 0xCD, 0x94, 0x76, 0xE4, 0x91, 0xC1,
+        0x69, 0x72, 0x7F, 0x6D, 0xC4, 0xE5, 0xDB, 0xC7, 0xD8, 0xD1, 0x92, 0x76, 0x44, 0xE3, 0x28, 0x57,
+        0xDF, 0xF8, 0x4D, 0x7F, 0xFE, 0x7E, 0x7F, 0x3E, 0xFF, 0x61, 0x84, 0x23, 0x4A
+    };
+    uint8_t* unpacked = NULL;
+    size_t unpacked_length = 0;
+    bool ok = tape_inflate_zlib(fixed_stream, sizeof(fixed_stream), &unpacked, &unpacked_length) &&
+              unpacked_length == sizeof(fixed_expected) && memcmp(unpacked, fixed_expected, unpacked_length) == 0;
+    free(unpacked);
+
+    // The Z-RLE data is 600 pseudo-random pulse lengths and one 70000-sample
+    // escape, as produced by zlib at level 9.
+    uint64_t expected[1024];
+    size_t expected_count = 0;
+    static const uint8_t lengths[8] = {9, 9, 9, 18, 18, 12, 40, 3};
+    uint32_t seed = 1u;
+    uint64_t position = 0;
+    for (int i = 0; i <= 600; ++i) {
+        uint64_t samples = 70000u;
+        if (i < 600) {
+            seed = seed * 1103515245u + 12345u;
+            samples = lengths[(seed >> 16) & 7u];
+        }
+        expected[expected_count++] = (position + samples) * 3500000u / 44100u - position * 3500000u / 44100u;
+        position += samples;
+    }
+    uint8_t csw[0x34 + sizeof(zrle)];
+    memset(csw, 0, sizeof(csw));
+    memcpy(csw, "Compressed Square Wave\x1A", 23);
+    csw[0x17] = 2;
+    csw[0x19] = 0x44;
+    csw[0x1A] = 0xAC; // 44100 Hz
+    csw[0x21] = 2;
+    csw[0x22] = 1;
+    memcpy(csw + 0x34, zrle, sizeof(zrle));
+
+    const char* path = "tape_stream_test.csw";
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    FILE* file = fopen(path, "wb");
+    ok = ok && file && fwrite(csw, sizeof(csw), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    ok = ok && tape_format_from_extension(path) == TAPE_FORMAT_CSW &&
+         tape_load_image(path, TAPE_FORMAT_CSW, &image) && image.count == 1u;
+    TapePulseCursor cursor;
+    tape_pulse_cursor_reset(&cursor, &image);
+    ok = ok && cursor.initial_level == 1;
+    for (size_t i = 0; ok && i < expected_count; ++i) {
+        ok = cursor.has_current && cursor.current == expected[i];
+        tape_pulse_cursor_advance(&cursor, &image);
+    }
+    ok = ok && !cursor.has_current;
+
+    // CSW v1: 22050 Hz, RLE, starting low.
+    static const uint8_t csw_v1_data[7] = {10, 0, 0xE0, 0x93, 0x04, 0x00, 7}; // 10, 300000, 7
+    memset(csw, 0, 0x20);
+    memcpy(csw, "Compressed Square Wave\x1A", 23);
+    csw[0x17] = 1;
+    csw[0x19] = 0x22;
+    csw[0x1A] = 0x56;
+    csw[0x1B] = 1;
+    memcpy(csw + 0x20, csw_v1_data, sizeof(csw_v1_data));
+    file = fopen(path, "wb");
+    ok = ok && file && fwrite(csw, 0x20 + sizeof(csw_v1_data), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    ok = ok && tape_load_image(path, TAPE_FORMAT_CSW, &image) && image.count == 1u;
+    const uint64_t clock = 3500000u;
+    tape_pulse_cursor_reset(&cursor, &image);
+    ok = ok && cursor.initial_level == 0 && cursor.current == 10u * clock / 22050u;
+    tape_pulse_cursor_advance(&cursor, &image);
+    ok = ok && cursor.current == 300010u * clock / 22050u - 10u * clock / 22050u;
+    tape_pulse_cursor_advance(&cursor, &image);
+    ok = ok && cursor.current == 300017u * clock / 22050u - 300010u * clock / 22050u;
+    ok = ok && !tape_pulse_cursor_advance(&cursor, &image);
+    remove(path);
+
+    static const uint8_t pzx[] = {
+        'P', 'Z', 'X', 'T', 2, 0, 0, 0, 1, 0,
+        // 500 x 2168, 667, 735, then one 100000-tstate pulse
+        'P', 'U', 'L', 'S', 14, 0, 0, 0,
+        0xF4, 0x81, 0x78, 0x08, 0x9B, 0x02, 0xDF, 0x02, 0x01, 0x80, 0x01, 0x80, 0xA0, 0x86,
+        // 12 bits starting high, 945 tail, two-pulse bits
+        'D', 'A', 'T', 'A', 18, 0, 0, 0,
+        12, 0, 0, 0x80, 0xB1, 0x03, 2, 2, 0x57, 0x03, 0x57, 0x03, 0xAE, 0x06, 0xAE, 0x06, 0xA5, 0xF0,
+        'B', 'R', 'W', 'S', 3, 0, 0, 0, 'X', 'Y', 0,
+        'P', 'A', 'U', 'S', 4, 0, 0, 0, 0xE0, 0x67, 0x35, 0x00, // 3500000
+        // 5 bits, one-pulse zeros and three-pulse ones, no tail
+        'D', 'A', 'T', 'A', 17, 0, 0, 0,
+        5, 0, 0, 0, 0, 0, 1, 3, 0xF4, 0x01, 0x2C, 0x01, 0x90, 0x01, 0xF4, 0x01, 0xB0};
+    expected_count = 0;
+    for (int i = 0; i < 500; ++i) {
+        expected[expected_count++] = 2168u;
+    }
+    expected[expected_count++] = 667u;
+    expected[expected_count++] = 735u;
+    expected[expected_count++] = 100000u;
+    static const uint8_t bits_a[12] = {1, 0, 1, 0, 0, 1, 0, 1, 1, 1, 1, 1};
+    for (int i = 0; i < 12; ++i) {
+        expected[expected_count++] = bits_a[i] ? 1710u : 855u;
+        expected[expected_count++] = bits_a[i] ? 1710u : 855u;
+    }
+    expected[expected_count++] = 945u;
+    static const uint8_t bits_b[5] = {1, 0, 1, 1, 0};
+    uint64_t silence = tape_pause_to_tstates(1000u);
+    for (int i = 0; i < 5; ++i) {
+        if (bits_b[i]) {
+            expected[expected_count++] = 300u + silence;
+            expected[expected_count++] = 400u;
+            expected[expected_count++] = 500u;
+        } else {
+            expected[expected_count++] = 500u + silence;
+        }
+        silence = 0;
     }
 
-    return registers_ok && alt_ok && special_ok && interrupt_ok && border_ok && memory_ok;
+    path = "tape_stream_test.pzx";
+    file = fopen(path, "wb");
+    ok = ok && file && fwrite(pzx, sizeof(pzx), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    ok = ok && tape_format_from_extension(path) == TAPE_FORMAT_PZX &&
+         tape_load_image(path, TAPE_FORMAT_PZX, &image) && image.count == 4u;
+    tape_pulse_cursor_reset(&cursor, &image);
+    ok = ok && cursor.initial_level == 0;
+    for (size_t i = 0; ok && i < expected_count; ++i) {
+        ok = cursor.has_current && cursor.current == expected[i];
+        if (!ok) {
+            printf("    PZX pulse %zu: %llu (expected %llu)\n",
+                   i,
+                   (unsigned long long)cursor.current,
+                   (unsigned long long)expected[i]);
+        }
+        tape_pulse_cursor_advance(&cursor, &image);
+    }
+    ok = ok && !cursor.has_current;
+
+    // Zero-length pulses flip the level, joining the pulses either side;
+    // an even run of them changes nothing, and one ending a block carries
+    // its pulse into the next block.
+    static const uint8_t zero_pulses[] = {
+        'P', 'Z', 'X', 'T', 2, 0, 0, 0, 1, 0,
+        'P', 'U', 'L', 'S', 24, 0, 0, 0,
+        0x00, 0x00, 0xE8, 0x03, 0x00, 0x00, 0xF4, 0x01, 0xBC, 0x02, 0x03, 0x80,
+        0x00, 0x00, 0x2C, 0x01, 0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0xFA, 0x00,
+        'P', 'U', 'L', 'S', 4, 0, 0, 0, 0x58, 0x02, 0x00, 0x00,
+        'P', 'U', 'L', 'S', 2, 0, 0, 0, 0x84, 0x03};
+    static const uint64_t zero_expected[5] = {1500u, 1000u, 400u, 250u, 1500u};
+    file = fopen(path, "wb");
+    ok = ok && file && fwrite(zero_pulses, sizeof(zero_pulses), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    ok = ok && tape_load_image(path, TAPE_FORMAT_PZX, &image) && image.count == 3u;
+    tape_pulse_cursor_reset(&cursor, &image);
+    ok = ok && cursor.initial_level == 1;
+    for (size_t i = 0; ok && i < 5u; ++i) {
+        ok = cursor.has_current && cursor.current == zero_expected[i];
+        if (!ok) {
+            printf("    PZX zero-pulse merge %zu: %llu (expected %llu)\n",
+                   i,
+                   (unsigned long long)cursor.current,
+                   (unsigned long long)zero_expected[i]);
+        }
+        tape_pulse_cursor_advance(&cursor, &image);
+    }
+    ok = ok && !cursor.has_current;
+
+    // Blocks claiming more than the file holds are refused, skipped or not.
+    static const uint8_t oversized[2][22] = {
+        {'P', 'Z', 'X', 'T', 2, 0, 0, 0, 1, 0, 'B', 'R', 'W', 'S', 0xF0, 0xFF, 0xFF, 0xFF, 'X', 'Y', 0, 0},
+        {'P', 'Z', 'X', 'T', 2, 0, 0, 0, 1, 0, 'P', 'U', 'L', 'S', 0x00, 0x00, 0x00, 0x80, 0x01, 0x00, 0, 0}};
+    for (int i = 0; ok && i < 2; ++i) {
+        file = fopen(path, "wb");
+        ok = file && fwrite(oversized[i], sizeof(oversized[i]), 1, file) == 1;
+        if (file) {
+            fclose(file);
+        }
+        TapeImage rejected;
+        memset(&rejected, 0, sizeof(rejected));
+        ok = ok && !tape_load_image(path, TAPE_FORMAT_PZX, &rejected);
+        tape_free_image(&rejected);
+    }
+    remove(path);
+    tape_free_image(&image);
+    return ok;
 }
 
-static bool test_snapshot_z80_v3_extended(const char* override_dir) {
-    char path[512];
-    if (!snapshot_fixture_resolve(path, sizeof(path), override_dir, "v3-128k.z80")) {
-        printf("    failed to prepare fixture v3-128k.z80\n");
-        return false;
+// Loads a TZX mixing every playable block with descriptive ones: payloads
+// must point into the image's arena with their fields decoded, and a block
+// whose length runs past the end of the file must fail the whole load.
+static bool test_tape_tzx_arena(void) {
+    static const uint8_t tzx[] = {
+        'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A, 1, 20,
+        0x30, 3, 'A', 'B', 'C',
+        0x10, 0xE8, 0x03, 3, 0, 0x00, 0x01, 0x02,
+        0x11, 0xD0, 0x07, 0x58, 0x02, 0xBC, 0x02, 0x20, 0x03, 0x40, 0x06, 0xD2, 0x04, 6, 50, 0, 2, 0, 0,
+        0xAA, 0xFC,
+        0x32, 4, 0, 1, 0, 1, 'X',
+        0x12, 0x84, 0x03, 10, 0,
+        0x13, 2, 111, 0, 222, 0,
+        0x14, 0xF4, 0x01, 0xE8, 0x03, 8, 0, 0, 1, 0, 0, 0x55,
+        0x15, 79, 0, 0, 0, 4, 1, 0, 0, 0xF0,
+        0x20, 200, 0,
+        0x22};
+    const char* path = "tape_arena_test.tzx";
+    FILE* file = fopen(path, "wb");
+    bool ok = file && fwrite(tzx, sizeof(tzx), 1, file) == 1;
+    if (file) {
+        fclose(file);
     }
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    ok = ok && tape_load_image(path, TAPE_FORMAT_TZX, &image) && image.count == 7u && image.capacity == 7u &&
+         image.arena;
+    if (ok) {
+        const TapeBlock* b = image.blocks;
+        const uint8_t* arena_end = image.arena + sizeof(tzx);
+        ok = b[0].type == TAPE_BLOCK_TYPE_STANDARD && b[0].in_arena && b[0].data == image.arena + 20 &&
+             b[0].length == 3u && b[0].pause_ms == 1000u &&
+             b[1].type == TAPE_BLOCK_TYPE_TURBO && b[1].data > b[0].data && b[1].data < arena_end &&
+             b[1].data[0] == 0xAAu && b[1].length == 2u && b[1].pause_ms == 50u &&
+             b[1].pilot_pulse_tstates == 2000u && b[1].pilot_pulse_count == 1234u &&
+             b[1].sync_first_pulse_tstates == 600u && b[1].sync_second_pulse_tstates == 700u &&
+             b[1].bit0_second_pulse_tstates == 800u && b[1].bit1_first_pulse_tstates == 1600u &&
+             b[1].used_bits_in_last_byte == 6u &&
+             b[2].type == TAPE_BLOCK_TYPE_PURE_TONE && b[2].tone_pulse_tstates == 900u && b[2].tone_pulse_count == 10u &&
+             b[3].type == TAPE_BLOCK_TYPE_PULSE_SEQUENCE && b[3].pulse_sequence_count == 2u &&
+             b[3].pulse_sequence_durations[0] == 111u && b[3].pulse_sequence_durations[1] == 222u &&
+             b[4].type == TAPE_BLOCK_TYPE_PURE_DATA && b[4].pilot_pulse_count == 0u && b[4].data[0] == 0x55u &&
+             b[4].bit0_first_pulse_tstates == 500u && b[4].bit1_second_pulse_tstates == 1000u &&
+             b[5].type == TAPE_BLOCK_TYPE_DIRECT_RECORDING && b[5].direct_samples == b[4].data + 10 &&
+             b[5].direct_sample_count == 4u && b[5].direct_tstates_per_sample == 79u && b[5].direct_initial_level == 1 &&
+             b[6].type == TAPE_BLOCK_TYPE_PULSE_SEQUENCE && b[6].pulse_sequence_count == 0u && b[6].pause_ms == 200u;
+    }
+    tape_free_image(&image);
+
+    // The standard block claims 50 bytes but only 3 remain.
+    uint8_t truncated[23];
+    memcpy(truncated, tzx, sizeof(truncated));
+    truncated[18] = 50;
+    file = fopen(path, "wb");
+    ok = ok && file && fwrite(truncated, sizeof(truncated), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    ok = ok && !tape_load_image(path, TAPE_FORMAT_TZX, &image) && image.count == 0u;
+    tape_free_image(&image);
+    remove(path);
+    return ok;
+}
 
-    Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    border_color_idx = 0u;
-
-    if (!snapshot_load(path, SNAPSHOT_FORMAT_Z80, &cpu)) {
-        return false;
+// A register log with a bad clock is refused, and varints stop at ten bytes.
+static bool test_ay_log_rejects_malformed(void) {
+    static const uint8_t header[16] = {'Z', 'X', 'A', 'Y', 'L', 'O', 'G', 0x1A, 1, 0, 0, 0, 0, 0, 0, 0};
+    FILE* log = tmpfile();
+    bool ok = log && fwrite(header, sizeof(header), 1, log) == 1;
+    if (ok) {
+        rewind(log);
+        ok = ay_log_render_stream(log, audio_null_sink(), 44100, 1, NULL) == 0;
     }
 
-    bool model_ok = (spectrum_model == SPECTRUM_MODEL_128K);
-    bool paging_ok = (gate_array_7ffd_state == 0x13u) &&
-                     (paging_disabled == 0) &&
-                     (current_paged_bank == 3u) &&
-                     (spectrum_pages[3].type == MEMORY_PAGE_RAM) &&
-                     (spectrum_pages[3].index == 3u);
-    bool registers_ok = (cpu.reg_A == 0xAAu) && (cpu.reg_F == 0x11u) &&
-                        (cpu.reg_PC == 0x1234u) && (cpu.reg_SP == 0xBEEFu);
-    bool refresh_ok = (cpu.reg_R == 0x83u) && (cpu.reg_I == 0xEDu);
-    bool border_ok = (border_color_idx == 6u);
-    bool interrupt_ok = (cpu.iff1 == 1) && (cpu.iff2 == 1) && (cpu.interruptMode == 2);
-    bool memory_ok = memory_block_matches(0x4000u, 0x45u) &&
-                     memory_block_matches(0x8000u, 0x42u) &&
-                     memory_block_matches(0xC000u, 0x43u);
+    uint64_t delta = 0;
+    uint8_t reg = 0;
+    uint8_t value = 0;
+    static const uint8_t widest[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0xAA};
+    static const uint8_t overlong[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02, 0x55};
+    static const uint8_t endless[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x55};
+    if (ok) {
+        rewind(log);
+        ok = fwrite(widest, sizeof(widest), 1, log) == 1 && fwrite(overlong, sizeof(overlong), 1, log) == 1 && fwrite(endless, sizeof(endless), 1, log) == 1;
+        rewind(log);
+        ok = ok && ay_log_read_record(log, &delta, &reg, &value) == 1 && delta == UINT64_MAX >> 4 &&
+             reg == 0x0Fu && value == 0xAAu && ftell(log) == 11;
+        ok = ok && ay_log_read_record(log, &delta, &reg, &value) < 0;
+        ok = ok && fseek(log, 22, SEEK_SET) == 0 && ay_log_read_record(log, &delta, &reg, &value) < 0;
+    }
+    if (log) {
+        fclose(log);
+    }
+    return ok;
+}
 
-    if (!memory_ok || !registers_ok || !refresh_ok || !border_ok || !interrupt_ok || !paging_ok || !model_ok) {
-        printf("    Z80 V3 debug: model=%s PC=%04X SP=%04X R=%02X border=%u mem=%02X/%02X/%02X bank=%u\n",
-               spectrum_model_to_string(spectrum_model),
-               cpu.reg_PC,
-               cpu.reg_SP,
-               cpu.reg_R,
-               (unsigned)border_color_idx,
-               memory[0x4000],
-               memory[0x8000],
-               memory[0xC000],
-               (unsigned)current_paged_bank);
+// A data chunk that claims far more than the file holds is clamped to the
+// file, so neither the mapped nor the buffered reader runs off its end.
+static bool test_tape_wav_truncated_data(void) {
+    const char* path = "tape_truncated_test.wav";
+    const uint32_t FRAMES = 4096u;
+    const uint32_t CLAIMED_BYTES = 10u * 1024u * 1024u;
+    uint8_t header[44];
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x01\0\x44\xAC\0\0\x88\x58\x01\0\x02\0\x10\0data\0\0\0\0", 44);
+    for (int b = 0; b < 4; ++b) {
+        header[4 + b] = (uint8_t)((36u + CLAIMED_BYTES) >> (8 * b));
+        header[40 + b] = (uint8_t)(CLAIMED_BYTES >> (8 * b));
+    }
+    FILE* file = fopen(path, "wb");
+    bool ok = file && fwrite(header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; ok && i < FRAMES; ++i) {
+        int16_t sample = ((i / 100u) & 1u) ? -12000 : 12000;
+        uint8_t bytes[2] = {(uint8_t)sample, (uint8_t)((uint16_t)sample >> 8)};
+        ok = fwrite(bytes, sizeof(bytes), 1, file) == 1;
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    for (int use_mmap = 1; ok && use_mmap >= 0; --use_mmap) {
+        tape_wav_stream_use_mmap = use_mmap;
+        TapePlaybackState state;
+        memset(&state, 0, sizeof(state));
+        ok = tape_load_wav(path, &state) != 0 && state.wav_stream.data_bytes == FRAMES * 2u;
+        tape_reset_playback(&state);
+        size_t pulses = 0;
+        while (ok && tape_playback_has_pulse(&state) && pulses <= FRAMES) {
+            ++pulses;
+            if (!tape_playback_next_pulse(&state)) {
+                break;
+            }
+        }
+        ok = ok && pulses == FRAMES / 100u;
+        if (!ok) {
+            printf("    %s: data %llu bytes, %zu pulses\n", use_mmap ? "mapped" : "buffered",
+                   (unsigned long long)state.wav_stream.data_bytes, pulses);
+        }
+        tape_wav_stream_close(&state.wav_stream);
+        tape_waveform_reset(&state.waveform);
     }
+    tape_wav_stream_use_mmap = 1;
+    remove(path);
+    return ok;
+}
 
-    return model_ok && paging_ok && registers_ok && refresh_ok && border_ok && interrupt_ok && memory_ok;
+// An empty pure data block as the last bytes of the file: its 3-byte length
+// must be read without touching the byte past the end of the arena.
+static bool test_tape_tzx_empty_block_at_end(void) {
+    static const uint8_t tzx[21] = {
+        'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1A, 1, 20,
+        0x14, 0x57, 0x03, 0xAE, 0x06, 8, 0xE8, 0x03, 0, 0, 0};
+    const char* path = "tape_empty_block_test.tzx";
+    FILE* file = fopen(path, "wb");
+    bool ok = file && fwrite(tzx, sizeof(tzx), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    TapeImage image;
+    memset(&image, 0, sizeof(image));
+    ok = ok && tape_load_image(path, TAPE_FORMAT_TZX, &image) && image.count == 1u &&
+         image.blocks[0].type == TAPE_BLOCK_TYPE_PURE_DATA && image.blocks[0].length == 0u &&
+         !image.blocks[0].data && image.blocks[0].pause_ms == 1000u &&
+         image.blocks[0].bit1_first_pulse_tstates == 1710u;
+    tape_free_image(&image);
+    remove(path);
+    return ok;
 }
 
-static bool snapshot_probe_load_file(const char* path, SnapshotFormat format) {
-    if (!path || format == SNAPSHOT_FORMAT_NONE) {
-        return false;
+// Runs the LD-BYTES trap over a standard block followed by a turbo one: the
+// first lands in memory with the ROM's exit registers and moves the tape on
+// by exactly its pulses, the second is left for the ROM to read from edges.
+static bool test_tape_rom_trap(void) {
+    static const uint8_t ld_bytes[] = {0x14, 0x08, 0x15, 0xF3, 0x3E, 0x0F, 0xD3, 0xFE};
+    uint8_t saved_ld_bytes[sizeof(ld_bytes)];
+    uint8_t saved_ld_start[3];
+    uint8_t saved_ld_ret = memory[TAPE_TRAP_LD_RET];
+    memcpy(saved_ld_bytes, &memory[TAPE_TRAP_LD_BYTES], sizeof(saved_ld_bytes));
+    memcpy(saved_ld_start, &memory[TAPE_TRAP_LD_START], sizeof(saved_ld_start));
+    memcpy(&memory[TAPE_TRAP_LD_BYTES], ld_bytes, sizeof(ld_bytes));
+    memory[TAPE_TRAP_LD_START] = 0xCDu;
+    memory[TAPE_TRAP_LD_START + 1u] = 0xE7u;
+    memory[TAPE_TRAP_LD_START + 2u] = 0x05u;
+    memory[TAPE_TRAP_LD_RET] = 0xC9u;
+
+    TapePlaybackState saved_playback = tape_playback;
+    int saved_input_enabled = tape_input_enabled;
+    int saved_ear_state = tape_ear_state;
+    int saved_playback_level = speaker_tape_playback_level;
+
+    uint8_t block[5] = {0x00, 0x11, 0x22, 0x33, 0x00};
+    block[4] = (uint8_t)(block[0] ^ block[1] ^ block[2] ^ block[3]);
+    static const uint8_t turbo[3] = {0xFF, 0x42, 0xBD};
+    memset(&tape_playback, 0, sizeof(tape_playback));
+    bool ok = tape_image_add_block(&tape_playback.image, block, sizeof(block), 500u) &&
+              tape_image_add_turbo_block(&tape_playback.image, turbo, sizeof(turbo), 0u,
+                                         2000u, 100u, 600u, 700u, 500u, 500u, 1000u, 1000u, 8u);
+    tape_playback.format = TAPE_FORMAT_TAP;
+    tape_playback.use_waveform_playback = 1;
+    tape_reset_playback(&tape_playback);
+    tape_input_enabled = 1;
+
+    uint64_t block_pulses = (uint64_t)TAPE_HEADER_PILOT_COUNT + 2u + sizeof(block) * 16u;
+    uint64_t block_tstates = (uint64_t)TAPE_HEADER_PILOT_COUNT * TAPE_PILOT_PULSE_TSTATES +
+                             TAPE_SYNC_FIRST_PULSE_TSTATES + TAPE_SYNC_SECOND_PULSE_TSTATES;
+    for (size_t i = 0; i < sizeof(block); ++i) {
+        for (uint8_t mask = 0x80u; mask; mask >>= 1) {
+            block_tstates += 2u * (uint64_t)((block[i] & mask) ? TAPE_BIT1_PULSE_TSTATES
+                                                                : TAPE_BIT0_PULSE_TSTATES);
+        }
     }
 
     Z80 cpu;
-    cpu_reset_state(&cpu);
-    spectrum_configure_model(SPECTRUM_MODEL_48K);
-    memory_clear();
-    border_color_idx = 0u;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.reg_PC = TAPE_TRAP_LD_START;
+    cpu.reg_IX = 0x8000u;
+    set_DE(&cpu, 3u);
+    cpu.alt_reg_A = 0x00u;
+    cpu.alt_reg_F = FLAG_C;
+    memset(&memory[0x8000u], 0, 4u);
+    ok = ok && cpu_step(&cpu) == 4;
+    ok = ok && memory[0x8000u] == 0x11u && memory[0x8001u] == 0x22u && memory[0x8002u] == 0x33u &&
+         memory[0x8003u] == 0x00u;
+    ok = ok && (cpu.reg_F & FLAG_C) && cpu.reg_PC == TAPE_TRAP_LD_RET && cpu.reg_IX == 0x8003u &&
+         get_DE(&cpu) == 0u && cpu.reg_B == 0xB0u && cpu.reg_C == 0x01u && cpu.reg_H == 0x00u &&
+         cpu.reg_L == block[4] && cpu.alt_reg_A == 0x01u;
+    ok = ok && tape_playback.pulse_cursor.block_index == 1u &&
+         tape_playback.waveform_index == block_pulses &&
+         tape_playback.position_tstates == block_tstates &&
+         tape_playback.pulse_cursor.current == tape_pause_to_tstates(500u) + 2000u &&
+         tape_playback.level == ((block_pulses & 1u) ? 0 : 1);
+
+    // The turbo block is not the ROM's format, so the trap stands aside.
+    cpu.reg_PC = TAPE_TRAP_LD_START;
+    cpu.alt_reg_A = 0xFFu;
+    ok = ok && !tape_rom_trap_load_block(&cpu) && cpu.reg_PC == TAPE_TRAP_LD_START &&
+         tape_playback.pulse_cursor.block_index == 1u;
+
+    // Nor does it fire once the ROM is not the one it knows.
+    tape_reset_playback(&tape_playback);
+    memory[TAPE_TRAP_LD_RET] = 0x00u;
+    ok = ok && !tape_rom_trap_load_block(&cpu) && tape_playback.pulse_cursor.block_index == 0u;
 
-    return snapshot_load(path, format, &cpu) ? true : false;
+    tape_free_image(&tape_playback.image);
+    tape_playback = saved_playback;
+    tape_input_enabled = saved_input_enabled;
+    tape_ear_state = saved_ear_state;
+    speaker_tape_playback_level = saved_playback_level;
+    memcpy(&memory[TAPE_TRAP_LD_BYTES], saved_ld_bytes, sizeof(saved_ld_bytes));
+    memcpy(&memory[TAPE_TRAP_LD_START], saved_ld_start, sizeof(saved_ld_start));
+    memory[TAPE_TRAP_LD_RET] = saved_ld_ret;
+    return ok;
 }
 
-static bool run_snapshot_probes(const char* override_dir) {
-    char probe_dir[PATH_MAX];
-    if (!snapshot_fixture_path(probe_dir, sizeof(probe_dir), override_dir, "probes")) {
-        return true;
+// Spins an IN/JR edge loop against a playing tape: warp engages after a few
+// frames of it, holds back speaker edges, and ends the frame the tape stops.
+// The same loop with the tape stopped never warps.
+static bool test_tape_auto_warp(void) {
+    TapePlaybackState saved_playback = tape_playback;
+    int saved_input_enabled = tape_input_enabled;
+    uint8_t saved_code[4];
+    memcpy(saved_code, &memory[0x8000u], sizeof(saved_code));
+    static const uint8_t loop[4] = {0xDB, 0xFE, 0x18, 0xFC}; // IN A,(0xFE) / JR -4
+
+    uint8_t block[64];
+    memset(block, 0xAA, sizeof(block));
+    block[0] = 0xFF;
+    memset(&tape_playback, 0, sizeof(tape_playback));
+    bool ok = tape_image_add_block(&tape_playback.image, block, sizeof(block), 0u) != 0;
+    tape_playback.format = TAPE_FORMAT_TAP;
+    tape_playback.use_waveform_playback = 1;
+    tape_input_enabled = 1;
+    memcpy(&memory[0x8000u], loop, sizeof(loop));
+
+    Z80 cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.reg_PC = 0x8000u;
+    total_t_states = 0;
+    tape_reset_playback(&tape_playback);
+    for (int frame = 0; ok && frame < 5; ++frame) {
+        ok = emulator_run_frame(&cpu) && !emulator_warp_active();
     }
 
-    DIR* dir = opendir(probe_dir);
-    if (!dir) {
-        printf("Snapshot compatibility probes directory %s not found (skipping)\n", probe_dir);
-        return true;
+    tape_start_playback(&tape_playback, total_t_states);
+    for (int frame = 0; ok && frame < TAPE_WARP_ENGAGE_FRAMES; ++frame) {
+        ok = emulator_run_frame(&cpu) && emulator_warp_active() == (frame == TAPE_WARP_ENGAGE_FRAMES - 1);
     }
+    size_t pending = beeper_pending_event_count();
+    ok = ok && emulator_run_frame(&cpu) && emulator_warp_active() && tape_playback.playing &&
+         beeper_pending_event_count() == pending;
 
-    printf("Running snapshot compatibility probes in %s...\n", probe_dir);
+    tape_pause_playback(&tape_playback, total_t_states);
+    ok = ok && emulator_run_frame(&cpu) && !emulator_warp_active();
 
-    bool any_files = false;
-    bool all_passed = true;
-    struct dirent* entry = NULL;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') {
-            continue;
-        }
+    tape_free_image(&tape_playback.image);
+    tape_playback = saved_playback;
+    tape_input_enabled = saved_input_enabled;
+    memcpy(&memory[0x8000u], saved_code, sizeof(saved_code));
+    return ok;
+}
 
-        SnapshotFormat format = snapshot_format_from_extension(entry->d_name);
-        if (format == SNAPSHOT_FORMAT_NONE) {
-            continue;
-        }
+// Drives the ring sink frame by frame: the format is negotiated down to the
+// ring's size, the reported latency is what the reader has not yet taken,
+// and a reader that stops draining loses frames without stalling the writer.
+static bool test_audio_ring_sink(void) {
+    enum { RATE = 44100, STORAGE = 2048, FRAMES = 50, STALL_FRAMES = 5 };
+    static int16_t storage[STORAGE];
+    static int16_t drained[STORAGE];
+    static AudioRingSink ring;
 
-        char full_path[PATH_MAX];
-        int required = snprintf(full_path, sizeof(full_path), "%s/%s", probe_dir, entry->d_name);
-        if (required < 0 || (size_t)required >= sizeof(full_path)) {
-            printf("  %-28s SKIP (path too long)\n", entry->d_name);
-            continue;
+    total_t_states = 0;
+    audio_ring_sink_init(&ring, storage, STORAGE);
+    bool ok = audio_sink_open(&ring.sink, RATE, 1, 4096u) != 0;
+    AudioSinkFormat format;
+    ok = ok && audio_sink_format(&format) && format.sample_rate == RATE && format.channels == 1 &&
+         format.block_frames == (STORAGE - 1) / 2;
+
+    uint64_t read_total = 0;
+    uint64_t peak = 0;
+    int level = 1;
+    for (uint32_t frame = 0; ok && frame < FRAMES + STALL_FRAMES; ++frame) {
+        uint64_t frame_end = (uint64_t)(frame + 1u) * T_STATES_PER_FRAME;
+        for (uint64_t t = frame_end - T_STATES_PER_FRAME; t < frame_end; t += 400u) {
+            level ^= 1;
+            beeper_push_event(t, level);
+        }
+        total_t_states = frame_end;
+        audio_sink_frame_end(frame_end);
+        uint64_t due = (frame_end * (uint64_t)RATE) / (uint64_t)CPU_CLOCK_HZ;
+        uint32_t latency = audio_sink_latency_frames();
+        if (frame < FRAMES) {
+            ok = latency == due - read_total;
+            size_t count = audio_ring_sink_read(&ring, drained, STORAGE);
+            for (size_t i = 0; i < count; ++i) {
+                int magnitude = drained[i] < 0 ? -drained[i] : drained[i];
+                peak = (uint64_t)magnitude > peak ? (uint64_t)magnitude : peak;
+            }
+            read_total += count;
+            ok = ok && audio_sink_latency_frames() == 0u;
+        } else {
+            ok = latency <= STORAGE - 1;
         }
+    }
+    uint64_t dropped = ring.dropped_frames.load();
+    uint32_t held = audio_sink_latency_frames();
+    uint64_t due = ((uint64_t)(FRAMES + STALL_FRAMES) * T_STATES_PER_FRAME * (uint64_t)RATE) / (uint64_t)CPU_CLOCK_HZ;
+    ok = ok && peak > 1000u && held == STORAGE - 1 && read_total + held + dropped == due;
+    ok = audio_sink_close() && ok;
+    if (!ok) {
+        printf("    read=%llu held=%u dropped=%llu due=%llu peak=%llu\n",
+               (unsigned long long)read_total,
+               held,
+               (unsigned long long)dropped,
+               (unsigned long long)due,
+               (unsigned long long)peak);
+    }
+    return ok;
+}
 
-        STAT_STRUCT info;
-        if (STAT_FUNC(full_path, &info) != 0 || STAT_ISDIR(info.st_mode)) {
-            continue;
-        }
+// Captures a scripted tune into a register log, plays the log back and
+// checks the result is sample-identical to rendering the same writes live.
+static bool test_ay_log_round_trip(void) {
+    enum { RATE = 44100, FRAMES = 50, WRITES_PER_FRAME = 6 };
+    static const uint16_t melody_period[] = {424, 377, 336, 317, 283, 252, 224, 212};
+    static int16_t live[RATE * 2];
+    static int16_t replayed[RATE * 2];
 
-        any_files = true;
-        bool ok = snapshot_probe_load_file(full_path, format);
-        printf("  %-28s %s\n", entry->d_name, ok ? "PASS" : "FAIL");
-        if (!ok) {
-            all_passed = false;
+    FILE* log = tmpfile();
+    FILE* live_output = tmpfile();
+    FILE* replay_output = tmpfile();
+    bool ok = log && live_output && replay_output;
+
+    total_t_states = 0;
+    memset(ay_registers, 0, sizeof(ay_registers));
+    ok = ok && ay_log_begin(log, 0) != 0;
+
+    AudioFileSink live_sink;
+    AudioFileSink replay_sink;
+    audio_file_sink_init(&live_sink, live_output, 0);
+    audio_file_sink_init(&replay_sink, replay_output, 0);
+    AudioOfflineSession session;
+    ok = ok && audio_offline_begin(&session, &live_sink.sink, RATE, 1, 0u) != 0;
+    ay_reset_state();
+    for (uint8_t reg = 0; ok && reg < 16u; ++reg) {
+        ay_write_register(reg, 0, 0);
+    }
+    uint64_t writes = 16;
+    for (uint32_t frame = 0; ok && frame < FRAMES; ++frame) {
+        uint64_t frame_start = (uint64_t)frame * T_STATES_PER_FRAME;
+        uint16_t period = melody_period[frame % 8u];
+        const uint8_t script[WRITES_PER_FRAME][2] = {
+            {0, (uint8_t)(period & 0xFFu)},
+            {1, (uint8_t)(period >> 8)},
+            {2, (uint8_t)((period >> 1) & 0xFFu)},
+            {7, 0x3C},
+            {8, (uint8_t)(15u - (frame % 8u))},
+            {9, (uint8_t)(frame % 3u ? 10u : 0u)},
+        };
+        for (int i = 0; i < WRITES_PER_FRAME; ++i) {
+            uint64_t t = frame_start + 200u + (uint64_t)i * 4321u + (frame * 97u) % 1000u;
+            ay_log_record(script[i][0], script[i][1], t);
+            ay_write_register(script[i][0], script[i][1], t);
+            ++writes;
         }
+        audio_offline_render_until(&session, frame_start + T_STATES_PER_FRAME);
     }
+    AudioOfflineStats live_stats;
+    ok = ok && audio_offline_end(&session, (uint64_t)FRAMES * T_STATES_PER_FRAME, &live_stats) != 0;
+    // The log stays open for playback, so detach it rather than closing it.
+    ok = ok && ay_log_file == log && ay_log_write_count == writes - 16u;
+    ay_log_file = NULL;
+    long log_bytes = log ? ftell(log) : 0;
 
-    closedir(dir);
+    total_t_states = 0;
+    AudioOfflineStats replay_stats;
+    if (ok) {
+        rewind(log);
+        ok = ay_log_render_stream(log, &replay_sink.sink, RATE, 1, &replay_stats) != 0;
+    }
 
-    if (!any_files) {
-        printf("  (no .sna or .z80 files found in %s)\n", probe_dir);
+    size_t live_count = 0;
+    size_t replay_count = 0;
+    if (ok) {
+        rewind(live_output);
+        rewind(replay_output);
+        live_count = fread(live, sizeof(int16_t), sizeof(live) / sizeof(live[0]), live_output);
+        replay_count = fread(replayed, sizeof(int16_t), sizeof(replayed) / sizeof(replayed[0]), replay_output);
+    }
+    int peak = 0;
+    for (size_t i = 0; i < live_count; ++i) {
+        int magnitude = live[i] < 0 ? -live[i] : live[i];
+        peak = magnitude > peak ? magnitude : peak;
+    }
+    ok = ok && live_count == live_stats.samples && replay_count == live_count && peak > 1000 &&
+         memcmp(live, replayed, live_count * sizeof(int16_t)) == 0;
+    printf("    %llu writes in %ld bytes (%.2f bytes per write including header)\n",
+           (unsigned long long)writes,
+           log_bytes,
+           writes ? (double)log_bytes / (double)writes : 0.0);
+    if (!ok) {
+        printf("    live=%zu replayed=%zu peak=%d\n", live_count, replay_count, peak);
     }
 
-    return all_passed;
+    if (log) {
+        fclose(log);
+    }
+    if (live_output) {
+        fclose(live_output);
+    }
+    if (replay_output) {
+        fclose(replay_output);
+    }
+    memset(ay_registers, 0, sizeof(ay_registers));
+    ay_reset_state();
+    return ok;
 }
 
-static bool run_snapshot_tests(const char* override_dir) {
-    struct {
-        const char* name;
-        bool (*fn)(const char* dir);
-    } tests[] = {
-        {"SNA 48K register restore", test_snapshot_sna_48k},
-        {"SNA 128K locked paging", test_snapshot_sna_128k_locked},
-        {"SNA +2A special map", test_snapshot_sna_plus2a_special},
-        {"SNA +3 ROM paging", test_snapshot_sna_plus3_rom},
-        {"Z80 V1 compressed RAM", test_snapshot_z80_v1_compressed},
-        {"Z80 V3 extended header", test_snapshot_z80_v3_extended},
-    };
+#if !defined(ESP_PLATFORM)
+// The double-precision beeper loop audio_callback() used before the
+// fixed-point cursor, kept as the reference for the benchmark below.
+typedef struct BeeperReferenceState {
+    double position;
+    double cycles_per_sample;
+    double last_input;
+    double last_output;
+    int level;
+} BeeperReferenceState;
+
+static void beeper_reference_render(BeeperReferenceState* state,
+                                    const BeeperEvent* events,
+                                    size_t event_count,
+                                    size_t* event_index,
+                                    int16_t* out,
+                                    int frames) {
+    for (int i = 0; i < frames; ++i) {
+        double target_position = state->position + state->cycles_per_sample;
+        while (*event_index < event_count && (double)events[*event_index].t_state <= target_position) {
+            state->level = events[*event_index].level;
+            ++*event_index;
+        }
+        double raw_sample = (double)state->level * (double)AUDIO_AMPLITUDE;
+        double filtered_sample = raw_sample - state->last_input + BEEPER_HP_ALPHA * state->last_output;
+        state->last_input = raw_sample;
+        state->last_output = filtered_sample;
+        out[i] = (int16_t)filtered_sample;
+        state->position = target_position;
+    }
+}
+
+// Renders ten minutes of a square-wave melody through audio_callback() (with
+// point sampling, as the reference has no band limiting) and through the
+// reference double loop, reporting both timings and checksums.
+static bool test_beeper_fixed_point_benchmark(void) {
+    enum { FRAME_SAMPLES = 882, FRAME_COUNT = 10 * 60 * 50, MAX_FRAME_EVENTS = 1024 };
+    static const double melody_hz[] = {262.0, 294.0, 330.0, 349.0, 392.0, 440.0, 494.0, 523.0,
+                                       1046.0, 880.0, 659.0, 587.0, 3136.0, 2093.0, 110.0, 55.0};
+    static BeeperEvent frame_events[MAX_FRAME_EVENTS];
+    int16_t fixed_out[FRAME_SAMPLES];
+    int16_t reference_out[FRAME_SAMPLES];
 
-    printf("Running snapshot loader tests...\n");
-    bool all_passed = true;
-    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
-        bool ok = tests[i].fn(override_dir);
-        printf("  %-28s %s\n", tests[i].name, ok ? "PASS" : "FAIL");
-        if (!ok) {
-            all_passed = false;
+    total_t_states = 0;
+    audio_set_output_format(44100, 1);
+    audio_set_band_limited_beeper(0);
+    beeper_reset_audio_state(0, 1);
+    BeeperReferenceState reference = {0.0, beeper_cycles_per_sample, (double)AUDIO_AMPLITUDE, 0.0, 1};
+
+    uint64_t next_edge = 0;
+    int edge_level = 1;
+    uint32_t fixed_hash = 2166136261u;
+    uint32_t reference_hash = 2166136261u;
+    int max_difference = 0;
+    double fixed_seconds = 0.0;
+    double reference_seconds = 0.0;
+
+    for (int frame = 0; frame < FRAME_COUNT; ++frame) {
+        uint64_t frame_end = (uint64_t)(frame + 1) * T_STATES_PER_FRAME;
+        size_t event_count = 0;
+        while (next_edge < frame_end && event_count < MAX_FRAME_EVENTS) {
+            double hz = melody_hz[(next_edge / (T_STATES_PER_FRAME * 6u)) % (sizeof(melody_hz) / sizeof(melody_hz[0]))];
+            edge_level = edge_level == 1 ? 3 : 1;
+            frame_events[event_count].t_state = next_edge;
+            frame_events[event_count].level = (int8_t)edge_level;
+            ++event_count;
+            next_edge += (uint64_t)(CPU_CLOCK_HZ / (2.0 * hz));
+        }
+        for (size_t i = 0; i < event_count; ++i) {
+            beeper_queue_push(frame_events[i].t_state, frame_events[i].level);
+            beeper_last_event_t_state = frame_events[i].t_state;
+            beeper_writer_cursor.store(frame_events[i].t_state << BEEPER_POSITION_FRACTION_BITS,
+                                       std::memory_order_relaxed);
+        }
+
+        auto fixed_start = std::chrono::steady_clock::now();
+        audio_callback(NULL, (uint8_t*)fixed_out, (int)sizeof(fixed_out));
+        auto fixed_end = std::chrono::steady_clock::now();
+        size_t reference_index = 0;
+        beeper_reference_render(&reference, frame_events, event_count, &reference_index, reference_out, FRAME_SAMPLES);
+        auto reference_end = std::chrono::steady_clock::now();
+        fixed_seconds += std::chrono::duration<double>(fixed_end - fixed_start).count();
+        reference_seconds += std::chrono::duration<double>(reference_end - fixed_end).count();
+
+        for (int i = 0; i < FRAME_SAMPLES; ++i) {
+            int difference = abs((int)fixed_out[i] - (int)reference_out[i]);
+            if (difference > max_difference) {
+                max_difference = difference;
+            }
+            fixed_hash = (fixed_hash ^ (uint16_t)fixed_out[i]) * 16777619u;
+            reference_hash = (reference_hash ^ (uint16_t)reference_out[i]) * 16777619u;
+        }
+    }
+    audio_set_band_limited_beeper(1);
+    audio_set_output_format(0, 1);
+
+    printf("    10 min beeper: fixed %.1f ms (%08X), double %.1f ms (%08X), max diff %d LSB\n",
+           fixed_seconds * 1000.0,
+           fixed_hash,
+           reference_seconds * 1000.0,
+           reference_hash,
+           max_difference);
+    return max_difference <= 1;
+}
+
+// Streams a second of patterned stereo blocks through the dump ring and reads
+// the WAV back: sizes patched at close, samples intact and in order.
+static bool test_audio_dump_async_writer(void) {
+    const int BLOCK_SAMPLES = 441 * 2;
+    const int BLOCK_COUNT = 50;
+    const char* path = "audio_dump_test.wav";
+    if (!audio_dump_start(path, 44100u, 2u)) {
+        return false;
+    }
+    Sint16 block[BLOCK_SAMPLES];
+    for (int b = 0; b < BLOCK_COUNT; ++b) {
+        for (int i = 0; i < BLOCK_SAMPLES; ++i) {
+            block[i] = (Sint16)(b * BLOCK_SAMPLES + i);
+        }
+        // Pace like a real callback: the blocks add up to more than the ring,
+        // so give the writer up to a second to make room for each one.
+        for (int wait = 0; wait < 1000; ++wait) {
+            size_t queued = audio_dump_tail.load(std::memory_order_relaxed) -
+                            audio_dump_head.load(std::memory_order_acquire);
+            if (queued + BLOCK_SAMPLES <= AUDIO_DUMP_RING_SAMPLES) {
+                break;
+            }
+            audio_dump_wake();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        audio_dump_write_samples(block, (size_t)BLOCK_SAMPLES);
+    }
+    uint64_t dropped = audio_dump_dropped_samples.load();
+    audio_dump_finish();
+
+    bool ok = dropped == 0u;
+    FILE* file = fopen(path, "rb");
+    uint8_t header[44];
+    if (!file || fread(header, sizeof(header), 1, file) != 1) {
+        ok = false;
+    } else {
+        uint32_t expected_bytes = (uint32_t)(BLOCK_COUNT * BLOCK_SAMPLES * (int)sizeof(Sint16));
+        uint32_t riff_size = (uint32_t)header[4] | ((uint32_t)header[5] << 8) |
+                             ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+        uint32_t data_size = (uint32_t)header[40] | ((uint32_t)header[41] << 8) |
+                             ((uint32_t)header[42] << 16) | ((uint32_t)header[43] << 24);
+        ok = ok && riff_size == 36u + expected_bytes && data_size == expected_bytes;
+        for (int i = 0; ok && i < BLOCK_COUNT * BLOCK_SAMPLES; ++i) {
+            Sint16 sample = 0;
+            ok = fread(&sample, sizeof(sample), 1, file) == 1 && sample == (Sint16)i;
+        }
+        ok = ok && fgetc(file) == EOF;
+    }
+    if (file) {
+        fclose(file);
+    }
+    remove(path);
+    if (!ok) {
+        printf("    dropped=%llu\n", (unsigned long long)dropped);
+    }
+    return ok;
+}
+
+// Hammers the beeper ring from two threads with no lock, then checks the
+// AY ring re-sends registers whose writes were dropped while it was full.
+static bool test_audio_event_ring_stress(void) {
+    const uint64_t EVENT_COUNT = 1u << 20;
+
+    beeper_event_head.store(0);
+    beeper_event_tail.store(0);
+    beeper_events_dropped.store(0);
+    std::atomic<bool> producer_done(false);
+    uint64_t pushed = 0;
+    uint64_t consumed = 0;
+    bool ordered = true;
+
+    std::thread producer([&]() {
+        for (uint64_t i = 1; i <= EVENT_COUNT; ++i) {
+            pushed += (uint64_t)beeper_queue_push(i, (int)(i % 7u) - 3);
+        }
+        producer_done.store(true, std::memory_order_release);
+    });
+    std::thread consumer([&]() {
+        uint64_t last_t_state = 0;
+        for (;;) {
+            bool done = producer_done.load(std::memory_order_acquire);
+            size_t head = beeper_event_head.load(std::memory_order_relaxed);
+            size_t tail = beeper_event_tail.load(std::memory_order_acquire);
+            if (head == tail) {
+                if (done) {
+                    break;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            while (head != tail) {
+                const BeeperEvent& event = beeper_events[head];
+                if (event.t_state <= last_t_state || event.level != (int)(event.t_state % 7u) - 3) {
+                    ordered = false;
+                }
+                last_t_state = event.t_state;
+                head = (head + 1) % BEEPER_EVENT_CAPACITY;
+                ++consumed;
+            }
+            beeper_event_head.store(head, std::memory_order_release);
         }
-    }
+    });
+    producer.join();
+    consumer.join();
+    uint32_t dropped = beeper_events_dropped.load();
+    bool beeper_ok = ordered && consumed == pushed && pushed + dropped == EVENT_COUNT;
 
-    bool probes_ok = run_snapshot_probes(override_dir);
-    if (!probes_ok) {
-        all_passed = false;
-    }
+    audio_set_output_format(44100, 2);
+    ay_reset_state_internal();
+    uint32_t ay_dropped_before = ay_events_dropped.load();
+    for (int i = 0; i < AY_EVENT_CAPACITY + 64; ++i) {
+        ay_write_register((uint8_t)(i % 14), (uint8_t)i, (uint64_t)i);
+    }
+    uint32_t ay_dropped = ay_events_dropped.load() - ay_dropped_before;
+    ay_apply_events_until(UINT64_MAX);
+    ay_write_register(7, 0x3Fu, (uint64_t)AY_EVENT_CAPACITY + 64u);
+    ay_apply_events_until(UINT64_MAX);
+    bool ay_ok = ay_dropped > 0u && memcmp(ay_state.registers, ay_registers, 14) == 0;
+    audio_set_output_format(0, 2);
+    ay_reset_state_internal();
 
-    return all_passed;
+    bool ok = beeper_ok && ay_ok;
+    if (!ok) {
+        printf("    pushed=%llu consumed=%llu dropped=%u ordered=%d ay_dropped=%u ay_ok=%d\n",
+               (unsigned long long)pushed,
+               (unsigned long long)consumed,
+               dropped,
+               ordered ? 1 : 0,
+               ay_dropped,
+               ay_ok ? 1 : 0);
+    }
+    return ok;
 }
+#endif
 
 static bool run_unit_tests(void) {
     struct {
@@ -11479,6 +16935,38 @@ static bool run_unit_tests(void) {
         {"+3 peripheral wait-states", test_plus3_peripheral_wait_states},
         {"128K bank paging", test_128k_bank_switching},
         {"128K contention penalties", test_128k_contention_penalty},
+        {"LCD blit layouts", test_video_blit_layouts},
+        {"Frame row diffing", test_video_row_diffing},
+        {"Fixed frame skipping", test_video_fixed_frameskip},
+        {"Inline auto frame skipping", test_video_auto_frameskip_inline},
+        {"Tape pulse cursor", test_tape_pulse_cursor},
+        {"Tape waveform runs", test_tape_waveform_runs},
+        {"Streamed WAV tape", test_tape_wav_streaming},
+        {"Truncated WAV tape", test_tape_wav_truncated_data},
+        {"Streaming tape recorder", test_tape_recorder_streaming},
+        {"Tape pulse classifier", test_tape_pulse_classifier},
+        {"Tape timeline seek", test_tape_timeline_seek},
+        {"Tape deck block skip", test_tape_deck_skip_block},
+        {"CSW and PZX tapes", test_tape_csw_pzx},
+        {"Zero-copy TZX loader", test_tape_tzx_arena},
+        {"Empty TZX block at end", test_tape_tzx_empty_block_at_end},
+        {"Tape ROM loader trap", test_tape_rom_trap},
+        {"Tape auto warp", test_tape_auto_warp},
+        {"AY timed register mixing", test_ay_audio_mixing},
+        {"AY integer generators", test_ay_integer_generators},
+        {"Band-limited beeper edges", test_beeper_band_limited_steps},
+        {"Audio rate control drift", test_audio_rate_control_drift},
+        {"Offline lockstep render", test_audio_offline_lockstep},
+        {"AY register log round trip", test_ay_log_round_trip},
+        {"AY register log validation", test_ay_log_rejects_malformed},
+        {"Audio ring sink", test_audio_ring_sink},
+#if !defined(ESP_PLATFORM)
+        {"Threaded render pipeline", test_video_pipeline_matches_direct_render},
+        {"Pipeline with tape overlay", test_video_pipeline_with_overlay},
+        {"Beeper fixed-point bench", test_beeper_fixed_point_benchmark},
+        {"Audio event ring stress", test_audio_event_ring_stress},
+        {"Async WAV dump writer", test_audio_dump_async_writer},
+#endif
     };
 
     bool all_passed = true;
@@ -11648,6 +17136,806 @@ static void ula_process_port_events(uint64_t current_t_state) {
     ula_write_count = 0;
 }
 
+// --- Frame Loop ---
+// Runs the CPU to the end of the current frame, raising the frame interrupt
+// at its start, and retires the frame's port, tape and border activity.
+static int emulator_run_frame(Z80* cpu) {
+    uint64_t frame_end = (total_t_states / T_STATES_PER_FRAME + 1u) * T_STATES_PER_FRAME;
+    tape_warp_cpu = cpu;
+    if (cpu->iff1 && !cpu->ei_delay) {
+        total_t_states += (uint64_t)cpu_interrupt(cpu, 0xFF);
+    }
+    while (total_t_states < frame_end) {
+        int t_states = cpu_step(cpu);
+        if (t_states <= 0) {
+            return 0;
+        }
+        total_t_states += (uint64_t)t_states;
+        ula_process_port_events(total_t_states);
+    }
+    tape_update(total_t_states);
+    tape_recorder_update(total_t_states, 0);
+    tape_warp_frame_end(total_t_states);
+    video_capture_border(NULL);
+    if (!tape_warp_active) {
+        audio_mark_frame_end(total_t_states);
+    }
+    audio_sink_frame_end(total_t_states);
+    return 1;
+}
+
+// --- Offline Audio Render ---
+#define AUDIO_OFFLINE_CHUNK_SAMPLES 4096
+
+static AudioOfflineSession* audio_offline_current = NULL;
+
+// Negotiates the format with `sink` (if any) and switches audio_callback()
+// to lockstep. Only one session can drive the callback at a time.
+static int audio_offline_begin(AudioOfflineSession* session,
+                               AudioSink* sink,
+                               int sample_rate,
+                               int channels,
+                               uint32_t block_frames) {
+    if (!session || audio_offline_current || sample_rate <= 0 || channels <= 0 ||
+        channels > AUDIO_OFFLINE_CHUNK_SAMPLES) {
+        return 0;
+    }
+    AudioSinkFormat format = {sample_rate, channels, block_frames, 0u};
+    if (sink && sink->open && !sink->open(sink, &format)) {
+        return 0;
+    }
+    uint32_t max_block = (uint32_t)(AUDIO_OFFLINE_CHUNK_SAMPLES / format.channels);
+    if (format.block_frames == 0u || format.block_frames > max_block) {
+        format.block_frames = max_block;
+    }
+
+    memset(session, 0, sizeof(*session));
+    session->sink = sink;
+    session->sample_rate = format.sample_rate;
+    session->channels = format.channels;
+    session->block_frames = format.block_frames;
+    session->saved_rate = beeper_step_q32 != 0u ? audio_sample_rate : 0;
+    session->saved_channels = audio_channel_count;
+    session->saved_available = audio_available;
+    session->ok = 1;
+
+    audio_offline_current = session;
+    audio_available = 0;
+    audio_lockstep = 1;
+    audio_set_output_format(session->sample_rate, session->channels);
+    session->start_t_state = total_t_states;
+    session->wall_start_us = video_monotonic_us();
+    return 1;
+}
+
+static int audio_offline_render_until(AudioOfflineSession* session, uint64_t t_state) {
+    static int16_t buffer[AUDIO_OFFLINE_CHUNK_SAMPLES];
+    if (!session->ok || t_state <= session->start_t_state) {
+        return session->ok;
+    }
+    int channels = session->channels;
+    uint64_t due = ((t_state - session->start_t_state) * (uint64_t)session->sample_rate) / (uint64_t)CPU_CLOCK_HZ;
+    while (session->rendered < due) {
+        uint32_t count = due - session->rendered < (uint64_t)session->block_frames ? (uint32_t)(due - session->rendered)
+                                                                                 : session->block_frames;
+        uint64_t callback_start_us = video_monotonic_us();
+        audio_callback(NULL, (uint8_t*)buffer, (int)(count * (uint32_t)channels * sizeof(int16_t)));
+        session->audio_us += video_monotonic_us() - callback_start_us;
+        if (session->sink && session->sink->write && !session->sink->write(session->sink, buffer, count)) {
+            fprintf(stderr, "[BEEPER] %s sink write failed after %llu samples\n",
+                    session->sink->name,
+                    (unsigned long long)session->rendered);
+            session->ok = 0;
+            break;
+        }
+        session->rendered += (uint64_t)count;
+    }
+    return session->ok;
+}
+
+static int audio_offline_end(AudioOfflineSession* session, uint64_t end_t_state, AudioOfflineStats* stats) {
+    uint64_t wall_us = video_monotonic_us() - session->wall_start_us;
+    if (session->sink && session->sink->close) {
+        session->sink->close(session->sink);
+    }
+    audio_offline_current = NULL;
+    audio_lockstep = 0;
+    audio_available = session->saved_available;
+    audio_set_output_format(session->saved_rate, session->saved_channels);
+
+    if (stats) {
+        stats->frames = (end_t_state - session->start_t_state) / T_STATES_PER_FRAME;
+        stats->samples = session->rendered;
+        stats->emulated_seconds = (double)(end_t_state - session->start_t_state) / CPU_CLOCK_HZ;
+        stats->wall_seconds = (double)wall_us / 1000000.0;
+        stats->audio_seconds = (double)session->audio_us / 1000000.0;
+    }
+    return session->ok;
+}
+
+// --- Audio Sinks ---
+// audio_sink_open() routes the mixer to one sink at a time. A push sink runs
+// a lockstep session that audio_sink_frame_end() advances after every frame;
+// a pull sink gets a free-running audio_callback() with rate control, as a
+// sound device needs.
+static AudioSink* audio_sink_active = NULL;
+static AudioSinkFormat audio_sink_active_format;
+static AudioOfflineSession audio_sink_session;
+
+static int audio_file_sink_open(AudioSink* sink, AudioSinkFormat* format) {
+    AudioFileSink* file_sink = (AudioFileSink*)sink->context;
+    if (!file_sink->file) {
+        return 0;
+    }
+    file_sink->channels = format->channels;
+    file_sink->frames = 0;
+    format->buffer_frames = 0;
+    if (file_sink->wav &&
+        !audio_dump_write_header(file_sink->file, (uint32_t)format->sample_rate, (uint16_t)format->channels)) {
+        fprintf(stderr, "[BEEPER] file sink: failed to write WAV header\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int audio_file_sink_write(AudioSink* sink, const int16_t* samples, uint32_t frames) {
+    AudioFileSink* file_sink = (AudioFileSink*)sink->context;
+    size_t count = (size_t)frames * (size_t)file_sink->channels;
+    if (fwrite(samples, sizeof(int16_t), count, file_sink->file) != count) {
+        return 0;
+    }
+    file_sink->frames += frames;
+    return 1;
+}
+
+static void audio_file_sink_close(AudioSink* sink) {
+    AudioFileSink* file_sink = (AudioFileSink*)sink->context;
+    if (file_sink->wav) {
+        audio_dump_patch_sizes(file_sink->file,
+                               (uint32_t)(file_sink->frames * (uint64_t)file_sink->channels * sizeof(int16_t)));
+    }
+    fflush(file_sink->file);
+}
+
+void audio_file_sink_init(AudioFileSink* file_sink, FILE* file, int wav) {
+    memset(&file_sink->sink, 0, sizeof(file_sink->sink));
+    file_sink->sink.name = "file";
+    file_sink->sink.mode = AUDIO_SINK_PUSH;
+    file_sink->sink.context = file_sink;
+    file_sink->sink.open = audio_file_sink_open;
+    file_sink->sink.write = audio_file_sink_write;
+    file_sink->sink.close = audio_file_sink_close;
+    file_sink->file = file;
+    file_sink->wav = wav;
+    file_sink->channels = 1;
+    file_sink->frames = 0;
+}
+
+static int audio_null_sink_write(AudioSink* sink, const int16_t* samples, uint32_t frames) {
+    (void)sink;
+    (void)samples;
+    (void)frames;
+    return 1;
+}
+
+// Discards everything; measures the cost of the emulator and mixer alone.
+AudioSink* audio_null_sink(void) {
+    static AudioSink sink = {"null", AUDIO_SINK_PUSH, NULL, NULL, NULL, audio_null_sink_write, NULL, NULL};
+    return &sink;
+}
+
+static int audio_ring_sink_open(AudioSink* sink, AudioSinkFormat* format) {
+    AudioRingSink* ring = (AudioRingSink*)sink->context;
+    ring->channels = format->channels;
+    ring->capacity_frames = ring->storage_samples / (size_t)format->channels;
+    if (ring->capacity_frames < 2u) {
+        return 0;
+    }
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->dropped_frames.store(0, std::memory_order_relaxed);
+    // One slot stays empty to tell a full ring from an empty one, and a
+    // block may fill at most half of it.
+    format->buffer_frames = (uint32_t)(ring->capacity_frames - 1u);
+    if (format->block_frames == 0u || format->block_frames > format->buffer_frames / 2u) {
+        format->block_frames = format->buffer_frames / 2u ? format->buffer_frames / 2u : 1u;
+    }
+    return 1;
+}
+
+static int audio_ring_sink_write(AudioSink* sink, const int16_t* samples, uint32_t frames) {
+    AudioRingSink* ring = (AudioRingSink*)sink->context;
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t head = ring->head.load(std::memory_order_acquire);
+    size_t used = (tail + ring->capacity_frames - head) % ring->capacity_frames;
+    size_t space = ring->capacity_frames - 1u - used;
+    size_t count = frames < space ? frames : space;
+    size_t channels = (size_t)ring->channels;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(ring->storage + tail * channels, samples + i * channels, channels * sizeof(int16_t));
+        tail = (tail + 1u) % ring->capacity_frames;
+    }
+    ring->tail.store(tail, std::memory_order_release);
+    if (count < frames) {
+        ring->dropped_frames.fetch_add(frames - count, std::memory_order_relaxed);
+    }
+    return 1;
+}
+
+static uint32_t audio_ring_sink_latency(AudioSink* sink) {
+    AudioRingSink* ring = (AudioRingSink*)sink->context;
+    size_t tail = ring->tail.load(std::memory_order_acquire);
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    return (uint32_t)((tail + ring->capacity_frames - head) % ring->capacity_frames);
+}
+
+void audio_ring_sink_init(AudioRingSink* ring, int16_t* storage, size_t storage_samples) {
+    memset(&ring->sink, 0, sizeof(ring->sink));
+    ring->sink.name = "ring";
+    ring->sink.mode = AUDIO_SINK_PUSH;
+    ring->sink.context = ring;
+    ring->sink.open = audio_ring_sink_open;
+    ring->sink.write = audio_ring_sink_write;
+    ring->sink.latency_frames = audio_ring_sink_latency;
+    ring->storage = storage;
+    ring->storage_samples = storage ? storage_samples : 0u;
+    ring->capacity_frames = 0;
+    ring->channels = 1;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->dropped_frames.store(0, std::memory_order_relaxed);
+}
+
+// Reader side of the ring sink; returns the frames copied to `out`.
+size_t audio_ring_sink_read(AudioRingSink* ring, int16_t* out, size_t frames) {
+    if (!ring || ring->capacity_frames == 0u) {
+        return 0;
+    }
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    size_t tail = ring->tail.load(std::memory_order_acquire);
+    size_t channels = (size_t)ring->channels;
+    size_t count = 0;
+    while (count < frames && head != tail) {
+        memcpy(out + count * channels, ring->storage + head * channels, channels * sizeof(int16_t));
+        head = (head + 1u) % ring->capacity_frames;
+        ++count;
+    }
+    ring->head.store(head, std::memory_order_release);
+    return count;
+}
+
+#if defined(ESP_PLATFORM) && defined(SPECTRUM_HAS_I2S)
+// I2S pull sink: a task pinned next to the render task fills one block with
+// audio_callback() and blocks in i2s_write() until the DMA ring has room, so
+// the codec's clock paces the mixer. Boards define the pins.
+#ifndef AUDIO_I2S_PORT
+#define AUDIO_I2S_PORT I2S_NUM_0
+#endif
+#ifndef AUDIO_I2S_BCLK_PIN
+#define AUDIO_I2S_BCLK_PIN -1
+#endif
+#ifndef AUDIO_I2S_WS_PIN
+#define AUDIO_I2S_WS_PIN -1
+#endif
+#ifndef AUDIO_I2S_DOUT_PIN
+#define AUDIO_I2S_DOUT_PIN -1
+#endif
+#define AUDIO_I2S_DMA_BUFFERS 4u
+#define AUDIO_I2S_MIN_BLOCK_FRAMES 64u
+#define AUDIO_I2S_MAX_BLOCK_FRAMES 1024u
+
+static const BaseType_t AUDIO_I2S_TASK_CORE = 0;
+static const uint32_t AUDIO_I2S_TASK_STACK = 4096u;
+static TaskHandle_t audio_i2s_task_handle = NULL;
+static std::atomic<int> audio_i2s_running(0);
+static std::atomic<int> audio_i2s_task_exited(1);
+static int16_t* audio_i2s_block = NULL;
+static uint32_t audio_i2s_block_frames = 0;
+static uint32_t audio_i2s_buffer_frames = 0;
+
+static void audio_i2s_task(void* param) {
+    (void)param;
+    size_t block_bytes = (size_t)audio_i2s_block_frames * 2u * sizeof(int16_t);
+    while (audio_i2s_running.load(std::memory_order_acquire)) {
+        audio_callback(NULL, (uint8_t*)audio_i2s_block, (int)block_bytes);
+        size_t written = 0;
+        i2s_write(AUDIO_I2S_PORT, audio_i2s_block, block_bytes, &written, portMAX_DELAY);
+    }
+    audio_i2s_task_exited.store(1, std::memory_order_release);
+    vTaskDelete(NULL);
+}
+
+static int audio_i2s_sink_open(AudioSink* sink, AudioSinkFormat* format) {
+    (void)sink;
+    if (AUDIO_I2S_BCLK_PIN < 0 || AUDIO_I2S_WS_PIN < 0 || AUDIO_I2S_DOUT_PIN < 0) {
+        fprintf(stderr, "[BEEPER] I2S sink: AUDIO_I2S_BCLK_PIN/WS_PIN/DOUT_PIN are not defined for this board\n");
+        return 0;
+    }
+    // The codec always gets 16-bit stereo frames.
+    format->channels = 2;
+    if (format->block_frames < AUDIO_I2S_MIN_BLOCK_FRAMES) {
+        format->block_frames = AUDIO_I2S_MIN_BLOCK_FRAMES;
+    } else if (format->block_frames > AUDIO_I2S_MAX_BLOCK_FRAMES) {
+        format->block_frames = AUDIO_I2S_MAX_BLOCK_FRAMES;
+    }
+    format->buffer_frames = format->block_frames * AUDIO_I2S_DMA_BUFFERS;
+
+    i2s_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX);
+    config.sample_rate = (uint32_t)format->sample_rate;
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+    config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.dma_buf_count = (int)AUDIO_I2S_DMA_BUFFERS;
+    config.dma_buf_len = (int)format->block_frames;
+    config.use_apll = true;
+    config.tx_desc_auto_clear = true;
+    if (i2s_driver_install(AUDIO_I2S_PORT, &config, 0, NULL) != ESP_OK) {
+        fprintf(stderr, "[BEEPER] I2S sink: driver install failed\n");
+        return 0;
+    }
+    i2s_pin_config_t pins;
+    memset(&pins, 0, sizeof(pins));
+    pins.mck_io_num = I2S_PIN_NO_CHANGE;
+    pins.bck_io_num = AUDIO_I2S_BCLK_PIN;
+    pins.ws_io_num = AUDIO_I2S_WS_PIN;
+    pins.data_out_num = AUDIO_I2S_DOUT_PIN;
+    pins.data_in_num = I2S_PIN_NO_CHANGE;
+    audio_i2s_block = (int16_t*)malloc((size_t)format->block_frames * 2u * sizeof(int16_t));
+    if (i2s_set_pin(AUDIO_I2S_PORT, &pins) != ESP_OK || !audio_i2s_block) {
+        fprintf(stderr, "[BEEPER] I2S sink: pin setup failed\n");
+        free(audio_i2s_block);
+        audio_i2s_block = NULL;
+        i2s_driver_uninstall(AUDIO_I2S_PORT);
+        return 0;
+    }
+    audio_i2s_block_frames = format->block_frames;
+    audio_i2s_buffer_frames = format->buffer_frames;
+    return 1;
+}
+
+static int audio_i2s_sink_start(AudioSink* sink) {
+    (void)sink;
+    audio_i2s_running.store(1, std::memory_order_release);
+    audio_i2s_task_exited.store(0, std::memory_order_release);
+    if (xTaskCreatePinnedToCore(audio_i2s_task,
+                                "spectrum_i2s",
+                                AUDIO_I2S_TASK_STACK,
+                                NULL,
+                                tskIDLE_PRIORITY + 2,
+                                &audio_i2s_task_handle,
+                                AUDIO_I2S_TASK_CORE) != pdPASS) {
+        audio_i2s_task_handle = NULL;
+        audio_i2s_running.store(0, std::memory_order_release);
+        audio_i2s_task_exited.store(1, std::memory_order_release);
+        fprintf(stderr, "[BEEPER] I2S sink: failed to start audio task\n");
+        return 0;
+    }
+    return 1;
+}
+
+// The task keeps every DMA buffer full, plus the block it is rendering.
+static uint32_t audio_i2s_sink_latency(AudioSink* sink) {
+    (void)sink;
+    return audio_i2s_buffer_frames + audio_i2s_block_frames;
+}
+
+static void audio_i2s_sink_close(AudioSink* sink) {
+    (void)sink;
+    audio_i2s_running.store(0, std::memory_order_release);
+    while (!audio_i2s_task_exited.load(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+    audio_i2s_task_handle = NULL;
+    i2s_driver_uninstall(AUDIO_I2S_PORT);
+    free(audio_i2s_block);
+    audio_i2s_block = NULL;
+}
+
+AudioSink* audio_i2s_sink(void) {
+    static AudioSink sink = {"i2s",
+                             AUDIO_SINK_PULL,
+                             NULL,
+                             audio_i2s_sink_open,
+                             audio_i2s_sink_start,
+                             NULL,
+                             audio_i2s_sink_latency,
+                             audio_i2s_sink_close};
+    return &sink;
+}
+#endif
+
+static int audio_sink_finish(uint64_t end_t_state, AudioOfflineStats* stats) {
+    AudioSink* sink = audio_sink_active;
+    if (!sink) {
+        return 0;
+    }
+    audio_sink_active = NULL;
+    if (sink->mode == AUDIO_SINK_PUSH) {
+        return audio_offline_end(&audio_sink_session, end_t_state, stats);
+    }
+    if (sink->close) {
+        sink->close(sink);
+    }
+    audio_available = 0;
+    audio_set_output_format(0, audio_channel_count);
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return 1;
+}
+
+// Routes the mixer to `sink`, replacing any sink already open. The format
+// is negotiated with the sink; audio_sink_format() returns what was agreed.
+int audio_sink_open(AudioSink* sink, int sample_rate, int channels, uint32_t block_frames) {
+    if (!sink || sample_rate <= 0 || channels <= 0) {
+        return 0;
+    }
+    audio_sink_close();
+    if (sink->mode == AUDIO_SINK_PUSH) {
+        if (!audio_offline_begin(&audio_sink_session, sink, sample_rate, channels, block_frames)) {
+            fprintf(stderr, "[BEEPER] %s sink refused %d Hz x %d\n", sink->name, sample_rate, channels);
+            return 0;
+        }
+        audio_sink_active_format.sample_rate = audio_sink_session.sample_rate;
+        audio_sink_active_format.channels = audio_sink_session.channels;
+        audio_sink_active_format.block_frames = audio_sink_session.block_frames;
+        audio_sink_active_format.buffer_frames = 0u;
+        audio_sink_active = sink;
+        return 1;
+    }
+
+    AudioSinkFormat format = {sample_rate, channels, block_frames, 0u};
+    if (audio_offline_current || (sink->open && !sink->open(sink, &format))) {
+        fprintf(stderr, "[BEEPER] %s sink refused %d Hz x %d\n", sink->name, sample_rate, channels);
+        return 0;
+    }
+    audio_set_output_format(format.sample_rate, format.channels);
+    audio_available = 1;
+    audio_sink_active = sink;
+    audio_sink_active_format = format;
+    if (sink->start && !sink->start(sink)) {
+        audio_sink_finish(total_t_states, NULL);
+        return 0;
+    }
+    return 1;
+}
+
+// Renders the samples a push sink is owed up to `t_state`; the frame loop
+// calls this after every frame. Pull sinks fetch their own.
+void audio_sink_frame_end(uint64_t t_state) {
+    if (audio_sink_active && audio_sink_active->mode == AUDIO_SINK_PUSH) {
+        audio_offline_render_until(&audio_sink_session, t_state);
+    }
+}
+
+int audio_sink_format(AudioSinkFormat* format) {
+    if (!audio_sink_active || !format) {
+        return 0;
+    }
+    *format = audio_sink_active_format;
+    return 1;
+}
+
+// Output latency in frames: what the sink holds that has not been heard,
+// plus, for pull sinks, the emulated backlog the callback has yet to render.
+uint32_t audio_sink_latency_frames(void) {
+    AudioSink* sink = audio_sink_active;
+    if (!sink) {
+        return 0;
+    }
+    uint32_t latency = sink->latency_frames ? sink->latency_frames(sink) : 0u;
+    if (sink->mode == AUDIO_SINK_PULL) {
+        int32_t backlog = audio_rate_fill_published.load(std::memory_order_relaxed) / 256;
+        if (backlog > 0) {
+            latency += (uint32_t)backlog;
+        }
+    }
+    return latency;
+}
+
+int audio_sink_close(void) {
+    return audio_sink_finish(total_t_states, NULL);
+}
+
+// Runs `frames` frames from the current machine state with no pacing,
+// pushing each frame's audio to `sink`.
+static int audio_render_offline_frames(Z80* cpu,
+                                       uint32_t frames,
+                                       AudioSink* sink,
+                                       int sample_rate,
+                                       int channels,
+                                       AudioOfflineStats* stats) {
+    if (!cpu || !sink || sink->mode != AUDIO_SINK_PUSH ||
+        !audio_sink_open(sink, sample_rate, channels, 0u)) {
+        return 0;
+    }
+    int ok = 1;
+    for (uint32_t frame = 0; frame < frames && audio_sink_session.ok; ++frame) {
+        if (!emulator_run_frame(cpu)) {
+            fprintf(stderr, "[BEEPER] offline render stopped at frame %u: CPU fault\n", frame);
+            ok = 0;
+            break;
+        }
+    }
+    return audio_sink_finish(total_t_states, stats) && ok;
+}
+
+// Headless render: loads a snapshot (.sna/.z80) or inserts and plays a tape
+// (.tap/.tzx/.csw/.pzx/.wav), runs `frames` frames as fast as the host allows and
+// writes the mixed audio to `output_path` (WAV when it ends in .wav, raw
+// little-endian 16-bit PCM otherwise). Used for reference audio in
+// regression checks and to measure the audio path's cost.
+int audio_render_offline(const char* media_path,
+                         uint32_t frames,
+                         const char* output_path,
+                         int sample_rate,
+                         int channels,
+                         AudioOfflineStats* stats) {
+    if (!media_path || !output_path || sample_rate <= 0 || channels <= 0) {
+        return 0;
+    }
+
+    Z80 cpu;
+    cpu_reset_state(&cpu);
+    SnapshotFormat snapshot_format = snapshot_format_from_extension(media_path);
+    if (snapshot_format != SNAPSHOT_FORMAT_NONE) {
+        if (!snapshot_load(media_path, snapshot_format, &cpu)) {
+            fprintf(stderr, "[BEEPER] offline render: failed to load snapshot '%s'\n", media_path);
+            return 0;
+        }
+    } else if (tape_format_from_extension(media_path) != TAPE_FORMAT_NONE) {
+        if (!tape_manager_load_path(media_path)) {
+            fprintf(stderr, "[BEEPER] offline render: failed to load tape '%s'\n", media_path);
+            return 0;
+        }
+        tape_deck_play(total_t_states);
+    } else {
+        fprintf(stderr, "[BEEPER] offline render: unsupported media '%s'\n", media_path);
+        return 0;
+    }
+
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        fprintf(stderr, "[BEEPER] offline render: failed to open '%s': %s\n", output_path, strerror(errno));
+        return 0;
+    }
+    AudioFileSink file_sink;
+    audio_file_sink_init(&file_sink, output, string_ends_with_case_insensitive(output_path, ".wav"));
+    AudioOfflineStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+    int ok = audio_render_offline_frames(&cpu, frames, &file_sink.sink, sample_rate, channels, stats);
+    if (fclose(output) != 0) {
+        ok = 0;
+    }
+
+    if (stats->wall_seconds > 0.0) {
+        BEEPER_LOG("[BEEPER] offline render: %.2f s of audio in %.3f s (%.0fx real time, audio path %.2f ms per emulated second)\n",
+                   stats->emulated_seconds,
+                   stats->wall_seconds,
+                   stats->emulated_seconds / stats->wall_seconds,
+                   stats->emulated_seconds > 0.0 ? stats->audio_seconds * 1000.0 / stats->emulated_seconds : 0.0);
+    }
+    return ok;
+}
+
+// --- AY Register Log ---
+// Every AY register write, captured as a compact byte stream so 128K music
+// can be replayed through the AY engine without the Z80. After a 16-byte
+// header ("ZXAYLOG" 0x1A, version, three reserved bytes, little-endian
+// clock in Hz) each write is one record: LEB128 of (tstates since the
+// previous write << 4 | register), then the value byte, so a write costs
+// two bytes within 1024 tstates of the last one and at most four within a
+// frame. The first 16 records restore the register file as it stood when
+// capture began.
+#define AY_LOG_VERSION 1u
+#define AY_LOG_HEADER_SIZE 16
+#define AY_LOG_MIN_CLOCK_HZ 1000000u
+#define AY_LOG_MAX_CLOCK_HZ 16000000u
+#define AY_LOG_VARINT_MAX_BYTES 10
+
+static const uint8_t ay_log_magic[8] = {'Z', 'X', 'A', 'Y', 'L', 'O', 'G', 0x1A};
+static int ay_log_put_record(FILE* file, uint64_t delta, uint8_t reg, uint8_t value) {
+    uint8_t bytes[12];
+    size_t length = 0;
+    uint64_t packed = (delta << 4) | (uint64_t)(reg & 0x0Fu);
+    do {
+        uint8_t byte = (uint8_t)(packed & 0x7Fu);
+        packed >>= 7;
+        bytes[length++] = packed ? (uint8_t)(byte | 0x80u) : byte;
+    } while (packed);
+    bytes[length++] = value;
+    return fwrite(bytes, 1, length, file) == length;
+}
+
+static void ay_log_record(uint8_t reg, uint8_t value, uint64_t t_state) {
+    if (!ay_log_file) {
+        return;
+    }
+    uint64_t delta = t_state > ay_log_last_t_state ? t_state - ay_log_last_t_state : 0u;
+    if (!ay_log_put_record(ay_log_file, delta, reg, value)) {
+        fprintf(stderr, "[AY] register log write failed after %llu writes\n",
+                (unsigned long long)ay_log_write_count);
+        ay_log_stop();
+        return;
+    }
+    ay_log_last_t_state += delta;
+    ++ay_log_write_count;
+}
+
+static int ay_log_begin(FILE* file, uint64_t t_state) {
+    uint8_t header[AY_LOG_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, ay_log_magic, sizeof(ay_log_magic));
+    header[8] = AY_LOG_VERSION;
+    audio_dump_write_uint32(header + 12, (uint32_t)CPU_CLOCK_HZ);
+    if (fwrite(header, sizeof(header), 1, file) != 1) {
+        return 0;
+    }
+    for (uint8_t reg = 0; reg < 16u; ++reg) {
+        if (!ay_log_put_record(file, 0u, reg, ay_registers[reg])) {
+            return 0;
+        }
+    }
+    ay_log_file = file;
+    ay_log_last_t_state = t_state;
+    ay_log_write_count = 0;
+    return 1;
+}
+
+int ay_log_start(const char* path) {
+    if (!path) {
+        return 0;
+    }
+    ay_log_stop();
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "[AY] failed to open register log '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (!ay_log_begin(file, total_t_states)) {
+        fprintf(stderr, "[AY] failed to write register log header to '%s'\n", path);
+        fclose(file);
+        return 0;
+    }
+    return 1;
+}
+
+void ay_log_stop(void) {
+    if (!ay_log_file) {
+        return;
+    }
+    FILE* file = ay_log_file;
+    ay_log_file = NULL;
+    if (fclose(file) != 0) {
+        fprintf(stderr, "[AY] failed to close register log: %s\n", strerror(errno));
+    }
+}
+
+// Returns 1 for a record, 0 at a clean end of stream, -1 on a truncated or
+// malformed one. A varint holds at most 64 bits: ten bytes, the last of
+// which may only carry bit 63.
+static int ay_log_read_record(FILE* file, uint64_t* delta, uint8_t* reg, uint8_t* value) {
+    uint64_t packed = 0;
+    int shift = 0;
+    int c = getc(file);
+    if (c == EOF) {
+        return 0;
+    }
+    for (int length = 1; c & 0x80; ++length) {
+        if (length == AY_LOG_VARINT_MAX_BYTES) {
+            return -1;
+        }
+        packed |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+        c = getc(file);
+        if (c == EOF) {
+            return -1;
+        }
+    }
+    if (shift == 63 && c > 1) {
+        return -1;
+    }
+    packed |= (uint64_t)c << shift;
+    c = getc(file);
+    if (c == EOF) {
+        return -1;
+    }
+    *delta = packed >> 4;
+    *reg = (uint8_t)(packed & 0x0Fu);
+    *value = (uint8_t)c;
+    return 1;
+}
+
+// Replays a register log through the AY engine in lockstep with
+// audio_callback(), one frame of writes at a time. The AY registers are put
+// back as they were afterwards.
+static int ay_log_render_stream(FILE* log, AudioSink* sink, int sample_rate, int channels, AudioOfflineStats* stats) {
+    uint8_t header[AY_LOG_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, log) != 1 || memcmp(header, ay_log_magic, sizeof(ay_log_magic)) != 0 ||
+        header[8] != AY_LOG_VERSION) {
+        fprintf(stderr, "[AY] not a register log (or unsupported version)\n");
+        return 0;
+    }
+    uint32_t clock_hz = tape_read_le32(header + 12);
+    if (clock_hz < AY_LOG_MIN_CLOCK_HZ || clock_hz > AY_LOG_MAX_CLOCK_HZ) {
+        fprintf(stderr, "[AY] register log clock %u Hz is out of range\n", (unsigned)clock_hz);
+        return 0;
+    }
+
+    uint8_t saved_registers[16];
+    memcpy(saved_registers, ay_registers, sizeof(saved_registers));
+    AudioOfflineSession session;
+    if (!audio_offline_begin(&session, sink, sample_rate, channels, 0u)) {
+        return 0;
+    }
+    ay_reset_state();
+
+    // Deltas count the logging machine's clock; convert them to ours.
+    const uint64_t cpu_hz = (uint64_t)CPU_CLOCK_HZ;
+    uint64_t t_state = session.start_t_state;
+    uint64_t log_t_state = 0;
+    uint64_t frame_end = t_state + T_STATES_PER_FRAME;
+    uint64_t delta = 0;
+    uint8_t reg = 0;
+    uint8_t value = 0;
+    int status;
+    while ((status = ay_log_read_record(log, &delta, &reg, &value)) > 0 && session.ok) {
+        log_t_state += delta;
+        t_state = session.start_t_state + log_t_state / clock_hz * cpu_hz + log_t_state % clock_hz * cpu_hz / clock_hz;
+        while (t_state >= frame_end && session.ok) {
+            audio_offline_render_until(&session, frame_end);
+            frame_end += T_STATES_PER_FRAME;
+        }
+        ay_write_register(reg, value, t_state);
+    }
+    if (status < 0) {
+        fprintf(stderr, "[AY] register log truncated or corrupt; rendered up to %llu tstates\n",
+                (unsigned long long)(t_state - session.start_t_state));
+    }
+    audio_offline_render_until(&session, frame_end);
+    int ok = audio_offline_end(&session, frame_end, stats);
+
+    for (uint8_t i = 0; i < 16u; ++i) {
+        ay_write_register(i, saved_registers[i], total_t_states);
+    }
+    return ok;
+}
+
+// Renders a register log to `output_path`: WAV when it ends in .wav, raw
+// 16-bit PCM otherwise.
+int ay_log_render(const char* log_path,
+                  const char* output_path,
+                  int sample_rate,
+                  int channels,
+                  AudioOfflineStats* stats) {
+    if (!log_path || !output_path || sample_rate <= 0 || channels <= 0) {
+        return 0;
+    }
+    FILE* log = fopen(log_path, "rb");
+    if (!log) {
+        fprintf(stderr, "[AY] failed to open register log '%s': %s\n", log_path, strerror(errno));
+        return 0;
+    }
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        fprintf(stderr, "[AY] failed to open '%s': %s\n", output_path, strerror(errno));
+        fclose(log);
+        return 0;
+    }
+    AudioFileSink file_sink;
+    audio_file_sink_init(&file_sink, output, string_ends_with_case_insensitive(output_path, ".wav"));
+    int ok = ay_log_render_stream(log, &file_sink.sink, sample_rate, channels, stats);
+    fclose(log);
+    if (fclose(output) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
 void emulator_setup(void) {}
 
 void emulator_loop(void) {}